@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+namespace {
+    class ElementAggregate : public Aggregate<ElementState>, public IEventHandler<PropertyChangedEvent> {
+    public:
+        ElementAggregate() { Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(); }
+        void Handle(const Metadata& m, const PropertyChangedEvent& evt) override {
+            (*_state.mutable_properties())[evt.property_name()] = evt.value_data();
+            _state.set_changes(_state.changes() + 1);
+        }
+    };
+
+    // One aggregate with 'events' events in its stream, snapshotted every 1000 events.
+    // 'Replay' ignores the snapshots, 'Snapshotted' starts from them.
+    struct LongStream {
+        shared_ptr<EventStore> Events = make_shared<EventStore>();
+        shared_ptr<Snapshotter> Snapshots = make_shared<Snapshotter>(make_shared<InMemorySnapshotStore>());
+        unique_ptr<AggregateRepository<ElementAggregate>> Replay;
+        unique_ptr<AggregateRepository<ElementAggregate>> Snapshotted;
+
+        explicit LongStream(size_t events) {
+            Events->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+            Events->SetEventLog(make_shared<InMemoryEventLog>());
+            Replay = make_unique<AggregateRepository<ElementAggregate>>(Events);
+            Snapshotted = make_unique<AggregateRepository<ElementAggregate>>(Events, Snapshots, SnapshotPolicy{ 1000 });
+            auto aggregate = Snapshotted->Load("pump");
+            PropertyChangedEvent evt;
+            evt.set_element_name("Pump");
+            evt.set_value_data("12345678");
+            for (size_t i = 0; i < events; ++i) {
+                evt.set_property_name("p" + to_string(i % 32));
+                Snapshotted->Append(*aggregate, evt);
+            }
+            Snapshots->Flush();
+        }
+        AggregateRepository<ElementAggregate>& Repository(bool snapshots) { return snapshots ? *Snapshotted : *Replay; }
+    };
+
+    // 0: replay, 1: snapshots, 2: snapshots + aggregate cache
+    AggregateRepository<ElementAggregate>& CommandRepository(LongStream& stream, int64_t mode) {
+        auto& repository = stream.Repository(mode != 0);
+        if (mode == 2 && !repository.Cache()) repository.EnableCache(64 * 1024 * 1024);
+        return repository;
+    }
+}
+
+// Rehydration of an aggregate from a 1M event stream, with and without snapshots.
+static void BM_Aggregate_Load(benchmark::State& state) {
+    static LongStream stream(1000000);
+    auto& repository = stream.Repository(state.range(0) != 0);
+    for (auto _ : state) {
+        auto aggregate = repository.Load("pump");
+        benchmark::DoNotOptimize(aggregate->Version());
+    }
+}
+BENCHMARK(BM_Aggregate_Load)->ArgName("snapshots")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// Latency of one command against a long stream: get the aggregate + append one event.
+static void BM_Aggregate_Command(benchmark::State& state) {
+    LongStream stream(state.range(1));
+    auto& repository = CommandRepository(stream, state.range(0));
+    PropertyChangedEvent evt;
+    evt.set_property_name("p0");
+    evt.set_value_data("1");
+    for (auto _ : state) {
+        auto aggregate = repository.Get("pump");
+        repository.Append(*aggregate, evt);
+    }
+    if (auto cache = repository.Cache()) state.counters["hit_ratio"] = cache->Stats().HitRatio();
+}
+BENCHMARK(BM_Aggregate_Command)->ArgNames({ "mode", "events" })
+    ->Args({ 0, 100000 })->Args({ 1, 100000 })->Args({ 2, 100000 })->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cppplumberd/compression.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+namespace {
+    // Property traffic: a few elements and properties, changing values.
+    vector<string> CreatePayloads(size_t count) {
+        static const vector<string> elements = { "fakevideosrc", "videoconvert", "x264enc", "rtph264pay", "udpsink" };
+        static const vector<string> properties = { "num-buffers", "framerate", "bitrate", "speed-preset", "config-interval", "port" };
+        vector<string> payloads;
+        for (size_t i = 0; i < count; ++i) {
+            PropertyChangedEvent evt;
+            evt.set_element_name(elements[i % elements.size()]);
+            evt.set_property_name(properties[(i / 3) % properties.size()]);
+            evt.set_value_type(ValueType::INT);
+            evt.set_value_data(to_string(i * 7919 % 10007));
+            payloads.push_back(evt.SerializeAsString());
+        }
+        return payloads;
+    }
+
+    unique_ptr<StreamCompressor> TrainedCompressor(size_t dictionaryBytes, const vector<string>& payloads) {
+        CompressionOptions options;
+        options.DictionaryBytes = dictionaryBytes;
+        auto compressor = make_unique<StreamCompressor>(options);
+        string out;
+        for (size_t i = 0; i < options.TrainingSamples; ++i)
+            compressor->Compress(payloads[i].data(), payloads[i].size(), out);
+        return compressor;
+    }
+}
+
+// Per frame cost and ratio of small events; range(0) is the dictionary size (0: plain deflate).
+static void BM_StreamCompressor_SmallEvent(benchmark::State& state) {
+    auto payloads = CreatePayloads(1024);
+    auto compressor = TrainedCompressor(static_cast<size_t>(state.range(0)), payloads);
+    size_t raw = 0, encoded = 0, i = 0;
+    string out;
+    for (auto _ : state) {
+        const auto& payload = payloads[i++ % payloads.size()];
+        auto result = compressor->Compress(payload.data(), payload.size(), out);
+        raw += payload.size();
+        encoded += result.Codec == CompressionCodec::NONE ? payload.size() : out.size();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(raw));
+    state.counters["ratio"] = static_cast<double>(raw) / static_cast<double>(encoded);
+}
+BENCHMARK(BM_StreamCompressor_SmallEvent)->Arg(0)->Arg(1024)->Arg(2048)->Arg(8192);
+
+static void BM_FrameDecompressor_SmallEvent(benchmark::State& state) {
+    auto payloads = CreatePayloads(1024);
+    auto compressor = TrainedCompressor(static_cast<size_t>(state.range(0)), payloads);
+    vector<pair<EventHeader, string>> frames;
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        string out;
+        auto result = compressor->Compress(payloads[i].data(), payloads[i].size(), out);
+        if (result.Codec == CompressionCodec::NONE) continue;
+        EventHeader header;
+        header.set_codec(static_cast<uint32_t>(result.Codec));
+        header.set_raw_size(static_cast<uint32_t>(payloads[i].size()));
+        header.set_dictionary_id(result.DictionaryId);
+        if (frames.empty() && result.DictionaryId != 0) header.set_dictionary(compressor->Dictionary());
+        frames.emplace_back(header, out);
+    }
+    if (frames.empty()) {
+        state.SkipWithError("No payload got smaller");
+        return;
+    }
+    FrameDecompressor decompressor;
+    string out;
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& [header, payload] = frames[i++ % frames.size()];
+        benchmark::DoNotOptimize(decompressor.Decode(header, reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), out));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(decompressor.Stats().RawBytes));
+}
+BENCHMARK(BM_FrameDecompressor_SmallEvent)->Arg(1024)->Arg(2048);
+
+// A batch of events compressed as one block, as replication batches are.
+static void BM_Deflate_Batch(benchmark::State& state) {
+    auto payloads = CreatePayloads(static_cast<size_t>(state.range(0)));
+    string batch;
+    for (const auto& payload : payloads) batch += payload;
+    Deflater deflater;
+    string out;
+    for (auto _ : state) {
+        deflater.Compress(batch.data(), batch.size(), string_view(), out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(batch.size()));
+    state.counters["ratio"] = static_cast<double>(batch.size()) / static_cast<double>(out.size());
+}
+BENCHMARK(BM_Deflate_Batch)->Arg(16)->Arg(256)->Arg(1024);
@@ -0,0 +1,50 @@
+#include <benchmark/benchmark.h>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+namespace {
+    class CountingReadModel : public EventHandlerBase,
+        public IEventHandler<PropertyChangedEvent> {
+    public:
+        size_t Count = 0;
+
+        CountingReadModel() {
+            Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        }
+
+        void Handle(const Metadata& metadata, const PropertyChangedEvent& evt) override {
+            Count += evt.value_data().size();
+        }
+    };
+}
+
+static void BM_EventHandlerBase_Handle(benchmark::State& state) {
+    CountingReadModel model;
+    IEventDispatcher& dispatcher = model;
+    Metadata metadata("foo", system_clock::now());
+    PropertyChangedEvent evt;
+    evt.set_value_data("1234");
+
+    for (auto _ : state) {
+        dispatcher.Handle(metadata, app::testing::EVENTS::PROPERTY_CHANGED, &evt);
+    }
+    benchmark::DoNotOptimize(model.Count);
+}
+BENCHMARK(BM_EventHandlerBase_Handle);
+
+static void BM_EventHandlerBase_Unmapped(benchmark::State& state) {
+    CountingReadModel model;
+    IEventDispatcher& dispatcher = model;
+    Metadata metadata("foo", system_clock::now());
+    SetterCommand cmd;
+
+    for (auto _ : state) {
+        dispatcher.Handle(metadata, app::testing::COMMANDS::SETTER, &cmd);
+    }
+}
+BENCHMARK(BM_EventHandlerBase_Unmapped);
@@ -0,0 +1,65 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+namespace {
+    class CountingHandler : public EventHandlerBase, public IEventHandler<PropertyChangedEvent> {
+    public:
+        atomic<uint64_t> Handled = 0;
+        CountingHandler() { Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(); }
+        void Handle(const Metadata& metadata, const PropertyChangedEvent& evt) override { ++Handled; }
+    };
+
+    // Publishes 'events' events to each of 'streams' streams with one in-process subscriber each and waits until
+    // every subscriber has handled them.
+    void RunFanOut(benchmark::State& state, const SubscriptionOptions& options) {
+        const int streams = static_cast<int>(state.range(0));
+        constexpr uint64_t events = 1000;
+        auto eventStore = make_shared<EventStore>();
+        eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        vector<shared_ptr<CountingHandler>> handlers;
+        vector<unique_ptr<ISubscription>> subscriptions;
+        for (int s = 0; s < streams; ++s) {
+            handlers.push_back(make_shared<CountingHandler>());
+            subscriptions.push_back(eventStore->Subscribe("stream-" + to_string(s), handlers.back(), options));
+        }
+        PropertyChangedEvent evt;
+        evt.set_property_name("Speed");
+        evt.set_value_data("1");
+
+        uint64_t expected = 0;
+        for (auto _ : state) {
+            for (uint64_t i = 0; i < events; ++i)
+                for (int s = 0; s < streams; ++s) eventStore->Publish("stream-" + to_string(s), evt);
+            expected += events;
+            for (auto& h : handlers) while (h->Handled < expected) this_thread::yield();
+        }
+        for (auto& s : subscriptions) s->Unsubscribe();
+        state.SetItemsProcessed(static_cast<int64_t>(expected) * streams);
+    }
+}
+
+// Arg: number of streams, one subscriber each. Every subscriber owns a dispatch thread.
+static void BM_FanOut_ThreadPerSubscriber(benchmark::State& state) {
+    SubscriptionOptions options;
+    options.FlowControl = FlowControlPolicy{ FlowControl::BLOCK, 1 << 20 };
+    RunFanOut(state, options);
+}
+BENCHMARK(BM_FanOut_ThreadPerSubscriber)->Arg(8)->Arg(64)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// The same subscribers on strands of one executor with a thread per CPU.
+static void BM_FanOut_SharedExecutor(benchmark::State& state) {
+    SubscriptionOptions options;
+    options.Executor = make_shared<Executor>();
+    RunFanOut(state, options);
+}
+BENCHMARK(BM_FanOut_SharedExecutor)->Arg(8)->Arg(64)->UseRealTime()->Unit(benchmark::kMillisecond);
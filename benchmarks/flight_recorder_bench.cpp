@@ -0,0 +1,43 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cppplumberd/flight_recorder.hpp"
+
+using namespace cppplumberd;
+using namespace std;
+
+// Cost added to every frame when the flight recorder is left on.
+static void BM_FlightRecorder_Record(benchmark::State& state) {
+    static FlightRecorder recorder(16 * 1024 * 1024);
+    vector<uint8_t> frame(static_cast<size_t>(state.range(0)), 0x5A);
+    string stream = "fakevideosrc";
+
+    for (auto _ : state) {
+        recorder.Record(FrameKind::EVENT_PUBLISHED, stream, frame.data(), frame.size());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(frame.size()));
+}
+BENCHMARK(BM_FlightRecorder_Record)->RangeMultiplier(8)->Range(64, 16 * 1024)->ThreadRange(1, 8);
+
+static void BM_FlightRecorder_Inactive(benchmark::State& state) {
+    vector<uint8_t> frame(256, 0x5A);
+    string stream = "fakevideosrc";
+
+    for (auto _ : state) {
+        RecordFrame(FrameKind::EVENT_PUBLISHED, stream, frame.data(), frame.size());
+    }
+}
+BENCHMARK(BM_FlightRecorder_Inactive);
+
+static void BM_FlightRecorder_Snapshot(benchmark::State& state) {
+    FlightRecorder recorder(static_cast<size_t>(state.range(0)));
+    vector<uint8_t> frame(256, 0x5A);
+    for (size_t written = 0; written < recorder.Capacity() * 2; written += frame.size())
+        recorder.Record(FrameKind::EVENT_PUBLISHED, "s", frame.data(), frame.size());
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(recorder.Snapshot());
+    }
+}
+BENCHMARK(BM_FlightRecorder_Snapshot)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,37 @@
+#include <benchmark/benchmark.h>
+#include <boost/signals2.hpp>
+#include <vector>
+#include "cppplumberd/listener_list.hpp"
+
+using namespace cppplumberd;
+using namespace std;
+
+// Per-frame cost of firing ITransportSubscribeSocket::Received, before and after it became a ListenerList.
+// Arg: number of connected listeners.
+static void BM_Received_Signals2(benchmark::State& state) {
+    boost::signals2::signal<void(uint8_t*, size_t)> received;
+    size_t total = 0;
+    for (int64_t i = 0; i < state.range(0); ++i)
+        received.connect([&total](uint8_t* buffer, size_t size) { total += size; });
+    vector<uint8_t> frame(256);
+
+    for (auto _ : state) {
+        received(frame.data(), frame.size());
+    }
+    benchmark::DoNotOptimize(total);
+}
+BENCHMARK(BM_Received_Signals2)->Arg(1)->Arg(4);
+
+static void BM_Received_ListenerList(benchmark::State& state) {
+    ListenerList<void(uint8_t*, size_t)> received;
+    size_t total = 0;
+    for (int64_t i = 0; i < state.range(0); ++i)
+        received.connect([&total](uint8_t* buffer, size_t size) { total += size; });
+    vector<uint8_t> frame(256);
+
+    for (auto _ : state) {
+        received(frame.data(), frame.size());
+    }
+    benchmark::DoNotOptimize(total);
+}
+BENCHMARK(BM_Received_ListenerList)->Arg(1)->Arg(4);
@@ -0,0 +1,153 @@
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <thread>
+#include "load_harness.hpp"
+
+using namespace cppplumberd;
+using namespace cppplumberd::load;
+using namespace std;
+
+namespace {
+
+	class LoadSubscriber : public EventHandlerBase, public IEventHandler<LoadEvent> {
+		std::mutex _mtx;
+		LatencySamples _publishToHandler;
+		LatencySamples _commandToHandler;
+		HopLatencyRecorder _hops;
+		uint64_t _lastReceivedNs = 0;
+		atomic<uint64_t>& _received;
+
+	public:
+		explicit LoadSubscriber(atomic<uint64_t>& received) : _received(received) {
+			Map<LoadEvent, load::EVENTS::LOAD_EVENT>();
+		}
+
+		void Handle(const Metadata& metadata, const LoadEvent& evt) override {
+			auto now = NowNs();
+			{
+				lock_guard lock(_mtx);
+				_publishToHandler.Add(now - evt.published_ns());
+				_commandToHandler.Add(now - evt.command_sent_ns());
+				_hops.Record(metadata);
+				_lastReceivedNs = max(_lastReceivedNs, now);
+			}
+			_received.fetch_add(1, memory_order_relaxed);
+		}
+
+		void Collect(LatencySamples& publishToHandler, LatencySamples& commandToHandler, HopLatencyRecorder& hops, uint64_t& lastReceivedNs) {
+			lock_guard lock(_mtx);
+			publishToHandler.Append(_publishToHandler);
+			commandToHandler.Append(_commandToHandler);
+			hops.Merge(_hops);
+			lastReceivedNs = max(lastReceivedNs, _lastReceivedNs);
+		}
+	};
+}
+
+// Usage: cppplumberd_load_client [--transport=ipc|inproc] [--url=...] [--commands=10000]
+//        [--events-per-command=1] [--message-size=64] [--streams=1] [--subscribers=1]
+//        [--rate=0] [--hop-stamps] [--async-publish [--io-threads=1]] [--warmup-ms=500] [--drain-ms=5000] [--report=cppplumberd_load_report.json|-] [--format=json|csv]
+int main(int argc, char** argv) {
+	LoadOptions options(argc, argv);
+	const auto commands = options.GetInt("commands", 10000);
+	const auto eventsPerCommand = static_cast<uint32_t>(options.GetInt("events-per-command", 1));
+	const auto messageSize = static_cast<uint32_t>(options.GetInt("message-size", 64));
+	const auto streams = max<uint64_t>(1, options.GetInt("streams", 1));
+	const auto subscribers = options.GetInt("subscribers", 1);
+	const auto rate = options.GetInt("rate", 0);
+
+	auto factory = make_shared<NggSocketFactory>(options.Url());
+	unique_ptr<Plumber> server;
+	if (options.Transport() == "inproc") {
+		server = CreateLoadServer(factory, options.Has("hop-stamps"),
+			options.Has("async-publish") ? options.GetInt("io-threads", 1) : 0);
+		server->Start();
+	}
+
+	auto client = PlumberClient::CreateClient(factory);
+	client->RegisterMessage<LoadCommand, load::COMMANDS::LOAD>();
+	client->RegisterMessage<LoadEvent, load::EVENTS::LOAD_EVENT>();
+
+	atomic<uint64_t> received{ 0 };
+	vector<string> streamNames;
+	vector<shared_ptr<LoadSubscriber>> handlers;
+	vector<unique_ptr<ISubscription>> subscriptions;
+	for (uint64_t s = 0; s < streams; ++s) {
+		streamNames.push_back("load-" + to_string(s));
+		for (uint64_t n = 0; n < subscribers; ++n) {
+			auto handler = make_shared<LoadSubscriber>(received);
+			subscriptions.push_back(client->SubscriptionManager()->Subscribe(streamNames.back(), handler));
+			handlers.push_back(handler);
+		}
+	}
+	client->Start();
+	this_thread::sleep_for(milliseconds(options.GetInt("warmup-ms", 500)));
+
+	LoadCommand cmd;
+	cmd.set_events(eventsPerCommand);
+	cmd.set_payload_size(messageSize);
+	cmd.set_payload(string(messageSize, 'c'));
+
+	LatencySamples roundTrip;
+	roundTrip.Reserve(commands);
+	const auto interval = rate > 0 ? nanoseconds(1'000'000'000 / rate) : nanoseconds(0);
+	const auto startNs = NowNs();
+	auto next = steady_clock::now();
+	for (uint64_t i = 0; i < commands; ++i) {
+		if (rate > 0) {
+			this_thread::sleep_until(next);
+			next += interval;
+		}
+		auto sentNs = NowNs();
+		cmd.set_sent_ns(sentNs);
+		client->CommandBus()->Send(streamNames[i % streams], cmd);
+		roundTrip.Add(NowNs() - sentNs);
+	}
+	const auto sendEndNs = NowNs();
+
+	const uint64_t expected = commands * eventsPerCommand * subscribers;
+	const auto drainDeadline = steady_clock::now() + milliseconds(options.GetInt("drain-ms", 5000));
+	while (received.load(memory_order_relaxed) < expected && steady_clock::now() < drainDeadline) {
+		this_thread::sleep_for(milliseconds(1));
+	}
+
+	for (auto& sub : subscriptions) sub->Unsubscribe();
+
+	LatencySamples publishToHandler, commandToHandler;
+	HopLatencyRecorder hops;
+	uint64_t lastReceivedNs = sendEndNs;
+	for (auto& h : handlers) h->Collect(publishToHandler, commandToHandler, hops, lastReceivedNs);
+
+	const double sendSeconds = static_cast<double>(sendEndNs - startNs) / 1e9;
+	const double receiveSeconds = static_cast<double>(lastReceivedNs - startNs) / 1e9;
+	const auto delivered = publishToHandler.Count();
+
+	LoadReport report;
+	report.Add("transport", options.Transport());
+	report.Add("url", options.Url());
+	report.Add("commands", commands);
+	report.Add("events_per_command", eventsPerCommand);
+	report.Add("message_size", messageSize);
+	report.Add("streams", streams);
+	report.Add("subscribers_per_stream", subscribers);
+	report.Add("rate_limit", rate);
+	report.Add("commands_per_sec", commands / sendSeconds);
+	report.Add("events_published", commands * eventsPerCommand);
+	report.Add("events_expected", expected);
+	report.Add("events_delivered", delivered);
+	report.Add("delivery_ratio", expected ? static_cast<double>(delivered) / static_cast<double>(expected) : 1.0);
+	report.Add("events_per_sec", delivered / receiveSeconds);
+	report.AddLatency("command_rtt", roundTrip);
+	report.AddLatency("publish_to_handler", publishToHandler);
+	report.AddLatency("command_to_handler", commandToHandler);
+	report.AddLatency("hop_publish_to_send", hops.PublishToSend());
+	report.AddLatency("hop_send_to_receive", hops.SendToReceive());
+	report.AddLatency("hop_receive_to_dispatch", hops.ReceiveToDispatch());
+	const auto format = options.Get("format", "json");
+	report.Write(options.Get("report", "cppplumberd_load_report." + format), format);
+
+	client->Stop();
+	if (server) server->Stop();
+	return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace cppplumberd {
+	namespace load {
+		enum COMMANDS : unsigned int {
+			LOAD = 0xFF + 100,
+		};
+		enum EVENTS : unsigned int {
+			LOAD_EVENT = 0xFFFF + 100,
+		};
+	}
+}
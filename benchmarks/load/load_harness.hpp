@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "plumberd.hpp"
+#include "load_msgs.pb.h"
+#include "load_contract.h"
+
+namespace cppplumberd {
+	namespace load {
+
+		inline uint64_t NowNs() {
+			return static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+		}
+
+		// --key=value command line options shared by load_server and load_client.
+		class LoadOptions {
+			map<string, string> _values;
+		public:
+			LoadOptions(int argc, char** argv) {
+				for (int i = 1; i < argc; ++i) {
+					string arg = argv[i];
+					if (arg.rfind("--", 0) != 0) {
+						throw invalid_argument("Unexpected argument: " + arg);
+					}
+					auto eq = arg.find('=');
+					if (eq == string::npos) _values[arg.substr(2)] = "1";
+					else _values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+				}
+			}
+			string Get(const string& key, const string& def) const {
+				auto it = _values.find(key);
+				return it == _values.end() ? def : it->second;
+			}
+			uint64_t GetInt(const string& key, uint64_t def) const {
+				auto it = _values.find(key);
+				return it == _values.end() ? def : stoull(it->second);
+			}
+			bool Has(const string& key) const { return _values.contains(key); }
+
+			// ipc (default) talks to a separate load_server process; inproc hosts the server in-process.
+			string Transport() const { return Get("transport", "ipc"); }
+			string Url() const {
+				return Get("url", Transport() == "inproc" ? "inproc://cppplumberd_load" : "ipc:///tmp/cppplumberd_load");
+			}
+		};
+
+		// Publishes the requested number of LoadEvents on the command's recipient stream.
+		class LoadCommandHandler : public ICommandHandler<LoadCommand> {
+			shared_ptr<EventStore> _eventStore;
+			uint64_t _sequence = 0;
+		public:
+			explicit LoadCommandHandler(shared_ptr<EventStore> eventStore) : _eventStore(eventStore) {}
+
+			void Handle(const string& stream_id, const LoadCommand& cmd) override {
+				LoadEvent evt;
+				evt.set_command_sent_ns(cmd.sent_ns());
+				evt.set_payload(string(cmd.payload_size(), 'e'));
+				for (uint32_t i = 0; i < cmd.events(); ++i) {
+					evt.set_sequence(++_sequence);
+					evt.set_published_ns(NowNs());
+					_eventStore->Publish(stream_id, evt);
+				}
+			}
+		};
+
+		// With ioThreads > 0 events are sent by that many I/O threads instead of the command handler.
+		inline unique_ptr<Plumber> CreateLoadServer(const shared_ptr<ISocketFactory>& factory, bool hopStamps, size_t ioThreads = 0) {
+			auto server = Plumber::CreateServer(factory);
+			server->GetEventStore()->EnableHopStamps(hopStamps);
+			if (ioThreads > 0) {
+				AsyncPublishOptions async;
+				async.IoThreads = ioThreads;
+				server->GetEventStore()->EnableAsyncPublish(async);
+			}
+			server->AddCommandHandler<LoadCommandHandler, LoadCommand, COMMANDS::LOAD>(server->GetEventStore());
+			server->RegisterMessage<LoadEvent, EVENTS::LOAD_EVENT>();
+			return server;
+		}
+
+		// Nanosecond samples with nearest-rank percentiles.
+		class LatencySamples {
+			vector<uint64_t> _samples;
+			bool _sorted = false;
+		public:
+			void Reserve(size_t n) { _samples.reserve(n); }
+			void Add(uint64_t ns) { _samples.push_back(ns); _sorted = false; }
+			void Append(const LatencySamples& other) {
+				_samples.insert(_samples.end(), other._samples.begin(), other._samples.end());
+				_sorted = false;
+			}
+			size_t Count() const { return _samples.size(); }
+			uint64_t Percentile(double p) {
+				if (_samples.empty()) return 0;
+				if (!_sorted) { ranges::sort(_samples); _sorted = true; }
+				auto rank = static_cast<size_t>(p / 100.0 * static_cast<double>(_samples.size()));
+				return _samples[min(rank, _samples.size() - 1)];
+			}
+			uint64_t Max() { return Percentile(100.0); }
+		};
+
+		// Flat, ordered metric list written as CSV (one header row, one value row) or JSON.
+		class LoadReport {
+			vector<pair<string, string>> _fields;
+		public:
+			template<typename T>
+			void Add(const string& name, const T& value) {
+				ostringstream os;
+				os << value;
+				_fields.emplace_back(name, os.str());
+			}
+			void AddLatency(const string& prefix, LatencySamples& samples) {
+				Add(prefix + "_count", samples.Count());
+				Add(prefix + "_p50_ns", samples.Percentile(50));
+				Add(prefix + "_p90_ns", samples.Percentile(90));
+				Add(prefix + "_p99_ns", samples.Percentile(99));
+				Add(prefix + "_p999_ns", samples.Percentile(99.9));
+				Add(prefix + "_max_ns", samples.Max());
+			}
+			void AddLatency(const string& prefix, const LatencyHistogram& histogram) {
+				Add(prefix + "_count", histogram.Count());
+				Add(prefix + "_p50_ns", histogram.Percentile(50));
+				Add(prefix + "_p90_ns", histogram.Percentile(90));
+				Add(prefix + "_p99_ns", histogram.Percentile(99));
+				Add(prefix + "_p999_ns", histogram.Percentile(99.9));
+				Add(prefix + "_max_ns", histogram.Max());
+			}
+			void WriteCsv(ostream& os) const {
+				for (size_t i = 0; i < _fields.size(); ++i) os << (i ? "," : "") << _fields[i].first;
+				os << "\n";
+				for (size_t i = 0; i < _fields.size(); ++i) os << (i ? "," : "") << _fields[i].second;
+				os << "\n";
+			}
+			void WriteJson(ostream& os) const {
+				os << "{\n";
+				for (size_t i = 0; i < _fields.size(); ++i) {
+					const auto& [name, value] = _fields[i];
+					bool numeric = !value.empty() && value.find_first_not_of("0123456789.-e") == string::npos;
+					os << "  \"" << name << "\": " << (numeric ? value : "\"" + value + "\"")
+						<< (i + 1 < _fields.size() ? ",\n" : "\n");
+				}
+				os << "}\n";
+			}
+			void Write(const string& path, const string& format) const {
+				if (path.empty() || path == "-") {
+					format == "csv" ? WriteCsv(cout) : WriteJson(cout);
+					return;
+				}
+				ofstream file(path);
+				if (!file) throw runtime_error("Cannot open report file: " + path);
+				format == "csv" ? WriteCsv(file) : WriteJson(file);
+			}
+		};
+	}
+}
@@ -0,0 +1,33 @@
+#include <iostream>
+#include <thread>
+#include "load_harness.hpp"
+
+using namespace cppplumberd;
+using namespace cppplumberd::load;
+using namespace std;
+
+// Usage: cppplumberd_load_server [--url=ipc:///tmp/cppplumberd_load] [--seconds=N] [--hop-stamps] [--async-publish [--io-threads=1]]
+int main(int argc, char** argv) {
+	LoadOptions options(argc, argv);
+	if (options.Transport() == "inproc") {
+		cerr << "inproc is process-local; run cppplumberd_load_client --transport=inproc instead." << endl;
+		return 1;
+	}
+
+	auto server = CreateLoadServer(make_shared<NggSocketFactory>(options.Url()), options.Has("hop-stamps"),
+		options.Has("async-publish") ? options.GetInt("io-threads", 1) : 0);
+	server->Start();
+
+	auto seconds = options.GetInt("seconds", 0);
+	if (seconds > 0) {
+		cout << "Load server running for " << seconds << "s at " << options.Url() << endl;
+		this_thread::sleep_for(chrono::seconds(seconds));
+	}
+	else {
+		cout << "Load server running at " << options.Url() << ". Press Enter to exit..." << endl;
+		cin.get();
+	}
+
+	server->Stop();
+	return 0;
+}
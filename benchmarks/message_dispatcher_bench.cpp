@@ -0,0 +1,31 @@
+#include <benchmark/benchmark.h>
+#include "cppplumberd/message_dispatcher.hpp"
+#include "cppplumberd/proto/cqrs.pb.h"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+static void BM_MessageDispatcher_Handle(benchmark::State& state) {
+    MessageDispatcher<size_t, CommandHeader> dispatcher;
+    size_t handled = 0;
+    dispatcher.RegisterHandler<SetterCommand, COMMANDS::SETTER>(
+        [&handled](const CommandHeader&, const SetterCommand& cmd) -> size_t {
+            return handled += cmd.value_data().size();
+        });
+    dispatcher.RegisterHandler<CreateReactiveSubscriptionCommand, COMMANDS::CREATE_REACTIVE_SUBSCRIPTION>(
+        [](const CommandHeader&, const CreateReactiveSubscriptionCommand&) -> size_t { return 0; });
+
+    CommandHeader header;
+    header.set_command_type(COMMANDS::SETTER);
+    header.set_recipient("foo");
+    SetterCommand cmd;
+    cmd.set_value_data("1234");
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(dispatcher.Handle(header, COMMANDS::SETTER, &cmd));
+    }
+}
+BENCHMARK(BM_MessageDispatcher_Handle);
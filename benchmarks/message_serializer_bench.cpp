@@ -0,0 +1,62 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include "cppplumberd/message_serializer.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+static void BM_MessageSerializer_Register(benchmark::State& state) {
+    for (auto _ : state) {
+        MessageSerializer serializer;
+        serializer.RegisterMessage<SetterCommand, COMMANDS::SETTER>();
+        serializer.RegisterMessage<PropertyChangedEvent, EVENTS::PROPERTY_CHANGED>();
+        serializer.RegisterMessage<TestError, 0xFFFF + 2>();
+        benchmark::DoNotOptimize(serializer);
+    }
+}
+BENCHMARK(BM_MessageSerializer_Register);
+
+static void BM_MessageSerializer_GetMessageId(benchmark::State& state) {
+    MessageSerializer serializer;
+    serializer.RegisterMessage<SetterCommand, COMMANDS::SETTER>();
+    serializer.RegisterMessage<PropertyChangedEvent, EVENTS::PROPERTY_CHANGED>();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(serializer.GetMessageId<PropertyChangedEvent>());
+    }
+}
+BENCHMARK(BM_MessageSerializer_GetMessageId);
+
+static void BM_MessageSerializer_GetMessageName(benchmark::State& state) {
+    MessageSerializer serializer;
+    serializer.RegisterMessage<PropertyChangedEvent, EVENTS::PROPERTY_CHANGED>();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(serializer.GetMessageName(EVENTS::PROPERTY_CHANGED));
+    }
+}
+BENCHMARK(BM_MessageSerializer_GetMessageName);
+
+static void BM_MessageSerializer_Deserialize(benchmark::State& state) {
+    MessageSerializer serializer;
+    serializer.RegisterMessage<PropertyChangedEvent, EVENTS::PROPERTY_CHANGED>();
+
+    PropertyChangedEvent evt;
+    evt.set_element_name("fakevideosrc");
+    evt.set_property_name("num-buffers");
+    evt.set_value_type(ValueType::BYTE_ARRAY);
+    evt.set_value_data(string(static_cast<size_t>(state.range(0)), 'x'));
+    string bytes = serializer.Serialize(evt);
+
+    for (auto _ : state) {
+        MessagePtr msg = serializer.Deserialize(bytes.data(), bytes.size(), EVENTS::PROPERTY_CHANGED);
+        benchmark::DoNotOptimize(msg);
+        delete msg;
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(bytes.size()));
+}
+BENCHMARK(BM_MessageSerializer_Deserialize)->RangeMultiplier(8)->Range(16, 32 * 1024);
@@ -0,0 +1,53 @@
+#include <benchmark/benchmark.h>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+namespace {
+    // Per-stream property table, the typical shape of a read model.
+    class PropertyReadModel : public EventHandlerBase, public IEventHandler<PropertyChangedEvent> {
+    public:
+        PropertyReadModel() { Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(); }
+        void Handle(const Metadata& m, const PropertyChangedEvent& evt) override {
+            _properties[m.StreamId()][evt.property_name()] = evt.value_data();
+        }
+    private:
+        unordered_map<string, unordered_map<string, string>> _properties;
+    };
+
+    // 1M events spread over 4096 streams.
+    struct RebuildLog {
+        shared_ptr<EventStore> Events = make_shared<EventStore>();
+
+        RebuildLog() {
+            Events->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+            Events->SetEventLog(make_shared<InMemoryEventLog>());
+            PropertyChangedEvent evt;
+            evt.set_element_name("Pump");
+            evt.set_value_data("12345678");
+            for (size_t i = 0; i < 1000000; ++i) {
+                evt.set_property_name("p" + to_string(i % 16));
+                Events->Publish("pump-" + to_string(i % 4096), evt);
+            }
+        }
+    };
+}
+
+// Rebuild of a read model from an empty checkpoint across 1..16 partitions.
+static void BM_Projection_Rebuild(benchmark::State& state) {
+    static RebuildLog log;
+    size_t partitions = state.range(0);
+    for (auto _ : state) {
+        PartitionedProjection projection("rebuild", log.Events->EventLog(), log.Events->Serializer(),
+            [](size_t) { return make_shared<PropertyReadModel>(); }, make_shared<InMemoryCheckpointStore>(), partitions);
+        projection.CatchUp();
+        benchmark::DoNotOptimize(projection.Stats().Processed);
+    }
+    state.SetItemsProcessed(state.iterations() * log.Events->EventLog()->Head());
+}
+BENCHMARK(BM_Projection_Rebuild)->ArgName("partitions")->RangeMultiplier(2)->Range(1, 16)
+    ->UseRealTime()->Unit(benchmark::kMillisecond);
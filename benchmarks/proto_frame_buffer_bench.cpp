@@ -0,0 +1,61 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include "cppplumberd/proto_frame_buffer.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+namespace {
+    PropertyChangedEvent CreateEvent(size_t payloadSize) {
+        PropertyChangedEvent evt;
+        evt.set_element_name("fakevideosrc");
+        evt.set_property_name("num-buffers");
+        evt.set_value_type(ValueType::BYTE_ARRAY);
+        evt.set_value_data(string(payloadSize, 'x'));
+        return evt;
+    }
+
+    EventHeader CreateHeader() {
+        EventHeader header;
+        header.set_timestamp(1743811200000);
+        header.set_event_type(EVENTS::PROPERTY_CHANGED);
+        return header;
+    }
+}
+
+static void BM_ProtoFrameBuffer_Write(benchmark::State& state) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, EVENTS::PROPERTY_CHANGED>();
+    auto buffer = make_unique<ProtoFrameBuffer<64 * 1024>>(serializer);
+    auto header = CreateHeader();
+    auto evt = CreateEvent(static_cast<size_t>(state.range(0)));
+
+    for (auto _ : state) {
+        buffer->Reset();
+        benchmark::DoNotOptimize(buffer->Write<EventHeader, PropertyChangedEvent>(header, evt));
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buffer->Written()));
+}
+BENCHMARK(BM_ProtoFrameBuffer_Write)->RangeMultiplier(8)->Range(16, 32 * 1024);
+
+static void BM_ProtoFrameBuffer_Read(benchmark::State& state) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, EVENTS::PROPERTY_CHANGED>();
+    auto buffer = make_unique<ProtoFrameBuffer<64 * 1024>>(serializer);
+    buffer->Write<EventHeader, PropertyChangedEvent>(CreateHeader(), CreateEvent(static_cast<size_t>(state.range(0))));
+    auto selector = [](const EventHeader& h) -> unsigned int { return h.event_type(); };
+
+    for (auto _ : state) {
+        MessagePtr payload = nullptr;
+        auto header = buffer->Read<EventHeader>(selector, payload);
+        benchmark::DoNotOptimize(header);
+        delete payload;
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(buffer->Written()));
+}
+BENCHMARK(BM_ProtoFrameBuffer_Read)->RangeMultiplier(8)->Range(16, 32 * 1024);
@@ -0,0 +1,101 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <list>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace app::testing;
+
+namespace {
+    // Blocks (as on I/O) for 'stall' on every 'every'-th event and records publish-to-handler latency.
+    class StallingHandler : public EventHandlerBase, public IEventHandler<PropertyChangedEvent> {
+        uint64_t _every;
+        nanoseconds _stall;
+    public:
+        LatencyHistogram Latency;
+        uint64_t Handled = 0;
+
+        StallingHandler(uint64_t every, nanoseconds stall) : _every(every), _stall(stall) {
+            Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        }
+
+        void Handle(const Metadata& metadata, const PropertyChangedEvent& evt) override {
+            Latency.Record(duration_cast<nanoseconds>(system_clock::now() - metadata.Hops().Published));
+            if (++Handled % _every == 0) this_thread::sleep_for(_stall);
+        }
+    };
+
+    class BenchSubscribeSocket : public ITransportSubscribeSocket {
+    public:
+        void Start() override {}
+        void Start(const string& url) override {}
+    };
+}
+
+// A paced publisher feeds a model of the NNG sub0 socket: a receive buffer of 128 messages that drops new messages
+// while full, drained by a receive thread that fires Received. The handler blocks 2 ms every 500 events (40% of the time
+// at one event per 10 us). Arg: receive ring bytes (0: handler runs on the receive thread). Reports the fraction of
+// events that never reached the handler and publish-to-handler percentiles.
+static void BM_ReceivePath_SlowHandler(benchmark::State& state) {
+    const size_t ringBytes = static_cast<size_t>(state.range(0));
+    constexpr uint64_t frames = 20000;
+    constexpr auto interval = microseconds(10);
+    constexpr size_t socketBuffer = 128;
+    uint64_t generated = 0, handled = 0;
+    LatencyHistogram latency;
+
+    for (auto _ : state) {
+        auto serializer = make_shared<MessageSerializer>();
+        serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        auto socket = make_unique<BenchSubscribeSocket>();
+        auto received = socket.get();
+        auto handler = make_shared<StallingHandler>(500, milliseconds(2));
+        ClientProtoSubscriptionStream stream(std::move(socket), handler, serializer, "bench");
+        if (ringBytes > 0) stream.EnableReceiveRing(ringBytes);
+        stream.Start();
+
+        FlowControlQueue<vector<uint8_t>> socketQueue(FlowControlPolicy{ FlowControl::DROP_NEWEST, socketBuffer });
+        thread receiver([&]() {
+            list<FlowControlQueue<vector<uint8_t>>::Item> batch;
+            while (socketQueue.WaitAndTake(batch)) {
+                for (auto& frame : batch) received->Received(frame.Value.data(), frame.Value.size());
+                batch.clear();
+            }
+        });
+
+        ProtoFrameBuffer<1024> frame(serializer);
+        EventHeader header;
+        header.set_event_type(app::testing::EVENTS::PROPERTY_CHANGED);
+        PropertyChangedEvent evt;
+        evt.set_property_name("Speed");
+        auto deadline = steady_clock::now();
+        for (uint64_t i = 1; i <= frames; ++i) {
+            deadline += interval;
+            while (steady_clock::now() < deadline) {}
+            header.set_timestamp_ns(static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count()));
+            header.set_sequence(i);
+            evt.set_value_data(to_string(i));
+            frame.Reset();
+            frame.Write<EventHeader, PropertyChangedEvent>(header, evt);
+            socketQueue.Push("", vector<uint8_t>(frame.Get(), frame.Get() + frame.Written()));
+        }
+        socketQueue.Close();
+        receiver.join();
+        stream.Stop();
+
+        generated += frames;
+        handled += handler->Handled;
+        latency.Merge(handler->Latency);
+    }
+    state.counters["drop_rate"] = 1.0 - static_cast<double>(handled) / static_cast<double>(generated);
+    state.counters["p50_us"] = latency.Percentile(50) / 1000.0;
+    state.counters["p99_us"] = latency.Percentile(99) / 1000.0;
+    state.counters["p999_us"] = latency.Percentile(99.9) / 1000.0;
+}
+BENCHMARK(BM_ReceivePath_SlowHandler)->Arg(0)->Arg(64 * 1024)->Arg(1024 * 1024)
+    ->Iterations(3)->UseRealTime()->Unit(benchmark::kMillisecond);
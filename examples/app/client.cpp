@@ -41,7 +41,13 @@ int main() {
 	plumber->CommandBus()->Send<app::CreateReactiveSubscriptionCommand>("foo",cmd);
 
 	auto vm = make_shared< app::ReactivePropertyViewModel>();
-	auto subscription = plumber->SubscriptionManager()->Subscribe("Foo", vm);
+	// The view model only needs the latest value of each property; if it falls behind, older updates are conflated.
+	// It starts from the stream's last values.
+	auto options = cppplumberd::SubscriptionOptions::ConflateBy<app::PropertyChangedEvent>([](const app::PropertyChangedEvent& evt) {
+		return evt.element_name() + "." + evt.property_name();
+	});
+	options.LastValues = true;
+	auto subscription = plumber->SubscriptionManager()->Subscribe("Foo", vm, options);
 
 	// Keep the program running
 	cout << "Client running. Press Enter to exit..." << endl;
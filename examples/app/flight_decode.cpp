@@ -0,0 +1,30 @@
+#include "../../include/plumberd.hpp"
+#include "example.pb.h"
+#include "contract.h"
+#include <iostream>
+
+using namespace cppplumberd;
+using namespace std;
+
+// Prints a flight recorder dump written by app-server, decoding frames with the app's message types.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "usage: flight_decode <dump-file>" << endl;
+        return 1;
+    }
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<example::SetterCommand, app::COMMANDS::SETTER>();
+    serializer->RegisterMessage<example::CreateReactiveSubscription, app::COMMANDS::CREATE_REACTIVE_SUBSCRIPTION>();
+    serializer->RegisterMessage<example::StartReactiveSubscription, app::COMMANDS::START_REACTIVE_SUBSCRIPTION>();
+    serializer->RegisterMessage<example::PropertyChangedEvent, app::EVENTS::PROPERTY_CHANGED>();
+
+    try {
+        FlightRecordReader reader(serializer);
+        reader.Print(cout, FlightRecordReader::Load(argv[1]));
+    }
+    catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
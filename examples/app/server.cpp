@@ -1,4 +1,5 @@
 #include "../../include/plumberd.hpp"
+#include "../../include/cppplumberd/flight_recorder_signals.hpp"
 #include "interfaces.hpp"
 #include "example.pb.h"
 #include "contract.h"
@@ -31,7 +32,7 @@ namespace app {
         bool _writable;
 
         // Signal for property changes
-        signal<void(IPropertyInfo&, int)> _valueChanged;
+        boost::signals2::signal<void(IPropertyInfo&, int)> _valueChanged;
 
     public:
         PropertyInfoImpl(const string& name, IElementInfo* parent, bool readable = true, bool writable = true)
@@ -226,6 +227,30 @@ namespace app {
         void OnPropertyChanged(const string& elementName, const string& propertyName, int newValue) {
             cout << "Property changed: " << elementName << "." << propertyName << " = " << newValue << endl;
 
+            // Publish to all reactive subscriptions
+            for (const auto& streamName : _reactiveSubscriptions) {
+                Publish(streamName, elementName, propertyName, newValue);
+            }
+        }
+
+        // Add a stream to send property changes to. The stream keeps the last value of every property,
+        // so clients that subscribe later start from the current state.
+        void AddReactiveSubscription(const string& streamName) {
+            _eventStore->EnableLastValue<PropertyChangedEvent>(streamName, [](const PropertyChangedEvent& evt) {
+                return evt.element_name() + "." + evt.property_name();
+            });
+            _reactiveSubscriptions.insert(streamName);
+        }
+
+        // Seeds 'streamName' with the property's current value.
+        void PublishCurrentValue(const string& streamName, shared_ptr<PropertyInfoImpl> property) {
+            Publish(streamName, property->GetElementInfo()->GetName(), property->GetName(), *property->GetValue());
+        }
+
+    private:
+        set<string> _reactiveSubscriptions;
+
+        void Publish(const string& streamName, const string& elementName, const string& propertyName, int newValue) {
             // Create event
             PropertyChangedEvent evt;
             evt.set_element_name(elementName);
@@ -238,19 +263,8 @@ namespace app {
             memcpy(&valueData[0], &newValue, sizeof(int));
             evt.set_value_data(valueData);
 
-            // Publish to all reactive subscriptions
-            for (const auto& streamName : _reactiveSubscriptions) {
-                _eventStore->Publish(streamName, evt);
-            }
-        }
-
-        // Add a stream to send property changes to
-        void AddReactiveSubscription(const string& streamName) {
-            _reactiveSubscriptions.insert(streamName);
+            _eventStore->Publish(streamName, evt);
         }
-
-    private:
-        set<string> _reactiveSubscriptions;
     };
 
     // Handler for creating reactive subscriptions
@@ -307,6 +321,7 @@ namespace app {
                 }
 
                 _propertyMonitor->MonitorProperty(propertyImpl);
+                _propertyMonitor->PublishCurrentValue(cmd.name(), propertyImpl);
             }
         }
     };
@@ -365,6 +380,13 @@ int main() {
     // Register message types
     plumber->RegisterMessage<app::PropertyChangedEvent, app::EVENTS::PROPERTY_CHANGED>();
 
+    // Keep the last 16MB of traffic for postmortems; decode dumps with flight_decode.
+    FlightRecorder::Install(16 * 1024 * 1024);
+    FlightRecorderDumps::OnFatal("app-server.crash.flight");
+#ifdef SIGUSR1
+    FlightRecorderDumps::OnSignal(SIGUSR1, "app-server.flight");
+#endif
+
     // Start the server
     plumber->Start();
 
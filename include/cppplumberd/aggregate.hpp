@@ -0,0 +1,162 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "cppplumberd/aggregate_cache.hpp"
+#include "cppplumberd/event_handler_base.hpp"
+#include "cppplumberd/event_log.hpp"
+#include "cppplumberd/event_store.hpp"
+#include "cppplumberd/snapshot_store.hpp"
+
+namespace cppplumberd {
+
+    // Event-sourced aggregate: state is a protobuf message folded from its stream by the IEventHandler<TEvent>
+    // implementations registered with Map<TEvent, Id>(), exactly like a read model.
+    template<typename TState>
+    class Aggregate : public EventHandlerBase {
+        template<typename> friend class AggregateRepository;
+
+        std::string _id;
+        uint64_t _version = 0;
+        uint64_t _snapshotVersion = 0;
+        std::chrono::steady_clock::time_point _snapshotTime = std::chrono::steady_clock::now();
+
+    protected:
+        TState _state;
+
+    public:
+        typedef TState StateType;
+
+        const std::string& Id() const { return _id; }
+        uint64_t Version() const { return _version; }
+        const TState& State() const { return _state; }
+    };
+
+    // Snapshot every 'EveryEvents' events and/or when 'Every' has elapsed since the last one (0 disables either).
+    struct SnapshotPolicy {
+        uint64_t EveryEvents = 1000;
+        std::chrono::milliseconds Every{ 0 };
+    };
+
+    // Loads aggregates from the latest snapshot plus the tail of their stream and appends their new events.
+    // Snapshots are taken off the command path by a Snapshotter.
+    template<typename TAggregate>
+    class AggregateRepository {
+        typedef typename TAggregate::StateType TState;
+
+        shared_ptr<EventStore> _eventStore;
+        shared_ptr<Snapshotter> _snapshotter;
+        SnapshotPolicy _policy;
+        shared_ptr<AggregateCache<TAggregate>> _cache;
+
+        void Apply(TAggregate& aggregate, const RecordedEvent& e) const {
+            MessagePtr msg = _eventStore->Serializer()->Deserialize(e.data(), e.event_type());
+            unique_ptr<google::protobuf::Message> owner(msg);
+            aggregate.EventHandlerBase::Handle(Metadata(e), e.event_type(), msg);
+            aggregate._version = e.version();
+        }
+
+        void MaybeSnapshot(TAggregate& aggregate) {
+            if (!_snapshotter) return;
+            bool byCount = _policy.EveryEvents > 0 && aggregate._version - aggregate._snapshotVersion >= _policy.EveryEvents;
+            auto now = steady_clock::now();
+            bool byTime = _policy.Every.count() > 0 && now - aggregate._snapshotTime >= _policy.Every;
+            if (!byCount && !byTime) return;
+            aggregate._snapshotVersion = aggregate._version;
+            aggregate._snapshotTime = now;
+            _snapshotter->Enqueue(aggregate._id, aggregate._version,
+                [state = aggregate._state]() { return state.SerializeAsString(); });
+        }
+
+    public:
+        AggregateRepository(shared_ptr<EventStore> eventStore, shared_ptr<Snapshotter> snapshotter = nullptr,
+            SnapshotPolicy policy = {})
+            : _eventStore(eventStore), _snapshotter(snapshotter), _policy(policy) {
+            if (!_eventStore->EventLog()) {
+                throw invalid_argument("AggregateRepository requires an EventStore with an event log");
+            }
+        }
+
+        const shared_ptr<Snapshotter>& GetSnapshotter() const { return _snapshotter; }
+
+        // Keeps up to 'capacityBytes' of hot aggregates in memory for Get().
+        void EnableCache(size_t capacityBytes) { _cache = make_shared<AggregateCache<TAggregate>>(capacityBytes); }
+        const shared_ptr<AggregateCache<TAggregate>>& Cache() const { return _cache; }
+
+        // Cached Load: a hit is validated against the stream's current version and caught up if it moved on.
+        // Callers must not work on the same aggregate from two threads at once.
+        shared_ptr<TAggregate> Get(const string& id) {
+            if (!_cache) return Load(id);
+            if (auto aggregate = _cache->Find(id)) {
+                if (_eventStore->EventLog()->StreamVersion(id) != aggregate->_version) {
+                    CatchUp(*aggregate);
+                    _cache->MarkStale();
+                    _cache->Update(id);
+                }
+                return aggregate;
+            }
+            shared_ptr<TAggregate> aggregate = Load(id);
+            _cache->Put(id, aggregate);
+            return aggregate;
+        }
+
+        unique_ptr<TAggregate> Load(const string& id) const {
+            auto aggregate = make_unique<TAggregate>();
+            aggregate->_id = id;
+            if (_snapshotter) {
+                if (auto snapshot = _snapshotter->Store()->Load(id)) {
+                    if (!aggregate->_state.ParseFromString(snapshot->state())) {
+                        throw runtime_error("Corrupt snapshot of stream: " + id);
+                    }
+                    aggregate->_version = aggregate->_snapshotVersion = snapshot->version();
+                }
+            }
+            CatchUp(*aggregate);
+            return aggregate;
+        }
+
+        // Applies events appended to the aggregate's stream since it was loaded; returns how many.
+        size_t CatchUp(TAggregate& aggregate) const {
+            return _eventStore->EventLog()->ReadStream(aggregate._id, aggregate._version + 1,
+                [this, &aggregate](const RecordedEvent& e) { Apply(aggregate, e); });
+        }
+
+        // Publishes 'evt' on the aggregate's stream (failing with 409 if the stream moved on) and applies it.
+        template<typename TEvent>
+        void Append(TAggregate& aggregate, const TEvent& evt) {
+            uint64_t version;
+            try {
+                version = _eventStore->Publish(aggregate._id, evt, aggregate._version);
+            }
+            catch (...) {
+                // Whatever is cached is behind the stream or was never appended; reload on next Get().
+                if (_cache) _cache->Evict(aggregate._id);
+                throw;
+            }
+            Metadata m(aggregate._id, system_clock::now(), Tracer::Current(), version, 0);
+            aggregate.EventHandlerBase::Handle(m, _eventStore->Serializer()->template GetMessageId<TEvent>(), const_cast<TEvent*>(&evt));
+            aggregate._version = version;
+            MaybeSnapshot(aggregate);
+            if (_cache) _cache->Update(aggregate._id);
+        }
+    };
+
+    // Base for command handlers that act on one aggregate per recipient stream: the aggregate is fetched
+    // through the repository (from its cache when enabled) and passed to Execute().
+    template<typename TAggregate, typename TCommand>
+    class AggregateCommandHandler : public ICommandHandler<TCommand> {
+        shared_ptr<AggregateRepository<TAggregate>> _repository;
+    protected:
+        AggregateRepository<TAggregate>& Repository() { return *_repository; }
+        virtual void Execute(TAggregate& aggregate, const TCommand& cmd) = 0;
+    public:
+        explicit AggregateCommandHandler(shared_ptr<AggregateRepository<TAggregate>> repository) : _repository(repository) {}
+
+        void Handle(const string& stream_id, const TCommand& cmd) override {
+            auto aggregate = _repository->Get(stream_id);
+            Execute(*aggregate, cmd);
+        }
+    };
+}
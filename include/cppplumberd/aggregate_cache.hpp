@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cppplumberd {
+
+    struct AggregateCacheStats {
+        uint64_t Hits = 0;
+        uint64_t Misses = 0;
+        // Hits whose stream had moved on and were caught up before use.
+        uint64_t Stale = 0;
+        uint64_t Evictions = 0;
+        size_t Entries = 0;
+        size_t Bytes = 0;
+        size_t CapacityBytes = 0;
+
+        double HitRatio() const {
+            uint64_t lookups = Hits + Misses;
+            return lookups == 0 ? 0.0 : static_cast<double>(Hits) / lookups;
+        }
+    };
+
+    // Hot aggregates keyed by stream id, evicted least-recently-used first once their estimated
+    // size exceeds 'capacityBytes'. The size of an entry is its state's SpaceUsedLong() plus the aggregate itself.
+    template<typename TAggregate>
+    class AggregateCache {
+        struct Entry {
+            std::string Id;
+            std::shared_ptr<TAggregate> Aggregate;
+            size_t Bytes;
+        };
+
+        mutable std::mutex _mtx;
+        std::list<Entry> _lru; // most recently used first
+        std::unordered_map<std::string, typename std::list<Entry>::iterator> _index;
+        size_t _capacityBytes;
+        AggregateCacheStats _stats;
+
+        static size_t SizeOf(const std::string& id, const TAggregate& aggregate) {
+            return sizeof(TAggregate) + id.capacity() + aggregate.State().SpaceUsedLong();
+        }
+
+        // Never evicts the most recently used entry, so a single aggregate larger than the capacity still caches.
+        void EvictOverCapacity() {
+            while (_stats.Bytes > _capacityBytes && _lru.size() > 1) {
+                auto& victim = _lru.back();
+                _stats.Bytes -= victim.Bytes;
+                _index.erase(victim.Id);
+                _lru.pop_back();
+                ++_stats.Evictions;
+            }
+        }
+
+    public:
+        explicit AggregateCache(size_t capacityBytes) : _capacityBytes(capacityBytes) {
+            _stats.CapacityBytes = capacityBytes;
+        }
+
+        std::shared_ptr<TAggregate> Find(const std::string& id) {
+            std::lock_guard lock(_mtx);
+            auto it = _index.find(id);
+            if (it == _index.end()) {
+                ++_stats.Misses;
+                return nullptr;
+            }
+            ++_stats.Hits;
+            _lru.splice(_lru.begin(), _lru, it->second);
+            return it->second->Aggregate;
+        }
+
+        void Put(const std::string& id, std::shared_ptr<TAggregate> aggregate) {
+            std::lock_guard lock(_mtx);
+            size_t bytes = SizeOf(id, *aggregate);
+            auto it = _index.find(id);
+            if (it != _index.end()) {
+                _stats.Bytes -= it->second->Bytes;
+                it->second->Aggregate = std::move(aggregate);
+                it->second->Bytes = bytes;
+                _lru.splice(_lru.begin(), _lru, it->second);
+            }
+            else {
+                _lru.push_front(Entry{ id, std::move(aggregate), bytes });
+                _index[id] = _lru.begin();
+            }
+            _stats.Bytes += bytes;
+            EvictOverCapacity();
+        }
+
+        // Re-measures an entry after its state changed.
+        void Update(const std::string& id) {
+            std::lock_guard lock(_mtx);
+            auto it = _index.find(id);
+            if (it == _index.end()) return;
+            size_t bytes = SizeOf(id, *it->second->Aggregate);
+            _stats.Bytes = _stats.Bytes - it->second->Bytes + bytes;
+            it->second->Bytes = bytes;
+            EvictOverCapacity();
+        }
+
+        void Evict(const std::string& id) {
+            std::lock_guard lock(_mtx);
+            auto it = _index.find(id);
+            if (it == _index.end()) return;
+            _stats.Bytes -= it->second->Bytes;
+            _lru.erase(it->second);
+            _index.erase(it);
+        }
+
+        void MarkStale() {
+            std::lock_guard lock(_mtx);
+            ++_stats.Stale;
+        }
+
+        void Clear() {
+            std::lock_guard lock(_mtx);
+            _lru.clear();
+            _index.clear();
+            _stats.Bytes = 0;
+        }
+
+        AggregateCacheStats Stats() const {
+            std::lock_guard lock(_mtx);
+            AggregateCacheStats stats = _stats;
+            stats.Entries = _index.size();
+            return stats;
+        }
+    };
+}
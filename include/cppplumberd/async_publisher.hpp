@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace cppplumberd {
+
+    // Unbounded lock-free multi-producer/single-consumer FIFO (Vyukov's intrusive-less variant): Push is one atomic
+    // exchange, TryPop touches no shared state other than the node it takes. Values pushed by one thread are popped in
+    // the order they were pushed; pushes from different threads are ordered by their exchange.
+    template<typename T>
+    class MpscQueue {
+        struct Node {
+            std::atomic<Node*> Next = nullptr;
+            std::optional<T> Value;
+        };
+
+        alignas(64) std::atomic<Node*> _head;
+        alignas(64) Node* _tail;
+        Node _stub;
+
+    public:
+        MpscQueue() : _head(&_stub), _tail(&_stub) {}
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+        ~MpscQueue() {
+            Node* n = _tail;
+            while (n) {
+                Node* next = n->Next.load(std::memory_order_relaxed);
+                if (n != &_stub) delete n;
+                n = next;
+            }
+        }
+
+        void Push(T value) {
+            Node* n = new Node();
+            n->Value.emplace(std::move(value));
+            Node* prev = _head.exchange(n, std::memory_order_acq_rel);
+            prev->Next.store(n, std::memory_order_release);
+        }
+
+        // Consumer only. Returns false when empty, or when the next producer has not finished linking its node yet.
+        bool TryPop(T& out) {
+            Node* tail = _tail;
+            Node* next = tail->Next.load(std::memory_order_acquire);
+            if (!next) return false;
+            out = std::move(*next->Value);
+            next->Value.reset();
+            // 'next' becomes the new stub.
+            _tail = next;
+            if (tail != &_stub) delete tail;
+            return true;
+        }
+    };
+
+    // Something an I/O thread drains: sends at most 'max' queued items and returns how many it sent.
+    class IAsyncChannel {
+    public:
+        virtual size_t Drain(size_t max) = 0;
+        virtual ~IAsyncChannel() = default;
+    };
+
+    struct AsyncPublishOptions {
+        size_t IoThreads = 1;
+        // Events a stream may have queued before Publish waits for the I/O thread (0: unbounded). Concurrent
+        // publishers on one stream can overshoot it by at most one event each.
+        size_t Capacity = 64 * 1024;
+        // Events sent from one stream before its I/O thread moves on to its next stream.
+        size_t MaxBatch = 256;
+    };
+
+    struct AsyncPublishStats {
+        uint64_t Enqueued = 0;
+        uint64_t Sent = 0;
+        uint64_t Failed = 0;
+        uint64_t Batches = 0;
+        uint64_t Blocked = 0;      // publishes that waited for a full queue
+        size_t Pending = 0;
+    };
+
+    // Dedicated I/O threads for publish channels. Each channel is drained by exactly one thread, so whatever order
+    // its queue has is the order on the wire.
+    class AsyncPublisher {
+    public:
+        class IoThread {
+            std::mutex _mtx;
+            std::vector<std::shared_ptr<IAsyncChannel>> _channels;
+            std::atomic<bool> _channelsChanged = false;
+            std::atomic<uint32_t> _signal = 0;
+            std::atomic<bool> _sleeping = false;
+            std::atomic<bool> _stopping = false;
+            size_t _maxBatch;
+            std::thread _thread;
+
+            void Run() {
+                std::vector<std::shared_ptr<IAsyncChannel>> channels;
+                while (true) {
+                    if (_channelsChanged.exchange(false)) {
+                        std::lock_guard lock(_mtx);
+                        channels = _channels;
+                    }
+                    uint32_t seen = _signal.load();
+                    size_t sent = 0;
+                    for (auto& c : channels) sent += c->Drain(_maxBatch);
+                    if (sent > 0) continue;
+                    if (_stopping) break;
+                    // A producer that pushes after the drain above bumps _signal, so wait() returns right away.
+                    _sleeping = true;
+                    _signal.wait(seen);
+                    _sleeping = false;
+                }
+            }
+
+        public:
+            explicit IoThread(size_t maxBatch) : _maxBatch(maxBatch > 0 ? maxBatch : 1) {
+                _thread = std::thread([this]() { Run(); });
+            }
+            ~IoThread() { Stop(); }
+
+            void Attach(const std::shared_ptr<IAsyncChannel>& channel) {
+                {
+                    std::lock_guard lock(_mtx);
+                    _channels.push_back(channel);
+                }
+                _channelsChanged = true;
+                Wake();
+            }
+
+            // Called by producers after every push.
+            inline void Wake() {
+                _signal.fetch_add(1);
+                if (_sleeping) _signal.notify_one();
+            }
+
+            // Returns after everything queued before the call has been sent.
+            void Stop() {
+                _stopping = true;
+                _signal.fetch_add(1);
+                _signal.notify_one();
+                if (_thread.joinable()) _thread.join();
+            }
+        };
+
+    private:
+        AsyncPublishOptions _options;
+        std::vector<std::unique_ptr<IoThread>> _threads;
+        std::atomic<size_t> _next = 0;
+
+    public:
+        explicit AsyncPublisher(const AsyncPublishOptions& options = {}) : _options(options) {
+            size_t n = options.IoThreads > 0 ? options.IoThreads : 1;
+            for (size_t i = 0; i < n; ++i) _threads.push_back(std::make_unique<IoThread>(options.MaxBatch));
+        }
+
+        const AsyncPublishOptions& Options() const { return _options; }
+
+        // Assigns the channel to an I/O thread (round robin) and returns it; the channel wakes it after each push.
+        IoThread& Attach(const std::shared_ptr<IAsyncChannel>& channel) {
+            auto& thread = *_threads[_next++ % _threads.size()];
+            thread.Attach(channel);
+            return thread;
+        }
+
+        // Sends what is queued and joins the I/O threads; channels must not be published to afterwards.
+        void Stop() {
+            for (auto& t : _threads) t->Stop();
+        }
+    };
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace cppplumberd {
+
+    using namespace std;
+
+    // Last event log position a projection has fully processed, by projection name; 0 when it never ran.
+    class ICheckpointStore {
+    public:
+        virtual void Save(const string& projection, uint64_t position) = 0;
+        virtual uint64_t Load(const string& projection) const = 0;
+        virtual ~ICheckpointStore() = default;
+    };
+
+    class InMemoryCheckpointStore : public ICheckpointStore {
+        mutable std::mutex _mtx;
+        unordered_map<string, uint64_t> _checkpoints;
+    public:
+        void Save(const string& projection, uint64_t position) override {
+            lock_guard lock(_mtx);
+            _checkpoints[projection] = position;
+        }
+        uint64_t Load(const string& projection) const override {
+            lock_guard lock(_mtx);
+            auto it = _checkpoints.find(projection);
+            return it == _checkpoints.end() ? 0 : it->second;
+        }
+    };
+
+    // One 8 byte file per projection in 'directory', replaced via rename like FileSnapshotStore.
+    class FileCheckpointStore : public ICheckpointStore {
+        filesystem::path _directory;
+
+        filesystem::path PathOf(const string& projection) const {
+            static constexpr char digits[] = "0123456789abcdef";
+            string name;
+            name.reserve(projection.size() * 2 + 11);
+            for (unsigned char c : projection) {
+                name += digits[c >> 4];
+                name += digits[c & 0xF];
+            }
+            return _directory / (name + ".checkpoint");
+        }
+    public:
+        explicit FileCheckpointStore(const filesystem::path& directory) : _directory(directory) {
+            filesystem::create_directories(_directory);
+        }
+        void Save(const string& projection, uint64_t position) override {
+            auto path = PathOf(projection);
+            auto tmp = path;
+            tmp += ".tmp";
+            {
+                ofstream file(tmp, ios::binary | ios::trunc);
+                file.write(reinterpret_cast<const char*>(&position), sizeof(position));
+                if (!file) throw runtime_error("Failed to write checkpoint: " + tmp.string());
+            }
+            filesystem::rename(tmp, path);
+        }
+        uint64_t Load(const string& projection) const override {
+            ifstream file(PathOf(projection), ios::binary);
+            if (!file) return 0;
+            uint64_t position = 0;
+            if (!file.read(reinterpret_cast<char*>(&position), sizeof(position))) {
+                throw runtime_error("Corrupt checkpoint of projection: " + projection);
+            }
+            return position;
+        }
+    };
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+#include "cppplumberd/cqrs_abstractions.hpp"
+#include "cppplumberd/query_bus.hpp"
+
+namespace cppplumberd {
+
+    struct ClientQueryCacheStats {
+        uint64_t Hits = 0;
+        uint64_t Misses = 0;
+        // Entries changed in place by an event, and entries dropped because of an event.
+        uint64_t Updates = 0;
+        uint64_t Invalidations = 0;
+        uint64_t Evictions = 0;
+        size_t Entries = 0;
+        size_t Bytes = 0;
+        size_t CapacityBytes = 0;
+
+        double HitRatio() const {
+            uint64_t lookups = Hits + Misses;
+            return lookups == 0 ? 0.0 : static_cast<double>(Hits) / lookups;
+        }
+    };
+
+    // Read-through cache in front of PlumberQueryBus. Registered query types are answered locally once fetched;
+    // the cache subscribes to their invalidating streams and, for every event there, updates each cached result with
+    // the handler registered for that event type or drops it. Bounded by bytes, least recently used evicted first.
+    class ClientQueryCache {
+        typedef std::function<bool(const google::protobuf::Message&, google::protobuf::Message&, const Metadata&, MessagePtr)> Updater;
+
+        struct QueryType {
+            std::vector<std::string> Streams;
+            std::unordered_map<unsigned int, Updater> Updaters;
+            uint64_t Generation = 0;
+        };
+        struct Entry {
+            std::type_index Type;
+            std::string Key;
+            std::shared_ptr<google::protobuf::Message> Query;
+            std::shared_ptr<google::protobuf::Message> Result;
+            // Server event log position the result reflects; events at or before it are already applied.
+            uint64_t Position;
+            size_t Bytes;
+        };
+
+        class StreamListener : public IEventDispatcher {
+            ClientQueryCache* _cache;
+        public:
+            explicit StreamListener(ClientQueryCache* cache) : _cache(cache) {}
+            void Handle(const Metadata& metadata, unsigned int messageId, MessagePtr msg) override {
+                _cache->OnEvent(metadata, messageId, msg);
+            }
+        };
+
+        shared_ptr<PlumberQueryBus> _queryBus;
+        shared_ptr<ISubscriptionManager> _subscriptionManager;
+
+        mutable std::mutex _mtx;
+        std::unordered_map<std::type_index, QueryType> _types;
+        std::unordered_multimap<std::string, std::type_index> _dependents;
+        std::unordered_map<std::string, unique_ptr<ISubscription>> _subscriptions;
+        std::list<Entry> _lru; // most recently used first
+        std::unordered_map<std::type_index, std::unordered_map<std::string, std::list<Entry>::iterator>> _index;
+        size_t _capacityBytes;
+        ClientQueryCacheStats _stats;
+
+        static size_t SizeOf(const Entry& e) {
+            return sizeof(Entry) + e.Key.capacity() + e.Query->SpaceUsedLong() + e.Result->SpaceUsedLong();
+        }
+
+        void Erase(std::list<Entry>::iterator it) {
+            _stats.Bytes -= it->Bytes;
+            _index[it->Type].erase(it->Key);
+            _lru.erase(it);
+        }
+
+        void EvictOverCapacity() {
+            while (_stats.Bytes > _capacityBytes && !_lru.empty()) {
+                Erase(std::prev(_lru.end()));
+                ++_stats.Evictions;
+            }
+        }
+
+        void OnEvent(const Metadata& metadata, unsigned int messageId, MessagePtr msg) {
+            std::lock_guard lock(_mtx);
+            auto range = _dependents.equal_range(metadata.StreamId());
+            for (auto d = range.first; d != range.second; ++d) {
+                auto& type = _types.at(d->second);
+                ++type.Generation;
+                auto updater = type.Updaters.find(messageId);
+                auto& entries = _index[d->second];
+                for (auto e = entries.begin(); e != entries.end();) {
+                    auto it = (e++)->second;
+                    if (metadata.Position() != 0 && metadata.Position() <= it->Position) continue;
+                    if (updater != type.Updaters.end() && updater->second(*it->Query, *it->Result, metadata, msg)) {
+                        _stats.Bytes -= it->Bytes;
+                        it->Bytes = SizeOf(*it);
+                        _stats.Bytes += it->Bytes;
+                        ++_stats.Updates;
+                    }
+                    else {
+                        Erase(it);
+                        ++_stats.Invalidations;
+                    }
+                }
+            }
+            EvictOverCapacity();
+        }
+
+    public:
+        ClientQueryCache(shared_ptr<PlumberQueryBus> queryBus, shared_ptr<ISubscriptionManager> subscriptionManager,
+            size_t capacityBytes = 16 * 1024 * 1024)
+            : _queryBus(queryBus), _subscriptionManager(subscriptionManager), _capacityBytes(capacityBytes) {
+            _stats.CapacityBytes = capacityBytes;
+        }
+        ~ClientQueryCache() {
+            for (auto& [stream, subscription] : _subscriptions) subscription->Unsubscribe();
+        }
+
+        void SetCapacity(size_t capacityBytes) {
+            std::lock_guard lock(_mtx);
+            _capacityBytes = _stats.CapacityBytes = capacityBytes;
+            EvictOverCapacity();
+        }
+
+        // Makes TQuery cacheable; its results change with events on 'invalidatedBy'.
+        template<typename TQuery, typename TResult>
+        void Register(const std::vector<std::string>& invalidatedBy) {
+            std::vector<std::string> subscribe;
+            {
+                std::lock_guard lock(_mtx);
+                std::type_index type(typeid(TQuery));
+                _types[type].Streams = invalidatedBy;
+                for (const auto& stream : invalidatedBy) {
+                    _dependents.insert({ stream, type });
+                    if (!_subscriptions.contains(stream)) subscribe.push_back(stream);
+                }
+            }
+            // Subscribing sends a command, so it is done outside the lock.
+            for (const auto& stream : subscribe) {
+                auto subscription = _subscriptionManager->Subscribe(stream, make_shared<StreamListener>(this));
+                std::lock_guard lock(_mtx);
+                _subscriptions[stream] = std::move(subscription);
+            }
+        }
+
+        // Applies TEvent to cached TQuery results in place; returning false drops the result instead.
+        // Event types without an update handler drop the results.
+        template<typename TQuery, typename TResult, typename TEvent, unsigned int EventId>
+        void OnEvent(std::function<bool(const TQuery&, TResult&, const Metadata&, const TEvent&)> update) {
+            std::lock_guard lock(_mtx);
+            _types[std::type_index(typeid(TQuery))].Updaters[EventId] =
+                [update](const google::protobuf::Message& query, google::protobuf::Message& result, const Metadata& m, MessagePtr evt) {
+                    auto typedEvent = dynamic_cast<const TEvent*>(evt);
+                    return typedEvent && update(static_cast<const TQuery&>(query), static_cast<TResult&>(result), m, *typedEvent);
+                };
+        }
+
+        // Answers from the cache when possible, otherwise sends the query and caches the result.
+        // Unregistered query types always go to the server.
+        template<typename TResult, typename TQuery>
+        TResult Query(const TQuery& query) {
+            std::type_index type(typeid(TQuery));
+            std::string key = QueryKey(query);
+            bool cacheable;
+            uint64_t generation = 0;
+            {
+                std::lock_guard lock(_mtx);
+                auto t = _types.find(type);
+                cacheable = t != _types.end();
+                if (cacheable) {
+                    auto& entries = _index[type];
+                    auto it = entries.find(key);
+                    if (it != entries.end()) {
+                        ++_stats.Hits;
+                        _lru.splice(_lru.begin(), _lru, it->second);
+                        return static_cast<const TResult&>(*it->second->Result);
+                    }
+                    ++_stats.Misses;
+                    generation = t->second.Generation;
+                }
+            }
+            uint64_t position = 0;
+            TResult result = _queryBus->Query<TResult>(query, position);
+            if (!cacheable) return result;
+            std::lock_guard lock(_mtx);
+            // An event on the query's streams arrived while it was in flight: the result may already be stale. Events
+            // that arrive later but are already part of the result are recognized by their position.
+            if (_types.at(type).Generation != generation) return result;
+            auto& entries = _index[type];
+            if (auto it = entries.find(key); it != entries.end()) Erase(it->second);
+            _lru.push_front(Entry{ type, key, make_shared<TQuery>(query), make_shared<TResult>(result), position, 0 });
+            _lru.front().Bytes = SizeOf(_lru.front());
+            _stats.Bytes += _lru.front().Bytes;
+            entries[key] = _lru.begin();
+            EvictOverCapacity();
+            return result;
+        }
+
+        void Clear() {
+            std::lock_guard lock(_mtx);
+            _lru.clear();
+            _index.clear();
+            _stats.Bytes = 0;
+        }
+
+        ClientQueryCacheStats Stats() const {
+            std::lock_guard lock(_mtx);
+            ClientQueryCacheStats stats = _stats;
+            stats.Entries = _lru.size();
+            return stats;
+        }
+    };
+}
@@ -1,7 +1,15 @@
+#pragma once
 
+
+#include <cstdio>
 #include <memory>
 #include <string>
+#include <thread>
 #include <boost/signals2.hpp>
+#include "cppplumberd/executor.hpp"
+#include "cppplumberd/coroutines.hpp"
+#include "cppplumberd/proto_req_rsp_client_handler.hpp"
+#include "cppplumberd/command_policy.hpp"
 using namespace std;
 using namespace std::chrono;
 using namespace boost::signals2;
@@ -10,16 +18,90 @@ namespace cppplumberd {
 	class PlumberCommandBus {
 	public:
 
-		inline PlumberCommandBus(std::unique_ptr<ProtoReqRspClientHandler> clientHandler)
-			: _handler(std::move(clientHandler)) {
+		// Coroutines awaiting SendAsync continue on 'executor' (Executor::Default() when null).
+		inline PlumberCommandBus(std::unique_ptr<ProtoReqRspClientHandler> clientHandler, shared_ptr<Executor> executor = nullptr)
+			: _handler(std::move(clientHandler)), _executor(executor ? executor : Executor::Default()) {
 			if (!_handler) {
 				throw std::invalid_argument("ClientHandler cannot be null");
 			}
 		}
 
+		// Timeout, retries and circuit breaking for every Send and SendAsync on this bus from now on.
+		inline void SetPolicy(const CommandPolicy& policy) {
+			{
+				lock_guard lock(_mtx);
+				_policy = policy;
+			}
+			_handler->SetTimeout(policy.Timeout);
+			_breaker.Configure(policy.CircuitBreaker);
+		}
+
+		// Pass the same NewCommandId() when retrying a command, so a server with dedup enabled runs it only once; with
+		// a retry policy and no id the bus makes one up for all attempts. Timeouts and transport failures are retried
+		// after a backoff, faults are not. Throws CircuitOpenException without sending while the circuit is open.
 		template<typename TCommand>
-		inline void Send(const string &recipient,const TCommand& cmd) {
-			_handler->Send<TCommand>(recipient, cmd);
+		inline void Send(const string &recipient,const TCommand& cmd, const string& commandId = string()) {
+			RetryPolicy retry;
+			{
+				lock_guard lock(_mtx);
+				retry = _policy.Retry;
+			}
+			string id = commandId.empty() && retry.MaxAttempts > 1 ? NewCommandId() : commandId;
+			for (uint32_t attempt = 1;; ++attempt) {
+				if (!_breaker.TryAcquire()) {
+					++_rejected;
+					throw CircuitOpenException("The circuit to the command server is open");
+				}
+				++_attempts;
+				try {
+					_handler->Send<TCommand>(recipient, cmd, id);
+					_breaker.OnSuccess();
+					return;
+				}
+				catch (const FaultException&) {
+					_breaker.OnSuccess();
+					throw;
+				}
+				catch (const TransportException& ex) {
+					if (dynamic_cast<const TimeoutException*>(&ex)) ++_timedOut;
+					++_failed;
+					_breaker.OnFailure();
+					if (attempt >= retry.MaxAttempts) throw;
+				}
+				catch (...) {
+					_breaker.OnFailure();
+					throw;
+				}
+				++_retries;
+				this_thread::sleep_for(retry.Backoff(attempt));
+			}
+		}
+
+		CommandBusStats Stats() const {
+			CommandBusStats stats;
+			stats.Attempts = _attempts;
+			stats.Retries = _retries;
+			stats.TimedOut = _timedOut;
+			stats.Failed = _failed;
+			stats.Rejected = _rejected;
+			stats.Circuit = _breaker.State();
+			return stats;
+		}
+
+		// Random 128-bit id, hex encoded.
+		static string NewCommandId() { return cppplumberd::NewCommandId(); }
+
+		// co_await bus.SendAsync(recipient, cmd): the request goes out on the bus's own I/O thread, one at a time like
+		// Send, and the coroutine continues on the executor once the response is in; faults are rethrown there.
+		// Waiting for a reply and retry backoffs block that thread only, never an executor worker; it starts with the
+		// first SendAsync.
+		template<typename TCommand>
+		Task<void> SendAsync(string recipient, TCommand cmd, string commandId = string()) {
+			TraceContext trace = Tracer::Current();
+			co_await Offload(IoStrand(), [this, &recipient, &cmd, &commandId, &trace]() {
+				TraceScope scope(trace);
+				Send<TCommand>(recipient, cmd, commandId);
+			}, _executor);
 		}
 
 		template<typename TMessage, unsigned int MessageId>
@@ -41,7 +123,28 @@ namespace cppplumberd {
 		}
 
 	private:
+		shared_ptr<Strand> IoStrand() {
+			lock_guard lock(_mtx);
+			if (!_io) {
+				ExecutorOptions options;
+				options.Threads = 1;
+				options.Name = "plumberd-cmd";
+				_io = make_shared<Strand>(make_shared<Executor>(options));
+			}
+			return _io;
+		}
+
 		std::unique_ptr<ProtoReqRspClientHandler> _handler;
+		shared_ptr<Executor> _executor;
+		shared_ptr<Strand> _io;
+		mutable std::mutex _mtx;
+		CommandPolicy _policy;
+		CircuitBreaker _breaker;
+		atomic<uint64_t> _attempts = 0;
+		atomic<uint64_t> _retries = 0;
+		atomic<uint64_t> _timedOut = 0;
+		atomic<uint64_t> _failed = 0;
+		atomic<uint64_t> _rejected = 0;
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cppplumberd {
+
+    struct CommandDedupOptions {
+        size_t Capacity = 64 * 1024;                            // command ids remembered; the oldest go first
+        std::chrono::milliseconds Ttl = std::chrono::minutes(5); // how long a retry still gets the first response
+    };
+
+    struct CommandDedupStats {
+        uint64_t Hits = 0;          // duplicates answered from the cache
+        uint64_t Stored = 0;
+        uint64_t Evicted = 0;       // dropped for capacity before their TTL
+        uint64_t Expired = 0;
+        size_t Entries = 0;
+        size_t Bytes = 0;           // response bytes held
+    };
+
+    // Serialized responses by command id, for a bounded time and count, so a retried command is answered with the
+    // response of its first execution instead of running its handler again. All entries share one TTL, so insertion
+    // order is expiry order and both limits are enforced from the front of one list.
+    class CommandDedupCache {
+        struct Entry {
+            std::string Id;
+            std::chrono::steady_clock::time_point Expires;
+            std::string Response;
+        };
+
+        CommandDedupOptions _options;
+        mutable std::mutex _mtx;
+        std::list<Entry> _entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+        CommandDedupStats _stats;
+
+        void Trim(std::chrono::steady_clock::time_point now) {
+            while (!_entries.empty()) {
+                auto& oldest = _entries.front();
+                if (oldest.Expires <= now) ++_stats.Expired;
+                else if (_entries.size() > _options.Capacity) ++_stats.Evicted;
+                else break;
+                _stats.Bytes -= oldest.Response.size();
+                _index.erase(oldest.Id);
+                _entries.pop_front();
+            }
+        }
+
+    public:
+        explicit CommandDedupCache(const CommandDedupOptions& options = {}) : _options(options) {}
+
+        // The response stored for 'commandId', if it has not expired.
+        bool Find(const std::string& commandId, std::string& response) {
+            std::lock_guard lock(_mtx);
+            Trim(std::chrono::steady_clock::now());
+            auto it = _index.find(commandId);
+            if (it == _index.end()) return false;
+            response = it->second->Response;
+            ++_stats.Hits;
+            return true;
+        }
+
+        // Keeps the first response stored for an id.
+        void Put(const std::string& commandId, const uint8_t* response, size_t size) {
+            if (_options.Capacity == 0) return;
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard lock(_mtx);
+            if (_index.contains(commandId)) return;
+            _entries.push_back(Entry{ commandId, now + _options.Ttl, std::string(reinterpret_cast<const char*>(response), size) });
+            _index.emplace(commandId, std::prev(_entries.end()));
+            _stats.Bytes += size;
+            ++_stats.Stored;
+            Trim(now);
+        }
+
+        CommandDedupStats Stats() const {
+            std::lock_guard lock(_mtx);
+            CommandDedupStats stats = _stats;
+            stats.Entries = _entries.size();
+            return stats;
+        }
+    };
+}
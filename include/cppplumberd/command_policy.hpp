@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "cppplumberd/tracing.hpp"
+
+namespace cppplumberd {
+
+    // Backoff before retry n (1-based): InitialBackoff * Multiplier^(n-1), capped at MaxBackoff, of which a random
+    // fraction of up to Jitter is taken off so clients that failed together do not retry together.
+    struct RetryPolicy {
+        uint32_t MaxAttempts = 1;       // 1: no retries
+        std::chrono::milliseconds InitialBackoff = std::chrono::milliseconds(50);
+        std::chrono::milliseconds MaxBackoff = std::chrono::seconds(2);
+        double Multiplier = 2.0;
+        double Jitter = 0.5;            // 0..1
+
+        std::chrono::milliseconds Backoff(uint32_t retry) const {
+            static thread_local std::mt19937_64 rng{ std::random_device{}() };
+            double backoff = static_cast<double>(InitialBackoff.count()) * std::pow(Multiplier, retry > 0 ? retry - 1 : 0);
+            backoff = std::min(backoff, static_cast<double>(MaxBackoff.count()));
+            double jitter = std::clamp(Jitter, 0.0, 1.0);
+            backoff *= 1.0 - jitter * std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            return std::chrono::milliseconds(static_cast<int64_t>(backoff));
+        }
+    };
+
+    // Random 128-bit command id, hex encoded.
+    inline std::string NewCommandId() {
+        char id[33];
+        snprintf(id, sizeof(id), "%016llx%016llx", static_cast<unsigned long long>(TraceContext::NewId()),
+            static_cast<unsigned long long>(TraceContext::NewId()));
+        return id;
+    }
+
+    struct CircuitBreakerOptions {
+        uint32_t FailureThreshold = 0;  // consecutive transport failures that open the circuit; 0: never opens
+        std::chrono::milliseconds OpenFor = std::chrono::seconds(5);    // then one trial command is let through
+    };
+
+    struct CommandPolicy {
+        std::chrono::milliseconds Timeout = std::chrono::milliseconds(0);   // per attempt; zero: wait forever
+        RetryPolicy Retry;
+        CircuitBreakerOptions CircuitBreaker;
+    };
+
+    enum class CircuitState { CLOSED, OPEN, HALF_OPEN };
+
+    // Thrown without sending while the circuit is open.
+    class CircuitOpenException : public std::runtime_error {
+    public:
+        explicit CircuitOpenException(const std::string& message) : std::runtime_error(message) {}
+    };
+
+    struct CommandBusStats {
+        uint64_t Attempts = 0;
+        uint64_t Retries = 0;
+        uint64_t TimedOut = 0;
+        uint64_t Failed = 0;            // transport failures, timeouts included
+        uint64_t Rejected = 0;          // by the open circuit
+        CircuitState Circuit = CircuitState::CLOSED;
+    };
+
+    // Closed: commands go out and consecutive transport failures are counted. FailureThreshold of them open the
+    // circuit: commands are rejected for OpenFor, then a single trial goes out (half open). The trial's success closes
+    // the circuit, its failure opens it again. A fault is a success here: the server is up and answered.
+    class CircuitBreaker {
+        mutable std::mutex _mtx;
+        CircuitBreakerOptions _options;
+        CircuitState _state = CircuitState::CLOSED;
+        uint32_t _failures = 0;
+        std::chrono::steady_clock::time_point _openedAt;
+
+    public:
+        void Configure(const CircuitBreakerOptions& options) {
+            std::lock_guard lock(_mtx);
+            _options = options;
+            _state = CircuitState::CLOSED;
+            _failures = 0;
+        }
+
+        // False when the command must not go out.
+        bool TryAcquire() {
+            std::lock_guard lock(_mtx);
+            switch (_state) {
+            case CircuitState::CLOSED:
+                return true;
+            case CircuitState::OPEN:
+                if (std::chrono::steady_clock::now() - _openedAt < _options.OpenFor) return false;
+                _state = CircuitState::HALF_OPEN;
+                return true;
+            default:
+                return false;   // the trial is still out
+            }
+        }
+
+        void OnSuccess() {
+            std::lock_guard lock(_mtx);
+            _state = CircuitState::CLOSED;
+            _failures = 0;
+        }
+
+        void OnFailure() {
+            std::lock_guard lock(_mtx);
+            ++_failures;
+            if (_state == CircuitState::HALF_OPEN ||
+                (_options.FailureThreshold > 0 && _failures >= _options.FailureThreshold)) {
+                _state = CircuitState::OPEN;
+                _openedAt = std::chrono::steady_clock::now();
+            }
+        }
+
+        CircuitState State() const {
+            std::lock_guard lock(_mtx);
+            return _state;
+        }
+    };
+}
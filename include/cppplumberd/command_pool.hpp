@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "cppplumberd/transport_interfaces.hpp"
+#include "cppplumberd/message_serializer.hpp"
+#include "cppplumberd/fault_exception.hpp"
+#include "cppplumberd/proto_req_rsp_client_handler.hpp"
+#include "cppplumberd/command_policy.hpp"
+#include "cppplumberd/contract.h"
+
+namespace cppplumberd {
+
+    // How a command type picks its server.
+    enum class Routing {
+        BY_RECIPIENT,       // consistent hashing of CommandHeader::recipient: one recipient, one server
+        LEAST_OUTSTANDING   // the healthy server with the fewest requests in flight; for stateless commands
+    };
+
+    struct CommandPoolEndpoint {
+        std::shared_ptr<ISocketFactory> Factory;
+        std::string Endpoint = "commands";
+        std::string Name;   // hashed onto the ring; must be the same on every client and unique in the pool (default: Endpoint)
+    };
+
+    struct CommandPoolOptions {
+        size_t ConnectionsPerServer = 4;    // REQ sockets per server; a Send waits while all of them are busy
+        size_t VirtualNodes = 64;           // ring points per server
+        std::chrono::milliseconds Timeout = std::chrono::seconds(5);    // per attempt
+        RetryPolicy Retry;                  // a retry goes to the next healthy server
+        uint32_t FailuresToEject = 1;       // consecutive transport failures that take a server out of rotation
+        std::chrono::milliseconds HealthCheckInterval = std::chrono::seconds(1);   // zero: no health checks, no ejection
+        std::chrono::milliseconds HealthCheckTimeout = std::chrono::milliseconds(500);
+    };
+
+    struct CommandPoolServerStats {
+        std::string Name;
+        bool Healthy = true;
+        uint32_t Outstanding = 0;
+        uint64_t Sent = 0;
+        uint64_t Failed = 0;        // transport failures
+        size_t Connections = 0;
+    };
+
+    struct CommandPoolStats {
+        std::vector<CommandPoolServerStats> Servers;
+        uint64_t Rebalances = 0;    // servers taken out of or put back into rotation
+    };
+
+    // Consistent hash ring: every node owns VirtualNodes points and a key belongs to the first node clockwise from its
+    // hash that the caller accepts. Taking a node out moves only its keys, each to the node after it on the ring.
+    class HashRing {
+        std::vector<std::pair<uint64_t, size_t>> _points;
+        size_t _nodes = 0;
+
+    public:
+        // FNV-1a with a 64-bit finalizer; stable across processes and platforms, unlike std::hash.
+        static uint64_t Hash(const std::string& key) {
+            uint64_t h = 14695981039346656037ull;
+            for (unsigned char c : key) {
+                h ^= c;
+                h *= 1099511628211ull;
+            }
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 33;
+            return h;
+        }
+
+        // Returns the index of the node.
+        size_t Add(const std::string& name, size_t virtualNodes) {
+            size_t node = _nodes++;
+            for (size_t v = 0; v < std::max<size_t>(virtualNodes, 1); ++v)
+                _points.emplace_back(Hash(name + "#" + std::to_string(v)), node);
+            std::sort(_points.begin(), _points.end());
+            return node;
+        }
+
+        size_t Nodes() const { return _nodes; }
+
+        // First node clockwise from the key's hash for which accept(node) holds; SIZE_MAX when there is none.
+        template<typename TAccept>
+        size_t Find(const std::string& key, TAccept&& accept) const {
+            if (_points.empty()) return SIZE_MAX;
+            size_t start = std::lower_bound(_points.begin(), _points.end(), std::make_pair(Hash(key), size_t(0))) - _points.begin();
+            for (size_t i = 0; i < _points.size(); ++i) {
+                size_t node = _points[(start + i) % _points.size()].second;
+                if (accept(node)) return node;
+            }
+            return SIZE_MAX;
+        }
+    };
+
+    // Command bus over a set of Plumber servers, on one host or many. Each server gets a pool of REQ sockets, so
+    // concurrent commands do not queue behind one socket. Command types registered with Routing::BY_RECIPIENT go to
+    // the server that owns the recipient on a hash ring; Routing::LEAST_OUTSTANDING ones go to the least busy server.
+    // A server is taken out of rotation after FailuresToEject transport failures in a row, or when a health check
+    // (a Ping) fails, and put back once a health check succeeds; its recipients move to the next servers on the ring
+    // meanwhile and come back with it. Command dedup is per server: a retry that lands on another server runs again.
+    class PlumberCommandPool {
+        struct Server {
+            CommandPoolEndpoint Address;
+            std::mutex Mtx;
+            std::condition_variable Free;
+            std::vector<std::unique_ptr<ProtoReqRspClientHandler>> Idle;
+            size_t Connections = 0;
+            std::unique_ptr<ProtoReqRspClientHandler> Probe;
+            std::atomic<bool> Healthy = true;
+            std::atomic<uint32_t> Failures = 0;
+            std::atomic<uint32_t> Outstanding = 0;
+            std::atomic<uint64_t> Sent = 0;
+            std::atomic<uint64_t> Failed = 0;
+        };
+
+        // A connection taken from a server's pool for one request; returned when done.
+        class Lease {
+            Server& _server;
+            std::unique_ptr<ProtoReqRspClientHandler> _connection;
+        public:
+            Lease(Server& server, std::unique_ptr<ProtoReqRspClientHandler> connection)
+                : _server(server), _connection(std::move(connection)) {
+                ++_server.Outstanding;
+            }
+            ~Lease() {
+                --_server.Outstanding;
+                {
+                    std::lock_guard lock(_server.Mtx);
+                    _server.Idle.push_back(std::move(_connection));
+                }
+                _server.Free.notify_one();
+            }
+            ProtoReqRspClientHandler* operator->() const { return _connection.get(); }
+        };
+
+        CommandPoolOptions _options;
+        std::shared_ptr<MessageSerializer> _serializer = std::make_shared<MessageSerializer>();
+        std::vector<std::function<void(ProtoReqRspClientHandler&)>> _registrations;
+        std::unordered_map<unsigned int, Routing> _routing;
+        std::vector<std::unique_ptr<Server>> _servers;
+        HashRing _ring;
+        std::atomic<size_t> _next = 0;
+        std::atomic<uint64_t> _rebalances = 0;
+        std::mutex _healthMtx;
+        std::condition_variable _healthWake;
+        bool _stopping = false;
+        std::thread _healthThread;
+
+        std::unique_ptr<ProtoReqRspClientHandler> Connect(Server& server, std::chrono::milliseconds timeout) {
+            auto connection = std::make_unique<ProtoReqRspClientHandler>(
+                server.Address.Factory->CreateReqRspClientSocket(server.Address.Endpoint), _serializer);
+            for (auto& registration : _registrations) registration(*connection);
+            connection->SetTimeout(timeout);
+            try {
+                connection->Start();
+            }
+            catch (const TransportException&) {
+                throw;
+            }
+            catch (const std::exception& ex) {
+                throw TransportException("Cannot connect to " + server.Address.Name + ": " + ex.what());
+            }
+            return connection;
+        }
+
+        Lease Acquire(Server& server) {
+            std::unique_lock lock(server.Mtx);
+            server.Free.wait(lock, [this, &server]() {
+                return !server.Idle.empty() || server.Connections < _options.ConnectionsPerServer;
+            });
+            if (!server.Idle.empty()) {
+                auto connection = std::move(server.Idle.back());
+                server.Idle.pop_back();
+                return Lease(server, std::move(connection));
+            }
+            ++server.Connections;
+            lock.unlock();
+            try {
+                return Lease(server, Connect(server, _options.Timeout));
+            }
+            catch (...) {
+                lock.lock();
+                --server.Connections;
+                server.Free.notify_one();
+                throw;
+            }
+        }
+
+        void SetHealthy(Server& server, bool healthy) {
+            server.Failures = 0;
+            if (server.Healthy.exchange(healthy) != healthy) ++_rebalances;
+        }
+
+        size_t Pick(Routing routing, const std::string& recipient) {
+            auto healthy = [this](size_t i) { return _servers[i]->Healthy.load(); };
+            if (routing == Routing::BY_RECIPIENT) return _ring.Find(recipient, healthy);
+            size_t best = SIZE_MAX;
+            uint32_t fewest = UINT32_MAX;
+            size_t start = _next++;
+            for (size_t n = 0; n < _servers.size(); ++n) {
+                size_t i = (start + n) % _servers.size();
+                if (!healthy(i)) continue;
+                uint32_t outstanding = _servers[i]->Outstanding;
+                if (outstanding < fewest) {
+                    fewest = outstanding;
+                    best = i;
+                }
+            }
+            return best;
+        }
+
+        bool IsAlive(Server& server) {
+            try {
+                if (!server.Probe) server.Probe = Connect(server, _options.HealthCheckTimeout);
+                cppplumberd::Ping ping;
+                ping.set_timestamp(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count()));
+                server.Probe->Send<cppplumberd::Ping>("$", ping);
+                return true;
+            }
+            catch (const FaultException&) {
+                return true;    // it answered
+            }
+            catch (const std::exception&) {
+                return false;
+            }
+        }
+
+        void CheckHealth() {
+            std::unique_lock lock(_healthMtx);
+            while (!_healthWake.wait_for(lock, _options.HealthCheckInterval, [this]() { return _stopping; })) {
+                lock.unlock();
+                for (auto& server : _servers) SetHealthy(*server, IsAlive(*server));
+                lock.lock();
+            }
+        }
+
+    public:
+        PlumberCommandPool(const std::vector<CommandPoolEndpoint>& endpoints, const CommandPoolOptions& options = {})
+            : _options(options) {
+            if (endpoints.empty()) throw std::invalid_argument("A command pool needs at least one server");
+            if (_options.ConnectionsPerServer == 0) _options.ConnectionsPerServer = 1;
+            for (const auto& endpoint : endpoints) {
+                if (!endpoint.Factory) throw std::invalid_argument("Socket factory cannot be null");
+                auto server = std::make_unique<Server>();
+                server->Address = endpoint;
+                if (server->Address.Name.empty()) server->Address.Name = endpoint.Endpoint;
+                for (const auto& other : _servers)
+                    if (other->Address.Name == server->Address.Name)
+                        throw std::invalid_argument("Duplicate server name in command pool: " + server->Address.Name);
+                _ring.Add(server->Address.Name, _options.VirtualNodes);
+                _servers.push_back(std::move(server));
+            }
+            _serializer->RegisterMessage<cppplumberd::Ping, COMMANDS::PING>();
+        }
+        PlumberCommandPool(const PlumberCommandPool&) = delete;
+        PlumberCommandPool& operator=(const PlumberCommandPool&) = delete;
+
+        ~PlumberCommandPool() {
+            Stop();
+        }
+
+        // Register before Start; 'routing' applies to every command of this type.
+        template<typename TMessage, unsigned int MessageId>
+        void RegisterMessage(Routing routing = Routing::BY_RECIPIENT) {
+            _serializer->RegisterMessage<TMessage, MessageId>();
+            _routing[MessageId] = routing;
+        }
+
+        template<typename TError, unsigned int MessageId>
+        void RegisterError() {
+            _registrations.push_back([](ProtoReqRspClientHandler& handler) { handler.RegisterError<TError, MessageId>(); });
+        }
+
+        // Connections are opened on first use; this starts the health checks.
+        void Start() {
+            if (_healthThread.joinable() || _options.HealthCheckInterval.count() <= 0) return;
+            _healthThread = std::thread([this]() { CheckHealth(); });
+        }
+
+        void Stop() {
+            {
+                std::lock_guard lock(_healthMtx);
+                _stopping = true;
+            }
+            _healthWake.notify_all();
+            if (_healthThread.joinable()) _healthThread.join();
+        }
+
+        // Throws TransportException when no server is healthy or the last attempt failed; faults are not retried.
+        template<typename TCommand>
+        void Send(const std::string& recipient, const TCommand& cmd, const std::string& commandId = std::string()) {
+            auto it = _routing.find(_serializer->GetMessageId<TCommand>());
+            Routing routing = it == _routing.end() ? Routing::BY_RECIPIENT : it->second;
+            std::string id = commandId.empty() && _options.Retry.MaxAttempts > 1 ? NewCommandId() : commandId;
+            for (uint32_t attempt = 1;; ++attempt) {
+                size_t index = Pick(routing, recipient);
+                if (index == SIZE_MAX) throw TransportException("No healthy command server");
+                Server& server = *_servers[index];
+                try {
+                    auto connection = Acquire(server);
+                    ++server.Sent;
+                    connection->Send<TCommand>(recipient, cmd, id);
+                    server.Failures = 0;
+                    return;
+                }
+                catch (const TransportException&) {
+                    ++server.Failed;
+                    if (_options.HealthCheckInterval.count() > 0 && ++server.Failures >= std::max<uint32_t>(_options.FailuresToEject, 1))
+                        SetHealthy(server, false);
+                    if (attempt >= _options.Retry.MaxAttempts) throw;
+                }
+                std::this_thread::sleep_for(_options.Retry.Backoff(attempt));
+            }
+        }
+
+        CommandPoolStats Stats() const {
+            CommandPoolStats stats;
+            for (const auto& server : _servers) {
+                CommandPoolServerStats s;
+                s.Name = server->Address.Name;
+                s.Healthy = server->Healthy;
+                s.Outstanding = server->Outstanding;
+                s.Sent = server->Sent;
+                s.Failed = server->Failed;
+                {
+                    std::lock_guard lock(server->Mtx);
+                    s.Connections = server->Connections;
+                }
+                stats.Servers.push_back(s);
+            }
+            stats.Rebalances = _rebalances;
+            return stats;
+        }
+    };
+}
@@ -37,6 +37,11 @@ namespace cppplumberd {
             _handler->RegisterError<TException, MessageId>();
         }
 
+        // Queries are served on the same endpoint.
+        inline ProtoReqRspSrvHandler& Handler() {
+            return *_handler;
+        }
+
         inline void Start(const std::string& url) {
             _handler->Start(url);
         }
@@ -49,6 +54,10 @@ namespace cppplumberd {
             _handler->Stop();
         }
 
+        inline void Close() {
+            _handler->Close();
+        }
+
     private:
         std::unique_ptr<ProtoReqRspSrvHandler> _handler;
     };
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    enum class CompressionCodec : uint32_t {
+        NONE = 0,
+        DEFLATE = 1     // raw deflate (RFC 1951), optionally primed with the stream's dictionary
+    };
+
+    // Largest payload a compressed frame or replication batch may claim: what a frame buffer could carry uncompressed.
+    constexpr size_t MAX_INFLATED_SIZE = 64 * 1024;
+
+    struct CompressionOptions {
+        size_t MinSize = 16;                    // smaller payloads are left as they are
+        size_t TrainingSamples = 256;           // payloads collected before the dictionary is trained
+        size_t DictionaryBytes = 2 * 1024;      // 0: none; a larger one costs more time per frame (32 KB at most)
+        size_t DictionaryMaxPayload = 1024;     // larger payloads (batches) are compressed as a block of their own
+        int Level = 6;                          // zlib level, 1 (fast) to 9 (small)
+    };
+
+    // Payload bytes only; frame and record headers are not counted. CpuNs is the time spent in the codec (and in
+    // training) on the threads that ran it.
+    struct StreamCompressionStats {
+        uint64_t Frames = 0;
+        uint64_t Compressed = 0;        // frames that went out compressed; the rest did not get smaller
+        uint64_t RawBytes = 0;
+        uint64_t EncodedBytes = 0;      // as sent or stored
+        uint64_t CpuNs = 0;
+        uint32_t DictionaryId = 0;      // 0 until the dictionary is trained (or received)
+
+        double Ratio() const { return EncodedBytes == 0 ? 1.0 : static_cast<double>(RawBytes) / EncodedBytes; }
+        double NsPerFrame() const { return Frames == 0 ? 0.0 : static_cast<double>(CpuNs) / Frames; }
+    };
+
+    // Never 0, which stands for "no dictionary".
+    inline uint32_t DictionaryId(std::string_view dictionary) {
+        uint32_t crc = static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef*>(dictionary.data()), static_cast<uInt>(dictionary.size())));
+        return crc == 0 ? 1 : crc;
+    }
+
+    // Deflate finds matches in the dictionary as if it preceded the payload, and the nearer the end the cheaper the
+    // match. The dictionary is therefore the distinct samples, least frequent first, cut to the last 'maxBytes'.
+    inline std::string TrainDictionary(const std::vector<std::string>& samples, size_t maxBytes) {
+        std::map<std::string_view, size_t> counts;
+        for (const auto& sample : samples) ++counts[sample];
+        std::vector<std::pair<size_t, std::string_view>> ordered;
+        for (const auto& [sample, count] : counts) ordered.emplace_back(count, sample);
+        std::stable_sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::string dictionary;
+        for (const auto& [count, sample] : ordered) dictionary.append(sample);
+        if (dictionary.size() > maxBytes) dictionary.erase(0, dictionary.size() - maxBytes);
+        return dictionary;
+    }
+
+    // Reusable raw deflate stream; one per thread (or under a lock).
+    class Deflater {
+        z_stream _z{};
+    public:
+        explicit Deflater(int level = Z_DEFAULT_COMPRESSION) {
+            if (deflateInit2(&_z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw std::runtime_error("Cannot initialize deflate");
+        }
+        Deflater(const Deflater&) = delete;
+        Deflater& operator=(const Deflater&) = delete;
+        ~Deflater() { deflateEnd(&_z); }
+
+        // Replaces 'out' with the compressed bytes.
+        void Compress(const void* data, size_t size, std::string_view dictionary, std::string& out) {
+            deflateReset(&_z);
+            if (!dictionary.empty() && deflateSetDictionary(&_z, reinterpret_cast<const Bytef*>(dictionary.data()),
+                static_cast<uInt>(dictionary.size())) != Z_OK)
+                throw std::runtime_error("Cannot set deflate dictionary");
+            out.resize(deflateBound(&_z, static_cast<uLong>(size)));
+            _z.next_in = const_cast<Bytef*>(static_cast<const Bytef*>(data));
+            _z.avail_in = static_cast<uInt>(size);
+            _z.next_out = reinterpret_cast<Bytef*>(out.data());
+            _z.avail_out = static_cast<uInt>(out.size());
+            if (deflate(&_z, Z_FINISH) != Z_STREAM_END) throw std::runtime_error("Deflate failed");
+            out.resize(_z.total_out);
+        }
+    };
+
+    class Inflater {
+        z_stream _z{};
+    public:
+        Inflater() {
+            if (inflateInit2(&_z, -15) != Z_OK) throw std::runtime_error("Cannot initialize inflate");
+        }
+        Inflater(const Inflater&) = delete;
+        Inflater& operator=(const Inflater&) = delete;
+        ~Inflater() { inflateEnd(&_z); }
+
+        // Replaces 'out' with the 'rawSize' bytes 'data' was compressed from. 'rawSize' comes from the sender, so it
+        // is checked before anything is allocated: against 'maxRawSize' and against deflate's best ratio (1032:1).
+        void Decompress(const void* data, size_t size, size_t rawSize, std::string_view dictionary, std::string& out,
+            size_t maxRawSize = MAX_INFLATED_SIZE) {
+            if (rawSize > maxRawSize || rawSize > size * 1032 + 64)
+                throw std::runtime_error("Compressed payload of " + std::to_string(size) + " bytes claims "
+                    + std::to_string(rawSize) + " bytes (at most " + std::to_string(maxRawSize) + ")");
+            inflateReset(&_z);
+            if (!dictionary.empty() && inflateSetDictionary(&_z, reinterpret_cast<const Bytef*>(dictionary.data()),
+                static_cast<uInt>(dictionary.size())) != Z_OK)
+                throw std::runtime_error("Cannot set inflate dictionary");
+            out.resize(rawSize);
+            _z.next_in = const_cast<Bytef*>(static_cast<const Bytef*>(data));
+            _z.avail_in = static_cast<uInt>(size);
+            _z.next_out = reinterpret_cast<Bytef*>(out.data());
+            _z.avail_out = static_cast<uInt>(out.size());
+            if (inflate(&_z, Z_FINISH) != Z_STREAM_END || _z.total_out != rawSize)
+                throw std::runtime_error("Corrupt compressed payload");
+        }
+    };
+
+    inline std::string Deflate(const void* data, size_t size, std::string_view dictionary = {}, int level = Z_DEFAULT_COMPRESSION) {
+        std::string out;
+        Deflater(level).Compress(data, size, dictionary, out);
+        return out;
+    }
+
+    inline std::string Inflate(const void* data, size_t size, size_t rawSize, std::string_view dictionary = {},
+        size_t maxRawSize = MAX_INFLATED_SIZE) {
+        std::string out;
+        Inflater().Decompress(data, size, rawSize, dictionary, out, maxRawSize);
+        return out;
+    }
+
+    struct CompressedPayload {
+        CompressionCodec Codec = CompressionCodec::NONE;
+        uint32_t DictionaryId = 0;
+    };
+
+    // Compression state of one stream, shared by everything that encodes it: the first TrainingSamples small payloads
+    // train the stream's dictionary (they are compressed without one meanwhile), and from then on small payloads are
+    // compressed with it. Payloads above DictionaryMaxPayload are compressed on their own. Thread-safe; the stream's
+    // encoders take turns.
+    class StreamCompressor {
+        mutable std::mutex _mtx;
+        CompressionOptions _options;
+        Deflater _deflater;
+        std::vector<std::string> _samples;
+        std::string _dictionary;
+        uint32_t _dictionaryId = 0;
+        StreamCompressionStats _stats;
+
+        void Train() {
+            _dictionary = TrainDictionary(_samples, std::min<size_t>(_options.DictionaryBytes, 32 * 1024));
+            _dictionaryId = _dictionary.empty() ? 0 : cppplumberd::DictionaryId(_dictionary);
+            _samples.clear();
+            _samples.shrink_to_fit();
+        }
+
+    public:
+        explicit StreamCompressor(const CompressionOptions& options = CompressionOptions())
+            : _options(options), _deflater(options.Level) {}
+
+        // Replaces 'out' with the compressed payload unless the result says NONE (it would not have been smaller).
+        CompressedPayload Compress(const void* data, size_t size, std::string& out) {
+            std::lock_guard lock(_mtx);
+            auto started = std::chrono::steady_clock::now();
+            CompressedPayload result;
+            bool small = size <= _options.DictionaryMaxPayload;
+            if (small && _dictionaryId == 0 && _options.DictionaryBytes > 0 && _samples.size() < _options.TrainingSamples) {
+                _samples.emplace_back(static_cast<const char*>(data), size);
+                if (_samples.size() == _options.TrainingSamples) Train();
+            }
+            if (size >= _options.MinSize) {
+                std::string_view dictionary = small ? std::string_view(_dictionary) : std::string_view();
+                _deflater.Compress(data, size, dictionary, out);
+                if (out.size() < size) {
+                    result.Codec = CompressionCodec::DEFLATE;
+                    result.DictionaryId = dictionary.empty() ? 0 : _dictionaryId;
+                }
+            }
+            ++_stats.Frames;
+            _stats.RawBytes += size;
+            if (result.Codec == CompressionCodec::NONE) _stats.EncodedBytes += size;
+            else {
+                ++_stats.Compressed;
+                _stats.EncodedBytes += out.size();
+            }
+            _stats.CpuNs += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - started).count());
+            return result;
+        }
+
+        // Uses a dictionary trained earlier (e.g. found in a reopened log) instead of training a new one.
+        void Adopt(const std::string& dictionary) {
+            std::lock_guard lock(_mtx);
+            _dictionary = dictionary;
+            _dictionaryId = dictionary.empty() ? 0 : cppplumberd::DictionaryId(dictionary);
+            _samples.clear();
+        }
+
+        // The dictionary with that id; empty when 'id' is not this stream's.
+        std::string Dictionary(uint32_t id) const {
+            std::lock_guard lock(_mtx);
+            return id != 0 && id == _dictionaryId ? _dictionary : std::string();
+        }
+        std::string Dictionary() const {
+            std::lock_guard lock(_mtx);
+            return _dictionary;
+        }
+
+        StreamCompressionStats Stats() const {
+            std::lock_guard lock(_mtx);
+            StreamCompressionStats stats = _stats;
+            stats.DictionaryId = _dictionaryId;
+            return stats;
+        }
+    };
+
+    // Subscriber side: turns the payload of an event frame back into what was serialized. Dictionaries come with the
+    // first frame that uses them; a subscriber that joined later gets them from the resolver (PlumberClient asks the
+    // server on a connection of its own) and keeps them. The resolver runs without the lock held. Stats count
+    // compressed frames only.
+    class FrameDecompressor {
+        mutable std::mutex _mtx;
+        Inflater _inflater;
+        std::unordered_map<uint32_t, std::string> _dictionaries;
+        std::function<std::string(uint32_t)> _resolver;
+        StreamCompressionStats _stats;
+
+    public:
+        void SetResolver(std::function<std::string(uint32_t)> resolver) {
+            std::lock_guard lock(_mtx);
+            _resolver = std::move(resolver);
+        }
+
+        // The payload to deserialize: 'data' itself, or 'out' holding it decompressed.
+        std::string_view Decode(const EventHeader& header, const uint8_t* data, size_t size, std::string& out) {
+            if (header.codec() == static_cast<uint32_t>(CompressionCodec::NONE))
+                return std::string_view(reinterpret_cast<const char*>(data), size);
+            if (header.codec() != static_cast<uint32_t>(CompressionCodec::DEFLATE))
+                throw std::runtime_error("Unsupported compression codec " + std::to_string(header.codec()));
+            std::unique_lock lock(_mtx);
+            uint32_t id = header.dictionary_id();
+            if (!header.dictionary().empty() && !_dictionaries.contains(id)) {
+                if (cppplumberd::DictionaryId(header.dictionary()) != id)
+                    throw std::runtime_error("Compression dictionary does not match its id");
+                _dictionaries[id] = header.dictionary();
+            }
+            if (id != 0 && !_dictionaries.contains(id)) {
+                // Fetching takes a round trip; other frames keep decoding meanwhile.
+                auto resolver = _resolver;
+                lock.unlock();
+                std::string fetched = resolver ? resolver(id) : std::string();
+                if (fetched.empty() || cppplumberd::DictionaryId(fetched) != id)
+                    throw std::runtime_error("Unknown compression dictionary " + std::to_string(id));
+                lock.lock();
+                _dictionaries.try_emplace(id, std::move(fetched));
+            }
+            auto started = std::chrono::steady_clock::now();
+            std::string_view dictionary = id == 0 ? std::string_view() : std::string_view(_dictionaries.at(id));
+            _inflater.Decompress(data, size, header.raw_size(), dictionary, out);
+            ++_stats.Frames;
+            ++_stats.Compressed;
+            _stats.RawBytes += out.size();
+            _stats.EncodedBytes += size;
+            if (id != 0) _stats.DictionaryId = id;
+            _stats.CpuNs += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - started).count());
+            return out;
+        }
+
+        StreamCompressionStats Stats() const {
+            std::lock_guard lock(_mtx);
+            return _stats;
+        }
+    };
+}
@@ -4,6 +4,21 @@ namespace cppplumberd {
 	
 		enum COMMANDS : unsigned int {
 			CREATE_STREAM = 1,
+			GET_LAST_VALUES = 2,
+			LAST_VALUE_SNAPSHOT = 3,
+			PING = 4,
+			GET_ROUTING_TABLE = 5,
+			ROUTING_TABLE = 6,
+			FREEZE_SLOT = 7,
+			EXPORT_SLOT = 8,
+			SLOT_EVENTS = 9,
+			IMPORT_EVENTS = 10,
+			ADOPT_ROUTING_TABLE = 11,
+			REPLICATE_EVENTS = 12,
+			REPLICATION_ACK = 13,
+			GET_COMPRESSION_DICTIONARY = 14,
+			COMPRESSION_DICTIONARY = 15,
+			UNFREEZE_SLOT = 16,
 			
 		};
 		enum EVENTS : unsigned int {
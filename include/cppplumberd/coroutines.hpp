@@ -0,0 +1,447 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "cppplumberd/cqrs_abstractions.hpp"
+#include "cppplumberd/executor.hpp"
+
+namespace cppplumberd {
+
+    template<typename T = void>
+    class Task;
+
+    struct TaskPromiseBase {
+        std::coroutine_handle<> Continuation = std::noop_coroutine();
+        std::exception_ptr Error;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            template<typename TPromise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> h) noexcept { return h.promise().Continuation; }
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { Error = std::current_exception(); }
+    };
+
+    template<typename T>
+    struct TaskPromise : TaskPromiseBase {
+        std::optional<T> Value;
+        Task<T> get_return_object();
+        template<typename U>
+        void return_value(U&& value) { Value.emplace(std::forward<U>(value)); }
+        T Result() {
+            if (this->Error) std::rethrow_exception(this->Error);
+            return std::move(*Value);
+        }
+    };
+
+    template<>
+    struct TaskPromise<void> : TaskPromiseBase {
+        Task<void> get_return_object();
+        void return_void() {}
+        void Result() {
+            if (Error) std::rethrow_exception(Error);
+        }
+    };
+
+    // Lazily started coroutine: runs when awaited, and resumes the awaiting coroutine on whatever thread it finishes.
+    // Exceptions reach the awaiter. Start one from plain code with Spawn().
+    template<typename T>
+    class Task {
+    public:
+        typedef TaskPromise<T> promise_type;
+
+    private:
+        std::coroutine_handle<promise_type> _handle;
+
+    public:
+        explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+        Task(Task&& other) noexcept : _handle(std::exchange(other._handle, {})) {}
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (_handle) _handle.destroy();
+                _handle = std::exchange(other._handle, {});
+            }
+            return *this;
+        }
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        ~Task() {
+            if (_handle) _handle.destroy();
+        }
+
+        auto operator co_await() && noexcept {
+            struct Awaiter {
+                std::coroutine_handle<promise_type> Handle;
+                bool await_ready() noexcept { return Handle.done(); }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                    Handle.promise().Continuation = awaiting;
+                    return Handle;
+                }
+                T await_resume() { return Handle.promise().Result(); }
+            };
+            return Awaiter{ _handle };
+        }
+    };
+
+    template<typename T>
+    Task<T> TaskPromise<T>::get_return_object() {
+        return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+    }
+    inline Task<void> TaskPromise<void>::get_return_object() {
+        return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+    }
+
+    // Continues the awaiting coroutine on one of the executor's threads (right away when already on one).
+    inline auto ResumeOn(std::shared_ptr<Executor> executor) {
+        struct Awaiter {
+            std::shared_ptr<Executor> Target;
+            bool await_ready() const noexcept { return Target->RunningInThisThread(); }
+            void await_suspend(std::coroutine_handle<> h) { Target->Post([h]() { h.resume(); }); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{ executor ? std::move(executor) : Executor::Default() };
+    }
+
+    // Runs a blocking call on 'strand' (one at a time, in order, next to the other calls posted to it) and continues
+    // the awaiting coroutine on 'resumeOn' (the strand's executor when null) once it returned; its result or exception
+    // reaches the awaiter.
+    template<typename TFunc>
+    auto Offload(std::shared_ptr<Strand> strand, TFunc fn, std::shared_ptr<Executor> resumeOn = nullptr) {
+        typedef std::invoke_result_t<TFunc&> Result;
+        struct Awaiter {
+            std::shared_ptr<Strand> Target;
+            std::shared_ptr<Executor> ResumeOn;
+            TFunc Fn;
+            std::conditional_t<std::is_void_v<Result>, bool, std::optional<Result>> Value{};
+            std::exception_ptr Error;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                Target->Post([this, h]() {
+                    try {
+                        if constexpr (std::is_void_v<Result>) Fn();
+                        else Value.emplace(Fn());
+                    }
+                    catch (...) {
+                        Error = std::current_exception();
+                    }
+                    // Not on the strand itself, so the next blocking call can start while this coroutine goes on.
+                    ResumeOn->Post([h]() { h.resume(); });
+                });
+            }
+            Result await_resume() {
+                if (Error) std::rethrow_exception(Error);
+                if constexpr (!std::is_void_v<Result>) return std::move(*Value);
+            }
+        };
+        auto target = resumeOn ? std::move(resumeOn) : strand->GetExecutor();
+        return Awaiter{ std::move(strand), std::move(target), std::move(fn), {}, nullptr };
+    }
+
+    // Coroutine that starts right away and owns its own frame; used to hand a Task to an executor.
+    struct DetachedCoroutine {
+        struct promise_type {
+            DetachedCoroutine get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    // Runs 'task' on 'executor' (Executor::Default() when null); the future holds its result or exception.
+    template<typename T>
+    std::future<T> Spawn(std::shared_ptr<Executor> executor, Task<T> task) {
+        std::promise<T> promise;
+        auto future = promise.get_future();
+        [](std::shared_ptr<Executor> executor, Task<T> task, std::promise<T> promise) -> DetachedCoroutine {
+            co_await ResumeOn(std::move(executor));
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    co_await std::move(task);
+                    promise.set_value();
+                }
+                else promise.set_value(co_await std::move(task));
+            }
+            catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }(std::move(executor), std::move(task), std::move(promise));
+        return future;
+    }
+
+    // Coroutine that produces a sequence with co_yield and may co_await in between. The consumer pulls one value at a
+    // time with co_await Next(), which returns nullopt once the generator has returned; exceptions reach the consumer.
+    // The generator runs on whatever thread resumed it last.
+    template<typename T>
+    class AsyncGenerator {
+    public:
+        struct promise_type {
+            std::optional<T> Value;
+            std::exception_ptr Error;
+            std::coroutine_handle<> Consumer = std::noop_coroutine();
+
+            struct YieldAwaiter {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept { return h.promise().Consumer; }
+                void await_resume() noexcept {}
+            };
+
+            AsyncGenerator get_return_object() { return AsyncGenerator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            YieldAwaiter final_suspend() noexcept { return {}; }
+            template<typename U>
+            YieldAwaiter yield_value(U&& value) {
+                Value.emplace(std::forward<U>(value));
+                return {};
+            }
+            void return_void() {}
+            void unhandled_exception() { Error = std::current_exception(); }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> _handle;
+
+    public:
+        explicit AsyncGenerator(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+        AsyncGenerator(AsyncGenerator&& other) noexcept : _handle(std::exchange(other._handle, {})) {}
+        AsyncGenerator(const AsyncGenerator&) = delete;
+        AsyncGenerator& operator=(const AsyncGenerator&) = delete;
+        ~AsyncGenerator() {
+            if (_handle) _handle.destroy();
+        }
+
+        auto Next() {
+            struct Awaiter {
+                std::coroutine_handle<promise_type> Handle;
+                bool await_ready() noexcept { return Handle.done(); }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+                    Handle.promise().Consumer = consumer;
+                    Handle.promise().Value.reset();
+                    return Handle;
+                }
+                std::optional<T> await_resume() {
+                    auto& promise = Handle.promise();
+                    if (promise.Error) std::rethrow_exception(std::exchange(promise.Error, nullptr));
+                    if (Handle.done()) return std::nullopt;
+                    return std::move(promise.Value);
+                }
+            };
+            return Awaiter{ _handle };
+        }
+    };
+
+    // Unbounded queue between plain producers and one awaiting coroutine, which is resumed on 'executor'.
+    template<typename T>
+    class AwaitableQueue {
+        std::shared_ptr<Executor> _executor;
+        std::mutex _mtx;
+        std::deque<T> _items;
+        std::coroutine_handle<> _waiter;
+        bool _closed = false;
+
+        void Wake(std::coroutine_handle<> waiter) {
+            if (waiter) _executor->Post([waiter]() { waiter.resume(); });
+        }
+
+    public:
+        explicit AwaitableQueue(std::shared_ptr<Executor> executor = nullptr)
+            : _executor(executor ? std::move(executor) : Executor::Default()) {
+        }
+
+        void Push(T item) {
+            std::coroutine_handle<> waiter;
+            {
+                std::lock_guard lock(_mtx);
+                if (_closed) return;
+                _items.push_back(std::move(item));
+                waiter = std::exchange(_waiter, {});
+            }
+            Wake(waiter);
+        }
+
+        // Next() returns what is queued, then nullopt.
+        void Close() {
+            std::coroutine_handle<> waiter;
+            {
+                std::lock_guard lock(_mtx);
+                _closed = true;
+                waiter = std::exchange(_waiter, {});
+            }
+            Wake(waiter);
+        }
+
+        auto Next() {
+            struct Awaiter {
+                AwaitableQueue& Queue;
+                bool await_ready() noexcept { return false; }
+                bool await_suspend(std::coroutine_handle<> h) {
+                    std::lock_guard lock(Queue._mtx);
+                    if (!Queue._items.empty() || Queue._closed) return false;
+                    Queue._waiter = h;
+                    return true;
+                }
+                std::optional<T> await_resume() {
+                    std::lock_guard lock(Queue._mtx);
+                    if (Queue._items.empty()) return std::nullopt;
+                    std::optional<T> item(std::move(Queue._items.front()));
+                    Queue._items.pop_front();
+                    return item;
+                }
+            };
+            return Awaiter{ *this };
+        }
+
+        // Closes the queue without resuming the waiting coroutine, which is being destroyed.
+        void Cancel() {
+            std::lock_guard lock(_mtx);
+            _closed = true;
+            _waiter = {};
+            _items.clear();
+        }
+
+        size_t Size() {
+            std::lock_guard lock(_mtx);
+            return _items.size();
+        }
+    };
+
+    template<typename TEvent>
+    struct StreamEvent {
+        Metadata Meta;
+        TEvent Event;
+    };
+
+    // Forwards the events of type TEvent into a queue; other event types of the stream are skipped.
+    template<typename TEvent>
+    class QueueingEventDispatcher : public IEventDispatcher {
+        std::shared_ptr<AwaitableQueue<StreamEvent<TEvent>>> _queue;
+    public:
+        explicit QueueingEventDispatcher(std::shared_ptr<AwaitableQueue<StreamEvent<TEvent>>> queue) : _queue(std::move(queue)) {}
+        void Handle(const Metadata& metadata, unsigned int, MessagePtr msg) override {
+            if (auto evt = dynamic_cast<const TEvent*>(msg)) _queue->Push(StreamEvent<TEvent>{ metadata, *evt });
+        }
+    };
+
+    template<typename TEvent>
+    struct EventFeed {
+        std::shared_ptr<AwaitableQueue<StreamEvent<TEvent>>> Queue;
+        std::unique_ptr<ISubscription> Subscription;
+
+        EventFeed(std::shared_ptr<AwaitableQueue<StreamEvent<TEvent>>> queue, std::unique_ptr<ISubscription> subscription)
+            : Queue(std::move(queue)), Subscription(std::move(subscription)) {
+        }
+        EventFeed(EventFeed&&) = default;
+        ~EventFeed() {
+            if (Subscription) Subscription->Unsubscribe();
+            if (Queue) Queue->Cancel();
+        }
+    };
+
+    template<typename TEvent>
+    AsyncGenerator<StreamEvent<TEvent>> DrainEventFeed(EventFeed<TEvent> feed) {
+        while (auto e = co_await feed.Queue->Next()) co_yield std::move(*e);
+    }
+
+    // Subscribes right away, so nothing published after the call is missed, and yields the stream's TEvent events in
+    // order, resuming the consumer on 'executor' (Executor::Default() when null). Destroying the generator
+    // unsubscribes. 'subscriptions' is an ISubscriptionManager or an EventStore.
+    template<typename TEvent, typename TSubscriptions>
+    AsyncGenerator<StreamEvent<TEvent>> SubscribeEvents(TSubscriptions& subscriptions, const std::string& streamName,
+        std::shared_ptr<Executor> executor = nullptr) {
+        auto queue = std::make_shared<AwaitableQueue<StreamEvent<TEvent>>>(std::move(executor));
+        auto subscription = subscriptions.Subscribe(streamName, std::make_shared<QueueingEventDispatcher<TEvent>>(queue));
+        return DrainEventFeed<TEvent>(EventFeed<TEvent>(queue, std::move(subscription)));
+    }
+
+    // Coroutines waiting for a counter per key (a stream's version, the log head) to reach a target. Advance() is
+    // called after the counter moved; a waiter checks the counter only after registering, so it cannot miss it.
+    class PositionWaiters {
+        struct Waiter {
+            uint64_t Target;
+            uint64_t* Reached;
+            std::coroutine_handle<> Handle;
+            std::shared_ptr<Executor> ResumeOn;
+        };
+
+        std::mutex _mtx;
+        std::unordered_map<std::string, std::vector<Waiter>> _waiters;
+        std::atomic<size_t> _count = 0;
+
+    public:
+        class Awaiter {
+            PositionWaiters& _owner;
+            std::string _key;
+            uint64_t _target;
+            std::function<uint64_t()> _current;
+            std::shared_ptr<Executor> _executor;
+            uint64_t _reached = 0;
+
+        public:
+            Awaiter(PositionWaiters& owner, std::string key, uint64_t target, std::function<uint64_t()> current,
+                std::shared_ptr<Executor> executor)
+                : _owner(owner), _key(std::move(key)), _target(target), _current(std::move(current)),
+                _executor(executor ? std::move(executor) : Executor::Default()) {
+            }
+
+            bool await_ready() {
+                _reached = _current();
+                return _reached >= _target;
+            }
+            bool await_suspend(std::coroutine_handle<> h) {
+                std::lock_guard lock(_owner._mtx);
+                auto& waiters = _owner._waiters[_key];
+                waiters.push_back(Waiter{ _target, &_reached, h, _executor });
+                ++_owner._count;
+                _reached = _current();
+                if (_reached < _target) return true;
+                waiters.pop_back();
+                --_owner._count;
+                return false;
+            }
+            uint64_t await_resume() const noexcept { return _reached; }
+        };
+
+        Awaiter Await(const std::string& key, uint64_t target, std::function<uint64_t()> current, std::shared_ptr<Executor> executor) {
+            return Awaiter(*this, key, target, std::move(current), std::move(executor));
+        }
+
+        void Advance(const std::string& key, uint64_t reached) {
+            if (_count == 0) return;
+            std::vector<Waiter> ready;
+            {
+                std::lock_guard lock(_mtx);
+                auto it = _waiters.find(key);
+                if (it == _waiters.end()) return;
+                auto& waiters = it->second;
+                for (size_t i = 0; i < waiters.size();) {
+                    if (waiters[i].Target <= reached) {
+                        *waiters[i].Reached = reached;
+                        ready.push_back(std::move(waiters[i]));
+                        waiters[i] = std::move(waiters.back());
+                        waiters.pop_back();
+                    }
+                    else ++i;
+                }
+                if (waiters.empty()) _waiters.erase(it);
+                _count -= ready.size();
+            }
+            for (auto& w : ready) w.ResumeOn->Post([h = w.Handle]() { h.resume(); });
+        }
+    };
+}
@@ -2,18 +2,43 @@
 
 #include <memory>
 #include <functional>
+#include <optional>
 #include <string>
+#include "cppplumberd/executor.hpp"
+#include "cppplumberd/flow_control.hpp"
 #include "cppplumberd/proto_req_rsp_srv_handler.hpp"
 #include "cppplumberd/fault_exception.hpp"
+#include "cppplumberd/tracing.hpp"
 
 namespace cppplumberd {
 
 
+	typedef time_point<system_clock, nanoseconds> NanoTimePoint;
+
+	// Publish time of an event frame; publishers that predate timestamp_ns only send milliseconds.
+	inline NanoTimePoint PublishedAt(const EventHeader& header) {
+		if (header.timestamp_ns() != 0) return NanoTimePoint(nanoseconds(header.timestamp_ns()));
+		return NanoTimePoint(milliseconds(header.timestamp()));
+	}
+
+	// Per-hop stamps of a received event; Sent is unset (epoch) unless the publisher enabled hop stamps.
+	struct HopStamps
+	{
+		NanoTimePoint Published;
+		NanoTimePoint Sent;
+		NanoTimePoint Received;
+		NanoTimePoint Dispatched;
+	};
+
     class Metadata
     {
 	private:
 		std::string _stream_id;
-		time_point<system_clock> _created;
+		NanoTimePoint _created;
+		HopStamps _hops;
+		TraceContext _trace;
+		uint64_t _version = 0;
+		uint64_t _position = 0;
 
     public:
 		Metadata() = default;
@@ -21,11 +46,42 @@ namespace cppplumberd {
 			: _stream_id(stream_id){
 		}
 
-		Metadata(const string& string, time_point<system_clock> created) : _stream_id(string), _created(created) {
+		Metadata(const string& string, NanoTimePoint created) : _stream_id(string), _created(created) {
+			_hops.Published = created;
+		}
+		Metadata(const string& string, const HopStamps& hops) : _stream_id(string), _created(hops.Published), _hops(hops) {
+		}
+		Metadata(const string& string, NanoTimePoint created, const TraceContext& trace) : Metadata(string, created) {
+			_trace = trace;
+		}
+		Metadata(const string& string, const HopStamps& hops, const TraceContext& trace) : Metadata(string, hops) {
+			_trace = trace;
+		}
+		// Received event that the publisher had persisted.
+		Metadata(const string& string, const HopStamps& hops, const TraceContext& trace, uint64_t version, uint64_t position)
+			: Metadata(string, hops, trace) {
+			_version = version;
+			_position = position;
+		}
+		// Event read from or appended to an IEventLog.
+		Metadata(const string& string, NanoTimePoint created, const TraceContext& trace, uint64_t version, uint64_t position)
+			: Metadata(string, created, trace) {
+			_version = version;
+			_position = position;
+		}
+		explicit Metadata(const RecordedEvent& e)
+			: Metadata(e.stream(), NanoTimePoint(nanoseconds(e.timestamp())), TraceContext::FromHeader(e.trace()), e.version(), e.position()) {
 		}
 		
 		const std::string& StreamId() const { return _stream_id; }
-		time_point<system_clock> Created() const {return _created;		}
+		time_point<system_clock> Created() const {return time_point_cast<system_clock::duration>(_created);		}
+		const HopStamps& Hops() const { return _hops; }
+		bool HasHopStamps() const { return _hops.Sent.time_since_epoch().count() != 0; }
+		// Trace of the event itself: Trace().SpanId is the event id, Trace().CausationId the command/event that caused it.
+		const TraceContext& Trace() const { return _trace; }
+		// Stream version and global log position; 0 when the event was not persisted.
+		uint64_t Version() const { return _version; }
+		uint64_t Position() const { return _position; }
     };
 
 	class ICommandHandlerBase
@@ -39,6 +95,15 @@ namespace cppplumberd {
         virtual void Handle(const std::string& stream_id, const TCommand& cmd) = 0;
         
     };
+    template<typename TQuery, typename TResult>
+    class IQueryHandler {
+    public:
+        virtual TResult Handle(const TQuery& query) = 0;
+        // Event log position the read model behind Handle has applied up to; 0 when it cannot tell. Results are
+        // stamped with it, and clients apply every event after it to their cached copies.
+        virtual uint64_t Position() const { return 0; }
+        virtual ~IQueryHandler() = default;
+    };
     template<typename TEvent>
     class IEventHandler {
     public:
@@ -56,8 +121,43 @@ namespace cppplumberd {
 	{
 	public:
 		virtual void Unsubscribe() = 0;
+		// Queue statistics; all zero for subscriptions without flow control.
+		virtual SubscriptionStats Stats() const { return SubscriptionStats(); }
 		virtual ~ISubscription() = default;
 	};
+	struct SubscriptionOptions
+	{
+		// When set, events are queued and handed to the handler on a separate thread; the policy decides what
+		// happens when the handler falls behind.
+		optional<FlowControlPolicy> FlowControl;
+		// Key of an event for FlowControl::CONFLATE. An empty key is never conflated.
+		function<string(const google::protobuf::Message&)> ConflationKey;
+		// Called when the subscriber becomes slow or is disconnected by its policy.
+		function<void(const string& streamName, const SubscriptionStats&)> OnSlowConsumer;
+		// Remote subscriptions: bytes of a lock-free ring between the socket's receive thread and a dispatch thread
+		// (0: frames are decoded and handled on the receive thread). Frames that do not fit are dropped.
+		size_t ReceiveRing = 0;
+		// When set (and FlowControl is not), events are handed to the handler on a strand of this executor: in order,
+		// off the publishing/receive thread, without a thread per subscription.
+		shared_ptr<cppplumberd::Executor> Executor;
+		// Remote subscriptions: ask the server for the stream's last values and deliver them before live events (one
+		// more round trip per subscribe). In-process subscribers of a stream with last values always get them.
+		bool LastValues = false;
+
+		// While the handler is behind, only the newest event per key is kept.
+		template<typename TEvent>
+		static SubscriptionOptions ConflateBy(function<string(const TEvent&)> key)
+		{
+			SubscriptionOptions options;
+			options.FlowControl = FlowControlPolicy{ FlowControl::CONFLATE, 0 };
+			options.ConflationKey = [key](const google::protobuf::Message& msg) -> string {
+				auto evt = dynamic_cast<const TEvent*>(&msg);
+				return evt ? key(*evt) : string();
+			};
+			return options;
+		}
+	};
+
 	class ISubscriptionManager
 	{
 	public:
@@ -66,6 +166,13 @@ namespace cppplumberd {
 
 		virtual unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler) = 0;
 
+		// Managers that do not support an option ignore it.
+		virtual unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler,
+			const SubscriptionOptions&)
+		{
+			return Subscribe(streamName, handler);
+		}
+
 		virtual ~ISubscriptionManager() = default;
 	};
 	
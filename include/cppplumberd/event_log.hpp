@@ -0,0 +1,373 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "cppplumberd/compression.hpp"
+#include "cppplumberd/fault_exception.hpp"
+#include "cppplumberd/tracing.hpp"
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    using namespace std;
+
+    // Append-only store of events. Positions are global and versions per stream, both starting at 1;
+    // 0 means "nothing yet".
+    class IEventLog {
+    public:
+        static constexpr uint64_t ANY_VERSION = UINT64_MAX;
+
+        // Throws FaultException(409) when 'expectedVersion' is given and differs from the stream's version.
+        virtual const RecordedEvent& Append(const string& stream, unsigned int eventType, string data,
+            const TraceContext& trace, uint64_t expectedVersion = ANY_VERSION) = 0;
+        // Appends a record read from another log (a leader's): it gets this log's position and version but keeps its
+        // timestamp and trace where the log can store them.
+        virtual const RecordedEvent& Replicate(const RecordedEvent& record) {
+            return Append(record.stream(), record.event_type(), record.data(), TraceContext::FromHeader(record.trace()));
+        }
+        virtual uint64_t StreamVersion(const string& stream) const = 0;
+        virtual uint64_t Head() const = 0;
+        // Callbacks run under the log's read lock and must not append.
+        virtual size_t ReadStream(const string& stream, uint64_t fromVersion, const function<void(const RecordedEvent&)>& callback) const = 0;
+        virtual size_t ReadAll(uint64_t fromPosition, size_t maxCount, const function<void(const RecordedEvent&)>& callback) const = 0;
+        // Blocks until the head passes 'position' or the timeout expires; returns the current head.
+        virtual uint64_t WaitForAppend(uint64_t position, chrono::milliseconds timeout) const = 0;
+        // Leader epoch stamped on the records appended from now on (RecordedEvent::epoch). Logs that do not keep
+        // it leave every record at epoch 0, so replication cannot tell their divergent records apart.
+        virtual void SetEpoch(uint64_t) {}
+        // The epoch last set, or the newest one of a reopened log; 0 for logs that do not keep it.
+        virtual uint64_t Epoch() const { return 0; }
+        // Drops the records after 'position': a follower's records its new leader does not have.
+        virtual void Truncate(uint64_t) {
+            throw FaultException("This event log cannot be truncated", 412);
+        }
+        virtual ~IEventLog() = default;
+    };
+
+    class InMemoryEventLog : public IEventLog {
+    protected:
+        mutable shared_mutex _mtx;
+        mutable std::mutex _waitMtx;
+        mutable condition_variable _appended;
+        // Chunked so records never move and references handed to callbacks stay valid.
+        static constexpr size_t CHUNK = 4096;
+        vector<unique_ptr<RecordedEvent[]>> _chunks;
+        uint64_t _head = 0;
+        uint64_t _epoch = 0;
+        unordered_map<string, vector<uint64_t>> _streams;
+
+        RecordedEvent& At(uint64_t position) const { return _chunks[(position - 1) / CHUNK][(position - 1) % CHUNK]; }
+
+        // Gives the event the position and version Store will keep it at.
+        void Sequence(RecordedEvent& e) const {
+            auto it = _streams.find(e.stream());
+            e.set_position(_head + 1);
+            e.set_version((it == _streams.end() ? 0 : it->second.size()) + 1);
+        }
+        RecordedEvent& Store(RecordedEvent&& e) {
+            if (_head / CHUNK == _chunks.size()) _chunks.push_back(make_unique<RecordedEvent[]>(CHUNK));
+            auto& positions = _streams[e.stream()];
+            ++_head;
+            e.set_position(_head);
+            e.set_version(positions.size() + 1);
+            positions.push_back(_head);
+            return At(_head) = std::move(e);
+        }
+        // Called with the sequenced event before it is stored; if it throws, the append fails and the log is unchanged.
+        virtual void OnAppending(const RecordedEvent&) {}
+        // Called before the records after 'position' are dropped; if it throws, the log is unchanged.
+        virtual void OnTruncating(uint64_t) {}
+        // Called before the epoch changes; if it throws, the epoch is unchanged.
+        virtual void OnEpochChanging(uint64_t) {}
+        void NotifyAppended() {
+            { lock_guard lock(_waitMtx); }
+            _appended.notify_all();
+        }
+
+    public:
+        const RecordedEvent& Append(const string& stream, unsigned int eventType, string data,
+            const TraceContext& trace, uint64_t expectedVersion = ANY_VERSION) override {
+            RecordedEvent e;
+            e.set_stream(stream);
+            e.set_event_type(eventType);
+            e.set_timestamp(Tracer::NowNs());
+            trace.WriteTo(*e.mutable_trace());
+            *e.mutable_data() = std::move(data);
+            const RecordedEvent* stored;
+            {
+                unique_lock lock(_mtx);
+                if (expectedVersion != ANY_VERSION) {
+                    auto it = _streams.find(stream);
+                    uint64_t current = it == _streams.end() ? 0 : it->second.size();
+                    if (current != expectedVersion) {
+                        throw FaultException("Wrong expected version of '" + stream + "': expected "
+                            + to_string(expectedVersion) + ", actual " + to_string(current), 409);
+                    }
+                }
+                e.set_epoch(_epoch);
+                Sequence(e);
+                OnAppending(e);
+                stored = &Store(std::move(e));
+            }
+            NotifyAppended();
+            return *stored;
+        }
+
+        const RecordedEvent& Replicate(const RecordedEvent& record) override {
+            const RecordedEvent* stored;
+            {
+                unique_lock lock(_mtx);
+                RecordedEvent e(record);
+                Sequence(e);
+                OnAppending(e);
+                stored = &Store(std::move(e));
+            }
+            NotifyAppended();
+            return *stored;
+        }
+
+        uint64_t StreamVersion(const string& stream) const override {
+            shared_lock lock(_mtx);
+            auto it = _streams.find(stream);
+            return it == _streams.end() ? 0 : it->second.size();
+        }
+        uint64_t Head() const override {
+            shared_lock lock(_mtx);
+            return _head;
+        }
+
+        size_t ReadStream(const string& stream, uint64_t fromVersion, const function<void(const RecordedEvent&)>& callback) const override {
+            shared_lock lock(_mtx);
+            auto it = _streams.find(stream);
+            if (it == _streams.end()) return 0;
+            const auto& positions = it->second;
+            size_t read = 0;
+            for (uint64_t v = max<uint64_t>(fromVersion, 1); v <= positions.size(); ++v, ++read)
+                callback(At(positions[v - 1]));
+            return read;
+        }
+
+        size_t ReadAll(uint64_t fromPosition, size_t maxCount, const function<void(const RecordedEvent&)>& callback) const override {
+            shared_lock lock(_mtx);
+            size_t read = 0;
+            for (uint64_t p = max<uint64_t>(fromPosition, 1); p <= _head && read < maxCount; ++p, ++read)
+                callback(At(p));
+            return read;
+        }
+
+        uint64_t WaitForAppend(uint64_t position, chrono::milliseconds timeout) const override {
+            unique_lock lock(_waitMtx);
+            _appended.wait_for(lock, timeout, [this, position]() { return Head() > position; });
+            return Head();
+        }
+
+        void SetEpoch(uint64_t epoch) override {
+            unique_lock lock(_mtx);
+            if (epoch == _epoch) return;
+            OnEpochChanging(epoch);
+            _epoch = epoch;
+        }
+        uint64_t Epoch() const override {
+            shared_lock lock(_mtx);
+            return _epoch;
+        }
+
+        // Dropped records keep their slots (references handed out stay valid) and are overwritten by later appends.
+        void Truncate(uint64_t position) override {
+            unique_lock lock(_mtx);
+            if (position >= _head) return;
+            OnTruncating(position);
+            for (; _head > position; --_head) {
+                auto& e = At(_head);
+                auto it = _streams.find(e.stream());
+                it->second.pop_back();
+                if (it->second.empty()) _streams.erase(it);
+                e.Clear();
+            }
+        }
+    };
+
+    // InMemoryEventLog that also appends every record to a file ([u32 size][RecordedEvent]) and reloads it on open.
+    // With compression enabled a record is [u32 size | COMPRESSED][u32 raw size][u32 dictionary id][raw deflate of
+    // the RecordedEvent], and the first record compressed with a stream's dictionary is preceded by
+    // [u32 size | DICTIONARY][CompressionDictionary]. Files of either format (or both) load. A new epoch is written
+    // as [u32 size | EPOCH][u64 epoch], so the log reopens at it even before a record of that epoch is appended.
+    class FileEventLog : public InMemoryEventLog {
+        static constexpr uint32_t COMPRESSED = 0x80000000u;
+        static constexpr uint32_t DICTIONARY = 0x40000000u;
+        static constexpr uint32_t EPOCH = COMPRESSED | DICTIONARY;
+        static constexpr uint32_t SIZE_MASK = 0x3FFFFFFFu;
+
+        string _path;
+        ofstream _file;
+        uint64_t _size = 0;                                     // of the file
+        vector<uint64_t> _offsets;                              // where each record (with its dictionary) starts
+        bool _flushEachAppend;
+        bool _compress = false;
+        CompressionOptions _compression;
+        unordered_map<string, unique_ptr<StreamCompressor>> _compressors;
+        unordered_map<uint32_t, string> _dictionaries;          // in the file
+        unordered_map<uint32_t, uint64_t> _dictionaryOffsets;
+        unordered_map<string, uint32_t> _streamDictionaries;    // last one per stream, as loaded
+
+        void Load(const string& path) {
+            ifstream in(path, ios::binary);
+            if (!in) return;
+            string buffer, raw;
+            Inflater inflater;
+            uint32_t size;
+            uint64_t valid = 0;
+            while (in.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+                uint32_t length = size & SIZE_MASK;
+                buffer.resize(length);
+                if (!in.read(buffer.data(), length)) break;
+                if ((size & EPOCH) == EPOCH) {
+                    uint64_t epoch;
+                    if (length != sizeof(epoch)) throw runtime_error("Corrupt event log: " + path);
+                    memcpy(&epoch, buffer.data(), sizeof(epoch));
+                    _epoch = max(_epoch, epoch);
+                }
+                else if (size & DICTIONARY) {
+                    CompressionDictionary dictionary;
+                    if (!dictionary.ParseFromString(buffer)) throw runtime_error("Corrupt event log: " + path);
+                    _dictionaries[dictionary.id()] = dictionary.dictionary();
+                    _dictionaryOffsets[dictionary.id()] = valid;
+                    _streamDictionaries[dictionary.stream()] = dictionary.id();
+                }
+                else {
+                    RecordedEvent e;
+                    bool parsed;
+                    if (size & COMPRESSED) {
+                        if (length < 8) throw runtime_error("Corrupt event log: " + path);
+                        uint32_t prefix[2];
+                        memcpy(prefix, buffer.data(), sizeof(prefix));
+                        auto dictionary = _dictionaries.find(prefix[1]);
+                        if (prefix[1] != 0 && dictionary == _dictionaries.end())
+                            throw runtime_error("Event log refers to a missing dictionary: " + path);
+                        inflater.Decompress(buffer.data() + 8, length - 8, prefix[0],
+                            prefix[1] == 0 ? string_view() : string_view(dictionary->second), raw, SIZE_MASK);
+                        parsed = e.ParseFromString(raw);
+                    }
+                    else parsed = e.ParseFromString(buffer);
+                    if (!parsed) throw runtime_error("Corrupt event log: " + path);
+                    _epoch = max(_epoch, e.epoch());
+                    Store(std::move(e));
+                    _offsets.push_back(valid);
+                }
+                valid += sizeof(size) + length;
+            }
+            in.close();
+            // A torn tail from a crash is dropped so new records start on a record boundary.
+            if (filesystem::file_size(path) != valid) filesystem::resize_file(path, valid);
+            _size = valid;
+        }
+
+        void Write(uint32_t flags, string_view prefix, string_view body) {
+            size_t length = prefix.size() + body.size();
+            if (length > SIZE_MASK) throw runtime_error("Event log record too large");
+            uint32_t size = static_cast<uint32_t>(length) | flags;
+            _file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            _file.write(prefix.data(), prefix.size());
+            _file.write(body.data(), body.size());
+            _size += sizeof(size) + length;
+        }
+
+        void WriteEpoch(uint64_t epoch) {
+            Write(EPOCH, string_view(), string_view(reinterpret_cast<const char*>(&epoch), sizeof(epoch)));
+            if (_flushEachAppend) _file.flush();
+            if (!_file) throw runtime_error("Failed to append to event log");
+        }
+
+        void WriteCompressed(const string& stream, const string& bytes) {
+            auto& compressor = _compressors[stream];
+            if (!compressor) compressor = make_unique<StreamCompressor>(_compression);
+            string packed;
+            auto payload = compressor->Compress(bytes.data(), bytes.size(), packed);
+            if (payload.Codec == CompressionCodec::NONE) {
+                Write(0, string_view(), bytes);
+                return;
+            }
+            if (payload.DictionaryId != 0 && !_dictionaries.contains(payload.DictionaryId)) {
+                CompressionDictionary dictionary;
+                dictionary.set_id(payload.DictionaryId);
+                dictionary.set_dictionary(compressor->Dictionary(payload.DictionaryId));
+                dictionary.set_stream(stream);
+                _dictionaryOffsets[payload.DictionaryId] = _size;
+                Write(DICTIONARY, string_view(), dictionary.SerializeAsString());
+                _dictionaries[payload.DictionaryId] = dictionary.dictionary();
+            }
+            uint32_t prefix[2] = { static_cast<uint32_t>(bytes.size()), payload.DictionaryId };
+            Write(COMPRESSED, string_view(reinterpret_cast<const char*>(prefix), sizeof(prefix)), packed);
+        }
+    protected:
+        void OnAppending(const RecordedEvent& e) override {
+            uint64_t offset = _size;
+            string bytes = e.SerializeAsString();
+            if (_compress) WriteCompressed(e.stream(), bytes);
+            else Write(0, string_view(), bytes);
+            if (_flushEachAppend) _file.flush();
+            if (!_file) throw runtime_error("Failed to append to event log");
+            _offsets.push_back(offset);
+        }
+        // Cuts the file where the first dropped record starts; dictionaries written with dropped records go too and
+        // are written again when a later record needs them.
+        void OnTruncating(uint64_t position) override {
+            if (position >= _offsets.size()) return;
+            uint64_t size = _offsets[position];
+            _file.close();
+            filesystem::resize_file(_path, size);
+            _file.open(_path, ios::binary | ios::app);
+            if (!_file) throw runtime_error("Cannot reopen event log: " + _path);
+            _offsets.resize(position);
+            _size = size;
+            erase_if(_dictionaryOffsets, [this, size](const auto& d) {
+                if (d.second < size) return false;
+                _dictionaries.erase(d.first);
+                return true;
+            });
+            // The cut may have taken the epoch marker with it.
+            if (_epoch != 0) WriteEpoch(_epoch);
+        }
+        void OnEpochChanging(uint64_t epoch) override { WriteEpoch(epoch); }
+    public:
+        explicit FileEventLog(const string& path, bool flushEachAppend = true) : _path(path), _flushEachAppend(flushEachAppend) {
+            Load(path);
+            _file.open(path, ios::binary | ios::app);
+            if (!_file) throw runtime_error("Cannot open event log: " + path);
+        }
+        void Flush() {
+            unique_lock lock(_mtx);
+            _file.flush();
+        }
+
+        // Records appended from now on are compressed per stream; a stream whose dictionary is in the file keeps it.
+        void EnableCompression(const CompressionOptions& options = {}) {
+            unique_lock lock(_mtx);
+            _compress = true;
+            _compression = options;
+            for (const auto& [stream, id] : _streamDictionaries) {
+                auto& compressor = _compressors[stream];
+                compressor = make_unique<StreamCompressor>(_compression);
+                compressor->Adopt(_dictionaries[id]);
+            }
+        }
+        // Ratio and CPU time of the stream's records compressed since EnableCompression.
+        StreamCompressionStats CompressionStats(const string& stream) const {
+            shared_lock lock(_mtx);
+            auto it = _compressors.find(stream);
+            return it == _compressors.end() ? StreamCompressionStats() : it->second->Stats();
+        }
+    };
+}
@@ -1,7 +1,10 @@
+#pragma once
+
 #include <memory>
 #include <string>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <functional>
 #include <typeindex>
 #include <vector>
@@ -10,6 +13,13 @@
 #include <unordered_map>
 #include <chrono>
 #include <boost/signals2.hpp>
+#include "cppplumberd/transport_interfaces.hpp"
+#include "cppplumberd/message_serializer.hpp"
+#include "cppplumberd/proto_publish_handler.hpp"
+#include "cppplumberd/proto_subscribe_handler.hpp"
+#include "cppplumberd/event_log.hpp"
+#include "cppplumberd/last_value_cache.hpp"
+#include "cppplumberd/coroutines.hpp"
 using namespace std;
 using namespace std::chrono;
 using namespace boost::signals2;
@@ -22,44 +32,152 @@ namespace cppplumberd {
 		class SubscriptionManager : ISubscriptionManager
 		{
 			
+			// An in-process subscriber as the publishing side sees it; shared so that a publish that already picked it up
+			// can finish while it unsubscribes.
+			class LocalSubscriber : public IEventDispatcher
+			{
+				struct HeldEvent {
+					Metadata Meta;
+					unsigned int MessageId;
+					unique_ptr<google::protobuf::Message> Message;
+				};
+				shared_ptr<IEventDispatcher> _dispatcher;
+				std::atomic<bool> _holding = false;
+				std::mutex _holdMtx;
+				vector<HeldEvent> _held;
+
+			public:
+				const shared_ptr<AsyncDispatcher> Queued;
+
+				LocalSubscriber(const shared_ptr<IEventDispatcher>& handler, const shared_ptr<AsyncDispatcher>& queued, bool holding)
+					: _dispatcher(queued ? static_pointer_cast<IEventDispatcher>(queued) : handler), _holding(holding), Queued(queued) {
+				}
+
+				void Handle(const Metadata& metadata, unsigned int messageId, MessagePtr msg) override
+				{
+					if (_holding) {
+						std::lock_guard lock(_holdMtx);
+						if (_holding) {
+							unique_ptr<google::protobuf::Message> copy(msg->New());
+							copy->CopyFrom(*msg);
+							_held.push_back(HeldEvent{ metadata, messageId, std::move(copy) });
+							return;
+						}
+					}
+					_dispatcher->Handle(metadata, messageId, msg);
+				}
+
+				// Dispatches the snapshot's events, then the events held since the subscriber was registered, then
+				// resumes live dispatch. Held events at or before the snapshot's latest log position are dropped: the
+				// snapshot already has them or a later value of their key, which must not be followed by an older one.
+				void DeliverSnapshot(const LastValueSnapshot& snapshot, MessageSerializer& serializer)
+				{
+					std::lock_guard lock(_holdMtx);
+					uint64_t covered = 0;
+					for (const auto& e : snapshot.events())
+					{
+						unique_ptr<google::protobuf::Message> msg(serializer.Deserialize(e.data(), e.event_type()));
+						_dispatcher->Handle(Metadata(e), e.event_type(), msg.get());
+						covered = max(covered, e.position());
+					}
+					for (auto& h : _held)
+						if (h.Meta.Position() == 0 || h.Meta.Position() > covered) _dispatcher->Handle(h.Meta, h.MessageId, h.Message.get());
+					_held.clear();
+					_holding = false;
+				}
+
+				SubscriptionStats Stats() const { return Queued ? Queued->Stats() : SubscriptionStats(); }
+			};
+
 			class Subscription : public ISubscription
 			{
 				SubscriptionManager* _parent;
 				string _streamName;
-				shared_ptr<IEventDispatcher> handler;
+				shared_ptr<LocalSubscriber> _subscriber;
 
 			public:
-				IEventDispatcher& Dispatcher() const { return *handler; }
-				string StreamName() const { return _streamName; }
-				Subscription(SubscriptionManager* eventStore, const string& streamName, const shared_ptr<IEventDispatcher>& handler)
-					: _parent(eventStore), _streamName(streamName), handler(handler) {
+				Subscription(SubscriptionManager* parent, const string& streamName, const shared_ptr<LocalSubscriber>& subscriber)
+					: _parent(parent), _streamName(streamName), _subscriber(subscriber) {
 				}
 				void Unsubscribe() override
 				{
-					_parent->Unsubscribe(this);
+					_parent->Unsubscribe(_streamName, _subscriber.get());
+					if (_subscriber->Queued) _subscriber->Queued->Stop();
+				}
+				SubscriptionStats Stats() const override
+				{
+					return _subscriber->Stats();
 				}
 			};
 			unordered_multimap<string, shared_ptr<ProtoPublishHandler>> _publishedStreams;
-			unordered_multimap<string, Subscription*> _localSubscribers;
+			// Subscribe and Unsubscribe may run concurrently with Publish and Deliver.
+			mutable std::mutex _subscribersMtx;
+			unordered_multimap<string, shared_ptr<LocalSubscriber>> _localSubscribers;
 			EventStore* _eventStore;
-			void Unsubscribe(const Subscription* subscription)
+			void Unsubscribe(const string& streamName, const LocalSubscriber* subscriber)
 			{
-				auto range = _localSubscribers.equal_range(subscription->StreamName());
+				std::lock_guard lock(_subscribersMtx);
+				auto range = _localSubscribers.equal_range(streamName);
 				for (auto it = range.first; it != range.second; ++it) {
-					if (it->second == subscription) {
+					if (it->second.get() == subscriber) {
 						_localSubscribers.erase(it);
 						break;
 					}
 				}
 			}
+			// Taken under the lock and called outside it, so handlers may subscribe and unsubscribe.
+			vector<shared_ptr<LocalSubscriber>> LocalSubscribers(const string& streamName) const
+			{
+				vector<shared_ptr<LocalSubscriber>> subscribers;
+				std::lock_guard lock(_subscribersMtx);
+				auto range = _localSubscribers.equal_range(streamName);
+				for (auto it = range.first; it != range.second; ++it) subscribers.push_back(it->second);
+				return subscribers;
+			}
 		public:
 			
 			SubscriptionManager(EventStore* parent) : _eventStore(parent) {}
 			unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler)
 			{
-				auto subscription = new Subscription(this, streamName, handler);
-				_localSubscribers.insert({ streamName, subscription });
-				return unique_ptr<ISubscription>(subscription);
+				return Subscribe(streamName, handler, SubscriptionOptions());
+			}
+			// On a stream with last values the subscriber is registered with live events held, then gets the snapshot
+			// through its own dispatcher (queue or strand included), then the held events: nothing published in
+			// between is lost.
+			unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler,
+				const SubscriptionOptions& options)
+			{
+				shared_ptr<AsyncDispatcher> queued;
+				if (options.FlowControl) queued = make_shared<QueuedDispatcher>(streamName, handler, options);
+				else if (options.Executor) queued = make_shared<StrandDispatcher>(streamName, handler, options.Executor);
+				bool lastValues = _eventStore->_lastValues->Tracks(streamName);
+				auto subscriber = make_shared<LocalSubscriber>(handler, queued, lastValues);
+				{
+					std::lock_guard lock(_subscribersMtx);
+					_localSubscribers.insert({ streamName, subscriber });
+				}
+				if (lastValues) subscriber->DeliverSnapshot(_eventStore->_lastValues->Snapshot(streamName), *_eventStore->_serializer);
+				return make_unique<Subscription>(this, streamName, subscriber);
+			}
+
+			// Pending events of the slowest in-process subscriber of the stream.
+			size_t QueueDepth(const string& streamName) const
+			{
+				size_t depth = 0;
+				std::lock_guard lock(_subscribersMtx);
+				auto range = _localSubscribers.equal_range(streamName);
+				for (auto it = range.first; it != range.second; ++it)
+					depth = max(depth, it->second->Stats().Pending);
+				return depth;
+			}
+
+			vector<SubscriptionStats> SubscriberStats(const string& streamName) const
+			{
+				vector<SubscriptionStats> stats;
+				std::lock_guard lock(_subscribersMtx);
+				auto range = _localSubscribers.equal_range(streamName);
+				for (auto it = range.first; it != range.second; ++it) stats.push_back(it->second->Stats());
+				return stats;
 			}
 
 			void AddStream(const string& streamName, const shared_ptr<ProtoPublishHandler>& channel)
@@ -67,12 +185,28 @@ namespace cppplumberd {
 				_publishedStreams.insert({ streamName, channel });
 			}
 			template<typename TEvent> // pushes events to local ISubscriptionManager 
-			void Publish(const string& streamName, const TEvent& evt)
+			uint64_t Publish(const string& streamName, const TEvent& evt, uint64_t expectedVersion = IEventLog::ANY_VERSION)
 			{
-				auto range = _localSubscribers.equal_range(streamName);
-				for (auto &it = range.first; it != range.second; ++it) 
+				// The event is a child of whatever is being processed on this thread (usually a command).
+				TraceContext trace = TraceContext::ChildOf(Tracer::Current());
+				ScopedSpan span("publish", SpanKind::PRODUCER, trace);
+				if (span.IsRecording()) span.SetAttribute("messaging.destination", streamName);
+
+				uint64_t version = 0, position = 0;
+				if (_eventStore->_eventLog) {
+					const auto& recorded = _eventStore->_eventLog->Append(streamName, _eventStore->_serializer->GetMessageId<TEvent>(),
+						_eventStore->_serializer->Serialize(evt), trace, expectedVersion);
+					version = recorded.version();
+					position = recorded.position();
+					_eventStore->_versionWaiters.Advance(streamName, version);
+					_eventStore->_positionWaiters.Advance(string(), position);
+				}
+				if (_eventStore->_lastValues->Tracks(streamName))
+					_eventStore->_lastValues->Update(streamName, _eventStore->_serializer->GetMessageId<TEvent>(), evt, trace, version, position);
+
+				for (auto& subscriber : LocalSubscribers(streamName))
 				{
-					Metadata metadata(streamName, system_clock::now());
+					Metadata metadata(streamName, system_clock::now(), trace, version, position);
 					unsigned int messageId = _eventStore->_serializer->GetMessageId<TEvent>();
 
 					// Just pass the pointer to the const event
@@ -80,7 +214,8 @@ namespace cppplumberd {
 					// but we're not actually modifying the event
 					MessagePtr ptr = const_cast<TEvent*>(&evt);
 					
-					it->second->Dispatcher().Handle(metadata, messageId, ptr);
+					TraceScope scope(TraceContext::ProcessingOf(trace));
+					subscriber->Handle(metadata, messageId, ptr);
 					
 				}
 
@@ -90,12 +225,76 @@ namespace cppplumberd {
 				{
 					type_index typeIdx = type_index(typeid(TEvent));
 					
-					it->second->Publish(evt);
+					it->second->Publish(evt, trace, version, position);
 
 					//cout << "Event published '" << typeIdx.name() << "' in stream: " << streamName << endl;
 				}
+				return version;
+
+			}
+
+			bool HasSubscribers(const string& streamName) const
+			{
+				if (_publishedStreams.contains(streamName)) return true;
+				std::lock_guard lock(_subscribersMtx);
+				return _localSubscribers.contains(streamName);
+			}
+
+			// Publish for an event that is already in the event log.
+			void Deliver(const string& streamName, unsigned int messageId, const google::protobuf::Message& evt,
+				const TraceContext& trace, uint64_t version, uint64_t position)
+			{
+				for (auto& subscriber : LocalSubscribers(streamName))
+				{
+					Metadata metadata(streamName, system_clock::now(), trace, version, position);
+					TraceScope scope(TraceContext::ProcessingOf(trace));
+					subscriber->Handle(metadata, messageId, const_cast<google::protobuf::Message*>(&evt));
+				}
+				auto channels = _publishedStreams.equal_range(streamName);
+				for (auto it = channels.first; it != channels.second; ++it)
+					it->second->Publish(messageId, evt, trace, version, position);
+			}
 
+			void EnableHopStamps(bool enabled)
+			{
+				for (auto& [name, channel] : _publishedStreams)
+					channel->EnableHopStamps(enabled);
+			}
 
+			void EnableCompression(const string& streamName, const shared_ptr<StreamCompressor>& compressor)
+			{
+				auto range = _publishedStreams.equal_range(streamName);
+				for (auto it = range.first; it != range.second; ++it)
+					it->second->EnableCompression(compressor);
+			}
+
+			void EnableAsync(AsyncPublisher& publisher)
+			{
+				for (auto& [name, channel] : _publishedStreams)
+					if (!channel->IsAsync()) channel->EnableAsync(publisher);
+			}
+
+			void Flush()
+			{
+				for (auto& [name, channel] : _publishedStreams)
+					channel->Flush();
+			}
+
+			AsyncPublishStats PublishStats(const string& streamName) const
+			{
+				AsyncPublishStats stats;
+				auto range = _publishedStreams.equal_range(streamName);
+				for (auto it = range.first; it != range.second; ++it)
+				{
+					auto s = it->second->Stats();
+					stats.Enqueued += s.Enqueued;
+					stats.Sent += s.Sent;
+					stats.Failed += s.Failed;
+					stats.Batches += s.Batches;
+					stats.Blocked += s.Blocked;
+					stats.Pending += s.Pending;
+				}
+				return stats;
 			}
 
 			inline bool StreamExists(const string& string)
@@ -107,7 +306,26 @@ namespace cppplumberd {
 		unique_ptr<SubscriptionManager> _subscriptionManager;
 		shared_ptr<MessageSerializer> _serializer;
 		shared_ptr<ISocketFactory> _socketFactory;
-		
+		shared_ptr<IEventLog> _eventLog;
+		PositionWaiters _versionWaiters;
+		PositionWaiters _positionWaiters;
+		shared_ptr<LastValueCache> _lastValues = make_shared<LastValueCache>();
+		unordered_map<string, FlowControlPolicy> _flowControl;
+		function<void(const string&, const SubscriptionStats&)> _onSlowConsumer;
+		bool _hopStamps = false;
+		unordered_map<string, shared_ptr<StreamCompressor>> _compressors;
+		// Declared after _subscriptionManager so its I/O threads are drained and joined before the streams go away.
+		unique_ptr<AsyncPublisher> _asyncPublisher;
+
+		shared_ptr<ProtoPublishHandler> CreatePublishHandler(const string& streamName)
+		{
+			auto h = make_shared<ProtoPublishHandler>(_socketFactory->CreatePublishSocket(streamName), _serializer, streamName);
+			h->EnableHopStamps(_hopStamps);
+			if (_asyncPublisher) h->EnableAsync(*_asyncPublisher);
+			auto compressor = _compressors.find(streamName);
+			if (compressor != _compressors.end()) h->EnableCompression(compressor->second);
+			return h;
+		}
 
 	public:
 		template<typename TMessage, unsigned int MessageId>
@@ -142,7 +360,7 @@ namespace cppplumberd {
 			{
 				return;
 			}
-			auto h = make_shared<ProtoPublishHandler>(_socketFactory->CreatePublishSocket(streamName), _serializer);
+			auto h = CreatePublishHandler(streamName);
 
 			_subscriptionManager->AddStream(streamName, h);
 
@@ -150,17 +368,141 @@ namespace cppplumberd {
 		}
 		virtual void CreateStream(const string& streamName)
 		{
-			auto h = make_shared<ProtoPublishHandler>(_socketFactory->CreatePublishSocket(streamName), _serializer);
+			auto h = CreatePublishHandler(streamName);
 
 			_subscriptionManager->AddStream(streamName, h);
 
 			h->Start();
 		}
 
-		template<typename TEvent> // pushes events to local ISubscriptionManager and remote channels.
-		void Publish(const string& streamName, const TEvent& evt)
+		// Stamps EventHeader::sent on every published frame so subscribers can measure per-hop latency.
+		void EnableHopStamps(bool enabled)
+		{
+			_hopStamps = enabled;
+			_subscriptionManager->EnableHopStamps(enabled);
+		}
+
+		// Remote subscribers are then fed by dedicated I/O threads: Publish appends to the event log, updates last
+		// values and calls in-process subscribers as before, but only queues the frame for the socket. Each stream is
+		// sent by a single I/O thread, so its order is preserved. Call before publishing starts.
+		void EnableAsyncPublish(const AsyncPublishOptions& options = {})
+		{
+			if (_asyncPublisher) return;
+			_asyncPublisher = make_unique<AsyncPublisher>(options);
+			_subscriptionManager->EnableAsync(*_asyncPublisher);
+		}
+
+		// Compresses the event frames of 'streamName' for remote subscribers, which decompress them transparently.
+		// Small events are compressed with a dictionary trained on the stream's first events. Call before publishing
+		// to the stream.
+		void EnableCompression(const string& streamName, const CompressionOptions& options = {})
+		{
+			auto compressor = make_shared<StreamCompressor>(options);
+			_compressors[streamName] = compressor;
+			_subscriptionManager->EnableCompression(streamName, compressor);
+		}
+		// Ratio and CPU time of the stream's frame compression (all zero when not enabled).
+		StreamCompressionStats CompressionStats(const string& streamName) const
+		{
+			auto it = _compressors.find(streamName);
+			return it == _compressors.end() ? StreamCompressionStats() : it->second->Stats();
+		}
+		// The stream's dictionary if 'id' is its id, otherwise empty.
+		string FindDictionary(const string& streamName, uint32_t id) const
+		{
+			auto it = _compressors.find(streamName);
+			return it == _compressors.end() ? string() : it->second->Dictionary(id);
+		}
+
+		// Returns after every event published so far has been handed to the transport.
+		void Flush() { _subscriptionManager->Flush(); }
+		AsyncPublishStats PublishStats(const string& streamName) const { return _subscriptionManager->PublishStats(streamName); }
+
+		// Subscribes an in-process handler; it is called synchronously on the publishing thread.
+		// On a stream with last values enabled the handler first receives the current snapshot.
+		unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler)
+		{
+			return Subscribe(streamName, handler, SubscriptionOptions());
+		}
+
+		// With options.FlowControl (or a policy set for the stream with SetFlowControl) the handler runs on its own
+		// thread behind a bounded queue and the publisher is only held up as far as the policy allows.
+		// Otherwise, with options.Executor, it runs on a strand of that executor, still in publish order.
+		unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler,
+			SubscriptionOptions options)
+		{
+			auto policy = _flowControl.find(streamName);
+			if (!options.FlowControl && policy != _flowControl.end()) options.FlowControl = policy->second;
+			if (options.FlowControl)
+			{
+				options.OnSlowConsumer = [onSubscriber = options.OnSlowConsumer, this](const string& stream, const SubscriptionStats& stats) {
+					if (onSubscriber) onSubscriber(stream, stats);
+					if (_onSlowConsumer) _onSlowConsumer(stream, stats);
+				};
+			}
+			return _subscriptionManager->Subscribe(streamName, handler, options);
+		}
+
+		// Default policy for in-process subscribers of 'streamName' that do not set their own.
+		void SetFlowControl(const string& streamName, const FlowControlPolicy& policy) { _flowControl[streamName] = policy; }
+
+		// Called on the publishing thread when an in-process subscriber becomes slow or is disconnected by its policy.
+		void OnSlowConsumer(function<void(const string& streamName, const SubscriptionStats&)> callback) { _onSlowConsumer = callback; }
+
+		// Lets publishers throttle: pending events of the stream's slowest in-process subscriber.
+		size_t QueueDepth(const string& streamName) const { return _subscriptionManager->QueueDepth(streamName); }
+		vector<SubscriptionStats> SubscriberStats(const string& streamName) const { return _subscriptionManager->SubscriberStats(streamName); }
+
+		// Keeps the latest event per key(evt) on 'streamName'; subscribers (local and remote) get those first.
+		template<typename TEvent>
+		void EnableLastValue(const string& streamName, function<string(const TEvent&)> key)
+		{
+			_lastValues->Track(streamName, _serializer->GetMessageId<TEvent>(),
+				[key](const google::protobuf::Message& evt) { return key(static_cast<const TEvent&>(evt)); });
+		}
+		LastValueCache& LastValues() { return *_lastValues; }
+
+		// With an event log attached every published event is appended before it is delivered.
+		void SetEventLog(shared_ptr<IEventLog> eventLog) { _eventLog = eventLog; }
+		const shared_ptr<IEventLog>& EventLog() const { return _eventLog; }
+		const shared_ptr<MessageSerializer>& Serializer() const { return _serializer; }
+
+		// co_await store->WhenVersion(stream, v): continues on 'executor' (Executor::Default() when null) once the
+		// stream's version in the event log has reached 'version', right away if it has; yields the version seen.
+		PositionWaiters::Awaiter WhenVersion(const string& streamName, uint64_t version, shared_ptr<Executor> executor = nullptr)
+		{
+			if (!_eventLog) throw invalid_argument("WhenVersion requires an EventStore with an event log");
+			return _versionWaiters.Await(streamName, version,
+				[log = _eventLog, streamName]() { return log->StreamVersion(streamName); }, std::move(executor));
+		}
+
+		// Like WhenVersion, for the global log position (the head).
+		PositionWaiters::Awaiter WhenPosition(uint64_t position, shared_ptr<Executor> executor = nullptr)
+		{
+			if (!_eventLog) throw invalid_argument("WhenPosition requires an EventStore with an event log");
+			return _positionWaiters.Await(string(), position, [log = _eventLog]() { return log->Head(); }, std::move(executor));
+		}
+
+		// For an event appended to the event log directly (replicated or imported), not through Publish: wakes its
+		// waiters and hands it to last values and subscribers as Publish would have.
+		void Deliver(const RecordedEvent& e)
+		{
+			_versionWaiters.Advance(e.stream(), e.version());
+			_positionWaiters.Advance(string(), e.position());
+			bool tracked = _lastValues->Tracks(e.stream());
+			if (!tracked && !_subscriptionManager->HasSubscribers(e.stream())) return;
+			unique_ptr<google::protobuf::Message> evt(_serializer->Deserialize(e.data(), e.event_type()));
+			TraceContext trace = TraceContext::FromHeader(e.trace());
+			if (tracked) _lastValues->Update(e.stream(), e.event_type(), *evt, trace, e.version(), e.position());
+			_subscriptionManager->Deliver(e.stream(), e.event_type(), *evt, trace, e.version(), e.position());
+		}
+
+		// pushes events to local ISubscriptionManager and remote channels.
+		// Returns the new stream version (0 without an event log); 'expectedVersion' enables optimistic concurrency.
+		template<typename TEvent>
+		uint64_t Publish(const string& streamName, const TEvent& evt, uint64_t expectedVersion = IEventLog::ANY_VERSION)
 		{
-			_subscriptionManager->Publish(streamName, evt);
+			return _subscriptionManager->Publish(streamName, evt, expectedVersion);
 		}
 	};
 }
\ No newline at end of file
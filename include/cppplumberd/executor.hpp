@@ -0,0 +1,284 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cppplumberd {
+
+    struct ExecutorOptions {
+        size_t Threads = 0;             // 0: one per CPU it may run on
+        std::vector<int> Cpus;          // worker i is pinned to Cpus[i % Cpus.size()]; empty: not pinned
+        int NumaNode = -1;              // >= 0: workers are pinned to the CPUs of this NUMA node (Linux; overrides Cpus)
+        std::string Name = "plumberd";  // thread name prefix
+    };
+
+    struct ExecutorStats {
+        size_t Threads = 0;
+        uint64_t Posted = 0;
+        uint64_t Executed = 0;
+        uint64_t Stolen = 0;
+    };
+
+    // Work-stealing thread pool. Every worker owns a deque: tasks posted from a worker go to its own deque, tasks
+    // posted from other threads are spread round robin, and a worker whose deque is empty steals from the back of the
+    // others' before it sleeps. Tasks are not ordered with respect to each other; use a Strand for that.
+    class Executor {
+    public:
+        typedef std::move_only_function<void()> Task;
+
+    private:
+        struct Worker {
+            std::mutex Mtx;
+            std::deque<Task> Tasks;
+            std::thread Thread;
+        };
+
+        ExecutorOptions _options;
+        std::vector<std::unique_ptr<Worker>> _workers;
+        std::atomic<size_t> _next = 0;
+        std::atomic<size_t> _queued = 0;
+        std::atomic<size_t> _sleeping = 0;
+        std::atomic<bool> _stopping = false;
+        std::mutex _idleMtx;
+        std::condition_variable _idle;
+        std::atomic<uint64_t> _posted = 0;
+        std::atomic<uint64_t> _executed = 0;
+        std::atomic<uint64_t> _stolen = 0;
+
+        static inline thread_local Executor* t_executor = nullptr;
+        static inline thread_local size_t t_worker = 0;
+
+        bool TryPop(size_t index, Task& task) {
+            auto& own = *_workers[index];
+            {
+                std::lock_guard lock(own.Mtx);
+                if (!own.Tasks.empty()) {
+                    task = std::move(own.Tasks.front());
+                    own.Tasks.pop_front();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < _workers.size(); ++i) {
+                auto& victim = *_workers[(index + i) % _workers.size()];
+                std::lock_guard lock(victim.Mtx);
+                if (!victim.Tasks.empty()) {
+                    task = std::move(victim.Tasks.back());
+                    victim.Tasks.pop_back();
+                    ++_stolen;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void Run(size_t index) {
+            t_executor = this;
+            t_worker = index;
+            Task task;
+            while (true) {
+                if (TryPop(index, task)) {
+                    --_queued;
+                    try {
+                        task();
+                    }
+                    catch (const std::exception& ex) {
+                        std::cerr << "Unhandled exception in executor task: " << ex.what() << std::endl;
+                    }
+                    task = nullptr;
+                    // The task held the last reference to this executor, which is gone now.
+                    if (t_executor != this) return;
+                    ++_executed;
+                    continue;
+                }
+                std::unique_lock lock(_idleMtx);
+                ++_sleeping;
+                _idle.wait(lock, [this]() { return _queued > 0 || _stopping; });
+                --_sleeping;
+                if (_stopping && _queued == 0) return;
+            }
+        }
+
+        void Pin(std::thread& thread, size_t index, const std::vector<int>& cpus) {
+#ifdef __linux__
+            std::string name = _options.Name.substr(0, 11) + "-" + std::to_string(index);
+            pthread_setname_np(thread.native_handle(), name.c_str());
+            if (cpus.empty()) return;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (_options.NumaNode >= 0) for (int cpu : cpus) CPU_SET(cpu, &set);
+            else CPU_SET(cpus[index % cpus.size()], &set);
+            if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0)
+                std::cerr << "Could not set the CPU affinity of executor thread " << index << std::endl;
+#endif
+        }
+
+    public:
+        // CPUs of a NUMA node as listed by the kernel (e.g. "0-3,8-11"); empty when unknown.
+        static std::vector<int> NumaNodeCpus(int node) {
+            std::vector<int> cpus;
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            if (!std::getline(file, list)) return cpus;
+            std::stringstream ranges(list);
+            std::string range;
+            while (std::getline(ranges, range, ',')) {
+                int first = 0, last = 0;
+                int n = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+                if (n < 1) continue;
+                if (n == 1) last = first;
+                for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+            }
+            return cpus;
+        }
+
+        explicit Executor(const ExecutorOptions& options = {}) : _options(options) {
+            std::vector<int> cpus = options.Cpus;
+            if (options.NumaNode >= 0) {
+                cpus = NumaNodeCpus(options.NumaNode);
+                if (cpus.empty()) std::cerr << "Unknown NUMA node " << options.NumaNode << "; executor threads are not pinned" << std::endl;
+            }
+            size_t threads = options.Threads;
+            if (threads == 0) threads = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+            if (threads == 0) threads = 1;
+            for (size_t i = 0; i < threads; ++i) _workers.push_back(std::make_unique<Worker>());
+            for (size_t i = 0; i < threads; ++i) {
+                _workers[i]->Thread = std::thread([this, i]() { Run(i); });
+                Pin(_workers[i]->Thread, i, cpus);
+            }
+        }
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        // Runs what is already queued, then joins the workers. May run on a worker, when a task (a strand, a
+        // subscription) held the last reference: that worker is detached and returns as soon as the task does.
+        ~Executor() {
+            {
+                std::lock_guard lock(_idleMtx);
+                _stopping = true;
+            }
+            _idle.notify_all();
+            bool onWorker = RunningInThisThread();
+            for (auto& w : _workers) {
+                if (onWorker && w->Thread.get_id() == std::this_thread::get_id()) w->Thread.detach();
+                else if (w->Thread.joinable()) w->Thread.join();
+            }
+            if (!onWorker) return;
+            Task task;
+            while (TryPop(t_worker, task)) {
+                try {
+                    task();
+                }
+                catch (const std::exception& ex) {
+                    std::cerr << "Unhandled exception in executor task: " << ex.what() << std::endl;
+                }
+                task = nullptr;
+            }
+            t_executor = nullptr;
+        }
+
+        // Shared by sockets and subscriptions that are not given an executor; created on first use.
+        static std::shared_ptr<Executor> Default() {
+            static std::shared_ptr<Executor> executor = std::make_shared<Executor>();
+            return executor;
+        }
+
+        void Post(Task task) {
+            size_t index = t_executor == this ? t_worker : _next++ % _workers.size();
+            {
+                auto& w = *_workers[index];
+                std::lock_guard lock(w.Mtx);
+                w.Tasks.push_back(std::move(task));
+            }
+            ++_posted;
+            ++_queued;
+            if (_sleeping > 0) {
+                std::lock_guard lock(_idleMtx);
+                _idle.notify_one();
+            }
+        }
+
+        bool RunningInThisThread() const { return t_executor == this; }
+        size_t Threads() const { return _workers.size(); }
+
+        ExecutorStats Stats() const {
+            return ExecutorStats{ _workers.size(), _posted.load(), _executed.load(), _stolen.load() };
+        }
+    };
+
+    // Runs the tasks posted to it one at a time and in post order, on whichever executor thread is free: events of one
+    // stream stay in order while different streams spread across the pool. After Batch tasks a busy strand goes to
+    // the back of the executor's queue so other strands get a turn.
+    class Strand : public std::enable_shared_from_this<Strand> {
+        std::shared_ptr<Executor> _executor;
+        std::mutex _mtx;
+        std::deque<Executor::Task> _tasks;
+        bool _scheduled = false;
+        size_t _batch;
+
+        static inline thread_local const Strand* t_current = nullptr;
+
+        void Schedule() {
+            _executor->Post([self = shared_from_this()]() { self->Run(); });
+        }
+
+        void Run() {
+            auto previous = t_current;
+            t_current = this;
+            for (size_t i = 0; i < _batch; ++i) {
+                Executor::Task task;
+                {
+                    std::lock_guard lock(_mtx);
+                    if (_tasks.empty()) {
+                        _scheduled = false;
+                        t_current = previous;
+                        return;
+                    }
+                    task = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                try {
+                    task();
+                }
+                catch (const std::exception& ex) {
+                    std::cerr << "Unhandled exception in strand task: " << ex.what() << std::endl;
+                }
+            }
+            t_current = previous;
+            Schedule();
+        }
+
+    public:
+        explicit Strand(std::shared_ptr<Executor> executor, size_t batch = 64)
+            : _executor(std::move(executor)), _batch(batch > 0 ? batch : 1) {
+        }
+
+        void Post(Executor::Task task) {
+            {
+                std::lock_guard lock(_mtx);
+                _tasks.push_back(std::move(task));
+                if (_scheduled) return;
+                _scheduled = true;
+            }
+            Schedule();
+        }
+
+        bool RunningInThisThread() const { return t_current == this; }
+        const std::shared_ptr<Executor>& GetExecutor() const { return _executor; }
+    };
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "cppplumberd/flight_recorder.hpp"
+#include "cppplumberd/message_serializer.hpp"
+#include "cppplumberd/cqrs_abstractions.hpp"
+#include "cppplumberd/proto_frame_buffer.hpp"
+#include "cppplumberd/contract.h"
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    // A dump record with its header and payload decoded through the registered message types.
+    struct DecodedFrame {
+        const FlightRecord* Record = nullptr;
+        unique_ptr<google::protobuf::Message> Header;
+        unique_ptr<google::protobuf::Message> Payload;
+        unsigned int PayloadType = 0;
+        string Error;
+
+        TraceContext Trace() const {
+            if (auto h = dynamic_cast<const CommandHeader*>(Header.get())) return TraceContext::FromHeader(h->trace());
+            if (auto h = dynamic_cast<const EventHeader*>(Header.get())) return TraceContext::FromHeader(h->trace());
+            return TraceContext();
+        }
+    };
+
+    class FlightRecordReader {
+        shared_ptr<MessageSerializer> _serializer;
+
+        template<typename THeader, typename TSelector>
+        void DecodeAs(DecodedFrame& d, TSelector typeSelector) const {
+            ProtoFrameBufferView v(_serializer, const_cast<uint8_t*>(d.Record->Frame.data()), d.Record->Frame.size());
+            v.AckWritten(d.Record->Frame.size());
+            MessagePtr payload = nullptr;
+            auto header = v.template Read<THeader>([&d, &typeSelector](THeader& h) {
+                d.PayloadType = typeSelector(h);
+                return d.PayloadType;
+                }, payload);
+            d.Header = std::move(header);
+            d.Payload.reset(payload);
+        }
+
+    public:
+        // 'serializer' must have the application's commands, events and errors registered.
+        explicit FlightRecordReader(shared_ptr<MessageSerializer> serializer) : _serializer(serializer) {
+            _serializer->RegisterMessage<CreateStream, COMMANDS::CREATE_STREAM>();
+        }
+
+        static vector<FlightRecord> Load(const string& path) {
+            ifstream file(path, ios::binary);
+            if (!file) throw runtime_error("Cannot open flight recorder dump: " + path);
+            char magic[sizeof(FlightRecorder::FILE_MAGIC)];
+            if (!file.read(magic, sizeof(magic)) || memcmp(magic, FlightRecorder::FILE_MAGIC, sizeof(magic)) != 0)
+                throw runtime_error("Not a flight recorder dump: " + path);
+            vector<FlightRecord> records;
+            FlightRecordHeader h;
+            while (file.read(reinterpret_cast<char*>(&h), sizeof(h))) {
+                FlightRecord r;
+                r.Kind = static_cast<FrameKind>(h.Kind);
+                r.TimestampNs = h.TimestampNs;
+                r.DurationNs = h.DurationNs;
+                r.Stream.resize(h.StreamSize);
+                r.Frame.resize(h.FrameSize);
+                file.read(r.Stream.data(), h.StreamSize);
+                file.read(reinterpret_cast<char*>(r.Frame.data()), h.FrameSize);
+                if (!file) throw runtime_error("Truncated flight recorder dump: " + path);
+                records.push_back(std::move(r));
+            }
+            return records;
+        }
+
+        // Never throws: frames that cannot be decoded carry the reason in Error.
+        DecodedFrame Decode(const FlightRecord& record) const {
+            DecodedFrame d;
+            d.Record = &record;
+            try {
+                switch (record.Kind) {
+                case FrameKind::COMMAND_SENT:
+                case FrameKind::COMMAND_RECEIVED:
+                    DecodeAs<CommandHeader>(d, [](CommandHeader& h) { return h.command_type(); });
+                    break;
+                case FrameKind::RESPONSE_SENT:
+                case FrameKind::RESPONSE_RECEIVED:
+                    DecodeAs<CommandResponse>(d, [](CommandResponse& h) { return h.response_type(); });
+                    break;
+                case FrameKind::EVENT_PUBLISHED:
+                case FrameKind::EVENT_RECEIVED:
+                    DecodeAs<EventHeader>(d, [](EventHeader& h) { return h.event_type(); });
+                    break;
+                default:
+                    d.Error = "unknown frame kind " + to_string(static_cast<uint32_t>(record.Kind));
+                }
+            }
+            catch (const exception& e) {
+                d.Error = e.what();
+            }
+            return d;
+        }
+
+        static const char* KindName(FrameKind kind) {
+            switch (kind) {
+            case FrameKind::COMMAND_SENT: return "command-sent";
+            case FrameKind::COMMAND_RECEIVED: return "command-received";
+            case FrameKind::RESPONSE_SENT: return "response-sent";
+            case FrameKind::RESPONSE_RECEIVED: return "response-received";
+            case FrameKind::EVENT_PUBLISHED: return "event-published";
+            case FrameKind::EVENT_RECEIVED: return "event-received";
+            }
+            return "unknown";
+        }
+
+        // One line per record: time, kind, stream, duration, header and payload in protobuf text format.
+        void Print(ostream& os, const vector<FlightRecord>& records) const {
+            for (const auto& r : records) {
+                auto d = Decode(r);
+                os << r.TimestampNs << " " << KindName(r.Kind) << " '" << r.Stream << "'";
+                if (r.DurationNs) os << " " << r.DurationNs << "ns";
+                if (d.Header) os << " {" << d.Header->ShortDebugString() << "}";
+                if (d.Payload) os << " " << d.Payload->GetTypeName() << " {" << d.Payload->ShortDebugString() << "}";
+                if (!d.Error.empty()) os << " !" << d.Error;
+                os << "\n";
+            }
+        }
+
+        // Feeds recorded events of the given kind to a dispatcher (e.g. to rebuild a read model as it was).
+        size_t ReplayEvents(const vector<FlightRecord>& records, IEventDispatcher& dispatcher,
+            FrameKind kind = FrameKind::EVENT_PUBLISHED) const {
+            size_t replayed = 0;
+            for (const auto& r : records) {
+                if (r.Kind != kind) continue;
+                auto d = Decode(r);
+                if (!d.Payload) continue;
+                auto header = static_cast<const EventHeader*>(d.Header.get());
+                Metadata m(r.Stream, PublishedAt(*header), d.Trace());
+                dispatcher.Handle(m, d.PayloadType, d.Payload.get());
+                ++replayed;
+            }
+            return replayed;
+        }
+
+        // Re-sends recorded command frames unchanged, e.g. against a staging server.
+        size_t ReplayCommands(const vector<FlightRecord>& records, ITransportReqRspClientSocket& socket,
+            FrameKind kind = FrameKind::COMMAND_RECEIVED) const {
+            ProtoFrameBuffer<64 * 1024> response(_serializer);
+            size_t replayed = 0;
+            for (const auto& r : records) {
+                if (r.Kind != kind) continue;
+                socket.Send(r.Frame.data(), r.Frame.size(), response.Get(), response.FreeBytes());
+                ++replayed;
+            }
+            return replayed;
+        }
+    };
+}
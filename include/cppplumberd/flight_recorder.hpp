@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace cppplumberd {
+
+    using namespace std;
+    using namespace std::chrono;
+
+    enum class FrameKind : uint32_t {
+        COMMAND_SENT = 1,
+        COMMAND_RECEIVED = 2,
+        RESPONSE_SENT = 3,
+        RESPONSE_RECEIVED = 4,
+        EVENT_PUBLISHED = 5,
+        EVENT_RECEIVED = 6,
+    };
+
+    // One captured frame. DurationNs is the handling time (RESPONSE_SENT) or round trip (RESPONSE_RECEIVED).
+    struct FlightRecord {
+        FrameKind Kind;
+        uint64_t TimestampNs = 0;
+        uint64_t DurationNs = 0;
+        string Stream;
+        vector<uint8_t> Frame;
+    };
+
+    // Dump file: FILE_MAGIC, then per record a FlightRecordHeader followed by the stream name and the raw frame.
+    struct FlightRecordHeader {
+        uint32_t Kind;
+        uint32_t StreamSize;
+        uint32_t FrameSize;
+        uint32_t Reserved;
+        uint64_t TimestampNs;
+        uint64_t DurationNs;
+    };
+
+    // Keeps the most recent frames in a fixed byte ring. Writers never block: each frame reserves its bytes
+    // and an index slot with one fetch_add each, and slots are published seqlock-style. Readers (dumps) validate
+    // that a frame was not overwritten while it was copied, so a dump taken under load may miss the oldest frames.
+    class FlightRecorder {
+    public:
+        static constexpr char FILE_MAGIC[8] = { 'C','P','P','L','F','R','1','\0' };
+
+    private:
+        struct Slot {
+            atomic<uint64_t> Seq{ 0 };
+            atomic<uint64_t> Offset{ 0 };
+            atomic<uint32_t> StreamSize{ 0 };
+            atomic<uint32_t> FrameSize{ 0 };
+            atomic<uint32_t> Kind{ 0 };
+            atomic<uint64_t> TimestampNs{ 0 };
+            atomic<uint64_t> DurationNs{ 0 };
+        };
+        struct SlotView {
+            uint64_t Offset;
+            FlightRecordHeader Header;
+        };
+
+        unique_ptr<uint8_t[]> _ring;
+        size_t _capacity;
+        unique_ptr<Slot[]> _slots;
+        size_t _slotCount;
+        atomic<uint64_t> _head{ 0 };
+        atomic<uint64_t> _seq{ 0 };
+        atomic<uint64_t> _dropped{ 0 };
+
+        static size_t RoundUpPow2(size_t v) {
+            size_t p = 1;
+            while (p < v) p <<= 1;
+            return p;
+        }
+        void CopyIn(uint64_t offset, const void* data, size_t size) {
+            size_t pos = offset & (_capacity - 1);
+            size_t first = min(size, _capacity - pos);
+            memcpy(_ring.get() + pos, data, first);
+            memcpy(_ring.get(), static_cast<const uint8_t*>(data) + first, size - first);
+        }
+        void CopyOut(uint64_t offset, void* out, size_t size) const {
+            size_t pos = offset & (_capacity - 1);
+            size_t first = min(size, _capacity - pos);
+            memcpy(out, _ring.get() + pos, first);
+            memcpy(static_cast<uint8_t*>(out) + first, _ring.get(), size - first);
+        }
+        bool IsOverwritten(uint64_t offset) const {
+            return _head.load(memory_order_acquire) > offset + _capacity;
+        }
+        bool ReadSlot(uint64_t index, SlotView& view) const {
+            const Slot& s = _slots[index & (_slotCount - 1)];
+            uint64_t seq = s.Seq.load(memory_order_acquire);
+            if (seq != index + 1) return false;
+            view.Offset = s.Offset.load(memory_order_relaxed);
+            view.Header.Kind = s.Kind.load(memory_order_relaxed);
+            view.Header.StreamSize = s.StreamSize.load(memory_order_relaxed);
+            view.Header.FrameSize = s.FrameSize.load(memory_order_relaxed);
+            view.Header.Reserved = 0;
+            view.Header.TimestampNs = s.TimestampNs.load(memory_order_relaxed);
+            view.Header.DurationNs = s.DurationNs.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            return s.Seq.load(memory_order_relaxed) == seq && !IsOverwritten(view.Offset);
+        }
+        pair<uint64_t, uint64_t> IndexRange() const {
+            uint64_t end = _seq.load(memory_order_acquire);
+            return { end > _slotCount ? end - _slotCount : 0, end };
+        }
+
+        static atomic<FlightRecorder*>& ActiveSlot() {
+            static atomic<FlightRecorder*> active{ nullptr };
+            return active;
+        }
+        // Installed recorders live until process exit so a frame being recorded never touches freed memory.
+        static vector<unique_ptr<FlightRecorder>>& Installed() {
+            static vector<unique_ptr<FlightRecorder>> installed;
+            return installed;
+        }
+
+    public:
+        // 'capacityBytes' is rounded up to a power of two; frames larger than a quarter of it are counted as dropped.
+        explicit FlightRecorder(size_t capacityBytes, size_t averageFrameSize = 128)
+            : _capacity(RoundUpPow2(max<size_t>(capacityBytes, 4096))),
+            _slotCount(RoundUpPow2(max<size_t>(_capacity / max<size_t>(averageFrameSize, 1), 1024))) {
+            _ring = make_unique<uint8_t[]>(_capacity);
+            _slots = make_unique<Slot[]>(_slotCount);
+        }
+
+        static FlightRecorder& Install(size_t capacityBytes, size_t averageFrameSize = 128) {
+            static std::mutex mtx;
+            lock_guard lock(mtx);
+            Installed().push_back(make_unique<FlightRecorder>(capacityBytes, averageFrameSize));
+            ActiveSlot().store(Installed().back().get(), memory_order_release);
+            return *Installed().back();
+        }
+        static void Uninstall() { ActiveSlot().store(nullptr, memory_order_release); }
+        static FlightRecorder* Active() { return ActiveSlot().load(memory_order_acquire); }
+
+        static uint64_t NowNs() {
+            return static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+        }
+
+        size_t Capacity() const { return _capacity; }
+        uint64_t Recorded() const { return _seq.load(memory_order_relaxed); }
+        uint64_t Dropped() const { return _dropped.load(memory_order_relaxed); }
+
+        void Record(FrameKind kind, const string& stream, const uint8_t* frame, size_t size, uint64_t durationNs = 0) {
+            size_t total = stream.size() + size;
+            if (total > _capacity / 4) {
+                _dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            uint64_t timestamp = NowNs();
+            uint64_t offset = _head.fetch_add(total, memory_order_relaxed);
+            CopyIn(offset, stream.data(), stream.size());
+            CopyIn(offset + stream.size(), frame, size);
+
+            uint64_t index = _seq.fetch_add(1, memory_order_relaxed);
+            Slot& s = _slots[index & (_slotCount - 1)];
+            s.Seq.store(0, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            s.Offset.store(offset, memory_order_relaxed);
+            s.StreamSize.store(static_cast<uint32_t>(stream.size()), memory_order_relaxed);
+            s.FrameSize.store(static_cast<uint32_t>(size), memory_order_relaxed);
+            s.Kind.store(static_cast<uint32_t>(kind), memory_order_relaxed);
+            s.TimestampNs.store(timestamp, memory_order_relaxed);
+            s.DurationNs.store(durationNs, memory_order_relaxed);
+            s.Seq.store(index + 1, memory_order_release);
+        }
+
+        // Frames still held by the ring, oldest first.
+        vector<FlightRecord> Snapshot() const {
+            vector<FlightRecord> records;
+            auto [begin, end] = IndexRange();
+            records.reserve(end - begin);
+            for (uint64_t i = begin; i < end; ++i) {
+                SlotView view;
+                if (!ReadSlot(i, view)) continue;
+                FlightRecord r;
+                r.Kind = static_cast<FrameKind>(view.Header.Kind);
+                r.TimestampNs = view.Header.TimestampNs;
+                r.DurationNs = view.Header.DurationNs;
+                r.Stream.resize(view.Header.StreamSize);
+                r.Frame.resize(view.Header.FrameSize);
+                CopyOut(view.Offset, r.Stream.data(), r.Stream.size());
+                CopyOut(view.Offset + r.Stream.size(), r.Frame.data(), r.Frame.size());
+                if (IsOverwritten(view.Offset)) continue;
+                records.push_back(std::move(r));
+            }
+            ranges::stable_sort(records, {}, &FlightRecord::TimestampNs);
+            return records;
+        }
+
+        void Dump(const string& path) const {
+            ofstream file(path, ios::binary | ios::trunc);
+            if (!file) throw runtime_error("Cannot open flight recorder dump: " + path);
+            file.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+            for (const auto& r : Snapshot()) {
+                FlightRecordHeader h{ static_cast<uint32_t>(r.Kind), static_cast<uint32_t>(r.Stream.size()),
+                    static_cast<uint32_t>(r.Frame.size()), 0, r.TimestampNs, r.DurationNs };
+                file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+                file.write(r.Stream.data(), static_cast<streamsize>(r.Stream.size()));
+                file.write(reinterpret_cast<const char*>(r.Frame.data()), static_cast<streamsize>(r.Frame.size()));
+            }
+            if (!file) throw runtime_error("Failed to write flight recorder dump: " + path);
+        }
+
+        // Best-effort dump from a crashing process: no allocation and no check for frames being overwritten.
+        // 'put(data, size)' must be async-signal-safe (e.g. ::write to a file descriptor).
+        template<typename TPut>
+        void DumpRaw(TPut put) const {
+            put(FILE_MAGIC, sizeof(FILE_MAGIC));
+            auto [begin, end] = IndexRange();
+            for (uint64_t i = begin; i < end; ++i) {
+                SlotView view;
+                if (!ReadSlot(i, view)) continue;
+                put(&view.Header, sizeof(view.Header));
+                size_t size = view.Header.StreamSize + view.Header.FrameSize;
+                size_t pos = view.Offset & (_capacity - 1);
+                size_t first = min(size, _capacity - pos);
+                put(_ring.get() + pos, first);
+                put(_ring.get(), size - first);
+            }
+        }
+    };
+
+    // Records a frame on the active flight recorder, if any.
+    inline void RecordFrame(FrameKind kind, const string& stream, const uint8_t* frame, size_t size, uint64_t durationNs = 0) {
+        if (auto recorder = FlightRecorder::Active()) recorder->Record(kind, stream, frame, size, durationNs);
+    }
+}
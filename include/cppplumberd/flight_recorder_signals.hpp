@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "cppplumberd/flight_recorder.hpp"
+
+// Kept out of plumberd.hpp: <csignal> makes the unqualified name 'signal' ambiguous next to boost::signals2.
+namespace cppplumberd {
+
+    // Dump triggers for the active FlightRecorder.
+    class FlightRecorderDumps {
+        static constexpr int MaxSignal = 65;
+
+        // One thread serves every OnSignal registration; handlers only raise a per-signal flag.
+        struct SignalDispatcher {
+            std::atomic<bool> pending[MaxSignal] = {};
+            std::mutex mutex;
+            std::map<int, std::pair<std::string, void (*)(int)>> registrations;
+            std::thread thread;
+            std::atomic<bool> running{ false };
+
+            ~SignalDispatcher() { Stop(); }
+
+            void Start() {
+                if (running.exchange(true)) return;
+                thread = std::thread([this]() { Run(); });
+            }
+            void Stop() {
+                running.store(false);
+                if (thread.joinable()) thread.join();
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto& [signum, registration] : registrations)
+                    std::signal(signum, registration.second);
+                registrations.clear();
+            }
+            void Run() {
+                while (running.load()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    for (int signum = 0; signum < MaxSignal; ++signum) {
+                        if (!pending[signum].exchange(false, std::memory_order_relaxed)) continue;
+                        std::string path;
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            auto it = registrations.find(signum);
+                            if (it == registrations.end()) continue;
+                            path = it->second.first;
+                        }
+                        if (auto recorder = FlightRecorder::Active()) {
+                            try { recorder->Dump(path); }
+                            catch (const std::exception& e) { std::cerr << e.what() << std::endl; }
+                        }
+                    }
+                }
+            }
+        };
+
+        static char* FatalPath() {
+            static char path[512] = { 0 };
+            return path;
+        }
+        static SignalDispatcher& Dispatcher() {
+            static SignalDispatcher dispatcher;
+            return dispatcher;
+        }
+
+    public:
+        // Dumps to 'path' whenever 'signum' (e.g. SIGUSR1) is raised.
+        // The handler only sets a flag; a single background thread writes the file.
+        // Registering the same signal again replaces its path.
+        static void OnSignal(int signum, const std::string& path) {
+            if (signum <= 0 || signum >= MaxSignal)
+                throw std::invalid_argument("Signal number out of range: " + std::to_string(signum));
+            auto& dispatcher = Dispatcher();
+            {
+                std::lock_guard<std::mutex> lock(dispatcher.mutex);
+                auto it = dispatcher.registrations.find(signum);
+                if (it != dispatcher.registrations.end()) {
+                    it->second.first = path;
+                }
+                else {
+                    auto previous = std::signal(signum, [](int sig) {
+                        Dispatcher().pending[sig].store(true, std::memory_order_relaxed);
+                    });
+                    dispatcher.registrations.emplace(signum, std::make_pair(path, previous == SIG_ERR ? SIG_DFL : previous));
+                }
+            }
+            dispatcher.Start();
+        }
+
+        // Stops the dispatcher thread and restores the handlers OnSignal replaced.
+        static void StopSignals() {
+            Dispatcher().Stop();
+        }
+
+        // Dumps to 'path' on std::terminate and, on POSIX, on fatal signals before the process dies.
+        static void OnFatal(const std::string& path) {
+            strncpy(FatalPath(), path.c_str(), 511);
+            static std::terminate_handler previous = std::set_terminate([]() {
+                if (auto recorder = FlightRecorder::Active()) {
+                    try { recorder->Dump(FatalPath()); }
+                    catch (...) {}
+                }
+                if (previous) previous();
+                std::abort();
+            });
+#ifndef _WIN32
+            for (int sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT }) {
+                std::signal(sig, [](int s) {
+                    if (auto recorder = FlightRecorder::Active()) {
+                        int fd = ::open(FatalPath(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                        if (fd >= 0) {
+                            recorder->DumpRaw([fd](const void* data, size_t size) {
+                                auto p = static_cast<const uint8_t*>(data);
+                                while (size > 0) {
+                                    auto n = ::write(fd, p, size);
+                                    if (n <= 0) return;
+                                    p += n;
+                                    size -= static_cast<size_t>(n);
+                                }
+                            });
+                            ::close(fd);
+                        }
+                    }
+                    std::signal(s, SIG_DFL);
+                    std::raise(s);
+                });
+            }
+#endif
+        }
+    };
+}
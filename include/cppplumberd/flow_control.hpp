@@ -0,0 +1,169 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cppplumberd {
+
+    // What a subscriber queue does with a new event when it is at capacity.
+    enum class FlowControl : int {
+        BLOCK = 1,          // the producer waits for space
+        DROP_OLDEST = 2,    // the oldest pending event is dropped
+        DROP_NEWEST = 3,    // the new event is dropped
+        CONFLATE = 4,       // pending events are replaced by newer ones with the same key; capacity is not enforced
+        DISCONNECT = 5      // the subscriber is cut off and no longer receives events
+    };
+
+    struct FlowControlPolicy {
+        FlowControl Mode = FlowControl::BLOCK;
+        size_t Capacity = 1024;      // 0: unbounded
+        // A subscriber is reported slow once this many events are pending (0: at capacity), and is reported again
+        // only after its queue has drained below half of it.
+        size_t SlowAfter = 0;
+    };
+
+    struct SubscriptionStats {
+        uint64_t Received = 0;
+        uint64_t Delivered = 0;
+        // Dropped by the policy, replaced by a newer event with the same key, and missed on the wire
+        // (gaps in the publisher's sequence numbers, for remote subscriptions).
+        uint64_t Dropped = 0;
+        uint64_t Conflated = 0;
+        uint64_t Lost = 0;
+        size_t Pending = 0;
+        size_t MaxPending = 0;
+        uint64_t SlowEpisodes = 0;
+        bool Slow = false;
+        bool Disconnected = false;
+    };
+
+    // Queue between a producer (publisher or receive thread) and a subscriber's dispatch thread, applying a
+    // FlowControlPolicy when the subscriber falls behind. Keys are only used in CONFLATE mode, where a value pushed
+    // with a key that is still pending replaces the pending value in place; an empty key is never conflated.
+    template<typename T>
+    class FlowControlQueue {
+    public:
+        struct Item {
+            std::string Key;
+            T Value;
+        };
+        enum class Result : int { QUEUED, CONFLATED, DROPPED, DISCONNECTED };
+
+    private:
+        FlowControlPolicy _policy;
+        size_t _slowAfter;
+        mutable std::mutex _mtx;
+        std::condition_variable _readable;
+        std::condition_variable _writable;
+        std::list<Item> _pending;
+        std::unordered_map<std::string, typename std::list<Item>::iterator> _index;
+        bool _closed = false;
+        SubscriptionStats _stats;
+
+        bool Full() const {
+            return _policy.Capacity > 0 && _pending.size() >= _policy.Capacity;
+        }
+
+        void Append(std::string&& key, T&& value) {
+            _pending.push_back(Item{ std::move(key), std::move(value) });
+            if (_policy.Mode == FlowControl::CONFLATE && !_pending.back().Key.empty())
+                _index.emplace(_pending.back().Key, std::prev(_pending.end()));
+            _stats.MaxPending = std::max(_stats.MaxPending, _pending.size());
+        }
+
+    public:
+        explicit FlowControlQueue(FlowControlPolicy policy = {})
+            : _policy(policy), _slowAfter(policy.SlowAfter > 0 ? policy.SlowAfter : policy.Capacity) {
+        }
+
+        const FlowControlPolicy& Policy() const { return _policy; }
+
+        // 'report' is set when this push made the subscriber slow (once per episode) or disconnected it.
+        Result Push(std::string key, T value, bool* report = nullptr) {
+            Result result = Result::QUEUED;
+            {
+                std::unique_lock lock(_mtx);
+                if (_stats.Disconnected || _closed) return Result::DISCONNECTED;
+                ++_stats.Received;
+                if (_policy.Mode == FlowControl::CONFLATE && !key.empty()) {
+                    auto it = _index.find(key);
+                    if (it != _index.end()) {
+                        it->second->Value = std::move(value);
+                        ++_stats.Conflated;
+                        return Result::CONFLATED;
+                    }
+                }
+                if (_policy.Mode != FlowControl::CONFLATE && Full()) {
+                    switch (_policy.Mode) {
+                    case FlowControl::BLOCK:
+                        _writable.wait(lock, [this]() { return !Full() || _closed; });
+                        if (_closed) return Result::DISCONNECTED;
+                        break;
+                    case FlowControl::DROP_OLDEST:
+                        _pending.pop_front();
+                        ++_stats.Dropped;
+                        result = Result::DROPPED;
+                        break;
+                    case FlowControl::DROP_NEWEST:
+                        ++_stats.Dropped;
+                        return Result::DROPPED;
+                    case FlowControl::DISCONNECT:
+                    default:
+                        _stats.Disconnected = true;
+                        ++_stats.Dropped;
+                        _pending.clear();
+                        _closed = true;
+                        if (report) *report = true;
+                        lock.unlock();
+                        _readable.notify_all();
+                        return Result::DISCONNECTED;
+                    }
+                }
+                Append(std::move(key), std::move(value));
+                if (!_stats.Slow && _slowAfter > 0 && _pending.size() >= _slowAfter) {
+                    _stats.Slow = true;
+                    ++_stats.SlowEpisodes;
+                    if (report) *report = true;
+                }
+            }
+            _readable.notify_one();
+            return result;
+        }
+
+        // Blocks until something is pending, then moves everything pending into 'out' (in push order).
+        // Returns false once the queue is closed and drained.
+        bool WaitAndTake(std::list<Item>& out) {
+            {
+                std::unique_lock lock(_mtx);
+                _readable.wait(lock, [this]() { return !_pending.empty() || _closed; });
+                if (_pending.empty()) return false;
+                _stats.Delivered += _pending.size();
+                out.splice(out.end(), _pending);
+                _index.clear();
+                if (_stats.Slow && out.size() < _slowAfter / 2 + 1) _stats.Slow = false;
+            }
+            _writable.notify_all();
+            return true;
+        }
+
+        void Close() {
+            {
+                std::lock_guard lock(_mtx);
+                _closed = true;
+            }
+            _readable.notify_all();
+            _writable.notify_all();
+        }
+
+        SubscriptionStats Stats() const {
+            std::lock_guard lock(_mtx);
+            SubscriptionStats stats = _stats;
+            stats.Pending = _pending.size();
+            return stats;
+        }
+    };
+}
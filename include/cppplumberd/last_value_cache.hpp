@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "cppplumberd/tracing.hpp"
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    struct LastValueCacheStats {
+        size_t Streams = 0;
+        size_t Keys = 0;
+        size_t Bytes = 0;
+        uint64_t Updates = 0;
+        uint64_t Snapshots = 0;
+    };
+
+    // Latest event per (stream, key) for state-like streams, where the key is extracted from the event by a
+    // user-supplied function (e.g. "element.property"). New subscribers get the snapshot first, then live events,
+    // instead of replaying the stream's history. Events of types without a key function are not cached.
+    class LastValueCache {
+        typedef std::function<std::string(const google::protobuf::Message&)> KeyFunction;
+
+        struct Stream {
+            std::unordered_map<unsigned int, KeyFunction> Keys;
+            std::map<std::string, RecordedEvent> Values;
+        };
+
+        mutable std::mutex _mtx;
+        std::unordered_map<std::string, Stream> _streams;
+        // Publishing on untracked streams only reads this.
+        std::atomic<size_t> _tracked = 0;
+        LastValueCacheStats _stats;
+
+        static size_t SizeOf(const std::string& key, const RecordedEvent& e) {
+            return key.capacity() + e.SpaceUsedLong();
+        }
+
+    public:
+        void Track(const std::string& stream, unsigned int eventType, KeyFunction key) {
+            std::lock_guard lock(_mtx);
+            _streams[stream].Keys[eventType] = std::move(key);
+            _tracked = _streams.size();
+        }
+
+        bool Tracks(const std::string& stream) const {
+            if (_tracked == 0) return false;
+            std::lock_guard lock(_mtx);
+            return _streams.contains(stream);
+        }
+
+        // Replaces the value stored under the event's key, unless the stored one is from a later log position (its
+        // publisher got to the cache first).
+        void Update(const std::string& stream, unsigned int eventType, const google::protobuf::Message& evt,
+            const TraceContext& trace, uint64_t version = 0, uint64_t position = 0) {
+            std::lock_guard lock(_mtx);
+            auto s = _streams.find(stream);
+            if (s == _streams.end()) return;
+            auto key = s->second.Keys.find(eventType);
+            if (key == s->second.Keys.end()) return;
+
+            auto [it, added] = s->second.Values.try_emplace(key->second(evt));
+            auto& e = it->second;
+            if (!added && position != 0 && position < e.position()) return;
+            if (!added) _stats.Bytes -= SizeOf(it->first, e);
+            e.set_position(position);
+            e.set_version(version);
+            e.set_stream(stream);
+            e.set_event_type(eventType);
+            e.set_timestamp(Tracer::NowNs());
+            trace.WriteTo(*e.mutable_trace());
+            // Reuses the previous value's buffer.
+            evt.SerializeToString(e.mutable_data());
+            _stats.Bytes += SizeOf(it->first, e);
+            ++_stats.Updates;
+        }
+
+        // Current values of 'stream' ordered by key; empty for untracked streams.
+        LastValueSnapshot Snapshot(const std::string& stream) {
+            LastValueSnapshot snapshot;
+            snapshot.set_stream(stream);
+            std::lock_guard lock(_mtx);
+            auto s = _streams.find(stream);
+            if (s == _streams.end()) return snapshot;
+            snapshot.mutable_events()->Reserve(static_cast<int>(s->second.Values.size()));
+            for (const auto& [key, e] : s->second.Values) *snapshot.add_events() = e;
+            ++_stats.Snapshots;
+            return snapshot;
+        }
+
+        void Erase(const std::string& stream, const std::string& key) {
+            std::lock_guard lock(_mtx);
+            auto s = _streams.find(stream);
+            if (s == _streams.end()) return;
+            auto it = s->second.Values.find(key);
+            if (it == s->second.Values.end()) return;
+            _stats.Bytes -= SizeOf(it->first, it->second);
+            s->second.Values.erase(it);
+        }
+
+        LastValueCacheStats Stats() const {
+            std::lock_guard lock(_mtx);
+            LastValueCacheStats stats = _stats;
+            stats.Streams = _streams.size();
+            for (const auto& [name, s] : _streams) stats.Keys += s.Values.size();
+            return stats;
+        }
+    };
+}
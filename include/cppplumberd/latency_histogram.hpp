@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include "cppplumberd/cqrs_abstractions.hpp"
+
+namespace cppplumberd {
+
+    // Log-linear histogram of nanosecond values: 16 linear sub-buckets per power of two (~6% precision),
+    // fixed 8KB footprint, O(1) Record. Not synchronized - keep one per recording thread and Merge.
+    class LatencyHistogram {
+    public:
+        static constexpr unsigned SUB_BUCKET_BITS = 4;
+        static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+        static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    private:
+        std::array<uint64_t, BUCKETS> _counts{};
+        uint64_t _count = 0;
+        uint64_t _min = UINT64_MAX;
+        uint64_t _max = 0;
+        long double _sum = 0;
+
+        static constexpr size_t IndexOf(uint64_t value) {
+            if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+            unsigned msb = 63u - static_cast<unsigned>(std::countl_zero(value));
+            unsigned shift = msb - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+        }
+        // Highest value that falls into the bucket, so percentiles never under-report.
+        static constexpr uint64_t UpperBoundOf(size_t index) {
+            if (index < SUB_BUCKETS) return index;
+            unsigned shift = static_cast<unsigned>(index / SUB_BUCKETS) - 1;
+            uint64_t base = (SUB_BUCKETS | (index & (SUB_BUCKETS - 1))) << shift;
+            return base + ((uint64_t(1) << shift) - 1);
+        }
+
+    public:
+        inline void Record(uint64_t valueNs) {
+            ++_counts[IndexOf(valueNs)];
+            ++_count;
+            _sum += valueNs;
+            if (valueNs < _min) _min = valueNs;
+            if (valueNs > _max) _max = valueNs;
+        }
+        inline void Record(std::chrono::nanoseconds value) {
+            Record(value.count() > 0 ? static_cast<uint64_t>(value.count()) : 0);
+        }
+
+        void Merge(const LatencyHistogram& other) {
+            for (size_t i = 0; i < BUCKETS; ++i) _counts[i] += other._counts[i];
+            _count += other._count;
+            _sum += other._sum;
+            if (other._min < _min) _min = other._min;
+            if (other._max > _max) _max = other._max;
+        }
+
+        void Reset() { *this = LatencyHistogram(); }
+
+        uint64_t Count() const { return _count; }
+        uint64_t Min() const { return _count ? _min : 0; }
+        uint64_t Max() const { return _max; }
+        double Mean() const { return _count ? static_cast<double>(_sum / _count) : 0.0; }
+
+        // Value (ns) at the given percentile in [0, 100].
+        uint64_t Percentile(double percentile) const {
+            if (_count == 0) return 0;
+            auto rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(_count));
+            if (rank >= _count) rank = _count - 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                seen += _counts[i];
+                if (seen > rank) return UpperBoundOf(i) < _max ? UpperBoundOf(i) : _max;
+            }
+            return _max;
+        }
+    };
+
+    // Per-hop latency of received events, fed from Metadata::Hops():
+    // publish -> wire-send -> receive -> dispatch.
+    class HopLatencyRecorder {
+        LatencyHistogram _publishToSend;
+        LatencyHistogram _sendToReceive;
+        LatencyHistogram _receiveToDispatch;
+        LatencyHistogram _publishToDispatch;
+
+    public:
+        inline void Record(const Metadata& metadata) {
+            const auto& hops = metadata.Hops();
+            if (metadata.HasHopStamps()) {
+                _publishToSend.Record(hops.Sent - hops.Published);
+                _sendToReceive.Record(hops.Received - hops.Sent);
+            }
+            if (hops.Dispatched.time_since_epoch().count() == 0) return;
+            _receiveToDispatch.Record(hops.Dispatched - hops.Received);
+            _publishToDispatch.Record(hops.Dispatched - hops.Published);
+        }
+
+        void Merge(const HopLatencyRecorder& other) {
+            _publishToSend.Merge(other._publishToSend);
+            _sendToReceive.Merge(other._sendToReceive);
+            _receiveToDispatch.Merge(other._receiveToDispatch);
+            _publishToDispatch.Merge(other._publishToDispatch);
+        }
+
+        const LatencyHistogram& PublishToSend() const { return _publishToSend; }
+        const LatencyHistogram& SendToReceive() const { return _sendToReceive; }
+        const LatencyHistogram& ReceiveToDispatch() const { return _receiveToDispatch; }
+        const LatencyHistogram& PublishToDispatch() const { return _publishToDispatch; }
+    };
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cppplumberd {
+
+    template<typename Signature>
+    class ListenerList;
+
+    // Handle returned by ListenerList::connect; may outlive the list.
+    class ListenerConnection {
+        std::function<void()> _disconnect;
+        std::shared_ptr<std::atomic<bool>> _connected;
+    public:
+        ListenerConnection() = default;
+        ListenerConnection(std::function<void()> disconnect, std::shared_ptr<std::atomic<bool>> connected)
+            : _disconnect(std::move(disconnect)), _connected(std::move(connected)) {
+        }
+        bool connected() const { return _connected && *_connected; }
+        void disconnect() {
+            if (connected() && _disconnect) _disconnect();
+        }
+    };
+
+    // Multi-listener callback for hot paths, with the connect/invoke surface of boost::signals2::signal. Invoking loads
+    // one atomic pointer to an immutable array of listeners and calls them in connection order: no lock, no slot
+    // tracking. connect/disconnect copy the array under a mutex and publish the copy. Superseded arrays are kept until
+    // the list is destroyed instead of being reclaimed under a concurrent invocation; listeners are wired up when a
+    // socket is created, so that is a handful of arrays, not one per message. An invocation that already started may
+    // still call a listener that is being disconnected.
+    template<typename... Args>
+    class ListenerList<void(Args...)> {
+        struct Listener {
+            uint64_t Id;
+            std::function<void(Args...)> Fn;
+            std::shared_ptr<std::atomic<bool>> Connected;
+        };
+        typedef std::vector<Listener> Listeners;
+
+        struct State {
+            std::atomic<const Listeners*> Current = nullptr;
+            std::mutex Mtx;
+            std::vector<std::unique_ptr<const Listeners>> Versions;
+            uint64_t NextId = 0;
+
+            void Publish(std::unique_ptr<const Listeners> next) {
+                Current.store(next.get(), std::memory_order_release);
+                Versions.push_back(std::move(next));
+            }
+            void Remove(uint64_t id) {
+                std::lock_guard lock(Mtx);
+                auto next = std::make_unique<Listeners>();
+                if (auto current = Current.load(std::memory_order_relaxed))
+                    for (const auto& l : *current) if (l.Id != id) next->push_back(l);
+                Publish(std::move(next));
+            }
+        };
+
+        std::shared_ptr<State> _state = std::make_shared<State>();
+
+    public:
+        ListenerList() = default;
+        ListenerList(const ListenerList&) = delete;
+        ListenerList& operator=(const ListenerList&) = delete;
+
+        template<typename TFunc>
+        ListenerConnection connect(TFunc&& fn) {
+            auto connected = std::make_shared<std::atomic<bool>>(true);
+            uint64_t id;
+            {
+                std::lock_guard lock(_state->Mtx);
+                id = ++_state->NextId;
+                auto next = std::make_unique<Listeners>();
+                if (auto current = _state->Current.load(std::memory_order_relaxed)) *next = *current;
+                next->push_back(Listener{ id, std::function<void(Args...)>(std::forward<TFunc>(fn)), connected });
+                _state->Publish(std::move(next));
+            }
+            std::weak_ptr<State> weak = _state;
+            return ListenerConnection([weak, id, connected]() {
+                if (!connected->exchange(false)) return;
+                if (auto state = weak.lock()) state->Remove(id);
+            }, connected);
+        }
+
+        void disconnect_all_slots() {
+            std::lock_guard lock(_state->Mtx);
+            if (auto current = _state->Current.load(std::memory_order_relaxed))
+                for (const auto& l : *current) *l.Connected = false;
+            _state->Publish(std::make_unique<Listeners>());
+        }
+
+        size_t num_slots() const {
+            auto current = _state->Current.load(std::memory_order_acquire);
+            return current ? current->size() : 0;
+        }
+        bool empty() const { return num_slots() == 0; }
+
+        // Keeps the listeners alive for the call, as a listener may destroy the object that owns the list.
+        inline void operator()(Args... args) const {
+            auto state = _state;
+            auto current = state->Current.load(std::memory_order_acquire);
+            if (!current) return;
+            for (const auto& l : *current) l.Fn(args...);
+        }
+    };
+}
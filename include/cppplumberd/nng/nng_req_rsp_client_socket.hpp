@@ -44,25 +44,30 @@ namespace cppplumberd {
             _connected = true;
             cout << "connected to: " << url << endl;
         }
+        // A timed out request is abandoned: req0 drops its late reply when the next request goes out.
+        void SetTimeout(milliseconds timeout) override {
+            int ms = timeout.count() > 0 ? static_cast<int>(timeout.count()) : -1;
+            _socket.set_opt_ms(nng::to_name(nng::option::send_timeout), ms);
+            _socket.set_opt_ms(nng::to_name(nng::option::recv_timeout), ms);
+        }
         size_t Send(const uint8_t* inBuf, const size_t inSize, uint8_t* outBuf, const size_t outMaxBufSize) override {
             if (!_connected) {
                 throw runtime_error("Socket not connected");
             }
 
-            nng::view view(inBuf, inSize);
-            _socket.send(view);
-
-            nng::view outView(outBuf, outMaxBufSize);
             try {
-                auto result = _socket.recv(outView);
+                nng::view view(inBuf, inSize);
+                _socket.send(view);
 
-                return result;
+                nng::view outView(outBuf, outMaxBufSize);
+                return _socket.recv(outView);
             }
-            catch (std::exception &e)
+            catch (const nng::exception &e)
             {
-				// Handle the exception
+                if (e.get_error() == nng::error::timedout)
+                    throw TimeoutException("No reply from " + _url + " in time");
 				cerr << "Error receiving data: " << e.what() << endl;
-                throw;
+                throw TransportException(string("Request to ") + _url + " failed: " + e.what());
             }
         }
 
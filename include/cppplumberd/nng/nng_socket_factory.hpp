@@ -19,6 +19,7 @@ namespace cppplumberd {
     class NggSocketFactory : public ISocketFactory {
     private:
         string _rootUrl;
+        shared_ptr<Executor> _executor;
 
         string GetFullUrl(const string& endpoint) const {
             return _rootUrl + "/" + endpoint;
@@ -34,8 +35,9 @@ namespace cppplumberd {
         }
 
     public:
-        explicit NggSocketFactory(string defaultUrl = "ipc:///tmp/cppplumberd")
-            : _rootUrl(std::move(defaultUrl)) {
+        // Subscribe sockets deliver messages on 'executor' (Executor::Default() when null).
+        explicit NggSocketFactory(string defaultUrl = "ipc:///tmp/cppplumberd", shared_ptr<Executor> executor = nullptr)
+            : _rootUrl(std::move(defaultUrl)), _executor(std::move(executor)) {
             EnsureDirectoryExists(_rootUrl);
         }
 
@@ -45,7 +47,7 @@ namespace cppplumberd {
         }
 
         unique_ptr<ITransportSubscribeSocket> CreateSubscribeSocket(const string& endpoint) override {
-            auto socket = make_unique<NngSubscribeSocket>(GetFullUrl(endpoint));
+            auto socket = make_unique<NngSubscribeSocket>(GetFullUrl(endpoint), _executor);
             return socket;
         }
 
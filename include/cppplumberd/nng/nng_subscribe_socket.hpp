@@ -2,65 +2,110 @@
 
 #include <string>
 #include <memory>
-#include <thread>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <nngpp/nngpp.h>
 #include <nngpp/protocol/sub0.h>
 #include <nngpp/protocol/req0.h>
+#include "cppplumberd/executor.hpp"
 #include "cppplumberd/transport_interfaces.hpp"
 
 namespace cppplumberd {
 
     using namespace std;
 
-    // NNG implementation for Subscribe socket using nngpp - with API fixes
+    // NNG implementation for Subscribe socket. Receives asynchronously (nng aio) instead of parking a thread per
+    // socket in recv: each message is handed to an executor thread, and the next receive is armed once Received has
+    // returned, so messages are delivered one at a time and in order while the socket's own buffer absorbs bursts.
     class NngSubscribeSocket : public ITransportSubscribeSocket {
     private:
         string _url;
         nng::socket _socket;
         bool _connected = false;
-        thread _recvThread;
-        constexpr static unsigned long long BUFFER_SIZE = 1024 * 64;
+        shared_ptr<Executor> _executor;
+        nng_aio* _aio = nullptr;
         atomic<bool> _running{ false };
 
-        void ReceiveLoop() {
-            while (_running) {
+        // Shared with the delivery tasks, which outlive the socket when they are still queued on the executor or
+        // when a handler destroyed it. Thread is the one running Received, if any.
+        struct Delivery {
+            std::mutex Mtx;
+            condition_variable Done;
+            thread::id Thread;
+            bool SocketDestroyed = false;
+        };
+        shared_ptr<Delivery> _delivery = make_shared<Delivery>();
+
+        struct MsgDeleter {
+            void operator()(nng_msg* msg) const { nng_msg_free(msg); }
+        };
+
+        void Receive() {
+            nng_recv_aio(_socket.get(), _aio);
+        }
+
+        static void OnReceived(void* arg) {
+            auto self = static_cast<NngSubscribeSocket*>(arg);
+            int rv = nng_aio_result(self->_aio);
+            if (rv != 0) {
+                if (rv == NNG_ECLOSED || rv == NNG_ECANCELED || !self->_running) return;
+                self->Receive();
+                return;
+            }
+            unique_ptr<nng_msg, MsgDeleter> msg(nng_aio_get_msg(self->_aio));
+            if (!self->_running) return;
+            self->_executor->Post([self, delivery = self->_delivery, msg = std::move(msg)]() mutable {
+                {
+                    lock_guard lock(delivery->Mtx);
+                    if (delivery->SocketDestroyed) return;
+                    delivery->Thread = this_thread::get_id();
+                }
                 try {
-					uint8_t buf[BUFFER_SIZE];
-                    auto rec = _socket.recv(nng::view(buf, BUFFER_SIZE));
-                    
-                    Received(buf, rec);
+                    self->Received(static_cast<uint8_t*>(nng_msg_body(msg.get())), nng_msg_len(msg.get()));
                 }
-                catch (const nng::exception& e) {
-                    if (!_running) {
-                        break;
-                    }
-                    if (e.get_error() == nng::error::timedout) {
-                        continue;
-                    }
-                	throw;
+                catch (const std::exception& ex) {
+                    cerr << "Error receiving: " << ex.what() << endl;
                 }
-            }
+                msg.reset();
+                {
+                    lock_guard lock(delivery->Mtx);
+                    delivery->Thread = thread::id();
+                    // A handler that destroyed its own socket: nothing of it may be touched any more.
+                    if (!delivery->SocketDestroyed && self->_running) self->Receive();
+                }
+                delivery->Done.notify_all();
+            });
         }
 
     public:
-        NngSubscribeSocket(const string &url) : _url(url) {
+        NngSubscribeSocket(const string &url, shared_ptr<Executor> executor = nullptr)
+            : _url(url), _executor(executor ? std::move(executor) : Executor::Default()) {
             
             _socket = nng::sub::open();
-            //_socket = nng::req::open();
             // Subscribe to everything
-            //nng::sub::set_opt_subscribe(_socket, "");
             nng_setopt(_socket.get(), NNG_OPT_SUB_SUBSCRIBE, "", 0);
-            _socket.set_opt_ms(nng::to_name(nng::option::recv_timeout), 100);
+            if (nng_aio_alloc(&_aio, &NngSubscribeSocket::OnReceived, this) != 0)
+                throw runtime_error("Could not allocate the receive aio for " + url);
+            nng_aio_set_timeout(_aio, NNG_DURATION_INFINITE);
         }
 
+        // Cancels the pending receive and waits for a message being delivered, unless it is called from that
+        // delivery (a handler dropping its own subscription). A message still queued on the executor is dropped by
+        // its task rather than waited for: it may be queued behind the thread running this destructor.
         ~NngSubscribeSocket() override {
-            if (_running) {
-                _running = false;
-                if (_recvThread.joinable()) {
-                    _recvThread.join();
-                }
+            _running = false;
+            nng_aio_stop(_aio);
+            {
+                unique_lock lock(_delivery->Mtx);
+                _delivery->SocketDestroyed = true;
+                auto current = this_thread::get_id();
+                _delivery->Done.wait(lock, [this, current]() {
+                    return _delivery->Thread == thread::id() || _delivery->Thread == current;
+                });
             }
+            nng_aio_free(_aio);
         }
         void Start() override
         {
@@ -81,9 +126,8 @@ namespace cppplumberd {
 
             _connected = true;
 
-            // Start receive thread
             _running = true;
-            _recvThread = thread(&NngSubscribeSocket::ReceiveLoop, this);
+            Receive();
         }
     };
-}
\ No newline at end of file
+}
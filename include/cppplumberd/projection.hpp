@@ -0,0 +1,270 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "cppplumberd/checkpoint_store.hpp"
+#include "cppplumberd/event_handler_base.hpp"
+#include "cppplumberd/event_log.hpp"
+#include "cppplumberd/message_serializer.hpp"
+
+namespace cppplumberd {
+
+    // Checkpoints are committed after 'CheckpointEvery' log positions and/or 'CheckpointInterval' (0 disables either),
+    // and always when the projection stops.
+    struct ProjectionOptions {
+        size_t BatchSize = 1024;
+        uint64_t CheckpointEvery = 10000;
+        std::chrono::milliseconds CheckpointInterval{ 1000 };
+        std::chrono::milliseconds IdleWait{ 100 };
+        // Only streams in partition 'Partition' of 'Partitions'; set by PartitionedProjection.
+        size_t Partitions = 1;
+        size_t Partition = 0;
+    };
+
+    // Stable across processes (no per-process seed), so partitioned checkpoints stay valid after a restart.
+    // Hashes 8 bytes per step and maps to [0, partitions) by multiply-shift instead of a division: partitioning
+    // runs for every event in every partition.
+    inline size_t StreamPartition(const std::string& stream, size_t partitions) {
+        constexpr uint64_t k = 0x9E3779B97F4A7C15ull;
+        uint64_t hash = stream.size() * k;
+        size_t i = 0;
+        for (; i + 8 <= stream.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, stream.data() + i, 8);
+            hash = (hash ^ word) * k;
+            hash ^= hash >> 29;
+        }
+        uint64_t tail = 0;
+        for (; i < stream.size(); ++i) tail = (tail << 8) | static_cast<unsigned char>(stream[i]);
+        hash = (hash ^ tail) * k;
+        hash ^= hash >> 32;
+        return static_cast<size_t>(((hash & 0xFFFFFFFFull) * partitions) >> 32);
+    }
+
+    struct ProjectionStats {
+        uint64_t Position = 0;
+        uint64_t Checkpoint = 0;
+        uint64_t Head = 0;
+        // Log positions not yet processed, and how long ago the oldest of them was appended.
+        uint64_t Lag = 0;
+        std::chrono::nanoseconds TimeLag{ 0 };
+        uint64_t Processed = 0;
+        uint64_t Checkpoints = 0;
+    };
+
+    // Runs an EventHandlerBase over the event log from its last checkpoint: all streams, or only 'streams' when given.
+    // Events the handler has not mapped are skipped without being deserialized.
+    class Projection {
+        struct Pending {
+            Metadata Meta;
+            unsigned int EventType;
+            std::unique_ptr<google::protobuf::Message> Message;
+        };
+
+        std::string _name;
+        shared_ptr<IEventLog> _log;
+        shared_ptr<MessageSerializer> _serializer;
+        shared_ptr<EventHandlerBase> _handler;
+        shared_ptr<ICheckpointStore> _checkpoints;
+        std::unordered_set<std::string> _streams;
+        ProjectionOptions _options;
+
+        std::vector<Pending> _batch;
+        std::atomic<uint64_t> _position;
+        std::atomic<uint64_t> _checkpoint;
+        std::atomic<uint64_t> _processed = 0;
+        std::atomic<uint64_t> _checkpointsSaved = 0;
+        std::chrono::steady_clock::time_point _checkpointTime = std::chrono::steady_clock::now();
+
+        std::atomic<bool> _running = false;
+        std::atomic<bool> _faulted = false;
+        std::thread _worker;
+
+        void Run() {
+            try {
+                while (_running) {
+                    if (Step() == 0) _log->WaitForAppend(_position, _options.IdleWait);
+                }
+            }
+            catch (const exception& e) {
+                _faulted = true;
+                cerr << "Projection '" << _name << "' stopped at " << _position << ": " << e.what() << endl;
+            }
+        }
+
+        void MaybeCheckpoint() {
+            uint64_t position = _position;
+            bool byCount = _options.CheckpointEvery > 0 && position - _checkpoint >= _options.CheckpointEvery;
+            bool byTime = _options.CheckpointInterval.count() > 0
+                && std::chrono::steady_clock::now() - _checkpointTime >= _options.CheckpointInterval;
+            if (byCount || byTime) Checkpoint();
+        }
+
+    public:
+        Projection(const std::string& name, shared_ptr<IEventLog> log, shared_ptr<MessageSerializer> serializer,
+            shared_ptr<EventHandlerBase> handler, shared_ptr<ICheckpointStore> checkpoints,
+            const std::vector<std::string>& streams = {}, ProjectionOptions options = {})
+            : _name(name), _log(log), _serializer(serializer), _handler(handler), _checkpoints(checkpoints),
+            _streams(streams.begin(), streams.end()), _options(options) {
+            if (!_log || !_serializer || !_handler || !_checkpoints) {
+                throw invalid_argument("Projection requires an event log, serializer, handler and checkpoint store");
+            }
+            if (_options.Partition >= _options.Partitions) throw invalid_argument("Partition out of range");
+            _checkpoint = _position = _checkpoints->Load(_name);
+            _batch.reserve(_options.BatchSize);
+        }
+        ~Projection() { Stop(); }
+
+        const std::string& Name() const { return _name; }
+        bool IsFaulted() const { return _faulted; }
+        // Last log position processed; a query handler over this read model can report it as its Position().
+        uint64_t Position() const { return _position; }
+
+        // Processes up to one batch; returns how many log positions were consumed. Not to be mixed with Start().
+        // If the handler throws, the position stops just before the failing event, so the next Step retries it
+        // without re-applying the ones already handled.
+        size_t Step() {
+            uint64_t last = _position;
+            _batch.clear();
+            size_t read = _log->ReadAll(last + 1, _options.BatchSize, [this, &last](const RecordedEvent& e) {
+                last = e.position();
+                if (!_streams.empty() && !_streams.contains(e.stream())) return;
+                if (_options.Partitions > 1 && StreamPartition(e.stream(), _options.Partitions) != _options.Partition) return;
+                if (!_handler->Handles(e.event_type())) return;
+                _batch.push_back(Pending{ Metadata(e), e.event_type(),
+                    std::unique_ptr<google::protobuf::Message>(_serializer->Deserialize(e.data(), e.event_type())) });
+            });
+            // Handlers run outside the log's lock.
+            size_t handled = 0;
+            try {
+                for (; handled < _batch.size(); ++handled) {
+                    auto& p = _batch[handled];
+                    _handler->Handle(p.Meta, p.EventType, p.Message.get());
+                }
+            }
+            catch (...) {
+                _processed += handled;
+                _position = _batch[handled].Meta.Position() - 1;
+                _batch.clear();
+                throw;
+            }
+            _processed += handled;
+            _batch.clear();
+            _position = last;
+            MaybeCheckpoint();
+            return read;
+        }
+
+        // Processes everything appended so far and commits the checkpoint; returns the position reached.
+        uint64_t CatchUp() {
+            while (Step() > 0) {}
+            Checkpoint();
+            return _position;
+        }
+
+        void Checkpoint() {
+            uint64_t position = _position;
+            _checkpointTime = std::chrono::steady_clock::now();
+            if (position == _checkpoint) return;
+            _checkpoints->Save(_name, position);
+            _checkpoint = position;
+            ++_checkpointsSaved;
+        }
+
+        void Start() {
+            if (_running.exchange(true)) return;
+            _worker = std::thread([this]() { Run(); });
+        }
+
+        void Stop() {
+            if (!_running.exchange(false)) return;
+            _worker.join();
+            if (!_faulted) Checkpoint();
+        }
+
+        ProjectionStats Stats() const {
+            ProjectionStats stats;
+            stats.Position = _position;
+            stats.Checkpoint = _checkpoint;
+            stats.Head = _log->Head();
+            stats.Lag = stats.Head > stats.Position ? stats.Head - stats.Position : 0;
+            if (stats.Lag > 0) {
+                _log->ReadAll(stats.Position + 1, 1, [&stats](const RecordedEvent& e) {
+                    stats.TimeLag = std::chrono::nanoseconds(Tracer::NowNs() - e.timestamp());
+                });
+            }
+            stats.Processed = _processed;
+            stats.Checkpoints = _checkpointsSaved;
+            return stats;
+        }
+    };
+
+    // Projection split across 'partitions' worker threads by StreamPartition(): events of one stream are always
+    // handled in order by the same partition, each with its own read model instance and checkpoint ("name/partition").
+    // The partition count must not change between runs that share checkpoints.
+    class PartitionedProjection {
+        std::vector<shared_ptr<EventHandlerBase>> _handlers;
+        std::vector<std::unique_ptr<Projection>> _partitions;
+
+    public:
+        PartitionedProjection(const std::string& name, shared_ptr<IEventLog> log, shared_ptr<MessageSerializer> serializer,
+            const std::function<shared_ptr<EventHandlerBase>(size_t)>& handlerFactory, shared_ptr<ICheckpointStore> checkpoints,
+            size_t partitions, const std::vector<std::string>& streams = {}, ProjectionOptions options = {}) {
+            if (partitions == 0) throw invalid_argument("PartitionedProjection requires at least one partition");
+            options.Partitions = partitions;
+            for (size_t i = 0; i < partitions; ++i) {
+                options.Partition = i;
+                _handlers.push_back(handlerFactory(i));
+                _partitions.push_back(std::make_unique<Projection>(name + "/" + std::to_string(i), log, serializer,
+                    _handlers.back(), checkpoints, streams, options));
+            }
+        }
+
+        size_t Partitions() const { return _partitions.size(); }
+        Projection& Partition(size_t i) { return *_partitions.at(i); }
+        const shared_ptr<EventHandlerBase>& Handler(size_t i) const { return _handlers.at(i); }
+
+        // Catches every partition up on its own thread (a rebuild when starting from empty checkpoints).
+        void CatchUp() {
+            std::vector<std::thread> workers;
+            std::vector<std::exception_ptr> errors(_partitions.size());
+            for (size_t i = 0; i < _partitions.size(); ++i) {
+                workers.emplace_back([this, i, &errors]() {
+                    try { _partitions[i]->CatchUp(); }
+                    catch (...) { errors[i] = std::current_exception(); }
+                });
+            }
+            for (auto& w : workers) w.join();
+            for (auto& e : errors) if (e) std::rethrow_exception(e);
+        }
+
+        void Start() { for (auto& p : _partitions) p->Start(); }
+        void Stop() { for (auto& p : _partitions) p->Stop(); }
+
+        // Position and Checkpoint of the slowest partition, Lag and TimeLag of the furthest behind, summed Processed/Checkpoints.
+        ProjectionStats Stats() const {
+            ProjectionStats total;
+            for (size_t i = 0; i < _partitions.size(); ++i) {
+                auto s = _partitions[i]->Stats();
+                total.Position = i == 0 ? s.Position : std::min(total.Position, s.Position);
+                total.Checkpoint = i == 0 ? s.Checkpoint : std::min(total.Checkpoint, s.Checkpoint);
+                total.Head = std::max(total.Head, s.Head);
+                total.Lag = std::max(total.Lag, s.Lag);
+                total.TimeLag = std::max(total.TimeLag, s.TimeLag);
+                total.Processed += s.Processed;
+                total.Checkpoints += s.Checkpoints;
+            }
+            return total;
+        }
+    };
+}
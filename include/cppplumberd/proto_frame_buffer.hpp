@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstring>
 #include <string>
 #include <memory>
 #include <functional>
@@ -119,11 +120,66 @@ namespace cppplumberd {
             }
             return _written;
         }
+        // Frame whose payload is already encoded (e.g. compressed).
+        template<typename THeader>
+        inline size_t Write(const THeader& header, const void* payload, size_t payloadSize)
+        {
+            size_t offset = _written + 8;
+            uint32_t* sizePtr = reinterpret_cast<uint32_t*>(_buffer);
+            if (!header.SerializeToArray(_buffer + offset, static_cast<int>(_capacity - offset))) {
+                throw std::runtime_error("Failed to serialize header");
+            }
+            uint32_t headerSize = static_cast<uint32_t>(header.ByteSizeLong());
+            sizePtr[0] = headerSize;
+            offset += headerSize;
+            if (payloadSize > _capacity - offset) {
+                throw std::runtime_error("Message too large for buffer");
+            }
+            memcpy(_buffer + offset, payload, payloadSize);
+            sizePtr[1] = static_cast<uint32_t>(payloadSize);
+            _written = offset + payloadSize;
+            return _written;
+        }
+        // Re-serializes the header of an already written frame in place; the encoded size must not change
+        // (e.g. only fixed64 fields that were already set are updated).
+        template<typename THeader>
+        inline void RewriteHeader(const THeader& header)
+        {
+            uint32_t* sizePtr = reinterpret_cast<uint32_t*>(_buffer);
+            if (header.ByteSizeLong() != sizePtr[0]) {
+                throw std::runtime_error("Header size changed on rewrite");
+            }
+            if (!header.SerializeToArray(_buffer + 8, static_cast<int>(sizePtr[0]))) {
+                throw std::runtime_error("Failed to serialize header");
+            }
+        }
         inline void AckWritten(size_t size)
         {
             _written = size;
         }
 
+        // Parses only the header; 'payload' and 'payloadSize' are set to the payload bytes as written.
+        template<typename THeader>
+        inline unique_ptr<THeader> ReadHeader(const uint8_t*& payload, size_t& payloadSize, size_t offset = 0) const
+        {
+            if (_written < offset + 8) {
+                throw std::runtime_error("Buffer too small");
+            }
+            const uint32_t* sizePtr = reinterpret_cast<const uint32_t*>(_buffer + offset);
+            uint32_t headerSize = sizePtr[0];
+            if (_written < 8 + static_cast<size_t>(headerSize) + sizePtr[1] + offset) {
+                throw std::runtime_error("Buffer too small for header and payload");
+            }
+            auto headerBytes = _buffer + offset + 8;
+            unique_ptr<THeader> typedHeader = make_unique<THeader>();
+            if (!typedHeader->ParseFromArray(headerBytes, headerSize)) {
+                throw std::runtime_error("Failed to parse header");
+            }
+            payload = headerBytes + headerSize;
+            payloadSize = sizePtr[1];
+            return typedHeader;
+        }
+
         template<typename THeader>
         inline unique_ptr<THeader> Read(function<unsigned int(THeader&)> payloadMessageIdSelector, MessagePtr& msgPtr, size_t offset = 0) const
         {
@@ -152,9 +208,10 @@ namespace cppplumberd {
 
             unsigned int payloadType = payloadMessageIdSelector(*typedHeader);
             auto payloadBytes = headerBytes + headerSize;
-            if (payloadSize > 0 && payloadType > 0)
+            // A message with all fields at their defaults serializes to no bytes; it still has a type.
+            if (payloadType > 0)
 				msgPtr = _serializer->Deserialize(payloadBytes, payloadSize, payloadType);
-            if ((payloadSize == 0) ^ (payloadType == 0))
+            else if (payloadSize > 0)
 				throw std::runtime_error("Payload size and type mismatch");
 
             return typedHeader;
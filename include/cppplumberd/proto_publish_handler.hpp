@@ -6,8 +6,14 @@
 #include <unordered_map>
 #include <chrono>
 #include <array>
+#include <atomic>
+#include <iostream>
 #include "cppplumberd/transport_interfaces.hpp"
+#include "cppplumberd/async_publisher.hpp"
+#include "cppplumberd/compression.hpp"
 #include "cppplumberd/message_serializer.hpp"
+#include "cppplumberd/tracing.hpp"
+#include "cppplumberd/flight_recorder.hpp"
 #include "proto/cqrs.pb.h"
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 
@@ -15,7 +21,7 @@
 
 namespace cppplumberd {
 
-    class ProtoPublishHandler {
+    class ProtoPublishHandler : public IAsyncChannel, public std::enable_shared_from_this<ProtoPublishHandler> {
     public:
         explicit ProtoPublishHandler(std::unique_ptr<ITransportPublishSocket> socket)
             : _socket(std::move(socket)) {
@@ -30,6 +36,12 @@ namespace cppplumberd {
                 throw std::invalid_argument("Socket cannot be null");
             }
         }
+        // 'streamName' only labels frames captured by the flight recorder.
+        explicit ProtoPublishHandler(std::unique_ptr<ITransportPublishSocket> socket, const std::shared_ptr<MessageSerializer>& serializer,
+            const std::string& streamName)
+            : ProtoPublishHandler(std::move(socket), serializer) {
+            _streamName = streamName;
+        }
         inline void Start() {
             _socket->Start();
         }
@@ -37,24 +49,189 @@ namespace cppplumberd {
         template<typename TEvent, unsigned int EventId>
         inline void RegisterMessage() { _serializer->RegisterMessage<TEvent, EventId>(); }
 
+        // When enabled, EventHeader::sent is stamped after the frame is encoded, right before the socket send.
+        inline void EnableHopStamps(bool enabled) { _hopStamps = enabled; }
+
         template<typename TEvent>
         inline void Publish(const TEvent& evt) {
+            Publish(evt, TraceContext::ChildOf(Tracer::Current()));
+        }
 
+        // 'trace' is the event's own context (see TraceContext::ChildOf); 'version' and 'position' its place in the
+        // event log, when it was persisted.
+        // In async mode the event is copied into the stream's queue and sent later by its I/O thread.
+        template<typename TEvent>
+        inline void Publish(const TEvent& evt, const TraceContext& trace, uint64_t version = 0, uint64_t position = 0) {
+            if (_io) {
+                Enqueue(PendingEvent{ _serializer->GetMessageId<TEvent>(), NowNs(), trace, version, position, std::make_unique<TEvent>(evt) });
+                return;
+            }
 			ProtoFrameBuffer<64 * 1024> frameBuffer(_serializer);
-			EventHeader header;
-            header.set_timestamp(std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::system_clock::now().time_since_epoch()).count());
-			header.set_event_type(_serializer->GetMessageId<TEvent>());
-			frameBuffer.Write<EventHeader, TEvent>(header, evt);
+            Send(frameBuffer, _serializer->GetMessageId<TEvent>(), NowNs(), trace, version, position, const_cast<TEvent*>(&evt));
+        }
 
-            _socket->Send(frameBuffer.Get(), frameBuffer.Written());
+        // For events known only by type id, such as records read back from an event log.
+        inline void Publish(unsigned int eventType, const google::protobuf::Message& evt, const TraceContext& trace,
+            uint64_t version = 0, uint64_t position = 0) {
+            if (_io) {
+                std::unique_ptr<google::protobuf::Message> copy(evt.New());
+                copy->CopyFrom(evt);
+                Enqueue(PendingEvent{ eventType, NowNs(), trace, version, position, std::move(copy) });
+                return;
+            }
+            ProtoFrameBuffer<64 * 1024> frameBuffer(_serializer);
+            Send(frameBuffer, eventType, NowNs(), trace, version, position, const_cast<google::protobuf::Message*>(&evt));
+        }
+
+        // Payloads are compressed by 'compressor' (shared by the stream's publishers) from now on; the header tells
+        // subscribers how to decompress them. Must be called before publishing starts.
+        void EnableCompression(std::shared_ptr<StreamCompressor> compressor) { _compressor = std::move(compressor); }
+        inline const std::shared_ptr<StreamCompressor>& Compressor() const { return _compressor; }
+
+        // Moves serialization and socket sends to an I/O thread of 'publisher': Publish returns once the event is
+        // queued, or waits while the stream has publisher.Options().Capacity events queued. Frames leave in queue order.
+        // Must be called before publishing starts; 'publisher' must outlive all publishes.
+        void EnableAsync(AsyncPublisher& publisher) {
+            _capacity = publisher.Options().Capacity;
+            _frame = std::make_unique<ProtoFrameBuffer<64 * 1024>>(_serializer);
+            _io = &publisher.Attach(shared_from_this());
+        }
+        inline bool IsAsync() const { return _io != nullptr; }
 
-            
+        // Returns after every event published before the call has been sent (no-op when synchronous).
+        void Flush() {
+            if (!_io) return;
+            uint64_t target = _enqueued.load();
+            _io->Wake();
+            uint64_t done;
+            while ((done = _done.load()) < target) _done.wait(done);
+        }
+
+        AsyncPublishStats Stats() const {
+            AsyncPublishStats stats;
+            stats.Enqueued = _enqueued.load();
+            stats.Sent = _done.load() - _failed.load();
+            stats.Failed = _failed.load();
+            stats.Batches = _batches.load();
+            stats.Blocked = _blocked.load();
+            stats.Pending = _pending.load();
+            return stats;
+        }
+
+        // I/O thread only.
+        size_t Drain(size_t max) override {
+            size_t n = 0;
+            PendingEvent p;
+            while (n < max && _queue.TryPop(p)) {
+                try {
+                    _frame->Reset();
+                    Send(*_frame, p.EventType, p.Timestamp, p.Trace, p.Version, p.Position, p.Event.get());
+                }
+                catch (const std::exception& ex) {
+                    ++_failed;
+                    std::cerr << "Failed to publish on '" << _streamName << "': " << ex.what() << std::endl;
+                }
+                ++n;
+            }
+            if (n == 0) return 0;
+            ++_batches;
+            _pending.fetch_sub(n);
+            _pending.notify_all();
+            _done.fetch_add(n);
+            _done.notify_all();
+            return n;
         }
 
     private:
         std::unique_ptr<ITransportPublishSocket> _socket;
 		std::shared_ptr<MessageSerializer> _serializer;
+        std::string _streamName;
+        bool _hopStamps = false;
+        std::atomic<uint64_t> _sequence = 0;
+        std::shared_ptr<StreamCompressor> _compressor;
+        std::atomic<uint32_t> _announcedDictionary = 0;
+
+        struct PendingEvent {
+            unsigned int EventType = 0;
+            uint64_t Timestamp = 0;
+            TraceContext Trace;
+            uint64_t Version = 0;
+            uint64_t Position = 0;
+            std::unique_ptr<google::protobuf::Message> Event;
+        };
+        AsyncPublisher::IoThread* _io = nullptr;
+        size_t _capacity = 0;
+        MpscQueue<PendingEvent> _queue;
+        std::unique_ptr<ProtoFrameBuffer<64 * 1024>> _frame;
+        std::atomic<size_t> _pending = 0;
+        std::atomic<uint64_t> _enqueued = 0;
+        std::atomic<uint64_t> _done = 0;
+        std::atomic<uint64_t> _failed = 0;
+        std::atomic<uint64_t> _batches = 0;
+        std::atomic<uint64_t> _blocked = 0;
+
+        void Enqueue(PendingEvent&& p) {
+            size_t pending = _pending.load();
+            if (_capacity > 0 && pending >= _capacity) {
+                ++_blocked;
+                do {
+                    _io->Wake();
+                    _pending.wait(pending);
+                } while ((pending = _pending.load()) >= _capacity);
+            }
+            _pending.fetch_add(1);
+            ++_enqueued;
+            _queue.Push(std::move(p));
+            _io->Wake();
+        }
+
+        // The sequence number is taken here, so in async mode it follows the order frames leave the I/O thread.
+        void Send(ProtoFrameBufferView& frameBuffer, unsigned int eventType, uint64_t timestamp, const TraceContext& trace,
+            uint64_t version, uint64_t position, MessagePtr evt) {
+			EventHeader header;
+            header.set_timestamp(timestamp / 1000000);
+            header.set_timestamp_ns(timestamp);
+			header.set_event_type(eventType);
+            header.set_sequence(++_sequence);
+            header.set_version(version);
+            header.set_position(position);
+            trace.WriteTo(*header.mutable_trace());
+            if (_hopStamps) header.set_sent(1);
+            if (_compressor && evt) WriteCompressed(frameBuffer, header, *evt);
+            else frameBuffer.Write<EventHeader>(header, evt);
+
+            if (_hopStamps) {
+                header.set_sent(NowNs());
+                frameBuffer.RewriteHeader(header);
+            }
+            _socket->Send(frameBuffer.Get(), frameBuffer.Written());
+            RecordFrame(FrameKind::EVENT_PUBLISHED, _streamName, frameBuffer.Get(), frameBuffer.Written());
+        }
+
+        // The first frame compressed with a dictionary carries it; subscribers that missed it ask the server.
+        void WriteCompressed(ProtoFrameBufferView& frameBuffer, EventHeader& header, const google::protobuf::Message& evt) {
+            std::string raw = evt.SerializeAsString();
+            std::string packed;
+            // Subscribers refuse to inflate more than MAX_INFLATED_SIZE; a larger event goes as it is (and fails as it
+            // would without compression).
+            CompressedPayload payload;
+            if (raw.size() <= MAX_INFLATED_SIZE) payload = _compressor->Compress(raw.data(), raw.size(), packed);
+            if (payload.Codec == CompressionCodec::NONE) {
+                frameBuffer.Write<EventHeader>(header, raw.data(), raw.size());
+                return;
+            }
+            header.set_codec(static_cast<uint32_t>(payload.Codec));
+            header.set_raw_size(static_cast<uint32_t>(raw.size()));
+            header.set_dictionary_id(payload.DictionaryId);
+            if (payload.DictionaryId != 0 && _announcedDictionary.exchange(payload.DictionaryId) != payload.DictionaryId)
+                header.set_dictionary(_compressor->Dictionary(payload.DictionaryId));
+            frameBuffer.Write<EventHeader>(header, packed.data(), packed.size());
+        }
+
+        static inline uint64_t NowNs() {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+        }
         
     };
 
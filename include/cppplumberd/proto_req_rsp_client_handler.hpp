@@ -3,12 +3,15 @@
 #include <string>
 #include <memory>
 #include <functional>
+#include <mutex>
 #include <typeindex>
 #include <unordered_map>
 #include "cppplumberd/transport_interfaces.hpp"
 #include "cppplumberd/message_serializer.hpp"
 #include "cppplumberd/fault_exception.hpp"
 #include "cppplumberd/proto_frame_buffer.hpp"
+#include "cppplumberd/tracing.hpp"
+#include "cppplumberd/flight_recorder.hpp"
 #include "proto/cqrs.pb.h"
 
 namespace cppplumberd {
@@ -18,6 +21,8 @@ namespace cppplumberd {
 		std::unique_ptr<ITransportReqRspClientSocket> _socket;
 		std::shared_ptr<MessageSerializer> _serializer;
 		bool _connected = false;
+		// A request/reply socket carries one request at a time; callers on other threads wait for the reply.
+		std::mutex _sendMtx;
 
 		// Map of message types to exception factories
 		std::unordered_map<unsigned int, std::function<void(const std::string&, MessagePtr, unsigned int)>> _exceptionFactories;
@@ -78,10 +83,11 @@ namespace cppplumberd {
 		}
 		// Helper method to process response using ProtoFrameBuffer
 		template<typename TRsp>
-		TRsp ProcessResponse(const ProtoFrameBuffer<64 * 1024>& frameBuffer, size_t received) {
+		TRsp ProcessResponse(const ProtoFrameBuffer<64 * 1024>& frameBuffer, size_t, uint64_t* position = nullptr) {
 			
 			MessagePtr payloadPtr;
 			auto response = OnResponse(frameBuffer, payloadPtr);
+			if (position) *position = response->position();
 
 			// Check for errors
 			if (response->status_code() >= 300 || response->status_code() < 200) {
@@ -170,19 +176,23 @@ namespace cppplumberd {
 				throw TypedFaultException<TError>(MessageId, errorCode, message, typedError);
 				};
 		}
+		// A non-empty 'commandId' lets a server with dedup enabled answer retries of the command without running it again.
 		template<typename TReq>
-		void Send(const string &recipient, const TReq& request)
+		void Send(const string &recipient, const TReq& request, const string& commandId = string())
 		{
+			ScopedSpan span("send", SpanKind::CLIENT, TraceContext::ChildOf(Tracer::Current()));
 			ProtoFrameBuffer<64 * 1024> outBuf(_serializer);
 			size_t received;
-			OnSend<TReq>(recipient,request, outBuf, received);
+			OnSend<TReq>(recipient,request, outBuf, received, commandId);
 			// Process the response
 			return ProcessResponse(outBuf, received);
 		}
 
 		template <typename TReq>
-		void OnSend(const string& recipient, const TReq& request, ProtoFrameBuffer<64 * 1024>& outBuf, size_t& received)
+		void OnSend(const string& recipient, const TReq& request, ProtoFrameBuffer<64 * 1024>& outBuf, size_t& received,
+			const string& commandId = string())
 		{
+			std::lock_guard lock(_sendMtx);
 			// Ensure connected
 			if (!_connected) {
 				_socket->Start();
@@ -197,19 +207,31 @@ namespace cppplumberd {
 			unsigned int reqId = _serializer->GetMessageId<TReq>();
 			header.set_command_type(reqId);
 			header.set_recipient(recipient);
+			if (!commandId.empty()) header.set_command_id(commandId);
+			Tracer::Current().WriteTo(*header.mutable_trace());
 
 			// Use frame buffer to create the framed message
 			inBuf.Write<CommandHeader, TReq>(header, request);
 			outBuf.Reset();
 			outBuf.Clear();
 
+			FlightRecorder* recorder = FlightRecorder::Active();
+			uint64_t started = 0;
+			if (recorder) {
+				started = FlightRecorder::NowNs();
+				recorder->Record(FrameKind::COMMAND_SENT, recipient, inBuf.Get(), inBuf.Written());
+			}
 			received = _socket->Send(inBuf.Get(), inBuf.Written(), outBuf.Get(), outBuf.FreeBytes());
 			outBuf.AckWritten(received);
+			if (recorder) {
+				recorder->Record(FrameKind::RESPONSE_RECEIVED, recipient, outBuf.Get(), received, FlightRecorder::NowNs() - started);
+			}
 		}
 
 		// Send request and receive response
 		template<typename TReq, typename TRsp>
 		TRsp Send(const string& recipient, const TReq& request) {
+			ScopedSpan span("send", SpanKind::CLIENT, TraceContext::ChildOf(Tracer::Current()));
 			ProtoFrameBuffer<64 * 1024> outBuf(_serializer);
 			size_t received;
 			OnSend<TReq>(recipient,request, outBuf, received);
@@ -217,8 +239,24 @@ namespace cppplumberd {
 			return ProcessResponse<TRsp>(outBuf, received);
 		}
 
+		// Like Send, for queries: 'position' receives the event log position the server says the response reflects.
+		template<typename TReq, typename TRsp>
+		TRsp Send(const string& recipient, const TReq& request, uint64_t& position) {
+			ScopedSpan span("send", SpanKind::CLIENT, TraceContext::ChildOf(Tracer::Current()));
+			ProtoFrameBuffer<64 * 1024> outBuf(_serializer);
+			size_t received;
+			OnSend<TReq>(recipient, request, outBuf, received);
+			return ProcessResponse<TRsp>(outBuf, received, &position);
+		}
+
+		// Per request; see ITransportReqRspClientSocket::SetTimeout.
+		void SetTimeout(milliseconds timeout) {
+			_socket->SetTimeout(timeout);
+		}
+
 		// Start the client
 		void Start(const std::string& url) {
+			std::lock_guard lock(_sendMtx);
 			if (!_connected) {
 				_socket->Start(url);
 				_connected = true;
@@ -226,6 +264,7 @@ namespace cppplumberd {
 		}
 
 		void Start() {
+			std::lock_guard lock(_sendMtx);
 			if (!_connected) {
 				_socket->Start();
 				_connected = true;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstring>
 #include <string>
 #include <memory>
 #include <functional>
@@ -7,9 +8,12 @@
 #include <unordered_map>
 #include <chrono>
 #include "cppplumberd/transport_interfaces.hpp"
+#include "cppplumberd/command_dedup.hpp"
 #include "cppplumberd/message_serializer.hpp"
 #include "cppplumberd/message_dispatcher.hpp"
 #include "cppplumberd/proto_frame_buffer.hpp"
+#include "cppplumberd/tracing.hpp"
+#include "cppplumberd/flight_recorder.hpp"
 #include "proto/cqrs.pb.h"
 
 namespace cppplumberd {
@@ -22,6 +26,9 @@ namespace cppplumberd {
         shared_ptr<MessageSerializer> _serializer;
         MessageDispatcher<size_t, CommandHeader> _dispatcher;
         bool _running = false;
+        shared_ptr<CommandDedupCache> _dedup;
+        function<void(const CommandHeader&)> _filter;
+        function<void(const CommandHeader&)> _replyGate;
 
         // Process incoming messages with direct buffer access
         inline size_t HandleRequest(const size_t requestSize) {
@@ -33,27 +40,80 @@ namespace cppplumberd {
                 };
             MessagePtr payload;
             unique_ptr<CommandHeader> header = this->_inBuffer->Read<CommandHeader>(responseTypeSelector, payload);
-            CommandResponse rsp;
+            FlightRecorder* recorder = FlightRecorder::Active();
+            uint64_t started = 0;
+            if (recorder) {
+                started = FlightRecorder::NowNs();
+                recorder->Record(FrameKind::COMMAND_RECEIVED, header->recipient(), _inBuffer->Get(), requestSize);
+            }
+            // A command this server must not handle (not the owner, not the leader) is rejected before the dedup window
+            // is consulted and its fault is not remembered: it did not run, so a retry with the same id is checked again.
+            if (_filter) {
+                try {
+                    _filter(*header);
+                }
+                catch (const FaultException& f) {
+                    unique_ptr<google::protobuf::Message> owned(payload);
+                    size_t size = WriteFault(f);
+                    if (recorder) {
+                        recorder->Record(FrameKind::RESPONSE_SENT, header->recipient(), _outBuffer->Get(), size,
+                            FlightRecorder::NowNs() - started);
+                    }
+                    return size;
+                }
+            }
+            // A retry of a command that already ran gets the response of that run.
+            if (_dedup && !header->command_id().empty()) {
+                string cached;
+                if (_dedup->Find(header->command_id(), cached)) {
+                    unique_ptr<google::protobuf::Message> owned(payload);
+                    memcpy(_outBuffer->Get(), cached.data(), cached.size());
+                    _outBuffer->AckWritten(cached.size());
+                    if (recorder) {
+                        recorder->Record(FrameKind::RESPONSE_SENT, header->recipient(), _outBuffer->Get(), cached.size(),
+                            FlightRecorder::NowNs() - started);
+                    }
+                    return cached.size();
+                }
+            }
+            // Events published by the handler become children of this span and are caused by the command.
+            ScopedSpan span("handle", SpanKind::SERVER, TraceContext::ProcessingOf(TraceContext::FromHeader(header->trace())));
+            if (span.IsRecording()) {
+                span.SetAttribute("messaging.message_type", _serializer->GetMessageName(header->command_type()));
+                span.SetAttribute("messaging.destination", header->recipient());
+            }
+            size_t retSize;
             try {
 				cout << "Handling command: " << _serializer->GetMessageName(header->command_type()) << endl;
-                size_t retSize = _dispatcher.Handle(*header, header->command_type(), payload);
+                retSize = _dispatcher.Handle(*header, header->command_type(), payload);
+                if (_replyGate) _replyGate(*header);
                 cout << "         command: " << _serializer->GetMessageName(header->command_type()) << " executed." << endl;
-                return retSize;
             }
             catch (const FaultException &f)
             {
-                rsp.set_error_message(f.what());
-                rsp.set_status_code(f.ErrorCode());
-                rsp.set_response_type(f.MessageTypeId());
-                // we need to serialize exception and return;
-                _outBuffer->Write(rsp, f.Get());
-                return _outBuffer->Written();
+                span.SetError(f.what());
+                retSize = WriteFault(f);
             }
             catch (const std::exception& e)
             {
                 cout << e.what() << endl;
                 throw;
             }
+            if (_dedup && !header->command_id().empty()) _dedup->Put(header->command_id(), _outBuffer->Get(), retSize);
+            if (recorder) {
+                recorder->Record(FrameKind::RESPONSE_SENT, header->recipient(), _outBuffer->Get(), retSize,
+                    FlightRecorder::NowNs() - started);
+            }
+            return retSize;
+        }
+        inline size_t WriteFault(const FaultException& f) {
+            CommandResponse rsp;
+            rsp.set_error_message(f.what());
+            rsp.set_status_code(f.ErrorCode());
+            rsp.set_response_type(f.MessageTypeId());
+            // we need to serialize exception and return;
+            _outBuffer->Write(rsp, f.Get());
+            return _outBuffer->Written();
         }
         unique_ptr<ProtoFrameBuffer<64 * 1024>> _inBuffer;
         unique_ptr<ProtoFrameBuffer<64 * 1024>> _outBuffer;
@@ -99,7 +159,25 @@ namespace cppplumberd {
                     TRsp response = handler(request);
                     CommandResponse rsp;
                     rsp.set_status_code(200);
-                    return _outBuffer->Write(rsp,&response);
+                    rsp.set_response_type(RspId);
+                    return _outBuffer->Write(rsp, response);
+                }
+            );
+        }
+        // For queries: the handler also reports the event log position its response reflects (CommandResponse::position).
+        template<typename TReq, unsigned int ReqId, typename TRsp, unsigned int RspId>
+        inline void RegisterHandlerWithPosition(function<TRsp(const TReq&, uint64_t& position)> handler) {
+            _serializer->RegisterMessage<TReq, ReqId>();
+            _serializer->RegisterMessage<TRsp, RspId>();
+            _dispatcher.RegisterHandler<TReq, ReqId>(
+                [this, handler](const CommandHeader& header, const TReq& request) -> size_t {
+                    uint64_t position = 0;
+                    TRsp response = handler(request, position);
+                    CommandResponse rsp;
+                    rsp.set_status_code(200);
+                    rsp.set_response_type(RspId);
+                    rsp.set_position(position);
+                    return _outBuffer->Write(rsp, response);
                 }
             );
         }
@@ -137,6 +215,25 @@ namespace cppplumberd {
             _serializer->RegisterMessage<TError, MessageId>();
         }
 
+        // Requests carrying CommandHeader::command_id are answered once per id within the window: successful and
+        // faulted responses are cached and replayed to retries without running the handler again.
+        inline void EnableDedup(const CommandDedupOptions& options = {}) {
+            _dedup = make_shared<CommandDedupCache>(options);
+        }
+        inline CommandDedupStats DedupStats() const {
+            return _dedup ? _dedup->Stats() : CommandDedupStats();
+        }
+
+        // Runs before every handler and before the dedup window is consulted; a FaultException it throws is the
+        // response, the handler does not run and dedup does not remember it.
+        inline void SetRequestFilter(function<void(const CommandHeader&)> filter) {
+            _filter = std::move(filter);
+        }
+        // Runs after a request was handled successfully, before its response is sent.
+        inline void SetReplyGate(function<void(const CommandHeader&)> gate) {
+            _replyGate = std::move(gate);
+        }
+
 
        
         inline void Start(const string& url) {
@@ -154,6 +251,12 @@ namespace cppplumberd {
             _running = false;
         }
 
+        // Closes the socket: a request being handled is answered first, and no request is handled afterwards.
+        inline void Close() {
+            _socket.reset();
+            _running = false;
+        }
+
         inline ~ProtoReqRspSrvHandler() {
             
         }
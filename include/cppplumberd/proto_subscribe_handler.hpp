@@ -6,9 +6,17 @@
 #include <typeindex>
 #include <unordered_map>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "cqrs_abstractions.hpp"
+#include "cppplumberd/queued_dispatcher.hpp"
+#include "cppplumberd/spsc_ring.hpp"
 #include "proto_frame_buffer.hpp"
+#include "cppplumberd/compression.hpp"
+#include "cppplumberd/flight_recorder.hpp"
 #include "cppplumberd/transport_interfaces.hpp"
 #include "cppplumberd/message_serializer.hpp"
 #include "cppplumberd/message_dispatcher.hpp"
@@ -42,43 +50,187 @@ namespace cppplumberd {
             Stop();
         }
 
+        // Decouples the handler from the receive thread: frames are decoded there and queued, and a dispatch thread
+        // hands them to the handler, so a slow handler does not stall the socket (whose queue would drop arbitrary
+        // frames). options.FlowControl decides what happens while the handler is behind. Call before Start().
+        void EnableFlowControl(const SubscriptionOptions& options) {
+            _queued = std::make_shared<QueuedDispatcher>(_streamName, _dispatcher, options);
+        }
+
+        // Like EnableFlowControl, but events are handled on a strand of a shared executor instead of a thread of
+        // their own. Call before Start().
+        void EnableExecutor(shared_ptr<Executor> executor) {
+            _queued = std::make_shared<StrandDispatcher>(_streamName, _dispatcher, std::move(executor));
+        }
 
+        // The receive thread only copies frames into a lock-free ring of 'bytes' and goes back to the socket; a
+        // dispatch thread decodes and handles them in batches, in order. Frames that do not fit are dropped (and
+        // counted), which bounds what a slow handler costs the socket. Call before Start().
+        void EnableReceiveRing(size_t bytes) {
+            _ring = std::make_unique<SpscFrameRing>(bytes);
+        }
+
+        // Fetches a compression dictionary the stream's frames refer to but this subscriber has not received in-band
+        // (it subscribed after the frame that carried it).
+        void SetDictionaryResolver(std::function<std::string(uint32_t)> resolver) {
+            _decompressor.SetResolver(std::move(resolver));
+        }
+
+        // Payload bytes and time spent decompressing the stream's compressed frames.
+        StreamCompressionStats DecompressionStats() const {
+            return _decompressor.Stats();
+        }
 
         void Start() {
             _running = true;
+            if (_ring && !_ringThread.joinable()) {
+                _ringThread = std::thread([this]() {
+                    _ring->Run([this](uint8_t* buffer, size_t size, uint64_t receivedNs) {
+                        Dispatch(buffer, size, NanoTimePoint(nanoseconds(receivedNs)));
+                    });
+                });
+            }
             _socket->Start();
         }
 
         void Stop() {
             _running = false;
+            if (_ring) {
+                _ring->Close();
+                if (_ringThread.joinable() && _ringThread.get_id() != std::this_thread::get_id()) _ringThread.join();
+            }
+            if (_queued) _queued->Stop();
+        }
+
+        // Queue statistics, and events missed on the wire (gaps in EventHeader::sequence) in any mode. Frames the
+        // receive ring had no room for count as Dropped rather than Lost.
+        SubscriptionStats Stats() const {
+            SubscriptionStats stats = _queued ? _queued->Stats() : SubscriptionStats();
+            stats.Lost = _lost;
+            if (_ring) {
+                auto ring = _ring->Stats();
+                stats.Dropped += ring.Dropped;
+                stats.Lost -= std::min<uint64_t>(stats.Lost, ring.Dropped);
+                if (!_queued) {
+                    stats.Received = ring.Pushed + ring.Dropped;
+                    stats.Delivered = ring.Taken;
+                }
+            }
+            return stats;
+        }
+
+        // Until DeliverSnapshot(), received frames are queued instead of dispatched, so live events are neither
+        // lost nor delivered ahead of a snapshot requested after Start().
+        void HoldLive() {
+            _holding = true;
+        }
+
+        // Dispatches the snapshot's events, then the frames held since HoldLive(), then resumes live dispatch. Held
+        // events at or before the snapshot's latest log position are dropped, as for in-process subscribers.
+        void DeliverSnapshot(const LastValueSnapshot& snapshot) {
+            std::lock_guard lock(_holdMtx);
+            uint64_t covered = 0;
+            for (const auto& e : snapshot.events()) {
+                covered = std::max(covered, e.position());
+                try {
+                    Deliver(Pending{ Metadata(e), e.event_type(),
+                        std::unique_ptr<google::protobuf::Message>(_serializer->Deserialize(e.data(), e.event_type())) });
+                }
+                catch (const std::exception& ex) {
+                    std::cerr << "Error processing snapshot event: " << ex.what() << std::endl;
+                }
+            }
+            for (auto& frame : _held) Dispatch(frame.data(), frame.size(), system_clock::now(), covered);
+            _held.clear();
+            _holding = false;
         }
 
     private:
+        struct Pending {
+            Metadata Meta;
+            unsigned int EventType;
+            std::unique_ptr<google::protobuf::Message> Message;
+        };
+
 		shared_ptr<IEventDispatcher> _dispatcher;
 		string _streamName;
         std::unique_ptr<ITransportSubscribeSocket> _socket;
         shared_ptr<MessageSerializer> _serializer;
         
-        bool _running;
-        
+        std::atomic<bool> _running;
+        std::atomic<bool> _holding = false;
+        std::mutex _holdMtx;
+        std::vector<std::vector<uint8_t>> _held;
+        shared_ptr<AsyncDispatcher> _queued;
+        uint64_t _nextSequence = 0;
+        std::atomic<uint64_t> _lost = 0;
+        std::unique_ptr<SpscFrameRing> _ring;
+        std::thread _ringThread;
+        FrameDecompressor _decompressor;
+
+        void Deliver(Pending p) {
+            if (_queued) _queued->Enqueue(p.Meta, p.EventType, std::move(p.Message));
+            else Handle(p);
+        }
+
+        // A sequence below the expected one arrived late rather than being lost.
+        void TrackSequence(uint64_t sequence) {
+            if (sequence == 0) return;
+            if (_nextSequence != 0 && sequence > _nextSequence) _lost += sequence - _nextSequence;
+            else if (sequence < _nextSequence && _lost > 0) --_lost;
+            if (sequence >= _nextSequence) _nextSequence = sequence + 1;
+        }
+
+        void Handle(const Pending& p) {
+            const TraceContext& trace = p.Meta.Trace();
+            ScopedSpan span("process", SpanKind::CONSUMER, TraceContext::ProcessingOf(trace));
+            if (span.IsRecording()) span.SetAttribute("messaging.destination", _streamName);
+            _dispatcher->Handle(p.Meta, p.EventType, p.Message.get());
+        }
 
         void OnMessageReceived(uint8_t* buffer, size_t size) {
             if (!_running) return;
+            if (_holding) {
+                std::lock_guard lock(_holdMtx);
+                if (_holding) {
+                    _held.emplace_back(buffer, buffer + size);
+                    return;
+                }
+            }
+            if (_ring) {
+                _ring->TryPush(buffer, size, static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count()));
+                return;
+            }
+            Dispatch(buffer, size);
+        }
 
+        void Dispatch(uint8_t* buffer, size_t size) {
+            Dispatch(buffer, size, system_clock::now());
+        }
+
+        // Events at or before 'covered' are decoded (they may carry a dictionary) but not delivered.
+        void Dispatch(uint8_t* buffer, size_t size, NanoTimePoint received, uint64_t covered = 0) {
             try {
+                HopStamps hops;
+                hops.Received = received;
+                RecordFrame(FrameKind::EVENT_RECEIVED, _streamName, buffer, size);
                 ProtoFrameBufferView v(_serializer, buffer, size);
                 v.AckWritten(size);
-                auto responseTypeSelector = [](const EventHeader& header) -> unsigned int { return header.event_type(); };
-                MessagePtr payloadBytes;
-                auto header = v.Read<EventHeader>(responseTypeSelector, payloadBytes);
+                const uint8_t* payloadBytes = nullptr;
+                size_t payloadSize = 0;
+                auto header = v.ReadHeader<EventHeader>(payloadBytes, payloadSize);
+                std::string decompressed;
+                auto encoded = _decompressor.Decode(*header, payloadBytes, payloadSize, decompressed);
+                std::unique_ptr<google::protobuf::Message> payload(_serializer->Deserialize(encoded.data(), encoded.size(), header->event_type()));
 
-                time_point<system_clock> timestamp = system_clock::time_point(
-                    milliseconds(header->timestamp()));
+                hops.Published = PublishedAt(*header);
+                hops.Sent = NanoTimePoint(nanoseconds(header->sent()));
+                hops.Dispatched = system_clock::now();
 
-                Metadata m(_streamName, timestamp);
-				_dispatcher->Handle(m, header->event_type(), payloadBytes);
-                
-                delete payloadBytes;
+                TrackSequence(header->sequence());
+                if (header->position() != 0 && header->position() <= covered) return;
+                TraceContext trace = TraceContext::FromHeader(header->trace());
+                Deliver(Pending{ Metadata(_streamName, hops, trace, header->version(), header->position()), header->event_type(), std::move(payload) });
             }
             catch (const std::exception& ex) {
                 // Log error but continue processing other messages
@@ -120,6 +272,11 @@ namespace cppplumberd {
                 };
         }
 
+        // See ClientProtoSubscriptionStream::SetDictionaryResolver.
+        void SetDictionaryResolver(std::function<std::string(uint32_t)> resolver) {
+            _decompressor.SetResolver(std::move(resolver));
+        }
+
         void Start() {
             _running = true;
             _socket->Start();
@@ -131,10 +288,11 @@ namespace cppplumberd {
 
     private:
         std::unique_ptr<ITransportSubscribeSocket> _socket;
+        FrameDecompressor _decompressor;
 		shared_ptr<MessageSerializer> _serializer = std::make_shared<MessageSerializer>();
         std::unordered_map<unsigned int,
             std::function<void(const time_point<system_clock>&, const MessagePtr)>> _eventHandlers;
-        bool _running;
+        std::atomic<bool> _running;
         MessageDispatcher<void, Metadata> _msgDispatcher;
 
         void OnMessageReceived(uint8_t* buffer, size_t size) {
@@ -143,22 +301,24 @@ namespace cppplumberd {
             try {
                 ProtoFrameBufferView v(_serializer, buffer, size);
                 v.AckWritten(size);
-                auto responseTypeSelector = [](const EventHeader& header) -> unsigned int { return header.event_type(); };
-				MessagePtr payloadBytes;
-                auto header = v.Read<EventHeader>(responseTypeSelector, payloadBytes);
+                const uint8_t* payloadBytes = nullptr;
+                size_t payloadSize = 0;
+                auto header = v.ReadHeader<EventHeader>(payloadBytes, payloadSize);
                 
                 auto handlerIt = _eventHandlers.find(header->event_type());
                 if (handlerIt == _eventHandlers.end()) {
                     return;
                 }
+                std::string decompressed;
+                auto encoded = _decompressor.Decode(*header, payloadBytes, payloadSize, decompressed);
+                std::unique_ptr<google::protobuf::Message> payload(_serializer->Deserialize(encoded.data(), encoded.size(), header->event_type()));
 
-                time_point<system_clock> timestamp = system_clock::time_point(
-                    milliseconds(header->timestamp()));
-
-                handlerIt->second(timestamp, payloadBytes);
+                time_point<system_clock> timestamp = time_point_cast<system_clock::duration>(PublishedAt(*header));
 
-                
-                delete payloadBytes;
+                {
+                    TraceScope scope(TraceContext::ProcessingOf(TraceContext::FromHeader(header->trace())));
+                    handlerIt->second(timestamp, payload.get());
+                }
             }
             catch (const std::exception& ex) {
                 // Log error but continue processing other messages
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include "cppplumberd/cqrs_abstractions.hpp"
+#include "cppplumberd/proto_req_rsp_client_handler.hpp"
+#include "cppplumberd/proto_req_rsp_srv_handler.hpp"
+#include "cppplumberd/event_store.hpp"
+
+namespace cppplumberd {
+
+    struct QueryCacheStats {
+        uint64_t Hits = 0;
+        uint64_t Misses = 0;
+        uint64_t Invalidations = 0;
+        uint64_t Evictions = 0;
+        size_t Entries = 0;
+        size_t Bytes = 0;
+        size_t CapacityBytes = 0;
+
+        double HitRatio() const {
+            uint64_t lookups = Hits + Misses;
+            return lookups == 0 ? 0.0 : static_cast<double>(Hits) / lookups;
+        }
+    };
+
+    // Query key: deterministic serialization, so equal queries (including map fields) give equal bytes.
+    inline string QueryKey(const google::protobuf::Message& query) {
+        string key;
+        {
+            google::protobuf::io::StringOutputStream out(&key);
+            google::protobuf::io::CodedOutputStream coded(&out);
+            coded.SetSerializationDeterministic(true);
+            query.SerializeToCodedStream(&coded);
+        }
+        return key;
+    }
+
+    // Results of cacheable queries by query type and serialized query. All results of a query type are dropped when
+    // an event is published on one of the streams it declared. Bounded by bytes, least recently used evicted first.
+    class QueryResultCache {
+        struct Entry {
+            unsigned int QueryId;
+            string Key;
+            shared_ptr<const google::protobuf::Message> Result;
+            uint64_t Position;
+            size_t Bytes;
+        };
+        struct Results {
+            uint64_t Generation = 0;
+            unordered_map<string, std::list<Entry>::iterator> Entries;
+        };
+
+        mutable std::mutex _mtx;
+        std::list<Entry> _lru; // most recently used first
+        unordered_map<unsigned int, Results> _byQuery;
+        size_t _capacityBytes;
+        QueryCacheStats _stats;
+
+        static size_t SizeOf(const Entry& e) {
+            return sizeof(Entry) + e.Key.capacity() + e.Result->SpaceUsedLong();
+        }
+
+        void Erase(std::list<Entry>::iterator it) {
+            _stats.Bytes -= it->Bytes;
+            _byQuery[it->QueryId].Entries.erase(it->Key);
+            _lru.erase(it);
+        }
+
+        void EvictOverCapacity() {
+            while (_stats.Bytes > _capacityBytes && !_lru.empty()) {
+                Erase(std::prev(_lru.end()));
+                ++_stats.Evictions;
+            }
+        }
+
+    public:
+        explicit QueryResultCache(size_t capacityBytes = 16 * 1024 * 1024) : _capacityBytes(capacityBytes) {
+            _stats.CapacityBytes = capacityBytes;
+        }
+
+        void SetCapacity(size_t capacityBytes) {
+            lock_guard lock(_mtx);
+            _capacityBytes = _stats.CapacityBytes = capacityBytes;
+            EvictOverCapacity();
+        }
+
+        // Generation of a query type's results; a result computed under an older generation is not cached.
+        uint64_t Generation(unsigned int queryId) {
+            lock_guard lock(_mtx);
+            return _byQuery[queryId].Generation;
+        }
+
+        // 'position' receives the event log position the result was computed at.
+        template<typename TResult>
+        shared_ptr<const TResult> Find(unsigned int queryId, const string& key, uint64_t& position) {
+            lock_guard lock(_mtx);
+            auto& results = _byQuery[queryId];
+            auto it = results.Entries.find(key);
+            if (it == results.Entries.end()) {
+                ++_stats.Misses;
+                return nullptr;
+            }
+            ++_stats.Hits;
+            _lru.splice(_lru.begin(), _lru, it->second);
+            position = it->second->Position;
+            return static_pointer_cast<const TResult>(it->second->Result);
+        }
+
+        template<typename TResult>
+        void Put(unsigned int queryId, uint64_t generation, const string& key, const TResult& result, uint64_t position = 0) {
+            auto copy = make_shared<const TResult>(result);
+            lock_guard lock(_mtx);
+            auto& results = _byQuery[queryId];
+            if (results.Generation != generation) return;
+            if (auto it = results.Entries.find(key); it != results.Entries.end()) Erase(it->second);
+            _lru.push_front(Entry{ queryId, key, copy, position, 0 });
+            _lru.front().Bytes = SizeOf(_lru.front());
+            _stats.Bytes += _lru.front().Bytes;
+            results.Entries[key] = _lru.begin();
+            EvictOverCapacity();
+        }
+
+        void Invalidate(unsigned int queryId) {
+            lock_guard lock(_mtx);
+            auto& results = _byQuery[queryId];
+            ++results.Generation;
+            ++_stats.Invalidations;
+            for (auto& [key, it] : results.Entries) {
+                _stats.Bytes -= it->Bytes;
+                _lru.erase(it);
+            }
+            results.Entries.clear();
+        }
+
+        QueryCacheStats Stats() const {
+            lock_guard lock(_mtx);
+            QueryCacheStats stats = _stats;
+            stats.Entries = _lru.size();
+            return stats;
+        }
+    };
+
+    // Server side of the query path. Query handlers are registered on the command endpoint's ProtoReqRspSrvHandler;
+    // queries that declare invalidating streams are answered from the QueryResultCache until an event is published
+    // on one of them through the EventStore.
+    class QueryServiceHandler {
+        class Invalidator : public IEventDispatcher {
+            QueryResultCache& _cache;
+            unsigned int _queryId;
+        public:
+            Invalidator(QueryResultCache& cache, unsigned int queryId) : _cache(cache), _queryId(queryId) {}
+            void Handle(const Metadata&, unsigned int, MessagePtr) override { _cache.Invalidate(_queryId); }
+        };
+
+        ProtoReqRspSrvHandler& _handler;
+        shared_ptr<EventStore> _eventStore;
+        QueryResultCache _cache;
+        vector<unique_ptr<ISubscription>> _subscriptions;
+
+    public:
+        QueryServiceHandler(ProtoReqRspSrvHandler& handler, shared_ptr<EventStore> eventStore)
+            : _handler(handler), _eventStore(eventStore) {
+        }
+        ~QueryServiceHandler() {
+            for (auto& s : _subscriptions) s->Unsubscribe();
+        }
+
+        template<typename TQuery, unsigned int QueryId, typename TResult, unsigned int ResultId>
+        void RegisterHandler(shared_ptr<IQueryHandler<TQuery, TResult>> handler, const vector<string>& invalidatedBy = {}) {
+            if (!handler) {
+                throw std::invalid_argument("Query handler cannot be null");
+            }
+            bool cacheable = !invalidatedBy.empty();
+            for (const auto& stream : invalidatedBy) {
+                _subscriptions.push_back(_eventStore->Subscribe(stream, make_shared<Invalidator>(_cache, QueryId)));
+            }
+            // Results carry the position the handler's read model had applied before it ran, not the log head: the
+            // read model may be behind the log, and events it has not applied yet must still reach cached copies.
+            _handler.RegisterHandlerWithPosition<TQuery, QueryId, TResult, ResultId>(
+                [this, handler, cacheable](const TQuery& query, uint64_t& position) -> TResult {
+                    if (!cacheable) {
+                        position = handler->Position();
+                        return handler->Handle(query);
+                    }
+                    string key = QueryKey(query);
+                    if (auto cached = _cache.template Find<TResult>(QueryId, key, position)) return *cached;
+                    uint64_t generation = _cache.Generation(QueryId);
+                    position = handler->Position();
+                    TResult result = handler->Handle(query);
+                    _cache.Put(QueryId, generation, key, result, position);
+                    return result;
+                });
+        }
+
+        // Bounds the memory held by cached results; least recently used results are evicted first.
+        void SetCacheCapacity(size_t capacityBytes) { _cache.SetCapacity(capacityBytes); }
+        const QueryResultCache& Cache() const { return _cache; }
+    };
+
+    // Client side of the query path. Queries from several threads go out one at a time: the client handler serializes
+    // requests on its socket, so a query waits for the one in flight.
+    class PlumberQueryBus {
+    public:
+        inline PlumberQueryBus(std::unique_ptr<ProtoReqRspClientHandler> clientHandler)
+            : _handler(std::move(clientHandler)) {
+            if (!_handler) {
+                throw std::invalid_argument("ClientHandler cannot be null");
+            }
+        }
+
+        template<typename TQuery, unsigned int QueryId, typename TResult, unsigned int ResultId>
+        inline void RegisterQuery() {
+            _handler->RegisterRequestResponse<TQuery, QueryId, TResult, ResultId>();
+        }
+
+        template<typename TError, unsigned int MessageId>
+        inline void RegisterError() {
+            _handler->RegisterError<TError, MessageId>();
+        }
+
+        template<typename TResult, typename TQuery>
+        inline TResult Query(const TQuery& query) {
+            return _handler->Send<TQuery, TResult>("", query);
+        }
+
+        // 'position' receives the event log position the result reflects (0 when the query handler cannot tell).
+        template<typename TResult, typename TQuery>
+        inline TResult Query(const TQuery& query, uint64_t& position) {
+            return _handler->Send<TQuery, TResult>("", query, position);
+        }
+
+        inline void Start(const std::string& endpoint) {
+            _handler->Start(endpoint);
+        }
+
+        inline void Start() {
+            _handler->Start();
+        }
+
+    private:
+        std::unique_ptr<ProtoReqRspClientHandler> _handler;
+    };
+}
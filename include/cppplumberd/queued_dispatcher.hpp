@@ -0,0 +1,163 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include "cppplumberd/cqrs_abstractions.hpp"
+#include "cppplumberd/executor.hpp"
+#include "cppplumberd/flow_control.hpp"
+#include "cppplumberd/tracing.hpp"
+
+namespace cppplumberd {
+
+    // A dispatcher that hands events to the subscriber's handler on another thread.
+    class AsyncDispatcher : public IEventDispatcher {
+    public:
+        // Copies the event; the caller keeps ownership of 'msg'.
+        void Handle(const Metadata& metadata, unsigned int messageId, MessagePtr msg) override {
+            std::unique_ptr<google::protobuf::Message> copy(msg->New());
+            copy->CopyFrom(*msg);
+            Enqueue(metadata, messageId, std::move(copy));
+        }
+
+        virtual void Enqueue(const Metadata& metadata, unsigned int messageId, std::unique_ptr<google::protobuf::Message> msg) = 0;
+        // No handler call starts after Stop() returns (unless called by the handler itself).
+        virtual void Stop() = 0;
+        virtual SubscriptionStats Stats() const = 0;
+
+    protected:
+        static void Invoke(const std::string& streamName, IEventDispatcher& handler, Metadata& meta, unsigned int eventType,
+            MessagePtr msg) {
+            // Received events waited in the queue; Dispatched is when the handler gets them.
+            if (meta.Hops().Received.time_since_epoch().count() != 0) {
+                HopStamps hops = meta.Hops();
+                hops.Dispatched = system_clock::now();
+                meta = Metadata(meta.StreamId(), hops, meta.Trace(), meta.Version(), meta.Position());
+            }
+            try {
+                ScopedSpan span("process", SpanKind::CONSUMER, TraceContext::ProcessingOf(meta.Trace()));
+                if (span.IsRecording()) span.SetAttribute("messaging.destination", streamName);
+                handler.Handle(meta, eventType, msg);
+            }
+            catch (const std::exception& ex) {
+                std::cerr << "Error processing message: " << ex.what() << std::endl;
+            }
+        }
+    };
+
+    // Runs a subscriber's handler on its own thread behind a FlowControlQueue, so whoever delivers events
+    // (a publisher, a receive thread) is not held up by a slow handler beyond what the policy allows.
+    class QueuedDispatcher : public AsyncDispatcher {
+        struct Pending {
+            Metadata Meta;
+            unsigned int EventType;
+            std::unique_ptr<google::protobuf::Message> Message;
+        };
+
+        std::string _streamName;
+        shared_ptr<IEventDispatcher> _handler;
+        SubscriptionOptions _options;
+        FlowControlQueue<Pending> _queue;
+        std::thread _worker;
+
+        void Run() {
+            std::list<FlowControlQueue<Pending>::Item> batch;
+            while (_queue.WaitAndTake(batch)) {
+                for (auto& item : batch) {
+                    auto& p = item.Value;
+                    Invoke(_streamName, *_handler, p.Meta, p.EventType, p.Message.get());
+                }
+                batch.clear();
+            }
+        }
+
+    public:
+        QueuedDispatcher(const std::string& streamName, shared_ptr<IEventDispatcher> handler, const SubscriptionOptions& options)
+            : _streamName(streamName), _handler(handler), _options(options),
+            _queue(options.FlowControl.value_or(FlowControlPolicy())) {
+            _worker = std::thread([this]() { Run(); });
+        }
+        ~QueuedDispatcher() override { Stop(); }
+
+        void Enqueue(const Metadata& metadata, unsigned int messageId, std::unique_ptr<google::protobuf::Message> msg) override {
+            std::string key = _options.ConflationKey ? _options.ConflationKey(*msg) : std::string();
+            bool report = false;
+            _queue.Push(std::move(key), Pending{ metadata, messageId, std::move(msg) }, &report);
+            if (!report) return;
+            auto stats = _queue.Stats();
+            if (stats.Disconnected) std::cerr << "Subscriber of '" << _streamName << "' disconnected: too slow" << std::endl;
+            if (_options.OnSlowConsumer) _options.OnSlowConsumer(_streamName, stats);
+        }
+
+        // Stops after the events already queued have been handled.
+        void Stop() override {
+            _queue.Close();
+            if (_worker.joinable() && _worker.get_id() != std::this_thread::get_id()) _worker.join();
+        }
+
+        SubscriptionStats Stats() const override { return _queue.Stats(); }
+    };
+
+    // Hands a subscriber's events to its handler on a Strand of a shared Executor: in order, never two at a time,
+    // but without a thread of its own. The queue is unbounded.
+    class StrandDispatcher : public AsyncDispatcher, public std::enable_shared_from_this<StrandDispatcher> {
+        std::string _streamName;
+        shared_ptr<IEventDispatcher> _handler;
+        shared_ptr<Strand> _strand;
+        std::atomic<bool> _stopped = false;
+        std::atomic<bool> _delivering = false;
+        std::atomic<uint64_t> _received = 0;
+        std::atomic<uint64_t> _delivered = 0;
+        std::atomic<size_t> _pending = 0;
+        std::atomic<size_t> _maxPending = 0;
+
+        // _delivering is set before _stopped is read, and Stop sets _stopped before it reads _delivering: a handler
+        // call that starts is one Stop sees.
+        void Deliver(Metadata& meta, unsigned int eventType, MessagePtr msg) {
+            _delivering = true;
+            if (!_stopped) {
+                Invoke(_streamName, *_handler, meta, eventType, msg);
+                ++_delivered;
+            }
+            _delivering = false;
+            _delivering.notify_all();
+            --_pending;
+        }
+
+    public:
+        StrandDispatcher(const std::string& streamName, shared_ptr<IEventDispatcher> handler, shared_ptr<Executor> executor)
+            : _streamName(streamName), _handler(handler), _strand(std::make_shared<Strand>(executor)) {
+        }
+
+        void Enqueue(const Metadata& metadata, unsigned int messageId, std::unique_ptr<google::protobuf::Message> msg) override {
+            if (_stopped) return;
+            ++_received;
+            size_t pending = ++_pending;
+            if (pending > _maxPending) _maxPending = pending;
+            _strand->Post([self = shared_from_this(), meta = metadata, messageId, msg = std::move(msg)]() mutable {
+                self->Deliver(meta, messageId, msg.get());
+            });
+        }
+
+        // Waits for a handler call in progress only: events still queued are dropped by their tasks, which may be
+        // queued behind the thread calling Stop when that is a worker of the same executor.
+        void Stop() override {
+            _stopped = true;
+            if (_strand->RunningInThisThread()) return;
+            while (_delivering) _delivering.wait(true);
+        }
+
+        SubscriptionStats Stats() const override {
+            SubscriptionStats stats;
+            stats.Received = _received;
+            stats.Delivered = _delivered;
+            stats.Pending = _pending;
+            stats.MaxPending = _maxPending;
+            return stats;
+        }
+    };
+}
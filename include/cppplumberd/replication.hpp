@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cppplumberd/transport_interfaces.hpp"
+#include "cppplumberd/message_serializer.hpp"
+#include "cppplumberd/fault_exception.hpp"
+#include "cppplumberd/proto_req_rsp_client_handler.hpp"
+#include "cppplumberd/compression.hpp"
+#include "cppplumberd/event_log.hpp"
+#include "cppplumberd/event_store.hpp"
+#include "cppplumberd/tracing.hpp"
+#include "cppplumberd/contract.h"
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    // Fault status of a command sent to a follower.
+    constexpr unsigned int NOT_LEADER = 403;
+    // Fault status of a replication batch from a leader that has been replaced.
+    constexpr unsigned int STALE_EPOCH = 409;
+
+    enum class ReplicationMode {
+        ASYNC,      // commands are answered right away; a failover loses what followers have not acked
+        SEMI_SYNC   // a command is answered once a follower has acked the log up to it, or SemiSyncTimeout passed
+    };
+
+    struct ReplicationOptions {
+        ReplicationMode Mode = ReplicationMode::ASYNC;
+        std::chrono::milliseconds SemiSyncTimeout = std::chrono::seconds(1);    // then the reply goes out anyway
+        size_t MaxBatchEvents = 4096;
+        size_t MaxBatchBytes = 48 * 1024;                   // one request frame
+        std::chrono::milliseconds Timeout = std::chrono::seconds(2);            // per batch
+        std::chrono::milliseconds RetryInterval = std::chrono::milliseconds(200);
+        std::chrono::milliseconds IdleWait = std::chrono::milliseconds(100);    // log polling when caught up
+        bool Compress = false;                              // deflate each batch as one block
+    };
+
+    struct FollowerEndpoint {
+        std::string Name;
+        std::shared_ptr<ISocketFactory> Factory;
+        std::string Endpoint = "commands";
+    };
+
+    struct FollowerStats {
+        std::string Name;
+        bool Connected = false;
+        bool Fenced = false;            // refused our epoch: a newer leader exists
+        uint64_t Acked = 0;             // how far the follower's log is known to match the leader's
+        uint64_t LagEvents = 0;         // leader head - Acked
+        std::chrono::nanoseconds Lag = std::chrono::nanoseconds(0);    // age of the oldest event not acked
+        uint64_t Batches = 0;
+        uint64_t Events = 0;
+        uint64_t Bytes = 0;             // as sent; RawBytes before compression
+        uint64_t RawBytes = 0;
+        uint64_t Errors = 0;
+    };
+
+    struct ReplicatorStats {
+        uint64_t Epoch = 0;
+        uint64_t Head = 0;
+        uint64_t SemiSyncWaits = 0;
+        uint64_t SemiSyncTimeouts = 0;
+        std::vector<FollowerStats> Followers;
+    };
+
+    // Epoch of the record at 'position' (0 for position 0).
+    inline uint64_t RecordEpoch(const IEventLog& log, uint64_t position) {
+        uint64_t epoch = 0;
+        if (position > 0) log.ReadAll(position, 1, [&epoch](const RecordedEvent& e) { epoch = e.epoch(); });
+        return epoch;
+    }
+
+    // Leader side: one thread per follower ships the log from the follower's head on. Whatever was appended while a
+    // batch was in flight goes out in the next one, so batches grow with the load and a slow link costs a round trip
+    // per batch rather than per event. The first, empty batch only asks for the follower's head. A follower whose
+    // head record has another epoch here (it took records from a leader that has been replaced) is sent the log from
+    // the last record both can share, and drops its own records that differ.
+    class EventLogReplicator {
+        struct Follower {
+            FollowerEndpoint Address;
+            std::unique_ptr<ProtoReqRspClientHandler> Connection;
+            std::thread Thread;
+            std::atomic<bool> Connected = false;
+            std::atomic<bool> Fenced = false;
+            std::atomic<uint64_t> Acked = 0;
+            std::atomic<uint64_t> Head = 0;     // as the follower reported it
+            std::atomic<uint64_t> Batches = 0;
+            std::atomic<uint64_t> Events = 0;
+            std::atomic<uint64_t> Bytes = 0;
+            std::atomic<uint64_t> RawBytes = 0;
+            std::atomic<uint64_t> Errors = 0;
+        };
+
+        std::shared_ptr<IEventLog> _log;
+        uint64_t _epoch;
+        ReplicationOptions _options;
+        std::shared_ptr<MessageSerializer> _serializer = std::make_shared<MessageSerializer>();
+        std::vector<std::unique_ptr<Follower>> _followers;
+        mutable std::mutex _mtx;
+        std::condition_variable _changed;   // acks and Stop
+        bool _stopping = false;
+        bool _started = false;
+        std::function<void()> _onFenced;
+        std::atomic<uint64_t> _semiSyncWaits = 0;
+        std::atomic<uint64_t> _semiSyncTimeouts = 0;
+
+        bool Sleep(std::chrono::milliseconds duration) {
+            std::unique_lock lock(_mtx);
+            return !_changed.wait_for(lock, duration, [this]() { return _stopping; });
+        }
+        bool Stopping() const {
+            std::lock_guard lock(_mtx);
+            return _stopping;
+        }
+
+        size_t NextBatch(uint64_t from, ReplicateEvents& batch) const {
+            size_t bytes = 0;
+            bool full = false;
+            _log->ReadAll(from, _options.MaxBatchEvents, [&](const RecordedEvent& e) {
+                if (full) return;
+                size_t size = e.ByteSizeLong();
+                if (bytes + size > _options.MaxBatchBytes && batch.events_size() > 0) {
+                    full = true;
+                    return;
+                }
+                *batch.add_events() = e;
+                bytes += size;
+            });
+            return bytes;
+        }
+
+        // How far the follower's log matches this one: up to its head when the record there has the same epoch here
+        // (records of one epoch come from one leader), else up to the last record here of no later epoch, which
+        // the next batch asks the follower to check. Epochs never decrease along a log.
+        uint64_t Agreed(const ReplicationAck& ack) const {
+            uint64_t head = std::min<uint64_t>(ack.head(), _log->Head());
+            if (head == ack.head() && RecordEpoch(*_log, head) == ack.head_epoch()) return head;
+            uint64_t low = 0;
+            while (low < head) {
+                uint64_t mid = low + (head - low + 1) / 2;
+                if (RecordEpoch(*_log, mid) <= ack.head_epoch()) low = mid;
+                else head = mid - 1;
+            }
+            return low;
+        }
+
+        // Moves the batch's events into one deflated block; returns the block size. A batch larger than followers
+        // inflate (MAX_INFLATED_SIZE) stays as it is and its size is returned.
+        static size_t Pack(ReplicateEvents& batch, Deflater& deflater) {
+            ReplicateEvents events;
+            events.mutable_events()->Swap(batch.mutable_events());
+            std::string raw = events.SerializeAsString();
+            if (raw.size() > MAX_INFLATED_SIZE) {
+                batch.mutable_events()->Swap(events.mutable_events());
+                return raw.size();
+            }
+            deflater.Compress(raw.data(), raw.size(), std::string_view(), *batch.mutable_block());
+            batch.set_raw_size(static_cast<uint32_t>(raw.size()));
+            return batch.block().size();
+        }
+
+        void Run(Follower& follower) {
+            Deflater deflater;
+            while (!Stopping()) {
+                try {
+                    if (!follower.Connection) {
+                        follower.Connection = std::make_unique<ProtoReqRspClientHandler>(
+                            follower.Address.Factory->CreateReqRspClientSocket(follower.Address.Endpoint), _serializer);
+                        follower.Connection->SetTimeout(_options.Timeout);
+                        follower.Connection->Start();
+                    }
+                    ReplicateEvents batch;
+                    batch.set_epoch(_epoch);
+                    size_t bytes = 0, sent = 0, events = 0;
+                    if (follower.Connected) {
+                        uint64_t acked = follower.Acked;
+                        uint64_t head = _log->Head();
+                        if (head <= acked && follower.Head <= acked) {
+                            _log->WaitForAppend(acked, _options.IdleWait);
+                            continue;
+                        }
+                        batch.set_prev_position(acked);
+                        batch.set_prev_epoch(RecordEpoch(*_log, acked));
+                        bytes = sent = NextBatch(acked + 1, batch);
+                        events = batch.events_size();
+                        batch.set_tail((events > 0 ? batch.events(events - 1).position() : acked) >= head);
+                        if (_options.Compress) sent = Pack(batch, deflater);
+                    }
+                    auto ack = follower.Connection->Send<ReplicateEvents, ReplicationAck>("$replication", batch);
+                    uint64_t agreed = Agreed(ack);
+                    if (events > 0) {
+                        ++follower.Batches;
+                        follower.Events += events;
+                        follower.Bytes += sent;
+                        follower.RawBytes += bytes;
+                    }
+                    {
+                        std::lock_guard lock(_mtx);
+                        follower.Head = ack.head();
+                        follower.Acked = agreed;
+                        follower.Connected = true;
+                    }
+                    _changed.notify_all();
+                }
+                catch (const FaultException& fault) {
+                    ++follower.Errors;
+                    if (fault.ErrorCode() == STALE_EPOCH) {
+                        follower.Fenced = true;
+                        follower.Connected = false;
+                        std::cerr << "Follower '" << follower.Address.Name << "' has a newer leader: " << fault.what() << std::endl;
+                        if (_onFenced) _onFenced();
+                        return;
+                    }
+                    std::cerr << "Replication to '" << follower.Address.Name << "' failed: " << fault.what() << std::endl;
+                    Sleep(_options.RetryInterval);
+                }
+                catch (const std::exception& ex) {
+                    ++follower.Errors;
+                    follower.Connected = false;
+                    follower.Connection.reset();
+                    Sleep(_options.RetryInterval);
+                }
+            }
+        }
+
+    public:
+        EventLogReplicator(std::shared_ptr<IEventLog> log, const std::vector<FollowerEndpoint>& followers, uint64_t epoch,
+            const ReplicationOptions& options = ReplicationOptions())
+            : _log(std::move(log)), _epoch(epoch), _options(options) {
+            if (!_log) throw std::invalid_argument("Replication requires an event log");
+            if (followers.empty()) throw std::invalid_argument("Replication needs at least one follower");
+            if (_options.MaxBatchEvents == 0) _options.MaxBatchEvents = 1;
+            for (const auto& endpoint : followers) {
+                if (!endpoint.Factory) throw std::invalid_argument("Socket factory cannot be null");
+                auto follower = std::make_unique<Follower>();
+                follower->Address = endpoint;
+                if (follower->Address.Name.empty()) follower->Address.Name = endpoint.Endpoint;
+                _followers.push_back(std::move(follower));
+            }
+            _serializer->RegisterMessage<ReplicateEvents, COMMANDS::REPLICATE_EVENTS>();
+            _serializer->RegisterMessage<ReplicationAck, COMMANDS::REPLICATION_ACK>();
+        }
+        EventLogReplicator(const EventLogReplicator&) = delete;
+        EventLogReplicator& operator=(const EventLogReplicator&) = delete;
+
+        ~EventLogReplicator() {
+            Stop();
+        }
+
+        // Called on a replication thread when a follower refuses the epoch; set before Start.
+        void OnFenced(std::function<void()> callback) {
+            _onFenced = std::move(callback);
+        }
+
+        void Start() {
+            if (_started) return;
+            _started = true;
+            for (auto& follower : _followers)
+                follower->Thread = std::thread([this, f = follower.get()]() { Run(*f); });
+        }
+
+        void Stop() {
+            {
+                std::lock_guard lock(_mtx);
+                if (_stopping) return;
+                _stopping = true;
+            }
+            _changed.notify_all();
+            for (auto& follower : _followers)
+                if (follower->Thread.joinable()) follower->Thread.join();
+        }
+
+        // True once some follower has acked the log up to 'position'.
+        bool WaitForAck(uint64_t position, std::chrono::milliseconds timeout) {
+            auto acked = [this, position]() {
+                for (const auto& follower : _followers)
+                    if (follower->Acked >= position) return true;
+                return false;
+            };
+            std::unique_lock lock(_mtx);
+            _changed.wait_for(lock, timeout, [this, &acked]() { return _stopping || acked(); });
+            return acked();
+        }
+
+        // Semi-synchronous reply gate: waits for an ack of the log head, at most SemiSyncTimeout.
+        void AwaitSemiSync() {
+            ++_semiSyncWaits;
+            if (!WaitForAck(_log->Head(), _options.SemiSyncTimeout)) ++_semiSyncTimeouts;
+        }
+
+        const ReplicationOptions& Options() const { return _options; }
+
+        ReplicatorStats Stats() const {
+            ReplicatorStats stats;
+            stats.Epoch = _epoch;
+            stats.Head = _log->Head();
+            stats.SemiSyncWaits = _semiSyncWaits;
+            stats.SemiSyncTimeouts = _semiSyncTimeouts;
+            uint64_t now = Tracer::NowNs();
+            for (const auto& follower : _followers) {
+                FollowerStats s;
+                s.Name = follower->Address.Name;
+                s.Connected = follower->Connected;
+                s.Fenced = follower->Fenced;
+                s.Acked = follower->Acked;
+                s.Batches = follower->Batches;
+                s.Events = follower->Events;
+                s.Bytes = follower->Bytes;
+                s.RawBytes = follower->RawBytes;
+                s.Errors = follower->Errors;
+                if (stats.Head > s.Acked) {
+                    s.LagEvents = stats.Head - s.Acked;
+                    _log->ReadAll(s.Acked + 1, 1, [&](const RecordedEvent& e) {
+                        if (now > e.timestamp()) s.Lag = std::chrono::nanoseconds(now - e.timestamp());
+                    });
+                }
+                stats.Followers.push_back(s);
+            }
+            return stats;
+        }
+    };
+
+    // Follower side: appends the records that continue the local log and delivers them to local subscribers, last
+    // values and remote subscribers. Records it already has are skipped; after a gap it stops, and the ack makes the
+    // leader resend from its head. Local records that differ from the leader's (another epoch at the same position,
+    // or beyond the leader's head) are truncated; what subscribers were already given of them stays delivered.
+    inline ReplicationAck ApplyReplicatedEvents(EventStore& store, const ReplicateEvents& batch) {
+        const auto& log = store.EventLog();
+        if (!log) throw FaultException("Replication requires an event log", 412);
+        ReplicateEvents unpacked;
+        if (!batch.block().empty()) {
+            std::string raw;
+            try {
+                raw = Inflate(batch.block().data(), batch.block().size(), batch.raw_size());
+            }
+            catch (const std::runtime_error& ex) {
+                throw FaultException(std::string("Corrupt replication batch: ") + ex.what(), 400);
+            }
+            if (!unpacked.ParseFromString(raw)) throw FaultException("Corrupt replication batch", 400);
+        }
+        const auto& events = batch.block().empty() ? batch.events() : unpacked.events();
+        uint64_t prev = batch.prev_position();
+        if (prev <= log->Head() && RecordEpoch(*log, prev) != batch.prev_epoch()) {
+            // The leader backs off to what the ack says is left.
+            log->Truncate(prev - 1);
+        }
+        else if (prev <= log->Head()) {
+            uint64_t through = prev;
+            for (const auto& e : events) {
+                uint64_t head = log->Head();
+                if (e.position() <= head) {
+                    if (RecordEpoch(*log, e.position()) == e.epoch()) {
+                        through = e.position();
+                        continue;
+                    }
+                    log->Truncate(e.position() - 1);
+                    head = log->Head();
+                }
+                if (e.position() != head + 1) break;
+                const auto& stored = log->Replicate(e);
+                through = e.position();
+                try {
+                    store.Deliver(stored);
+                }
+                catch (const std::exception& ex) {
+                    std::cerr << "Replicated event " << stored.position() << " on '" << stored.stream()
+                        << "' was stored but not delivered: " << ex.what() << std::endl;
+                }
+            }
+            bool complete = events.empty() || through == events[events.size() - 1].position();
+            if (batch.tail() && complete && log->Head() > through) log->Truncate(through);
+        }
+        ReplicationAck ack;
+        ack.set_head(log->Head());
+        ack.set_head_epoch(RecordEpoch(*log, ack.head()));
+        return ack;
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "cppplumberd/fault_exception.hpp"
+#include "cppplumberd/command_pool.hpp"
+#include "cppplumberd/event_log.hpp"
+#include "cppplumberd/event_store.hpp"
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    // Fault status of a command sent to a shard that does not own its stream; the client refreshes its table.
+    constexpr unsigned int SHARD_MISDIRECTED = 421;
+    // Fault status of a command for a slot that is being handed off; the client retries after a backoff.
+    constexpr unsigned int SHARD_SLOT_MOVING = 503;
+
+    // "" (queries) and "$..." (CreateStream, admin messages) address the server rather than a stream.
+    inline bool IsSystemRecipient(const std::string& recipient) {
+        return recipient.empty() || recipient[0] == '$';
+    }
+
+    inline uint32_t ShardSlot(const std::string& stream, size_t slots) {
+        return static_cast<uint32_t>(HashRing::Hash(stream) % slots);
+    }
+
+    // Version 1 table that deals 'slots' slots round robin to 'shards'.
+    inline RoutingTable EvenRoutingTable(const std::vector<std::string>& shards, uint32_t slots = 1024) {
+        if (shards.empty() || slots == 0) throw std::invalid_argument("A routing table needs shards and slots");
+        RoutingTable table;
+        table.set_version(1);
+        for (const auto& shard : shards) table.add_shards(shard);
+        for (uint32_t i = 0; i < slots; ++i) table.add_slots(i % shards.size());
+        return table;
+    }
+
+    inline const std::string& ShardOf(const RoutingTable& table, const std::string& stream) {
+        if (table.slots_size() == 0) throw std::invalid_argument("Empty routing table");
+        uint32_t owner = table.slots(ShardSlot(stream, table.slots_size()));
+        if (owner >= static_cast<uint32_t>(table.shards_size())) throw std::invalid_argument("Routing table names an unknown shard");
+        return table.shards(owner);
+    }
+
+    // Copy of 'table', one version later, with 'slot' owned by 'shard' (added to the shards if new).
+    inline RoutingTable MoveSlotTo(const RoutingTable& table, uint32_t slot, const std::string& shard) {
+        if (slot >= static_cast<uint32_t>(table.slots_size())) throw std::invalid_argument("No slot " + std::to_string(slot));
+        RoutingTable next = table;
+        next.set_version(table.version() + 1);
+        int index = 0;
+        while (index < next.shards_size() && next.shards(index) != shard) ++index;
+        if (index == next.shards_size()) next.add_shards(shard);
+        next.set_slots(slot, index);
+        return next;
+    }
+
+    // A shard's view of the routing table: which streams it may handle commands for. Commands to system recipients
+    // are always handled.
+    class ShardOwnership {
+        mutable std::mutex _mtx;
+        std::string _shard;
+        RoutingTable _table;
+        std::set<uint32_t> _frozen;
+
+    public:
+        ShardOwnership(std::string shard, const RoutingTable& table) : _shard(std::move(shard)), _table(table) {}
+
+        const std::string& Shard() const { return _shard; }
+
+        RoutingTable Table() const {
+            std::lock_guard lock(_mtx);
+            return _table;
+        }
+
+        bool Owns(const std::string& stream) const {
+            std::lock_guard lock(_mtx);
+            return ShardOf(_table, stream) == _shard;
+        }
+
+        // Throws the fault a command for 'stream' gets when this shard must not handle it.
+        void Check(const std::string& stream) const {
+            if (IsSystemRecipient(stream)) return;
+            std::lock_guard lock(_mtx);
+            uint32_t slot = ShardSlot(stream, _table.slots_size());
+            if (_frozen.contains(slot))
+                throw FaultException("Slot " + std::to_string(slot) + " of '" + stream + "' is being handed off", SHARD_SLOT_MOVING);
+            const auto& owner = ShardOf(_table, stream);
+            if (owner != _shard)
+                throw FaultException("'" + stream + "' is owned by shard '" + owner + "' (routing table version "
+                    + std::to_string(_table.version()) + ")", SHARD_MISDIRECTED);
+        }
+
+        // Stops handling commands for the slot until a table that moves it is adopted.
+        void Freeze(uint32_t slot) {
+            std::lock_guard lock(_mtx);
+            if (slot >= static_cast<uint32_t>(_table.slots_size())) throw FaultException("No slot " + std::to_string(slot), 400);
+            _frozen.insert(slot);
+        }
+
+        // Takes commands for the slot again; for a handoff that failed before the new owner adopted the table.
+        void Unfreeze(uint32_t slot) {
+            std::lock_guard lock(_mtx);
+            _frozen.erase(slot);
+        }
+
+        // Older and equal versions are ignored; returns whether the table was adopted.
+        bool Adopt(const RoutingTable& table) {
+            std::lock_guard lock(_mtx);
+            if (table.version() <= _table.version()) return false;
+            if (table.slots_size() != _table.slots_size()) throw FaultException("The number of slots cannot change", 400);
+            _table = table;
+            _frozen.clear();
+            return true;
+        }
+    };
+
+    // One page of the slot's events from 'from_position' on, small enough for one response frame.
+    inline SlotEvents ExportSlotEvents(const EventStore& store, const ExportSlot& request, size_t slots,
+        size_t maxBytes = 48 * 1024) {
+        const auto& log = store.EventLog();
+        if (!log) throw FaultException("Slot handoff requires an event log", 412);
+        SlotEvents page;
+        uint64_t position = std::max<uint64_t>(request.from_position(), 1);
+        size_t bytes = 0;
+        bool full = false;
+        while (!full) {
+            size_t read = log->ReadAll(position, 256, [&](const RecordedEvent& e) {
+                if (full) return;
+                if (ShardSlot(e.stream(), slots) == request.slot()) {
+                    size_t size = e.ByteSizeLong();
+                    if (bytes + size > maxBytes && page.events_size() > 0) {
+                        full = true;
+                        return;
+                    }
+                    *page.add_events() = e;
+                    bytes += size;
+                }
+                position = e.position() + 1;
+            });
+            if (read == 0) break;
+        }
+        page.set_next_position(position);
+        page.set_done(!full);
+        return page;
+    }
+
+    // Appends imported events to the local log, skipping the versions a stream already has here (a slot that moves
+    // back), and delivers them as if they had been published here.
+    inline void ImportSlotEvents(EventStore& store, const ImportEvents& request) {
+        const auto& log = store.EventLog();
+        if (!log) throw FaultException("Slot handoff requires an event log", 412);
+        for (const auto& e : request.events()) {
+            if (e.version() <= log->StreamVersion(e.stream())) continue;
+            TraceContext trace = TraceContext::FromHeader(e.trace());
+            store.Deliver(log->Append(e.stream(), e.event_type(), e.data(), trace));
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "cppplumberd/tracing.hpp"
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    using namespace std;
+
+    // Latest snapshot per stream.
+    class ISnapshotStore {
+    public:
+        virtual void Save(const AggregateSnapshot& snapshot) = 0;
+        virtual optional<AggregateSnapshot> Load(const string& stream) const = 0;
+        virtual ~ISnapshotStore() = default;
+    };
+
+    class InMemorySnapshotStore : public ISnapshotStore {
+        mutable std::mutex _mtx;
+        unordered_map<string, AggregateSnapshot> _snapshots;
+    public:
+        void Save(const AggregateSnapshot& snapshot) override {
+            lock_guard lock(_mtx);
+            auto& current = _snapshots[snapshot.stream()];
+            if (snapshot.version() >= current.version()) current = snapshot;
+        }
+        optional<AggregateSnapshot> Load(const string& stream) const override {
+            lock_guard lock(_mtx);
+            auto it = _snapshots.find(stream);
+            if (it == _snapshots.end()) return nullopt;
+            return it->second;
+        }
+    };
+
+    // One file per stream in 'directory'; written to a temporary file and renamed so a crash never leaves a torn snapshot.
+    class FileSnapshotStore : public ISnapshotStore {
+        filesystem::path _directory;
+
+        filesystem::path PathOf(const string& stream) const {
+            static constexpr char digits[] = "0123456789abcdef";
+            string name;
+            name.reserve(stream.size() * 2 + 9);
+            for (unsigned char c : stream) {
+                name += digits[c >> 4];
+                name += digits[c & 0xF];
+            }
+            return _directory / (name + ".snapshot");
+        }
+    public:
+        explicit FileSnapshotStore(const filesystem::path& directory) : _directory(directory) {
+            filesystem::create_directories(_directory);
+        }
+        void Save(const AggregateSnapshot& snapshot) override {
+            auto path = PathOf(snapshot.stream());
+            auto tmp = path;
+            tmp += ".tmp";
+            {
+                ofstream file(tmp, ios::binary | ios::trunc);
+                if (!file || !snapshot.SerializeToOstream(&file)) {
+                    throw runtime_error("Failed to write snapshot: " + tmp.string());
+                }
+            }
+            filesystem::rename(tmp, path);
+        }
+        optional<AggregateSnapshot> Load(const string& stream) const override {
+            ifstream file(PathOf(stream), ios::binary);
+            if (!file) return nullopt;
+            AggregateSnapshot snapshot;
+            if (!snapshot.ParseFromIstream(&file)) {
+                throw runtime_error("Corrupt snapshot of stream: " + stream);
+            }
+            return snapshot;
+        }
+    };
+
+    // Serializes and saves snapshots on a background thread. Pending snapshots of the same stream are coalesced,
+    // so a slow store only ever writes the newest state.
+    class Snapshotter {
+        shared_ptr<ISnapshotStore> _store;
+        std::mutex _mtx;
+        condition_variable _cv;
+        condition_variable _idle;
+        map<string, pair<uint64_t, function<string()>>> _pending;
+        size_t _inFlight = 0;
+        uint64_t _saved = 0;
+        bool _stopping = false;
+        thread _worker;
+
+        void Run() {
+            unique_lock lock(_mtx);
+            for (;;) {
+                _cv.wait(lock, [this]() { return _stopping || !_pending.empty(); });
+                if (_pending.empty()) return;
+                auto node = _pending.extract(_pending.begin());
+                ++_inFlight;
+                lock.unlock();
+                try {
+                    AggregateSnapshot snapshot;
+                    snapshot.set_stream(node.key());
+                    snapshot.set_version(node.mapped().first);
+                    snapshot.set_timestamp(Tracer::NowNs());
+                    snapshot.set_state(node.mapped().second());
+                    _store->Save(snapshot);
+                }
+                catch (const exception& e) {
+                    cerr << "Snapshot of '" << node.key() << "' failed: " << e.what() << endl;
+                }
+                lock.lock();
+                --_inFlight;
+                ++_saved;
+                if (_pending.empty() && _inFlight == 0) _idle.notify_all();
+            }
+        }
+    public:
+        explicit Snapshotter(shared_ptr<ISnapshotStore> store) : _store(store) {
+            _worker = thread([this]() { Run(); });
+        }
+        ~Snapshotter() {
+            {
+                lock_guard lock(_mtx);
+                _stopping = true;
+            }
+            _cv.notify_all();
+            _worker.join();
+        }
+
+        const shared_ptr<ISnapshotStore>& Store() const { return _store; }
+
+        // 'serialize' runs on the snapshot thread and must own the state it serializes.
+        void Enqueue(const string& stream, uint64_t version, function<string()> serialize) {
+            {
+                lock_guard lock(_mtx);
+                auto& pending = _pending[stream];
+                if (pending.second && pending.first > version) return;
+                pending = { version, std::move(serialize) };
+            }
+            _cv.notify_one();
+        }
+
+        // Waits until every enqueued snapshot has been saved.
+        void Flush() {
+            unique_lock lock(_mtx);
+            _idle.wait(lock, [this]() { return _pending.empty() && _inFlight == 0; });
+        }
+
+        uint64_t Saved() {
+            lock_guard lock(_mtx);
+            return _saved;
+        }
+    };
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace cppplumberd {
+
+    struct FrameRingStats {
+        uint64_t Pushed = 0;
+        uint64_t Dropped = 0;       // frames that did not fit
+        uint64_t Taken = 0;
+        size_t Used = 0;            // bytes
+        size_t MaxUsed = 0;
+    };
+
+    // Lock-free single-producer/single-consumer ring of variable-size frames in one contiguous buffer. Each frame is
+    // stored whole (never split across the end) behind a 16-byte record header holding its size and a caller stamp, so
+    // the consumer reads it in place. Push never blocks: a frame that does not fit is dropped and counted.
+    class SpscFrameRing {
+        struct Record {
+            uint32_t Size;
+            uint32_t Reserved;
+            uint64_t Stamp;
+        };
+        static constexpr uint32_t WRAP = UINT32_MAX;
+        static constexpr size_t ALIGN = sizeof(Record);
+
+        std::unique_ptr<uint8_t[]> _buffer;
+        size_t _capacity;
+        // Producer side.
+        alignas(64) std::atomic<uint64_t> _head = 0;
+        uint64_t _cachedTail = 0;
+        std::atomic<uint64_t> _pushed = 0;
+        std::atomic<uint64_t> _dropped = 0;
+        std::atomic<size_t> _maxUsed = 0;
+        // Consumer side.
+        alignas(64) std::atomic<uint64_t> _tail = 0;
+        std::atomic<uint64_t> _taken = 0;
+        // Bumped after every push (and by Close) so a sleeping consumer can wait on it.
+        alignas(64) std::atomic<uint32_t> _signal = 0;
+        std::atomic<bool> _sleeping = false;
+        std::atomic<bool> _closed = false;
+
+        static constexpr size_t Aligned(size_t n) { return (n + ALIGN - 1) & ~(ALIGN - 1); }
+
+    public:
+        explicit SpscFrameRing(size_t capacity)
+            : _capacity(Aligned(capacity < 2 * sizeof(Record) ? 2 * sizeof(Record) : capacity)) {
+            _buffer.reset(new uint8_t[_capacity]);
+        }
+
+        size_t Capacity() const { return _capacity; }
+
+        // Producer only. Copies the frame into the ring; false (and counted as dropped) when it does not fit.
+        bool TryPush(const uint8_t* data, size_t size, uint64_t stamp = 0) {
+            size_t need = sizeof(Record) + Aligned(size);
+            uint64_t head = _head.load(std::memory_order_relaxed);
+            size_t offset = head % _capacity;
+            size_t toEnd = _capacity - offset;
+            size_t total = need <= toEnd ? need : toEnd + need;
+            if (head + total - _cachedTail > _capacity) {
+                _cachedTail = _tail.load(std::memory_order_acquire);
+                if (head + total - _cachedTail > _capacity) {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            if (need > toEnd) {
+                reinterpret_cast<Record*>(_buffer.get() + offset)->Size = WRAP;
+                head += toEnd;
+                offset = 0;
+            }
+            auto record = reinterpret_cast<Record*>(_buffer.get() + offset);
+            record->Size = static_cast<uint32_t>(size);
+            record->Stamp = stamp;
+            std::memcpy(_buffer.get() + offset + sizeof(Record), data, size);
+            _head.store(head + need, std::memory_order_release);
+            _pushed.fetch_add(1, std::memory_order_relaxed);
+            size_t used = head + need - _cachedTail;
+            if (used > _maxUsed.load(std::memory_order_relaxed)) _maxUsed.store(used, std::memory_order_relaxed);
+
+            _signal.fetch_add(1);
+            if (_sleeping) _signal.notify_one();
+            return true;
+        }
+
+        // Consumer only. Calls fn(data, size, stamp) for up to 'max' frames available now, releasing each frame's
+        // space after fn returns, and returns how many were taken.
+        template<typename TFunc>
+        size_t Drain(TFunc&& fn, size_t max = SIZE_MAX) {
+            uint64_t tail = _tail.load(std::memory_order_relaxed);
+            uint64_t head = _head.load(std::memory_order_acquire);
+            size_t n = 0;
+            while (tail != head && n < max) {
+                size_t offset = tail % _capacity;
+                auto record = reinterpret_cast<const Record*>(_buffer.get() + offset);
+                if (record->Size == WRAP) {
+                    tail += _capacity - offset;
+                    continue;
+                }
+                fn(_buffer.get() + offset + sizeof(Record), static_cast<size_t>(record->Size), record->Stamp);
+                tail += sizeof(Record) + Aligned(record->Size);
+                _tail.store(tail, std::memory_order_release);
+                ++n;
+            }
+            _tail.store(tail, std::memory_order_release);
+            if (n > 0) _taken.fetch_add(n, std::memory_order_relaxed);
+            return n;
+        }
+
+        // Consumer only. Drains in batches of up to 'batch' frames until Close(), sleeping while the ring is empty;
+        // frames pushed before Close() are still handed out.
+        template<typename TFunc>
+        void Run(TFunc&& fn, size_t batch = 256) {
+            while (true) {
+                uint32_t seen = _signal.load();
+                if (Drain(fn, batch) > 0) continue;
+                if (_closed) break;
+                _sleeping = true;
+                _signal.wait(seen);
+                _sleeping = false;
+            }
+        }
+
+        void Close() {
+            _closed = true;
+            _signal.fetch_add(1);
+            _signal.notify_all();
+        }
+
+        FrameRingStats Stats() const {
+            FrameRingStats stats;
+            stats.Pushed = _pushed.load();
+            stats.Taken = _taken.load();
+            stats.Dropped = _dropped.load();
+            uint64_t tail = _tail.load();
+            stats.Used = static_cast<size_t>(_head.load() - tail);
+            stats.MaxUsed = _maxUsed.load();
+            return stats;
+        }
+    };
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "proto/cqrs.pb.h"
+
+namespace cppplumberd {
+
+    // Causal context carried by every command and event.
+    // On the wire SpanId is the message's own id and CausationId the id of the message that caused it.
+    // While a message is being processed, the thread's current context has CausationId = that message's id,
+    // so anything produced from it is linked back automatically.
+    struct TraceContext {
+        uint64_t TraceIdHigh = 0;
+        uint64_t TraceIdLow = 0;
+        uint64_t SpanId = 0;
+        uint64_t ParentSpanId = 0;
+        uint64_t CausationId = 0;
+        std::string CorrelationId;
+
+        bool IsValid() const { return (TraceIdHigh | TraceIdLow) != 0 && SpanId != 0; }
+
+        static uint64_t NewId() {
+            thread_local std::mt19937_64 rng(std::random_device{}()
+                ^ std::hash<std::thread::id>{}(std::this_thread::get_id())
+                ^ static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+            uint64_t id;
+            do { id = rng(); } while (id == 0);
+            return id;
+        }
+
+        // Starts a new trace; the correlation id defaults to the root message id.
+        static TraceContext NewRoot(const std::string& correlationId = "") {
+            TraceContext ctx;
+            ctx.TraceIdHigh = NewId();
+            ctx.TraceIdLow = NewId();
+            ctx.SpanId = NewId();
+            ctx.CorrelationId = correlationId.empty() ? ToHex(ctx.SpanId) : correlationId;
+            return ctx;
+        }
+
+        // Context of a message produced while 'current' is active (a new root when there is none).
+        static TraceContext ChildOf(const TraceContext& current) {
+            if (!current.IsValid()) return NewRoot(current.CorrelationId);
+            TraceContext ctx = current;
+            ctx.SpanId = NewId();
+            ctx.ParentSpanId = current.SpanId;
+            return ctx;
+        }
+
+        // Context active while handling 'message': a child span caused by that message.
+        static TraceContext ProcessingOf(const TraceContext& message) {
+            TraceContext ctx = ChildOf(message);
+            ctx.CausationId = message.IsValid() ? message.SpanId : 0;
+            return ctx;
+        }
+
+        void WriteTo(TraceHeader& header) const {
+            header.set_trace_id_high(TraceIdHigh);
+            header.set_trace_id_low(TraceIdLow);
+            header.set_span_id(SpanId);
+            header.set_parent_span_id(ParentSpanId);
+            header.set_causation_id(CausationId);
+            header.set_correlation_id(CorrelationId);
+        }
+        static TraceContext FromHeader(const TraceHeader& header) {
+            TraceContext ctx;
+            ctx.TraceIdHigh = header.trace_id_high();
+            ctx.TraceIdLow = header.trace_id_low();
+            ctx.SpanId = header.span_id();
+            ctx.ParentSpanId = header.parent_span_id();
+            ctx.CausationId = header.causation_id();
+            ctx.CorrelationId = header.correlation_id();
+            return ctx;
+        }
+
+        std::string TraceIdHex() const { return ToHex(TraceIdHigh) + ToHex(TraceIdLow); }
+        std::string SpanIdHex() const { return ToHex(SpanId); }
+
+        static std::string ToHex(uint64_t v) {
+            static constexpr char digits[] = "0123456789abcdef";
+            std::string s(16, '0');
+            for (int i = 15; i >= 0; --i, v >>= 4) s[i] = digits[v & 0xF];
+            return s;
+        }
+    };
+
+    // Numeric values follow OTLP SpanKind.
+    enum class SpanKind : int { INTERNAL = 1, SERVER = 2, CLIENT = 3, PRODUCER = 4, CONSUMER = 5 };
+
+    struct Span {
+        std::string Name;
+        SpanKind Kind = SpanKind::INTERNAL;
+        TraceContext Context;
+        uint64_t StartNs = 0;
+        uint64_t EndNs = 0;
+        bool Error = false;
+        std::string StatusMessage;
+        std::vector<std::pair<std::string, std::string>> Attributes;
+    };
+
+    class ISpanExporter {
+    public:
+        virtual void Export(const Span& span) = 0;
+        virtual void Flush() {}
+        virtual ~ISpanExporter() = default;
+    };
+
+    class Tracer {
+        static std::atomic<std::shared_ptr<ISpanExporter>>& ExporterSlot() {
+            static std::atomic<std::shared_ptr<ISpanExporter>> exporter;
+            return exporter;
+        }
+        static std::atomic<bool>& RecordingFlag() {
+            static std::atomic<bool> recording{ false };
+            return recording;
+        }
+    public:
+        // Context of the message currently processed (or the active client span) on this thread.
+        static TraceContext& Current() {
+            thread_local TraceContext current;
+            return current;
+        }
+
+        // Spans are recorded only while an exporter is installed; contexts are propagated regardless.
+        static void SetExporter(std::shared_ptr<ISpanExporter> exporter) {
+            RecordingFlag().store(exporter != nullptr, std::memory_order_release);
+            auto previous = ExporterSlot().exchange(std::move(exporter));
+            if (previous) previous->Flush();
+        }
+        static bool IsRecording() { return RecordingFlag().load(std::memory_order_acquire); }
+        static void Export(const Span& span) {
+            if (auto exporter = ExporterSlot().load()) exporter->Export(span);
+        }
+
+        static uint64_t NowNs() {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+        }
+    };
+
+    // Installs a context as the thread's current one for the lifetime of the scope.
+    class TraceScope {
+        TraceContext _previous;
+    public:
+        explicit TraceScope(const TraceContext& ctx) : _previous(std::move(Tracer::Current())) {
+            Tracer::Current() = ctx;
+        }
+        ~TraceScope() { Tracer::Current() = std::move(_previous); }
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+    };
+
+    // TraceScope that also records a timed span; a span left by an exception is marked as failed.
+    class ScopedSpan {
+        TraceScope _scope;
+        std::unique_ptr<Span> _span;
+        int _uncaught;
+    public:
+        ScopedSpan(const std::string& name, SpanKind kind, const TraceContext& ctx)
+            : _scope(ctx), _uncaught(std::uncaught_exceptions()) {
+            if (!Tracer::IsRecording()) return;
+            _span = std::make_unique<Span>();
+            _span->Name = name;
+            _span->Kind = kind;
+            _span->Context = ctx;
+            _span->StartNs = Tracer::NowNs();
+        }
+        ~ScopedSpan() {
+            if (!_span) return;
+            _span->EndNs = Tracer::NowNs();
+            if (std::uncaught_exceptions() > _uncaught) _span->Error = true;
+            Tracer::Export(*_span);
+        }
+        ScopedSpan(const ScopedSpan&) = delete;
+        ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+        const TraceContext& Context() const { return Tracer::Current(); }
+        bool IsRecording() const { return _span != nullptr; }
+        void SetAttribute(const std::string& key, const std::string& value) {
+            if (_span) _span->Attributes.emplace_back(key, value);
+        }
+        void SetError(const std::string& message) {
+            if (!_span) return;
+            _span->Error = true;
+            _span->StatusMessage = message;
+        }
+    };
+
+    // Collector stand-in that keeps spans in memory.
+    class InMemorySpanExporter : public ISpanExporter {
+        std::mutex _mtx;
+        std::vector<Span> _spans;
+    public:
+        void Export(const Span& span) override {
+            std::lock_guard lock(_mtx);
+            _spans.push_back(span);
+        }
+        std::vector<Span> Spans() {
+            std::lock_guard lock(_mtx);
+            return _spans;
+        }
+        void Clear() {
+            std::lock_guard lock(_mtx);
+            _spans.clear();
+        }
+    };
+
+    // Appends spans as OTLP/JSON ExportTraceServiceRequest lines (the OpenTelemetry file exporter format),
+    // batching up to 'batchSize' spans per line.
+    class OtlpJsonFileSpanExporter : public ISpanExporter {
+        std::mutex _mtx;
+        std::ofstream _file;
+        std::string _serviceName;
+        size_t _batchSize;
+        std::vector<Span> _pending;
+
+        static std::string Escape(const std::string& s) {
+            std::string out;
+            out.reserve(s.size());
+            for (char c : s) {
+                switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        static constexpr char digits[] = "0123456789abcdef";
+                        out += "\\u00";
+                        out += digits[(c >> 4) & 0xF];
+                        out += digits[c & 0xF];
+                    }
+                    else out += c;
+                }
+            }
+            return out;
+        }
+        static void WriteAttribute(std::ostream& os, const std::string& key, const std::string& value) {
+            os << "{\"key\":\"" << Escape(key) << "\",\"value\":{\"stringValue\":\"" << Escape(value) << "\"}}";
+        }
+        void WriteSpan(std::ostream& os, const Span& span) {
+            const auto& c = span.Context;
+            os << "{\"traceId\":\"" << c.TraceIdHex() << "\",\"spanId\":\"" << c.SpanIdHex() << "\"";
+            if (c.ParentSpanId) os << ",\"parentSpanId\":\"" << TraceContext::ToHex(c.ParentSpanId) << "\"";
+            os << ",\"name\":\"" << Escape(span.Name) << "\",\"kind\":" << static_cast<int>(span.Kind)
+                << ",\"startTimeUnixNano\":\"" << span.StartNs << "\",\"endTimeUnixNano\":\"" << span.EndNs << "\""
+                << ",\"attributes\":[";
+            WriteAttribute(os, "messaging.correlation_id", c.CorrelationId);
+            if (c.CausationId) {
+                os << ",";
+                WriteAttribute(os, "messaging.causation_id", TraceContext::ToHex(c.CausationId));
+            }
+            for (const auto& [key, value] : span.Attributes) {
+                os << ",";
+                WriteAttribute(os, key, value);
+            }
+            os << "],\"status\":{\"code\":" << (span.Error ? 2 : 1);
+            if (!span.StatusMessage.empty()) os << ",\"message\":\"" << Escape(span.StatusMessage) << "\"";
+            os << "}}";
+        }
+        void FlushLocked() {
+            if (_pending.empty()) return;
+            _file << "{\"resourceSpans\":[{\"resource\":{\"attributes\":[";
+            WriteAttribute(_file, "service.name", _serviceName);
+            _file << "]},\"scopeSpans\":[{\"scope\":{\"name\":\"cppplumberd\"},\"spans\":[";
+            for (size_t i = 0; i < _pending.size(); ++i) {
+                if (i) _file << ",";
+                WriteSpan(_file, _pending[i]);
+            }
+            _file << "]}]}]}\n";
+            _file.flush();
+            _pending.clear();
+        }
+    public:
+        OtlpJsonFileSpanExporter(const std::string& path, const std::string& serviceName, size_t batchSize = 64)
+            : _file(path, std::ios::app), _serviceName(serviceName), _batchSize(batchSize) {
+            if (!_file) {
+                throw std::runtime_error("Cannot open span export file: " + path);
+            }
+        }
+        ~OtlpJsonFileSpanExporter() override { Flush(); }
+
+        void Export(const Span& span) override {
+            std::lock_guard lock(_mtx);
+            _pending.push_back(span);
+            if (_pending.size() >= _batchSize) FlushLocked();
+        }
+        void Flush() override {
+            std::lock_guard lock(_mtx);
+            FlushLocked();
+        }
+    };
+}
@@ -7,12 +7,26 @@
 #include <map>
 #include <set>
 #include <chrono>
+#include <stdexcept>
 #include <boost/signals2.hpp>
+#include "cppplumberd/listener_list.hpp"
 using namespace std;
 using namespace std::chrono;
 using namespace boost::signals2;
 namespace cppplumberd {
 
+	// The transport failed to deliver a request or its reply; the server may or may not have handled it.
+	class TransportException : public runtime_error {
+	public:
+		explicit TransportException(const string& message) : runtime_error(message) {}
+	};
+
+	// No reply within the socket's timeout.
+	class TimeoutException : public TransportException {
+	public:
+		explicit TimeoutException(const string& message) : TransportException(message) {}
+	};
+
 	class ISocket
 	{
 	public:
@@ -26,13 +40,17 @@ namespace cppplumberd {
 	};
 	class ITransportSubscribeSocket : public ISocket {
 	public:
-		typedef boost::signals2::signal<void(uint8_t* buffer, size_t size)> ReceivedSignal;
+		// Fired by the receive thread for every frame; lock-free to invoke (see ListenerList).
+		typedef ListenerList<void(uint8_t* buffer, size_t size)> ReceivedSignal;
 		ReceivedSignal Received;
 
 	};
 	class ITransportReqRspClientSocket : public ISocket {
 	public:
 		virtual size_t Send(const uint8_t* inBuf, const size_t inSize, uint8_t* outBuf, const size_t outMaxBufSize) = 0;
+		// Bounds how long Send waits for the reply (zero: forever); a Send that runs out of time throws
+		// TimeoutException. Sockets that cannot bound a Send ignore it.
+		virtual void SetTimeout(milliseconds) {}
 	};
 	class ITransportReqRspSrvSocket : public ISocket {
 	public:
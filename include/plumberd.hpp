@@ -19,14 +19,36 @@
 #include "cppplumberd/message_dispatcher.hpp"
 #include "cppplumberd/nng/nng_socket_factory.hpp"
 #include "cppplumberd/stop_watch.hpp"
+#include "cppplumberd/latency_histogram.hpp"
+#include "cppplumberd/tracing.hpp"
+#include "cppplumberd/flight_recorder.hpp"
 #include "cppplumberd/fault_exception.hpp"
+#include "cppplumberd/executor.hpp"
+#include "cppplumberd/coroutines.hpp"
+#include "cppplumberd/compression.hpp"
+#include "cppplumberd/async_publisher.hpp"
 #include "cppplumberd/proto_publish_handler.hpp"
 #include "cppplumberd/proto_subscribe_handler.hpp"
 #include "cppplumberd/proto_req_rsp_srv_handler.hpp"
 #include "cppplumberd/proto_req_rsp_client_handler.hpp"
+#include "cppplumberd/command_policy.hpp"
 #include "cppplumberd/command_bus.hpp"
+#include "cppplumberd/command_pool.hpp"
 #include "cppplumberd/command_service_handler.hpp"
+#include "cppplumberd/event_handler_base.hpp"
+#include "cppplumberd/event_log.hpp"
+#include "cppplumberd/snapshot_store.hpp"
+#include "cppplumberd/last_value_cache.hpp"
 #include "cppplumberd/event_store.hpp"
+#include "cppplumberd/sharding.hpp"
+#include "cppplumberd/replication.hpp"
+#include "cppplumberd/aggregate_cache.hpp"
+#include "cppplumberd/aggregate.hpp"
+#include "cppplumberd/checkpoint_store.hpp"
+#include "cppplumberd/projection.hpp"
+#include "cppplumberd/query_bus.hpp"
+#include "cppplumberd/client_query_cache.hpp"
+#include "cppplumberd/flight_record_reader.hpp"
 #include "cppplumberd/contract.h"
 #include <memory>
 #include <string>
@@ -56,58 +78,6 @@ namespace cppplumberd {
 
 
 
-	class EventHandlerBase : public IEventDispatcher {
-    private:
-        // Map from message type ID to a type-erased handler function
-        std::unordered_map<unsigned int, std::function<void(const Metadata&, MessagePtr)>> _handlers;
-
-        // Stores the relationship between message type and message ID
-        std::unordered_map<std::type_index, unsigned int> _messageTypeToId;
-
-	public:
-		// we expect here that "this" implements IEventHandler<TEvent>
-        template<typename TEvent, unsigned int EventType>
-        void Map() {
-            // Store the message type to ID mapping
-            _messageTypeToId[std::type_index(typeid(TEvent))] = EventType;
-
-
-            // Create type-erased handler that forwards to the derived class's handler
-            // This assumes the derived class implements IEventHandler<TEvent>
-            _handlers[EventType] = [this](const Metadata& metadata, MessagePtr msg) {
-                // Convert the message pointer to the specific event type
-                const TEvent* typedEvent = dynamic_cast<const TEvent*>(msg);
-                if (!typedEvent) {
-                    throw std::runtime_error("Event type mismatch in handler");
-                }
-
-                // Forward to the derived handler
-                // We use dynamic_cast to find the appropriate IEventHandler<TEvent> interface
-                IEventHandler<TEvent>* handler = dynamic_cast<IEventHandler<TEvent>*>(this);
-                if (!handler) {
-                    throw std::runtime_error("Derived class doesn't implement IEventHandler<TEvent>");
-                }
-
-                // Call the derived handler method
-                handler->Handle(metadata, *typedEvent);
-                };
-        }
-
-        inline void Handle(const Metadata& metadata, unsigned int messageId, MessagePtr msg) override
-		{
-            auto handlerIt = _handlers.find(messageId);
-            if (handlerIt == _handlers.end()) {
-                // No handler registered for this message type
-                return;
-            }
-
-            // Call the handler
-            handlerIt->second(metadata, msg);
-		}
-	};
-
-
-	
 	template<typename T>
 	concept TException = requires(T t) {
 		{ t.ErrorCode() } -> same_as<unsigned short>;
@@ -150,6 +120,9 @@ namespace cppplumberd {
 					_stream->Stop();
                     _parent->Unsubscribe(this);
                 }
+                SubscriptionStats Stats() const override {
+                    return _stream->Stats();
+                }
             };
             void Unsubscribe(Subscription* subscription)
             {
@@ -159,7 +132,12 @@ namespace cppplumberd {
                 }
             }
         public:
-            unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler)
+            unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler) override
+            {
+                return Subscribe(streamName, handler, SubscriptionOptions());
+            }
+            unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler,
+                const SubscriptionOptions& options) override
             {
                 CreateStream cmd;
                 cmd.set_name(streamName);
@@ -168,7 +146,26 @@ namespace cppplumberd {
                 
 				auto stream = make_shared<ClientProtoSubscriptionStream>(std::move(sock),handler,_parent->_serializer, streamName);
 				auto sub = make_unique<Subscription>(this, streamName, stream);
-                stream->Start();
+                if (options.FlowControl) stream->EnableFlowControl(options);
+                else if (options.Executor) stream->EnableExecutor(options.Executor);
+                if (options.ReceiveRing > 0) stream->EnableReceiveRing(options.ReceiveRing);
+                stream->SetDictionaryResolver([parent = _parent, streamName](uint32_t id) {
+                    GetCompressionDictionary query;
+                    query.set_stream(streamName);
+                    query.set_id(id);
+                    return parent->DictionaryBus()->Query<CompressionDictionary>(query).dictionary();
+                });
+                if (options.LastValues) {
+                    // Live events are held back until the stream's last values have been delivered.
+                    stream->HoldLive();
+                    stream->Start();
+                    GetLastValues query;
+                    query.set_stream(streamName);
+                    stream->DeliverSnapshot(_parent->_queryBus->Query<LastValueSnapshot>(query));
+                }
+                else {
+                    stream->Start();
+                }
 				_subscriptions.push_back(sub.get());
                 return sub;
             }
@@ -186,10 +183,28 @@ namespace cppplumberd {
         shared_ptr<ISocketFactory> _socketFactory;
         string _endpoint;
         shared_ptr<PlumberCommandBus> _commandBus;
+        shared_ptr<PlumberQueryBus> _queryBus;
         shared_ptr<ISubscriptionManager> _subscriptionManager;
 		shared_ptr<MessageSerializer> _serializer;
+        shared_ptr<ClientQueryCache> _queryCache;
+        std::mutex _dictionaryMtx;
+        shared_ptr<PlumberQueryBus> _dictionaryBus;
         bool _isStarted = false;
 
+        // Dictionaries are fetched from a subscriber's receive thread; a connection of their own keeps that round
+        // trip from queueing behind (or ahead of) the application's queries. Opened on first use.
+        shared_ptr<PlumberQueryBus> DictionaryBus() {
+            lock_guard lock(_dictionaryMtx);
+            if (!_dictionaryBus) {
+                auto bus = make_shared<PlumberQueryBus>(make_unique<ProtoReqRspClientHandler>(
+                    _socketFactory->CreateReqRspClientSocket(_endpoint), _serializer));
+                bus->RegisterQuery<GetCompressionDictionary, COMMANDS::GET_COMPRESSION_DICTIONARY, CompressionDictionary, COMMANDS::COMPRESSION_DICTIONARY>();
+                bus->Start();
+                _dictionaryBus = bus;
+            }
+            return _dictionaryBus;
+        }
+
     public:
         static unique_ptr<PlumberClient> CreateClient(shared_ptr<ISocketFactory> factory, const string& endpoint = "commands") {
             return make_unique<PlumberClient>(factory, endpoint);
@@ -204,8 +219,12 @@ namespace cppplumberd {
                 _socketFactory->CreateReqRspClientSocket(endpoint), _serializer);
 
             _commandBus = make_shared<cppplumberd::PlumberCommandBus>(std::move(clientHandler));
+            _queryBus = make_shared<PlumberQueryBus>(make_unique<ProtoReqRspClientHandler>(
+                _socketFactory->CreateReqRspClientSocket(endpoint), _serializer));
 			_subscriptionManager = make_shared<cppplumberd::PlumberClient::SubscriptionManagerImp>(this);
+            _queryCache = make_shared<ClientQueryCache>(_queryBus, _subscriptionManager);
 			_commandBus->RegisterMessage<CreateStream, COMMANDS::CREATE_STREAM>();
+            _queryBus->RegisterQuery<GetLastValues, COMMANDS::GET_LAST_VALUES, LastValueSnapshot, COMMANDS::LAST_VALUE_SNAPSHOT>();
         }
         template<typename TMessage, unsigned int MessageId>
         inline void RegisterMessage() const
@@ -216,6 +235,7 @@ namespace cppplumberd {
             if (_isStarted) return;
 
             _commandBus->Start();
+            _queryBus->Start();
 
             _isStarted = true;
         }
@@ -224,10 +244,25 @@ namespace cppplumberd {
             _isStarted = false;
         }
 
+        // Deadline, retries and circuit breaking for commands sent through CommandBus(), including the CreateStream
+        // sent by Subscribe.
+        void SetCommandPolicy(const CommandPolicy& policy) {
+            _commandBus->SetPolicy(policy);
+        }
+
         virtual shared_ptr<PlumberCommandBus> CommandBus() {
             return _commandBus;
         }
 
+        virtual shared_ptr<PlumberQueryBus> QueryBus() {
+            return _queryBus;
+        }
+
+        // Read-through cache over QueryBus() for query types registered with it.
+        virtual shared_ptr<ClientQueryCache> QueryCache() {
+            return _queryCache;
+        }
+
         virtual shared_ptr<ISubscriptionManager> SubscriptionManager() {
             return _subscriptionManager;
         }
@@ -240,10 +275,43 @@ namespace cppplumberd {
     private:
         shared_ptr<CommandServiceHandler> _commandServiceHandler;
 		shared_ptr<EventStore> _eventStore;
+        shared_ptr<QueryServiceHandler> _queryServiceHandler;
         shared_ptr<ISocketFactory> _socketFactory;
 		shared_ptr<MessageSerializer> _serializer;
+        shared_ptr<ShardOwnership> _shard;
+        atomic<bool> _following = false;
+        atomic<uint64_t> _epoch = 1;
         string _endpoint;
         bool _isStarted;
+        // Last, so replication threads are joined before anything they use goes away.
+        atomic<shared_ptr<EventLogReplicator>> _replicator;
+
+        void CheckRequest(const CommandHeader& header) const {
+            if (_following && !IsSystemRecipient(header.recipient()))
+                throw FaultException("This server is a read-only follower; send commands to the leader", NOT_LEADER);
+            if (_shard) _shard->Check(header.recipient());
+        }
+        void AwaitReplication(const CommandHeader& header) const {
+            auto replicator = _replicator.load();
+            if (replicator && replicator->Options().Mode == ReplicationMode::SEMI_SYNC && !IsSystemRecipient(header.recipient()))
+                replicator->AwaitSemiSync();
+        }
+        // The event log keeps the epoch, so a server that reopens its log resumes at the newest epoch it had seen.
+        uint64_t CurrentEpoch() const {
+            auto& log = _eventStore->EventLog();
+            return log ? max<uint64_t>(_epoch, log->Epoch()) : _epoch.load();
+        }
+        ReplicationAck OnReplicate(const ReplicateEvents& batch) {
+            uint64_t epoch = CurrentEpoch();
+            if (batch.epoch() < epoch)
+                throw FaultException("Epoch " + to_string(batch.epoch()) + " has been replaced by " + to_string(epoch), STALE_EPOCH);
+            if (!_following) throw FaultException("This server is a leader, not a follower", 412);
+            if (batch.epoch() > epoch) {
+                _eventStore->EventLog()->SetEpoch(batch.epoch());
+                _epoch = batch.epoch();
+            }
+            return ApplyReplicatedEvents(*_eventStore, batch);
+        }
     public:
         static unique_ptr<Plumber> CreateServer(shared_ptr<ISocketFactory> factory, const string& endpoint = "commands") {
             return make_unique<Plumber>(factory, endpoint);
@@ -258,7 +326,33 @@ namespace cppplumberd {
             _commandServiceHandler = make_shared<CommandServiceHandler>(unique_ptr<ProtoReqRspSrvHandler>(srvHandler));
 
 			_eventStore = make_shared<cppplumberd::EventStore>(factory, _serializer);
+            _queryServiceHandler = make_shared<QueryServiceHandler>(_commandServiceHandler->Handler(), _eventStore);
+            _commandServiceHandler->Handler().RegisterHandler<GetLastValues, COMMANDS::GET_LAST_VALUES, LastValueSnapshot, COMMANDS::LAST_VALUE_SNAPSHOT>(
+                [eventStore = _eventStore](const GetLastValues& query) { return eventStore->LastValues().Snapshot(query.stream()); });
+            _commandServiceHandler->Handler().RegisterHandler<GetCompressionDictionary, COMMANDS::GET_COMPRESSION_DICTIONARY, CompressionDictionary, COMMANDS::COMPRESSION_DICTIONARY>(
+                [eventStore = _eventStore](const GetCompressionDictionary& query) {
+                    CompressionDictionary result;
+                    result.set_dictionary(eventStore->FindDictionary(query.stream(), query.id()));
+                    if (result.dictionary().empty())
+                        throw FaultException("No compression dictionary " + to_string(query.id()) + " on '" + query.stream() + "'", 404);
+                    result.set_id(query.id());
+                    result.set_stream(query.stream());
+                    return result;
+                });
             this->AddCommandHandler<CreateStreamCommandHandler, CreateStream, COMMANDS::CREATE_STREAM>(_eventStore);
+            _commandServiceHandler->Handler().RegisterHandler<Ping, COMMANDS::PING>(function<void(const Ping&)>([](const Ping&) {}));
+            _commandServiceHandler->Handler().RegisterHandler<ReplicateEvents, COMMANDS::REPLICATE_EVENTS, ReplicationAck, COMMANDS::REPLICATION_ACK>(
+                [this](const ReplicateEvents& batch) { return OnReplicate(batch); });
+            _commandServiceHandler->Handler().SetRequestFilter([this](const CommandHeader& header) { CheckRequest(header); });
+            _commandServiceHandler->Handler().SetReplyGate([this](const CommandHeader& header) { AwaitReplication(header); });
+        }
+
+        // The request filter, the reply gate and the replication handler use this server's members: the socket is
+        // closed before any of them goes away, once the request it is handling has been answered (a semi-sync reply
+        // may still wait for the replicator, so replication stops after that).
+        ~Plumber() {
+            _commandServiceHandler->Close();
+            StopReplication();
         }
 
         void Start() {
@@ -289,6 +383,83 @@ namespace cppplumberd {
             return _commandServiceHandler;
         }
 
+        // Commands sent with a command id run once per id within the window; retries get the first response.
+        void EnableCommandDedup(const CommandDedupOptions& options = {}) {
+            _commandServiceHandler->Handler().EnableDedup(options);
+        }
+        CommandDedupStats DedupStats() const {
+            return _commandServiceHandler->Handler().DedupStats();
+        }
+
+        // Makes this server shard 'shardName' of 'table': commands for streams it does not own are refused with
+        // SHARD_MISDIRECTED, and it serves the routing table and its side of slot handoffs (which need an event log).
+        void EnableSharding(const string& shardName, const RoutingTable& table) {
+            auto shard = make_shared<ShardOwnership>(shardName, table);
+            _shard = shard;
+            auto& handler = _commandServiceHandler->Handler();
+            handler.RegisterHandler<GetRoutingTable, COMMANDS::GET_ROUTING_TABLE, RoutingTable, COMMANDS::ROUTING_TABLE>(
+                [shard](const GetRoutingTable&) { return shard->Table(); });
+            handler.RegisterHandler<FreezeSlot, COMMANDS::FREEZE_SLOT>(
+                function<void(const FreezeSlot&)>([shard](const FreezeSlot& cmd) { shard->Freeze(cmd.slot()); }));
+            handler.RegisterHandler<UnfreezeSlot, COMMANDS::UNFREEZE_SLOT>(
+                function<void(const UnfreezeSlot&)>([shard](const UnfreezeSlot& cmd) { shard->Unfreeze(cmd.slot()); }));
+            handler.RegisterHandler<ExportSlot, COMMANDS::EXPORT_SLOT, SlotEvents, COMMANDS::SLOT_EVENTS>(
+                [shard, store = _eventStore](const ExportSlot& query) { return ExportSlotEvents(*store, query, shard->Table().slots_size()); });
+            handler.RegisterHandler<ImportEvents, COMMANDS::IMPORT_EVENTS>(
+                function<void(const ImportEvents&)>([store = _eventStore](const ImportEvents& cmd) { ImportSlotEvents(*store, cmd); }));
+            handler.RegisterHandler<AdoptRoutingTable, COMMANDS::ADOPT_ROUTING_TABLE>(
+                function<void(const AdoptRoutingTable&)>([shard](const AdoptRoutingTable& cmd) { shard->Adopt(cmd.table()); }));
+        }
+        // Null unless EnableSharding was called.
+        shared_ptr<ShardOwnership> Sharding() const {
+            return _shard;
+        }
+
+        // Leader: ships the event log to 'followers' (see EventLogReplicator). In SEMI_SYNC mode a command is answered
+        // once a follower has acked its events. When a follower reports a newer epoch, this server has been replaced
+        // and turns into a read-only follower itself; the new leader then truncates the records it took meanwhile.
+        void ReplicateTo(const vector<FollowerEndpoint>& followers, const ReplicationOptions& options = ReplicationOptions()) {
+            StopReplication();
+            _epoch = CurrentEpoch();
+            auto replicator = make_shared<EventLogReplicator>(_eventStore->EventLog(), followers, _epoch, options);
+            _eventStore->EventLog()->SetEpoch(_epoch);
+            replicator->OnFenced([this]() { _following = true; });
+            replicator->Start();
+            _replicator = replicator;
+        }
+        void StopReplication() {
+            if (auto replicator = _replicator.exchange(nullptr)) replicator->Stop();
+        }
+        ReplicatorStats ReplicationStats() const {
+            auto replicator = _replicator.load();
+            if (replicator) return replicator->Stats();
+            ReplicatorStats stats;
+            stats.Epoch = CurrentEpoch();
+            if (_eventStore->EventLog()) stats.Head = _eventStore->EventLog()->Head();
+            return stats;
+        }
+
+        // Follower: commands for streams are refused with NOT_LEADER; the log a leader replicates here is appended to
+        // the event log and delivered to this server's subscribers. Records the leader does not have are truncated.
+        void Follow() {
+            if (!_eventStore->EventLog()) throw invalid_argument("A follower needs an event log");
+            StopReplication();
+            _following = true;
+        }
+        // Failover: the follower starts taking commands under the next epoch. Followers it replicates to refuse the
+        // old leader from then on. Promote exactly one follower; choosing it is up to the operator or a coordinator.
+        void Promote() {
+            _epoch = CurrentEpoch() + 1;
+            if (_eventStore->EventLog()) _eventStore->EventLog()->SetEpoch(_epoch);
+            _following = false;
+        }
+        bool IsLeader() const {
+            return !_following;
+        }
+        uint64_t Epoch() const {
+            return CurrentEpoch();
+        }
+
         // Command handler registration
         template<typename TCommandHandler, typename TCommand, unsigned int MessageId>
         void AddCommandHandler() {
@@ -310,6 +481,17 @@ namespace cppplumberd {
             _commandServiceHandler->RegisterHandler<TCommand, MessageId>(handler);
         }
 
+        // Query handler registration; results are cached until an event is published on one of 'invalidatedBy'
+        // (no caching when empty).
+        template<typename TQuery, unsigned int QueryId, typename TResult, unsigned int ResultId>
+        void AddQueryHandler(shared_ptr<IQueryHandler<TQuery, TResult>> handler, const vector<string>& invalidatedBy = {}) {
+            _queryServiceHandler->RegisterHandler<TQuery, QueryId, TResult, ResultId>(handler, invalidatedBy);
+        }
+
+        shared_ptr<QueryServiceHandler> GetQueryServiceHandler() {
+            return _queryServiceHandler;
+        }
+
         // Event handler registration
         template<typename TEventHandler, typename TEvent, unsigned int MessageId>
         void AddEventHandler() {
@@ -317,6 +499,204 @@ namespace cppplumberd {
             
         }
     };
+
+    struct ShardEndpoint {
+        string Name;                        // as in the routing table
+        shared_ptr<ISocketFactory> Factory;
+        string Endpoint = "commands";
+    };
+
+    // Client of a set of sharded Plumber servers (see Plumber::EnableSharding). Commands and subscriptions go to the
+    // shard that owns their stream in the newest routing table it knows. A SHARD_MISDIRECTED fault makes it fetch
+    // the table again and resend; SHARD_SLOT_MOVING makes it wait and resend. Subscriptions stay on the shard they
+    // were made on: use OnRoutingChanged to resubscribe streams that moved.
+    class ShardedPlumberClient {
+        struct Shard {
+            string Name;
+            unique_ptr<PlumberClient> Client;
+        };
+        vector<Shard> _shards;
+        mutable std::mutex _mtx;
+        RoutingTable _table;
+        function<void(const RoutingTable&)> _onRoutingChanged;
+        uint32_t _maxResends = 8;
+        milliseconds _slotMovingBackoff = milliseconds(20);
+
+        PlumberClient& ClientOf(const string& shardName) {
+            for (auto& shard : _shards) if (shard.Name == shardName) return *shard.Client;
+            throw invalid_argument("Unknown shard '" + shardName + "'");
+        }
+
+        // Sends the table to every shard but 'except', all of them even if some fail; the first failure is rethrown.
+        void Distribute(const AdoptRoutingTable& adopt, const string& except) {
+            exception_ptr failed;
+            for (auto& shard : _shards) {
+                if (shard.Name == except) continue;
+                try {
+                    shard.Client->CommandBus()->Send("$", adopt);
+                }
+                catch (...) {
+                    if (!failed) failed = current_exception();
+                }
+            }
+            Adopt(adopt.table());
+            if (failed) rethrow_exception(failed);
+        }
+
+        void Adopt(const RoutingTable& table) {
+            function<void(const RoutingTable&)> onChanged;
+            {
+                lock_guard lock(_mtx);
+                if (table.version() <= _table.version()) return;
+                _table = table;
+                onChanged = _onRoutingChanged;
+            }
+            if (onChanged) onChanged(table);
+        }
+
+    public:
+        ShardedPlumberClient(const vector<ShardEndpoint>& shards) {
+            if (shards.empty()) throw invalid_argument("A sharded client needs at least one shard");
+            for (const auto& endpoint : shards) {
+                auto client = make_unique<PlumberClient>(endpoint.Factory, endpoint.Endpoint);
+                auto bus = client->CommandBus();
+                bus->RegisterMessage<FreezeSlot, COMMANDS::FREEZE_SLOT>();
+                bus->RegisterMessage<UnfreezeSlot, COMMANDS::UNFREEZE_SLOT>();
+                bus->RegisterMessage<ImportEvents, COMMANDS::IMPORT_EVENTS>();
+                bus->RegisterMessage<AdoptRoutingTable, COMMANDS::ADOPT_ROUTING_TABLE>();
+                auto queries = client->QueryBus();
+                queries->RegisterQuery<GetRoutingTable, COMMANDS::GET_ROUTING_TABLE, RoutingTable, COMMANDS::ROUTING_TABLE>();
+                queries->RegisterQuery<ExportSlot, COMMANDS::EXPORT_SLOT, SlotEvents, COMMANDS::SLOT_EVENTS>();
+                _shards.push_back(Shard{ endpoint.Name, std::move(client) });
+            }
+        }
+
+        // Event types, for subscriptions.
+        template<typename TMessage, unsigned int MessageId>
+        void RegisterMessage() {
+            for (auto& shard : _shards) shard.Client->RegisterMessage<TMessage, MessageId>();
+        }
+        template<typename TCommand, unsigned int MessageId>
+        void RegisterCommand() {
+            for (auto& shard : _shards) shard.Client->CommandBus()->RegisterMessage<TCommand, MessageId>();
+        }
+
+        // Connects to every shard and fetches the routing table.
+        void Start() {
+            for (auto& shard : _shards) shard.Client->Start();
+            RefreshRoutingTable();
+        }
+        void Stop() {
+            for (auto& shard : _shards) shard.Client->Stop();
+        }
+
+        // Asks every reachable shard for its table and keeps the newest.
+        void RefreshRoutingTable() {
+            bool any = false;
+            for (auto& shard : _shards) {
+                try {
+                    Adopt(shard.Client->QueryBus()->Query<RoutingTable>(GetRoutingTable()));
+                    any = true;
+                }
+                catch (const exception& ex) {
+                    cerr << "No routing table from shard '" << shard.Name << "': " << ex.what() << endl;
+                }
+            }
+            if (!any) throw TransportException("No shard answered with a routing table");
+        }
+
+        RoutingTable Table() const {
+            lock_guard lock(_mtx);
+            return _table;
+        }
+        string ShardOf(const string& stream) const {
+            lock_guard lock(_mtx);
+            return cppplumberd::ShardOf(_table, stream);
+        }
+
+        // Called after a newer routing table has been adopted.
+        void OnRoutingChanged(function<void(const RoutingTable&)> callback) {
+            lock_guard lock(_mtx);
+            _onRoutingChanged = std::move(callback);
+        }
+
+        template<typename TCommand>
+        void Send(const string& stream, const TCommand& cmd, const string& commandId = string()) {
+            for (uint32_t resend = 0;; ++resend) {
+                try {
+                    ClientOf(ShardOf(stream)).CommandBus()->Send(stream, cmd, commandId);
+                    return;
+                }
+                catch (const FaultException& fault) {
+                    if (resend >= _maxResends) throw;
+                    if (fault.ErrorCode() == SHARD_SLOT_MOVING) this_thread::sleep_for(_slotMovingBackoff);
+                    else if (fault.ErrorCode() != SHARD_MISDIRECTED) throw;
+                    RefreshRoutingTable();
+                }
+            }
+        }
+
+        unique_ptr<ISubscription> Subscribe(const string& stream, const shared_ptr<IEventDispatcher>& handler,
+            const SubscriptionOptions& options = SubscriptionOptions()) {
+            return ClientOf(ShardOf(stream)).SubscriptionManager()->Subscribe(stream, handler, options);
+        }
+
+        // Hands 'slot' over to shard 'target': the owner stops taking commands for it, its events are copied to the
+        // target page by page, then every shard adopts the next table version (the target first). Commands for the
+        // slot wait meanwhile. If the copy or the target's adoption fails, the owner is told to take the slot's
+        // commands again. Once the target has the table the move stands: shards that missed it are sent it again
+        // by the next MoveSlot. Calling it again after a failure is safe: already imported versions are skipped.
+        void MoveSlot(uint32_t slot, const string& target) {
+            RefreshRoutingTable();
+            RoutingTable table = Table();
+            if (slot >= static_cast<uint32_t>(table.slots_size())) throw invalid_argument("No slot " + to_string(slot));
+            const string source = table.shards(table.slots(slot));
+            AdoptRoutingTable adopt;
+            if (source == target) {
+                *adopt.mutable_table() = table;
+                Distribute(adopt, string());
+                return;
+            }
+            auto& from = ClientOf(source);
+            auto& to = ClientOf(target);
+
+            FreezeSlot freeze;
+            freeze.set_slot(slot);
+            from.CommandBus()->Send("$", freeze);
+            *adopt.mutable_table() = MoveSlotTo(table, slot, target);
+            try {
+                ExportSlot page;
+                page.set_slot(slot);
+                while (true) {
+                    auto events = from.QueryBus()->Query<SlotEvents>(page);
+                    if (events.events_size() > 0) {
+                        ImportEvents import;
+                        *import.mutable_events() = events.events();
+                        to.CommandBus()->Send("$", import);
+                    }
+                    if (events.done()) break;
+                    page.set_from_position(events.next_position());
+                }
+                to.CommandBus()->Send("$", adopt);
+            }
+            catch (const exception& ex) {
+                // A lost reply may hide that the target did adopt the table; then the source must stay frozen.
+                try {
+                    if (to.QueryBus()->Query<RoutingTable>(GetRoutingTable()).version() < adopt.table().version()) {
+                        UnfreezeSlot unfreeze;
+                        unfreeze.set_slot(slot);
+                        from.CommandBus()->Send("$", unfreeze);
+                    }
+                }
+                catch (const exception& rollback) {
+                    cerr << "Slot " << slot << " stays frozen on shard '" << source << "' after '" << ex.what()
+                        << "': " << rollback.what() << endl;
+                }
+                throw;
+            }
+            Distribute(adopt, target);
+        }
+    };
 }
 
 #endif // PLUMBERD_HPP
\ No newline at end of file
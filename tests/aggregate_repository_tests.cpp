@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <string>
+#include <filesystem>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+class ElementAggregate : public Aggregate<ElementState>, public IEventHandler<PropertyChangedEvent> {
+public:
+    ElementAggregate() { Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(); }
+    void Handle(const Metadata& m, const PropertyChangedEvent& evt) override {
+        _state.set_element_name(evt.element_name());
+        (*_state.mutable_properties())[evt.property_name()] = evt.value_data();
+        _state.set_changes(_state.changes() + 1);
+        ++Applied;
+    }
+    size_t Applied = 0;
+};
+
+class AggregateRepositoryTest : public Test {
+protected:
+    shared_ptr<EventStore> _eventStore;
+
+    void SetUp() override {
+        _eventStore = make_shared<EventStore>();
+        _eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        _eventStore->SetEventLog(make_shared<InMemoryEventLog>());
+    }
+
+    static PropertyChangedEvent Change(const string& property, const string& value) {
+        PropertyChangedEvent evt;
+        evt.set_element_name("Pump");
+        evt.set_property_name(property);
+        evt.set_value_data(value);
+        return evt;
+    }
+};
+
+TEST_F(AggregateRepositoryTest, LoadReplaysStream) {
+    AggregateRepository<ElementAggregate> repository(_eventStore);
+    auto pump = repository.Load("pump-1");
+    repository.Append(*pump, Change("Speed", "1"));
+    repository.Append(*pump, Change("Speed", "2"));
+    repository.Append(*pump, Change("Mode", "auto"));
+
+    auto loaded = repository.Load("pump-1");
+
+    EXPECT_EQ(loaded->Version(), 3u);
+    EXPECT_EQ(loaded->Applied, 3u);
+    EXPECT_EQ(loaded->State().changes(), 3u);
+    EXPECT_EQ(loaded->State().properties().at("Speed"), "2");
+}
+
+TEST_F(AggregateRepositoryTest, LoadStartsFromLatestSnapshot) {
+    auto snapshotter = make_shared<Snapshotter>(make_shared<InMemorySnapshotStore>());
+    AggregateRepository<ElementAggregate> repository(_eventStore, snapshotter, SnapshotPolicy{ 10 });
+    auto pump = repository.Load("pump-1");
+    for (int i = 0; i < 25; ++i) repository.Append(*pump, Change("Speed", to_string(i)));
+    snapshotter->Flush();
+
+    auto loaded = repository.Load("pump-1");
+
+    EXPECT_EQ(snapshotter->Store()->Load("pump-1")->version(), 20u);
+    EXPECT_EQ(loaded->Version(), 25u);
+    EXPECT_EQ(loaded->Applied, 5u);
+    EXPECT_EQ(loaded->State().changes(), 25u);
+    EXPECT_EQ(loaded->State().properties().at("Speed"), "24");
+}
+
+TEST_F(AggregateRepositoryTest, ConcurrentWriterGetsConflict) {
+    AggregateRepository<ElementAggregate> repository(_eventStore);
+    auto first = repository.Load("pump-1");
+    auto second = repository.Load("pump-1");
+    repository.Append(*first, Change("Speed", "1"));
+
+    EXPECT_THROW(repository.Append(*second, Change("Speed", "2")), FaultException);
+    EXPECT_EQ(repository.CatchUp(*second), 1u);
+    repository.Append(*second, Change("Speed", "2"));
+    EXPECT_EQ(second->Version(), 2u);
+}
+
+TEST_F(AggregateRepositoryTest, FileSnapshotsSurviveRestart) {
+    string directory = "/tmp/cppplumberd_snapshots_test";
+    filesystem::remove_all(directory);
+    {
+        auto snapshotter = make_shared<Snapshotter>(make_shared<FileSnapshotStore>(directory));
+        AggregateRepository<ElementAggregate> repository(_eventStore, snapshotter, SnapshotPolicy{ 4 });
+        auto pump = repository.Load("pump/1");
+        for (int i = 0; i < 6; ++i) repository.Append(*pump, Change("Speed", to_string(i)));
+        snapshotter->Flush();
+    }
+
+    auto snapshotter = make_shared<Snapshotter>(make_shared<FileSnapshotStore>(directory));
+    AggregateRepository<ElementAggregate> repository(_eventStore, snapshotter);
+    auto loaded = repository.Load("pump/1");
+
+    EXPECT_EQ(loaded->Applied, 2u);
+    EXPECT_EQ(loaded->State().changes(), 6u);
+}
+
+TEST_F(AggregateRepositoryTest, RepeatedCommandsHitTheCache) {
+    AggregateRepository<ElementAggregate> repository(_eventStore);
+    repository.EnableCache(1024 * 1024);
+
+    auto first = repository.Get("pump-1");
+    repository.Append(*first, Change("Speed", "1"));
+    auto second = repository.Get("pump-1");
+
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(second->Version(), 1u);
+    auto stats = repository.Cache()->Stats();
+    EXPECT_EQ(stats.Hits, 1u);
+    EXPECT_EQ(stats.Misses, 1u);
+    EXPECT_EQ(stats.Entries, 1u);
+    EXPECT_GT(stats.Bytes, 0u);
+    EXPECT_DOUBLE_EQ(stats.HitRatio(), 0.5);
+}
+
+TEST_F(AggregateRepositoryTest, CachedAggregateIsValidatedAgainstStream) {
+    AggregateRepository<ElementAggregate> repository(_eventStore);
+    repository.EnableCache(1024 * 1024);
+    auto cached = repository.Get("pump-1");
+
+    _eventStore->Publish("pump-1", Change("Speed", "7"));
+    auto validated = repository.Get("pump-1");
+
+    EXPECT_EQ(validated->Version(), 1u);
+    EXPECT_EQ(validated->State().properties().at("Speed"), "7");
+    EXPECT_EQ(repository.Cache()->Stats().Stale, 1u);
+}
+
+TEST_F(AggregateRepositoryTest, CacheEvictsLeastRecentlyUsedOverCapacity) {
+    AggregateRepository<ElementAggregate> repository(_eventStore);
+    repository.EnableCache(1);
+
+    repository.Get("pump-1");
+    repository.Get("pump-2");
+    repository.Get("pump-1");
+
+    auto stats = repository.Cache()->Stats();
+    EXPECT_EQ(stats.Misses, 3u);
+    EXPECT_EQ(stats.Evictions, 2u);
+    EXPECT_EQ(stats.Entries, 1u);
+}
+
+TEST_F(AggregateRepositoryTest, ConflictEvictsCachedAggregate) {
+    AggregateRepository<ElementAggregate> repository(_eventStore);
+    repository.EnableCache(1024 * 1024);
+    auto cached = repository.Get("pump-1");
+    auto other = repository.Load("pump-1");
+    repository.Append(*other, Change("Speed", "1"));
+
+    EXPECT_THROW(repository.Append(*cached, Change("Speed", "2")), FaultException);
+    EXPECT_EQ(repository.Cache()->Stats().Entries, 0u);
+    EXPECT_EQ(repository.Get("pump-1")->Version(), 1u);
+}
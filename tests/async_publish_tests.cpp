@@ -0,0 +1,203 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+// Keeps every frame it is asked to send; Send blocks while the gate is closed.
+class RecordingPublishSocket : public ITransportPublishSocket {
+public:
+    void Start() override {}
+    void Start(const string& url) override {}
+    void Send(const uint8_t* buffer, const size_t size) override {
+        std::unique_lock lock(_mtx);
+        _gate.wait(lock, [this]() { return _open; });
+        Frames.emplace_back(buffer, buffer + size);
+        SendThreads.insert(this_thread::get_id());
+    }
+    void Close() {
+        std::lock_guard lock(_mtx);
+        _open = false;
+    }
+    void Open() {
+        {
+            std::lock_guard lock(_mtx);
+            _open = true;
+        }
+        _gate.notify_all();
+    }
+    vector<vector<uint8_t>> Frames;
+    set<thread::id> SendThreads;
+
+private:
+    std::mutex _mtx;
+    std::condition_variable _gate;
+    bool _open = true;
+};
+
+class RecordingSocketFactory : public ISocketFactory {
+public:
+    unique_ptr<ITransportPublishSocket> CreatePublishSocket(const string& endpoint) override {
+        auto socket = make_unique<RecordingPublishSocket>();
+        Sockets[endpoint] = socket.get();
+        return socket;
+    }
+    unique_ptr<ITransportSubscribeSocket> CreateSubscribeSocket(const string& endpoint) override { throw runtime_error("not supported"); }
+    unique_ptr<ITransportReqRspClientSocket> CreateReqRspClientSocket(const string& endpoint) override { throw runtime_error("not supported"); }
+    unique_ptr<ITransportReqRspSrvSocket> CreateReqRspSrvSocket(const string& endpoint) override { throw runtime_error("not supported"); }
+    map<string, RecordingPublishSocket*> Sockets;
+};
+
+struct SentEvent {
+    uint64_t Sequence;
+    string Value;
+};
+
+static vector<SentEvent> Decode(const shared_ptr<MessageSerializer>& serializer, const vector<vector<uint8_t>>& frames) {
+    vector<SentEvent> decoded;
+    for (auto frame : frames) {
+        ProtoFrameBufferView view(serializer, frame.data(), frame.size());
+        view.AckWritten(frame.size());
+        MessagePtr msg = nullptr;
+        auto header = view.Read<EventHeader>([](EventHeader& h) { return h.event_type(); }, msg);
+        unique_ptr<google::protobuf::Message> owned(msg);
+        decoded.push_back({ header->sequence(), static_cast<PropertyChangedEvent*>(msg)->value_data() });
+    }
+    return decoded;
+}
+
+static PropertyChangedEvent Changed(const string& value) {
+    PropertyChangedEvent evt;
+    evt.set_property_name("Speed");
+    evt.set_value_data(value);
+    return evt;
+}
+
+TEST(MpscQueueTest, KeepsEachProducersOrderUnderConcurrentPushes) {
+    constexpr int producers = 4, perProducer = 20000;
+    MpscQueue<pair<int, int>> queue;
+    vector<thread> threads;
+    for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&queue, p]() { for (int i = 0; i < perProducer; ++i) queue.Push({ p, i }); });
+
+    vector<int> next(producers, 0);
+    int popped = 0;
+    pair<int, int> item;
+    while (popped < producers * perProducer) {
+        if (!queue.TryPop(item)) continue;
+        ASSERT_EQ(item.second, next[item.first]);
+        ++next[item.first];
+        ++popped;
+    }
+    for (auto& t : threads) t.join();
+    EXPECT_FALSE(queue.TryPop(item));
+}
+
+class AsyncPublishTest : public Test {
+protected:
+    shared_ptr<MessageSerializer> _serializer = make_shared<MessageSerializer>();
+    RecordingPublishSocket* _socket = nullptr;
+    shared_ptr<ProtoPublishHandler> _handler;
+
+    void SetUp() override {
+        _serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        auto socket = make_unique<RecordingPublishSocket>();
+        _socket = socket.get();
+        _handler = make_shared<ProtoPublishHandler>(std::move(socket), _serializer, "pump-1");
+    }
+
+    template<typename TPredicate>
+    static bool WaitFor(TPredicate predicate) {
+        for (int i = 0; i < 2000 && !predicate(); ++i) this_thread::sleep_for(chrono::milliseconds(1));
+        return predicate();
+    }
+};
+
+TEST_F(AsyncPublishTest, PublishReturnsBeforeTheSocketSendsAndKeepsOrder) {
+    AsyncPublisher publisher;
+    _handler->EnableAsync(publisher);
+    _socket->Close();
+
+    for (int i = 1; i <= 3; ++i) _handler->Publish(Changed(to_string(i)));
+    EXPECT_EQ(_handler->Stats().Enqueued, 3u);
+    EXPECT_EQ(_handler->Stats().Sent, 0u);
+
+    _socket->Open();
+    _handler->Flush();
+
+    auto frames = Decode(_serializer, _socket->Frames);
+    ASSERT_EQ(frames.size(), 3u);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(frames[i].Sequence, static_cast<uint64_t>(i + 1));
+        EXPECT_EQ(frames[i].Value, to_string(i + 1));
+    }
+    EXPECT_THAT(_socket->SendThreads, Not(Contains(this_thread::get_id())));
+    auto stats = _handler->Stats();
+    EXPECT_EQ(stats.Sent, 3u);
+    EXPECT_EQ(stats.Pending, 0u);
+}
+
+TEST_F(AsyncPublishTest, FullQueueHoldsThePublisher) {
+    AsyncPublishOptions options;
+    options.Capacity = 2;
+    AsyncPublisher publisher(options);
+    _handler->EnableAsync(publisher);
+    _socket->Close();
+
+    thread producer([this]() { for (int i = 1; i <= 3; ++i) _handler->Publish(Changed(to_string(i))); });
+    ASSERT_TRUE(WaitFor([this]() { return _handler->Stats().Blocked == 1; }));
+    EXPECT_EQ(_handler->Stats().Enqueued, 2u);
+
+    _socket->Open();
+    producer.join();
+    _handler->Flush();
+    EXPECT_EQ(_handler->Stats().Sent, 3u);
+    EXPECT_EQ(_socket->Frames.size(), 3u);
+}
+
+TEST(EventStoreAsyncPublishTest, EachStreamKeepsItsOrderAcrossIoThreads) {
+    constexpr int streams = 4, perStream = 500;
+    auto factory = make_shared<RecordingSocketFactory>();
+    auto eventStore = make_shared<EventStore>(factory);
+    eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    AsyncPublishOptions options;
+    options.IoThreads = 2;
+    options.Capacity = 64;
+    options.MaxBatch = 16;
+    eventStore->EnableAsyncPublish(options);
+    for (int s = 0; s < streams; ++s) eventStore->CreateStream("stream-" + to_string(s));
+
+    vector<thread> publishers;
+    for (int s = 0; s < streams; ++s)
+        publishers.emplace_back([&eventStore, s]() {
+            for (int i = 0; i < perStream; ++i) eventStore->Publish("stream-" + to_string(s), Changed(to_string(i)));
+        });
+    for (auto& t : publishers) t.join();
+    eventStore->Flush();
+
+    for (int s = 0; s < streams; ++s) {
+        string name = "stream-" + to_string(s);
+        auto frames = Decode(eventStore->Serializer(), factory->Sockets[name]->Frames);
+        ASSERT_EQ(frames.size(), static_cast<size_t>(perStream));
+        for (int i = 0; i < perStream; ++i) {
+            EXPECT_EQ(frames[i].Sequence, static_cast<uint64_t>(i + 1));
+            EXPECT_EQ(frames[i].Value, to_string(i));
+        }
+        EXPECT_EQ(factory->Sockets[name]->SendThreads.size(), 1u);
+        EXPECT_EQ(eventStore->PublishStats(name).Sent, static_cast<uint64_t>(perStream));
+    }
+}
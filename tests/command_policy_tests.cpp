@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+// Stalls while the gate is closed and for 'Delay' on the first command.
+class StallingCommandHandler : public ICommandHandler<SetterCommand> {
+public:
+    void Handle(const string& stream_id, const SetterCommand& cmd) override {
+        if (Handled++ == 0) this_thread::sleep_for(Delay);
+        unique_lock lock(_mtx);
+        _gate.wait(lock, [this]() { return _open; });
+    }
+    void Close() {
+        lock_guard lock(_mtx);
+        _open = false;
+    }
+    void Open() {
+        {
+            lock_guard lock(_mtx);
+            _open = true;
+        }
+        _gate.notify_all();
+    }
+    atomic<int> Handled = 0;
+    milliseconds Delay = milliseconds(0);
+private:
+    std::mutex _mtx;
+    condition_variable _gate;
+    bool _open = true;
+};
+
+class CommandPolicyTest : public Test {
+protected:
+    void SetUp() override {
+        factory = make_shared<LoopbackSocketFactory>();
+        server = Plumber::CreateServer(factory);
+        handler = make_shared<StallingCommandHandler>();
+        server->AddCommandHandler<SetterCommand, app::testing::COMMANDS::SETTER>(handler);
+        server->Start();
+        client = PlumberClient::CreateClient(factory);
+        client->CommandBus()->RegisterMessage<SetterCommand, app::testing::COMMANDS::SETTER>();
+        client->Start();
+    }
+    void TearDown() override {
+        handler->Open();
+        factory->Server->WaitIdle();
+        client.reset();
+        server.reset();
+    }
+
+    static SetterCommand Setter(int value) {
+        SetterCommand cmd;
+        cmd.set_element_name("pump");
+        cmd.set_property_name("Speed");
+        cmd.set_value_data(to_string(value));
+        return cmd;
+    }
+
+    shared_ptr<LoopbackSocketFactory> factory;
+    unique_ptr<Plumber> server;
+    unique_ptr<PlumberClient> client;
+    shared_ptr<StallingCommandHandler> handler;
+};
+
+TEST_F(CommandPolicyTest, StalledServerTimesOutInsteadOfBlocking) {
+    CommandPolicy policy;
+    policy.Timeout = milliseconds(100);
+    client->SetCommandPolicy(policy);
+    handler->Close();
+
+    auto started = steady_clock::now();
+    EXPECT_THROW(client->CommandBus()->Send("pump", Setter(1)), TimeoutException);
+    EXPECT_LT(steady_clock::now() - started, seconds(2));
+    EXPECT_EQ(client->CommandBus()->Stats().TimedOut, 1u);
+}
+
+TEST_F(CommandPolicyTest, RetriesCarryOneCommandIdSoTheServerRunsItOnce) {
+    server->EnableCommandDedup();
+    CommandPolicy policy;
+    policy.Timeout = milliseconds(50);
+    policy.Retry.MaxAttempts = 20;
+    policy.Retry.InitialBackoff = milliseconds(20);
+    policy.Retry.MaxBackoff = milliseconds(50);
+    client->SetCommandPolicy(policy);
+    handler->Delay = milliseconds(200);
+
+    client->CommandBus()->Send("pump", Setter(1));
+
+    auto stats = client->CommandBus()->Stats();
+    EXPECT_GE(stats.Retries, 1u);
+    EXPECT_EQ(stats.Attempts, stats.Retries + 1);
+    EXPECT_EQ(handler->Handled, 1);
+    EXPECT_GE(server->DedupStats().Hits, 1u);
+}
+
+TEST_F(CommandPolicyTest, CircuitFailsFastWhileOpenAndClosesAfterASuccessfulTrial) {
+    CommandPolicy policy;
+    policy.Timeout = milliseconds(50);
+    policy.CircuitBreaker.FailureThreshold = 2;
+    policy.CircuitBreaker.OpenFor = milliseconds(200);
+    client->SetCommandPolicy(policy);
+    auto bus = client->CommandBus();
+    handler->Close();
+
+    EXPECT_THROW(bus->Send("pump", Setter(1)), TimeoutException);
+    EXPECT_THROW(bus->Send("pump", Setter(2)), TimeoutException);
+    EXPECT_EQ(bus->Stats().Circuit, CircuitState::OPEN);
+
+    auto started = steady_clock::now();
+    EXPECT_THROW(bus->Send("pump", Setter(3)), CircuitOpenException);
+    EXPECT_LT(steady_clock::now() - started, milliseconds(50));
+    EXPECT_EQ(bus->Stats().Rejected, 1u);
+
+    handler->Open();
+    this_thread::sleep_for(milliseconds(250));
+    bus->Send("pump", Setter(4));
+    EXPECT_EQ(bus->Stats().Circuit, CircuitState::CLOSED);
+    EXPECT_EQ(handler->Handled, 3);
+}
+
+TEST(RetryPolicyTest, BackoffGrowsUpToTheCapAndJitterOnlyShortensIt) {
+    RetryPolicy retry;
+    retry.InitialBackoff = milliseconds(100);
+    retry.MaxBackoff = milliseconds(1000);
+    retry.Multiplier = 2.0;
+    retry.Jitter = 0.0;
+    EXPECT_EQ(retry.Backoff(1), milliseconds(100));
+    EXPECT_EQ(retry.Backoff(3), milliseconds(400));
+    EXPECT_EQ(retry.Backoff(10), milliseconds(1000));
+
+    retry.Jitter = 0.5;
+    for (int i = 0; i < 100; ++i) {
+        auto backoff = retry.Backoff(2);
+        EXPECT_GE(backoff, milliseconds(100));
+        EXPECT_LE(backoff, milliseconds(200));
+    }
+}
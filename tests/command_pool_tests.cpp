@@ -0,0 +1,211 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+// Records which recipients reached its server; blocks while the gate is closed.
+class RecordingCommandHandler : public ICommandHandler<SetterCommand> {
+public:
+    void Handle(const string& stream_id, const SetterCommand& cmd) override {
+        unique_lock lock(_mtx);
+        Recipients.push_back(stream_id);
+        _changed.notify_all();
+        _changed.wait(lock, [this]() { return _open; });
+    }
+    void Close() {
+        lock_guard lock(_mtx);
+        _open = false;
+    }
+    void Open() {
+        {
+            lock_guard lock(_mtx);
+            _open = true;
+        }
+        _changed.notify_all();
+    }
+    bool WaitFor(size_t count) {
+        unique_lock lock(_mtx);
+        return _changed.wait_for(lock, seconds(5), [this, count]() { return Recipients.size() >= count; });
+    }
+    size_t Count() {
+        lock_guard lock(_mtx);
+        return Recipients.size();
+    }
+    vector<string> Recipients;
+private:
+    std::mutex _mtx;
+    condition_variable _changed;
+    bool _open = true;
+};
+
+class CommandPoolTest : public Test {
+protected:
+    static constexpr int SERVERS = 3;
+
+    void SetUp() override {
+        vector<CommandPoolEndpoint> endpoints;
+        for (int i = 0; i < SERVERS; ++i) {
+            auto factory = make_shared<LoopbackSocketFactory>();
+            auto server = Plumber::CreateServer(factory);
+            auto handler = make_shared<RecordingCommandHandler>();
+            server->AddCommandHandler<SetterCommand, app::testing::COMMANDS::SETTER>(handler);
+            server->Start();
+            factories.push_back(factory);
+            servers.push_back(std::move(server));
+            handlers.push_back(handler);
+            endpoints.push_back(CommandPoolEndpoint{ factory, "commands", "server-" + to_string(i) });
+        }
+        CommandPoolOptions options;
+        options.HealthCheckInterval = milliseconds(20);
+        options.Retry.MaxAttempts = SERVERS;
+        options.Retry.InitialBackoff = milliseconds(1);
+        pool = make_unique<PlumberCommandPool>(endpoints, options);
+        pool->RegisterMessage<SetterCommand, app::testing::COMMANDS::SETTER>();
+        pool->Start();
+    }
+    void TearDown() override {
+        for (auto& h : handlers) h->Open();
+        pool.reset();
+        servers.clear();
+    }
+
+    static SetterCommand Setter() {
+        SetterCommand cmd;
+        cmd.set_property_name("Speed");
+        cmd.set_value_data("1");
+        return cmd;
+    }
+
+    // Server that handled each recipient since the last call.
+    map<string, int> Owners() {
+        map<string, int> owners;
+        for (int i = 0; i < SERVERS; ++i) {
+            for (auto& r : handlers[i]->Recipients) owners[r] = i;
+            handlers[i]->Recipients.clear();
+        }
+        return owners;
+    }
+    void SendToAll(int recipients) {
+        for (int r = 0; r < recipients; ++r) pool->Send("pump-" + to_string(r), Setter());
+    }
+    bool WaitUntilHealthy(int server, bool healthy) {
+        for (int i = 0; i < 500; ++i) {
+            if (pool->Stats().Servers[server].Healthy == healthy) return true;
+            this_thread::sleep_for(milliseconds(2));
+        }
+        return false;
+    }
+
+    vector<shared_ptr<LoopbackSocketFactory>> factories;
+    vector<unique_ptr<Plumber>> servers;
+    vector<shared_ptr<RecordingCommandHandler>> handlers;
+    unique_ptr<PlumberCommandPool> pool;
+};
+
+TEST_F(CommandPoolTest, EachRecipientStaysOnOneServerAndRecipientsSpreadAcrossServers) {
+    SendToAll(60);
+    SendToAll(60);
+
+    map<string, set<int>> seenOn;
+    for (int i = 0; i < SERVERS; ++i) {
+        EXPECT_GT(handlers[i]->Recipients.size(), 0u) << "server " << i;
+        for (auto& r : handlers[i]->Recipients) seenOn[r].insert(i);
+    }
+    ASSERT_EQ(seenOn.size(), 60u);
+    for (auto& [recipient, on] : seenOn) EXPECT_EQ(on.size(), 1u) << recipient;
+}
+
+TEST_F(CommandPoolTest, FailedServerIsEjectedAndOnlyItsRecipientsMoveUntilItRecovers) {
+    SendToAll(60);
+    auto before = Owners();
+
+    factories[1]->Server->Down = true;
+    SendToAll(60);
+    EXPECT_FALSE(pool->Stats().Servers[1].Healthy);
+    auto during = Owners();
+    for (auto& [recipient, owner] : before) {
+        if (owner == 1) {
+            EXPECT_NE(during[recipient], 1) << recipient;
+        }
+        else {
+            EXPECT_EQ(during[recipient], owner) << recipient;
+        }
+    }
+
+    factories[1]->Server->Down = false;
+    ASSERT_TRUE(WaitUntilHealthy(1, true));
+    SendToAll(60);
+    EXPECT_EQ(Owners(), before);
+    EXPECT_GE(pool->Stats().Rebalances, 2u);
+}
+
+TEST_F(CommandPoolTest, LeastOutstandingSkipsTheBusyServer) {
+    CommandPoolOptions options;
+    options.HealthCheckInterval = milliseconds(0);
+    vector<CommandPoolEndpoint> endpoints;
+    for (int i = 0; i < SERVERS; ++i) endpoints.push_back(CommandPoolEndpoint{ factories[i], "commands", "server-" + to_string(i) });
+    pool = make_unique<PlumberCommandPool>(endpoints, options);
+    pool->RegisterMessage<SetterCommand, app::testing::COMMANDS::SETTER>(Routing::LEAST_OUTSTANDING);
+
+    for (auto& h : handlers) h->Close();
+    thread slow([this]() { pool->Send("slow", Setter()); });
+    int busy = -1;
+    for (int i = 0; busy < 0 && i < 1000; ++i) {
+        for (int s = 0; s < SERVERS; ++s) if (handlers[s]->Count() > 0) busy = s;
+        this_thread::sleep_for(milliseconds(1));
+    }
+    ASSERT_GE(busy, 0);
+    for (int s = 0; s < SERVERS; ++s) if (s != busy) handlers[s]->Open();
+
+    for (int i = 0; i < 20; ++i) pool->Send("fast-" + to_string(i), Setter());
+    EXPECT_EQ(handlers[busy]->Count(), 1u);
+    EXPECT_EQ(pool->Stats().Servers[busy].Outstanding, 1u);
+
+    handlers[busy]->Open();
+    slow.join();
+    for (int s = 0; s < SERVERS; ++s) {
+        if (s != busy) {
+            EXPECT_GT(handlers[s]->Count(), 0u);
+        }
+    }
+}
+
+TEST(HashRingTest, RemovingANodeMovesOnlyItsKeys) {
+    HashRing ring;
+    for (int n = 0; n < 4; ++n) ring.Add("node-" + to_string(n), 64);
+    auto all = [](size_t) { return true; };
+    auto withoutTwo = [](size_t node) { return node != 2; };
+
+    map<size_t, int> perNode;
+    int moved = 0;
+    for (int k = 0; k < 4000; ++k) {
+        string key = "key-" + to_string(k);
+        size_t owner = ring.Find(key, all);
+        ++perNode[owner];
+        size_t after = ring.Find(key, withoutTwo);
+        if (owner == 2) ++moved;
+        else EXPECT_EQ(after, owner);
+    }
+    ASSERT_EQ(perNode.size(), 4u);
+    for (auto& [node, keys] : perNode) {
+        EXPECT_GT(keys, 500) << "node " << node;
+        EXPECT_LT(keys, 1500) << "node " << node;
+    }
+    EXPECT_EQ(moved, perNode[2]);
+}
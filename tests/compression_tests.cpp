@@ -0,0 +1,255 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+class CollectingEventDispatcher : public IEventDispatcher {
+public:
+    void Handle(const Metadata& metadata, unsigned int messageId, MessagePtr msg) override {
+        lock_guard lock(_mtx);
+        Values.push_back(static_cast<PropertyChangedEvent*>(msg)->value_data());
+    }
+    vector<string> Received() {
+        lock_guard lock(_mtx);
+        return Values;
+    }
+    vector<string> Values;
+private:
+    std::mutex _mtx;
+};
+
+// The shape of our property traffic: a few elements and properties, changing values.
+static PropertyChangedEvent Property(int i) {
+    static const vector<string> elements = { "fakevideosrc", "videoconvert", "x264enc", "rtph264pay", "udpsink" };
+    static const vector<string> properties = { "num-buffers", "framerate", "bitrate", "speed-preset", "config-interval", "port" };
+    PropertyChangedEvent evt;
+    evt.set_element_name(elements[i % elements.size()]);
+    evt.set_property_name(properties[(i / 3) % properties.size()]);
+    evt.set_value_type(ValueType::INT);
+    evt.set_value_data(to_string(i * 7919 % 10007));
+    return evt;
+}
+
+TEST(CompressionCodecTest, TrainedDictionaryCompressesSmallEventsAndRoundTrips) {
+    CompressionOptions options;
+    options.TrainingSamples = 64;
+    StreamCompressor compressor(options);
+    string packed;
+    for (int i = 0; i < 64; ++i) {
+        string raw = Property(i).SerializeAsString();
+        compressor.Compress(raw.data(), raw.size(), packed);
+    }
+    auto trained = compressor.Stats();
+    ASSERT_NE(trained.DictionaryId, 0u);
+    string dictionary = compressor.Dictionary(trained.DictionaryId);
+    EXPECT_EQ(DictionaryId(dictionary), trained.DictionaryId);
+    EXPECT_TRUE(compressor.Dictionary(trained.DictionaryId + 1).empty());
+
+    size_t raw = 0, plain = 0, withDictionary = 0;
+    for (int i = 1000; i < 1200; ++i) {
+        string bytes = Property(i).SerializeAsString();
+        auto payload = compressor.Compress(bytes.data(), bytes.size(), packed);
+        ASSERT_EQ(payload.Codec, CompressionCodec::DEFLATE);
+        EXPECT_EQ(payload.DictionaryId, trained.DictionaryId);
+        EXPECT_EQ(Inflate(packed.data(), packed.size(), bytes.size(), dictionary), bytes);
+        raw += bytes.size();
+        plain += min(Deflate(bytes.data(), bytes.size()).size(), bytes.size());
+        withDictionary += packed.size();
+    }
+    EXPECT_LT(withDictionary * 2, raw);
+    EXPECT_LT(withDictionary * 2, plain);
+
+    auto stats = compressor.Stats();
+    EXPECT_EQ(stats.Frames, 264u);
+    EXPECT_GT(stats.Ratio(), 1.5);
+    EXPECT_GT(stats.CpuNs, 0u);
+
+    // Blocks above DictionaryMaxPayload go without the dictionary; incompressible payloads stay as they are.
+    string block;
+    for (int i = 0; i < 100; ++i) block += Property(i).SerializeAsString();
+    auto blockPayload = compressor.Compress(block.data(), block.size(), packed);
+    EXPECT_EQ(blockPayload.Codec, CompressionCodec::DEFLATE);
+    EXPECT_EQ(blockPayload.DictionaryId, 0u);
+    EXPECT_EQ(Inflate(packed.data(), packed.size(), block.size()), block);
+    string noise;
+    for (int i = 0; i < 200; ++i) noise.push_back(static_cast<char>((i * 2654435761u) >> 13));
+    EXPECT_EQ(compressor.Compress(noise.data(), noise.size(), packed).Codec, CompressionCodec::NONE);
+}
+
+TEST(CompressionCodecTest, OversizedRawSizeIsRefusedBeforeInflating) {
+    string raw(100 * 1024, 'x');
+    string packed = Deflate(raw.data(), raw.size());
+    EXPECT_THROW(Inflate(packed.data(), packed.size(), raw.size()), runtime_error);
+    EXPECT_EQ(Inflate(packed.data(), packed.size(), raw.size(), {}, raw.size()), raw);
+
+    // A frame that claims 4 GiB.
+    string small = Property(1).SerializeAsString();
+    string frame = Deflate(small.data(), small.size());
+    EventHeader header;
+    header.set_codec(static_cast<uint32_t>(CompressionCodec::DEFLATE));
+    header.set_raw_size(0xFFFFFFF0u);
+    FrameDecompressor decompressor;
+    string out;
+    EXPECT_THROW(decompressor.Decode(header, reinterpret_cast<const uint8_t*>(frame.data()), frame.size(), out), runtime_error);
+    EXPECT_TRUE(out.empty());
+    // Within the limit but beyond what deflate can expand the payload to.
+    EXPECT_THROW(Inflate(frame.data(), frame.size(), MAX_INFLATED_SIZE), runtime_error);
+}
+
+TEST(CompressionCodecTest, FramesDecodeWhileADictionaryIsBeingFetched) {
+    CompressionOptions options;
+    options.TrainingSamples = 16;
+    StreamCompressor compressor(options);
+    string packed;
+    for (int i = 0; i < 16; ++i) {
+        string raw = Property(i).SerializeAsString();
+        compressor.Compress(raw.data(), raw.size(), packed);
+    }
+    uint32_t id = compressor.Stats().DictionaryId;
+    ASSERT_NE(id, 0u);
+    string bytes = Property(100).SerializeAsString();
+    string withDictionary;
+    ASSERT_EQ(compressor.Compress(bytes.data(), bytes.size(), withDictionary).DictionaryId, id);
+    string plain = Deflate(bytes.data(), bytes.size());
+    EventHeader fetching, other;
+    fetching.set_codec(static_cast<uint32_t>(CompressionCodec::DEFLATE));
+    fetching.set_raw_size(static_cast<uint32_t>(bytes.size()));
+    fetching.set_dictionary_id(id);
+    other.set_codec(fetching.codec());
+    other.set_raw_size(fetching.raw_size());
+
+    FrameDecompressor decompressor;
+    thread second;
+    promise<void> decoded;
+    bool decodedMeanwhile = false;
+    decompressor.SetResolver([&](uint32_t requested) {
+        second = thread([&] {
+            string out;
+            decompressor.Decode(other, reinterpret_cast<const uint8_t*>(plain.data()), plain.size(), out);
+            decoded.set_value();
+        });
+        decodedMeanwhile = decoded.get_future().wait_for(2s) == future_status::ready;
+        return compressor.Dictionary(requested);
+    });
+    string out;
+    EXPECT_EQ(decompressor.Decode(fetching, reinterpret_cast<const uint8_t*>(withDictionary.data()), withDictionary.size(), out), bytes);
+    second.join();
+    EXPECT_TRUE(decodedMeanwhile);
+    EXPECT_EQ(decompressor.Stats().Frames, 2u);
+}
+
+class CompressedStreamTest : public Test {
+protected:
+    void SetUp() override {
+        factory = make_shared<LoopbackSocketFactory>();
+        server = Plumber::CreateServer(factory);
+        server->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        CompressionOptions options;
+        options.TrainingSamples = 16;
+        server->GetEventStore()->EnableCompression("pump-1", options);
+        server->Start();
+    }
+    unique_ptr<PlumberClient> Client() {
+        auto client = PlumberClient::CreateClient(factory);
+        client->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        client->Start();
+        return client;
+    }
+    void Publish(int from, int to) {
+        for (int i = from; i < to; ++i) server->GetEventStore()->Publish("pump-1", Property(i));
+    }
+    static vector<string> Values(int from, int to) {
+        vector<string> values;
+        for (int i = from; i < to; ++i) values.push_back(Property(i).value_data());
+        return values;
+    }
+
+    shared_ptr<LoopbackSocketFactory> factory;
+    unique_ptr<Plumber> server;
+};
+
+TEST_F(CompressedStreamTest, SubscribersDecompressAndLateOnesFetchTheDictionary) {
+    auto early = Client();
+    size_t clientSockets = factory->ClientSockets.load();
+    auto earlyHandler = make_shared<CollectingEventDispatcher>();
+    auto earlySubscription = early->SubscriptionManager()->Subscribe("pump-1", earlyHandler);
+    Publish(0, 200);
+
+    // Joins after the frame that carried the dictionary.
+    auto late = Client();
+    auto lateHandler = make_shared<CollectingEventDispatcher>();
+    auto lateSubscription = late->SubscriptionManager()->Subscribe("pump-1", lateHandler);
+    Publish(200, 300);
+    // Only the late subscriber needed the dictionary; it fetched it on a connection of its own.
+    EXPECT_EQ(factory->ClientSockets.load(), 2 * clientSockets + 1);
+
+    EXPECT_EQ(earlyHandler->Received(), Values(0, 300));
+    EXPECT_EQ(lateHandler->Received(), Values(200, 300));
+
+    auto stats = server->GetEventStore()->CompressionStats("pump-1");
+    EXPECT_EQ(stats.Frames, 300u);
+    EXPECT_GT(stats.Compressed, 250u);
+    EXPECT_NE(stats.DictionaryId, 0u);
+    EXPECT_GT(stats.Ratio(), 1.5);
+    EXPECT_FALSE(server->GetEventStore()->FindDictionary("pump-1", stats.DictionaryId).empty());
+    EXPECT_EQ(server->GetEventStore()->CompressionStats("other").Frames, 0u);
+}
+
+TEST(CompressedFileEventLogTest, CompressedRecordsReloadAlongsidePlainOnes) {
+    string path = "/tmp/cppplumberd_compressed_log_test.bin";
+    string plainPath = "/tmp/cppplumberd_plain_log_test.bin";
+    filesystem::remove(path);
+    filesystem::remove(plainPath);
+    auto append = [](IEventLog& log, int from, int to) {
+        for (int i = from; i < to; ++i) log.Append(i % 2 ? "pump-1" : "pump-2", 1, Property(i).SerializeAsString(), TraceContext());
+    };
+    vector<string> expected;
+    {
+        FileEventLog plain(plainPath);
+        append(plain, 0, 500);
+        plain.ReadAll(1, SIZE_MAX, [&expected](const RecordedEvent& e) { expected.push_back(e.data()); });
+    }
+    uint32_t dictionary = 0;
+    {
+        FileEventLog log(path);
+        append(log, 0, 10);
+        CompressionOptions options;
+        options.TrainingSamples = 32;
+        log.EnableCompression(options);
+        append(log, 10, 500);
+        auto stats = log.CompressionStats("pump-1");
+        EXPECT_GT(stats.Compressed, 0u);
+        EXPECT_GT(stats.Ratio(), 1.5);
+        dictionary = stats.DictionaryId;
+        EXPECT_NE(dictionary, 0u);
+    }
+    EXPECT_LT(filesystem::file_size(path), filesystem::file_size(plainPath));
+
+    FileEventLog reopened(path);
+    EXPECT_EQ(reopened.Head(), 500u);
+    EXPECT_EQ(reopened.StreamVersion("pump-1"), 250u);
+    vector<string> loaded;
+    reopened.ReadAll(1, SIZE_MAX, [&loaded](const RecordedEvent& e) { loaded.push_back(e.data()); });
+    EXPECT_EQ(loaded, expected);
+
+    // The stream keeps the dictionary found in the file instead of training another one.
+    reopened.EnableCompression();
+    append(reopened, 501, 503);
+    EXPECT_EQ(reopened.CompressionStats("pump-1").DictionaryId, dictionary);
+    EXPECT_EQ(FileEventLog(path).Head(), 502u);
+}
@@ -10,5 +10,9 @@ namespace app {
 		enum EVENTS : unsigned int {
 			PROPERTY_CHANGED = 0xFFFF + 1,
 		};
+		enum QUERIES : unsigned int {
+			GET_PROPERTY = 0xFFF + 1,
+			PROPERTY_VALUE = 0xFFF + 2,
+		};
 	}
 }
\ No newline at end of file
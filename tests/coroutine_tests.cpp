@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+static Task<int> Add(int a, int b) {
+    co_return a + b;
+}
+
+static Task<int> SumOfSums() {
+    int first = co_await Add(1, 2);
+    int second = co_await Add(3, 4);
+    co_return first + second;
+}
+
+static Task<void> Fails() {
+    co_await Add(1, 1);
+    throw runtime_error("boom");
+}
+
+TEST(TaskTest, AwaitsNestedTasksAndPropagatesExceptions) {
+    ExecutorOptions options;
+    options.Threads = 2;
+    auto executor = make_shared<Executor>(options);
+
+    EXPECT_EQ(Spawn(executor, SumOfSums()).get(), 10);
+    auto failed = Spawn(executor, Fails());
+    EXPECT_THROW(failed.get(), runtime_error);
+}
+
+static SetterCommand Setter(int value) {
+    SetterCommand cmd;
+    cmd.set_element_name("Pump");
+    cmd.set_property_name("Speed");
+    cmd.set_value_data(to_string(value));
+    return cmd;
+}
+
+struct FlowThreads {
+    std::mutex Mtx;
+    set<thread::id> Ids;
+    void Add() {
+        lock_guard lock(Mtx);
+        Ids.insert(this_thread::get_id());
+    }
+};
+
+static Task<int> Workflow(PlumberCommandBus& bus, int id, FlowThreads& threads) {
+    int faults = 0;
+    for (int step = 0; step < 3; ++step) {
+        try {
+            co_await bus.SendAsync("pump", Setter(id * 10 + step));
+        }
+        catch (const FaultException& ex) {
+            ++faults;
+        }
+        threads.Add();
+    }
+    co_return faults;
+}
+
+TEST(CommandBusCoroutineTest, ManyWorkflowsShareTheExecutor) {
+    constexpr int flows = 500;
+    ExecutorOptions options;
+    options.Threads = 2;
+    auto executor = make_shared<Executor>(options);
+    auto server = make_unique<LoopbackSrvSocket>();
+    auto serverSocket = server.get();
+    ProtoReqRspSrvHandler serverHandler(std::move(server));
+    atomic<int> handled = 0;
+    serverHandler.RegisterHandler<SetterCommand, app::testing::COMMANDS::SETTER>([&handled](const SetterCommand& cmd) {
+        ++handled;
+        // Every workflow's second step is rejected.
+        if (stoi(cmd.value_data()) % 10 == 1) throw FaultException("Rejected", 400);
+    });
+    serverHandler.Start();
+    auto client = make_unique<LoopbackClientSocket>(serverSocket);
+    auto clientSocket = client.get();
+    auto clientHandler = make_unique<ProtoReqRspClientHandler>(std::move(client));
+    clientHandler->RegisterRequest<SetterCommand, app::testing::COMMANDS::SETTER>();
+    PlumberCommandBus bus(std::move(clientHandler), executor);
+
+    FlowThreads threads;
+    vector<future<int>> results;
+    for (int i = 0; i < flows; ++i) results.push_back(Spawn(executor, Workflow(bus, i, threads)));
+    int faults = 0;
+    for (auto& r : results) faults += r.get();
+
+    EXPECT_EQ(handled, 3 * flows);
+    EXPECT_EQ(faults, flows);
+    EXPECT_EQ(clientSocket->MaxInFlight, 1);
+    EXPECT_LE(threads.Ids.size(), 2u);
+    EXPECT_THAT(threads.Ids, Not(Contains(this_thread::get_id())));
+}
+
+static Task<thread::id> SendAndReportThread(PlumberCommandBus& bus) {
+    co_await bus.SendAsync("pump", Setter(1));
+    co_return this_thread::get_id();
+}
+
+static Task<int> Noop() {
+    co_return 1;
+}
+
+TEST(CommandBusCoroutineTest, RequestWaitingForItsReplyDoesNotHoldAWorker) {
+    ExecutorOptions options;
+    options.Threads = 1;
+    auto executor = make_shared<Executor>(options);
+    auto server = make_unique<LoopbackSrvSocket>();
+    auto serverSocket = server.get();
+    ProtoReqRspSrvHandler serverHandler(std::move(server));
+    promise<void> entered, reply;
+    auto replied = reply.get_future().share();
+    serverHandler.RegisterHandler<SetterCommand, app::testing::COMMANDS::SETTER>([&entered, replied](const SetterCommand&) {
+        entered.set_value();
+        replied.wait();
+    });
+    serverHandler.Start();
+    auto clientHandler = make_unique<ProtoReqRspClientHandler>(make_unique<LoopbackClientSocket>(serverSocket));
+    clientHandler->RegisterRequest<SetterCommand, app::testing::COMMANDS::SETTER>();
+    PlumberCommandBus bus(std::move(clientHandler), executor);
+
+    auto sent = Spawn(executor, SendAndReportThread(bus));
+    entered.get_future().wait();
+    auto other = Spawn(executor, Noop());
+    EXPECT_EQ(other.wait_for(chrono::seconds(5)), future_status::ready);
+    EXPECT_EQ(sent.wait_for(chrono::milliseconds(10)), future_status::timeout);
+    reply.set_value();
+
+    auto worker = Spawn(executor, []() -> Task<thread::id> { co_return this_thread::get_id(); }());
+    EXPECT_EQ(sent.get(), worker.get());
+}
+
+static Task<vector<string>> Take(AsyncGenerator<StreamEvent<PropertyChangedEvent>>& events, size_t count) {
+    vector<string> values;
+    while (values.size() < count) {
+        auto e = co_await events.Next();
+        if (!e) break;
+        values.push_back(e->Meta.StreamId() + ":" + e->Event.value_data());
+    }
+    co_return values;
+}
+
+static Task<uint64_t> AwaitVersion(shared_ptr<EventStore> store, string stream, uint64_t version) {
+    co_return co_await store->WhenVersion(stream, version);
+}
+
+static Task<uint64_t> AwaitPosition(shared_ptr<EventStore> store, uint64_t position) {
+    co_return co_await store->WhenPosition(position);
+}
+
+class EventStoreCoroutineTest : public Test {
+protected:
+    shared_ptr<Executor> _executor;
+    shared_ptr<EventStore> _store = make_shared<EventStore>();
+
+    void SetUp() override {
+        ExecutorOptions options;
+        options.Threads = 2;
+        _executor = make_shared<Executor>(options);
+        _store->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        _store->SetEventLog(make_shared<InMemoryEventLog>());
+    }
+
+    void Publish(const string& stream, int value) {
+        PropertyChangedEvent evt;
+        evt.set_property_name("Speed");
+        evt.set_value_data(to_string(value));
+        _store->Publish(stream, evt);
+    }
+};
+
+TEST_F(EventStoreCoroutineTest, GeneratorYieldsSubscribedEventsInOrder) {
+    auto events = SubscribeEvents<PropertyChangedEvent>(*_store, "pump-1", _executor);
+    for (int i = 0; i < 3; ++i) Publish("pump-1", i);
+    auto taken = Spawn(_executor, Take(events, 5));
+    this_thread::sleep_for(chrono::milliseconds(10));
+    Publish("pump-2", 99);
+    for (int i = 3; i < 5; ++i) Publish("pump-1", i);
+
+    EXPECT_THAT(taken.get(), ElementsAre("pump-1:0", "pump-1:1", "pump-1:2", "pump-1:3", "pump-1:4"));
+}
+
+TEST_F(EventStoreCoroutineTest, WhenVersionResumesOnceTheStreamGetsThere) {
+    Publish("pump-1", 0);
+    EXPECT_EQ(Spawn(_executor, AwaitVersion(_store, "pump-1", 1)).get(), 1u);
+
+    auto version = Spawn(_executor, AwaitVersion(_store, "pump-1", 3));
+    auto position = Spawn(_executor, AwaitPosition(_store, 4));
+    Publish("pump-1", 1);
+    Publish("pump-2", 2);
+    EXPECT_EQ(version.wait_for(chrono::milliseconds(20)), future_status::timeout);
+    Publish("pump-1", 3);
+
+    EXPECT_EQ(version.get(), 3u);
+    EXPECT_EQ(position.get(), 4u);
+}
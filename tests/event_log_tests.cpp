@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+TEST(EventLogTest, AssignsPositionsAndStreamVersions) {
+    InMemoryEventLog log;
+
+    log.Append("a", 1, "x", TraceContext());
+    log.Append("b", 1, "y", TraceContext());
+    auto& e = log.Append("a", 2, "z", TraceContext());
+
+    EXPECT_EQ(e.position(), 3u);
+    EXPECT_EQ(e.version(), 2u);
+    EXPECT_EQ(log.Head(), 3u);
+    EXPECT_EQ(log.StreamVersion("a"), 2u);
+    EXPECT_EQ(log.StreamVersion("c"), 0u);
+    vector<string> data;
+    EXPECT_EQ(log.ReadStream("a", 2, [&data](const RecordedEvent& r) { data.push_back(r.data()); }), 1u);
+    EXPECT_THAT(data, ElementsAre("z"));
+    data.clear();
+    EXPECT_EQ(log.ReadAll(2, 10, [&data](const RecordedEvent& r) { data.push_back(r.data()); }), 2u);
+    EXPECT_THAT(data, ElementsAre("y", "z"));
+}
+
+TEST(EventLogTest, WrongExpectedVersionIsRejected) {
+    InMemoryEventLog log;
+    log.Append("a", 1, "x", TraceContext(), 0);
+
+    try {
+        log.Append("a", 1, "y", TraceContext(), 0);
+        FAIL() << "Expected FaultException";
+    }
+    catch (const FaultException& ex) {
+        EXPECT_EQ(ex.ErrorCode(), 409);
+    }
+    EXPECT_EQ(log.StreamVersion("a"), 1u);
+}
+
+// Stands in for a FileEventLog whose write fails (disk full, I/O error).
+class FailingWriteEventLog : public InMemoryEventLog {
+protected:
+    void OnAppending(const RecordedEvent& e) override {
+        if (Fail) throw runtime_error("Failed to append to event log");
+        Persisted.push_back(e.position());
+    }
+public:
+    bool Fail = false;
+    vector<uint64_t> Persisted;
+};
+
+TEST(EventLogTest, FailedWriteLeavesTheLogUnchanged) {
+    FailingWriteEventLog log;
+    log.Append("a", 1, "x", TraceContext());
+    log.Fail = true;
+    EXPECT_THROW(log.Append("a", 1, "y", TraceContext()), runtime_error);
+    EXPECT_EQ(log.Head(), 1u);
+    EXPECT_EQ(log.StreamVersion("a"), 1u);
+
+    log.Fail = false;
+    auto& e = log.Append("a", 1, "z", TraceContext());
+    EXPECT_EQ(e.position(), 2u);
+    EXPECT_EQ(e.version(), 2u);
+    EXPECT_THAT(log.Persisted, ElementsAre(1u, 2u));
+    vector<string> data;
+    log.ReadAll(1, 10, [&data](const RecordedEvent& r) { data.push_back(r.data()); });
+    EXPECT_THAT(data, ElementsAre("x", "z"));
+}
+
+TEST(EventLogTest, FileLogReloadsAndDropsTornTail) {
+    string path = "/tmp/cppplumberd_event_log_test.bin";
+    filesystem::remove(path);
+    {
+        FileEventLog log(path);
+        log.Append("a", 1, "x", TraceContext());
+        log.Append("a", 1, "y", TraceContext());
+    }
+    {
+        ofstream torn(path, ios::binary | ios::app);
+        uint32_t size = 100;
+        torn.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        torn.write("abc", 3);
+    }
+
+    FileEventLog log(path);
+    log.Append("a", 1, "z", TraceContext());
+    FileEventLog reopened(path);
+
+    EXPECT_EQ(reopened.Head(), 3u);
+    EXPECT_EQ(reopened.StreamVersion("a"), 3u);
+}
+
+TEST(EventLogTest, TruncateDropsTheRecordsAfterAPosition) {
+    InMemoryEventLog log;
+    log.SetEpoch(1);
+    log.Append("a", 1, "x", TraceContext());
+    log.Append("b", 1, "y", TraceContext());
+    log.Append("a", 1, "z", TraceContext());
+
+    log.Truncate(1);
+    log.SetEpoch(2);
+    auto& e = log.Append("a", 1, "w", TraceContext());
+
+    EXPECT_EQ(e.position(), 2u);
+    EXPECT_EQ(e.version(), 2u);
+    EXPECT_EQ(e.epoch(), 2u);
+    EXPECT_EQ(log.StreamVersion("b"), 0u);
+    vector<string> data;
+    log.ReadAll(1, 10, [&data](const RecordedEvent& r) { data.push_back(r.data()); });
+    EXPECT_THAT(data, ElementsAre("x", "w"));
+}
+
+TEST(EventLogTest, FileLogTruncateCutsTheFile) {
+    string path = "/tmp/cppplumberd_event_log_truncate_test.bin";
+    filesystem::remove(path);
+    {
+        FileEventLog log(path);
+        log.Append("a", 1, "x", TraceContext());
+        log.Append("a", 1, "y", TraceContext());
+        log.Append("a", 1, "z", TraceContext());
+        log.Truncate(1);
+        log.Append("a", 1, "w", TraceContext());
+    }
+
+    FileEventLog reopened(path);
+    vector<string> data;
+    reopened.ReadAll(1, 10, [&data](const RecordedEvent& r) { data.push_back(r.data()); });
+    EXPECT_THAT(data, ElementsAre("x", "w"));
+    EXPECT_EQ(reopened.StreamVersion("a"), 2u);
+}
+
+TEST(EventLogTest, FileLogReopensAtItsEpoch) {
+    string path = "/tmp/cppplumberd_event_log_epoch_test.bin";
+    filesystem::remove(path);
+    {
+        FileEventLog log(path);
+        log.SetEpoch(2);
+        log.Append("a", 1, "x", TraceContext());
+        log.Append("a", 1, "y", TraceContext());
+        // A new epoch with no record of it yet, and a cut that drops the records written after the epoch changed.
+        log.SetEpoch(3);
+        log.Truncate(1);
+    }
+
+    FileEventLog reopened(path);
+    EXPECT_EQ(reopened.Epoch(), 3u);
+    EXPECT_EQ(reopened.Head(), 1u);
+    EXPECT_EQ(reopened.Append("a", 1, "z", TraceContext()).epoch(), 3u);
+}
+
+TEST(EventLogTest, WaitForAppendWakesOnAppend) {
+    InMemoryEventLog log;
+    thread writer([&log]() {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        log.Append("a", 1, "x", TraceContext());
+    });
+
+    auto head = log.WaitForAppend(0, chrono::milliseconds(2000));
+    writer.join();
+
+    EXPECT_EQ(head, 1u);
+}
+
+TEST(EventLogTest, EventStorePublishAppendsBeforeDelivery) {
+    auto eventStore = make_shared<EventStore>();
+    eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    auto log = make_shared<InMemoryEventLog>();
+    eventStore->SetEventLog(log);
+    PropertyChangedEvent evt;
+    evt.set_element_name("e");
+
+    EXPECT_EQ(eventStore->Publish("s", evt), 1u);
+    EXPECT_EQ(eventStore->Publish("s", evt, 1), 2u);
+    EXPECT_THROW(eventStore->Publish("s", evt, 1), FaultException);
+    EXPECT_EQ(log->StreamVersion("s"), 2u);
+}
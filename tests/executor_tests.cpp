@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+static shared_ptr<Executor> MakeExecutor(size_t threads) {
+    ExecutorOptions options;
+    options.Threads = threads;
+    return make_shared<Executor>(options);
+}
+
+// Running strands hold their executor; once idle, the test's references are the last ones.
+static void WaitIdle(const Executor& executor) {
+    while (executor.Stats().Executed < executor.Stats().Posted) this_thread::yield();
+}
+
+TEST(StrandTest, RunsTasksOneAtATimeInPostOrder) {
+    constexpr int tasks = 20000;
+    atomic<int> active = 0;
+    atomic<bool> overlapped = false;
+    vector<int> order;
+    promise<void> done;
+    // Declared after what its tasks use, so its workers are joined first.
+    auto executor = MakeExecutor(4);
+    auto strand = make_shared<Strand>(executor, 16);
+    for (int i = 0; i < tasks; ++i) {
+        strand->Post([&, i]() {
+            if (++active > 1) overlapped = true;
+            order.push_back(i);
+            --active;
+            if (i == tasks - 1) done.set_value();
+        });
+    }
+    done.get_future().wait();
+    WaitIdle(*executor);
+
+    EXPECT_FALSE(overlapped);
+    ASSERT_EQ(order.size(), static_cast<size_t>(tasks));
+    for (int i = 0; i < tasks; ++i) ASSERT_EQ(order[i], i);
+}
+
+TEST(StrandTest, DifferentStrandsRunInParallel) {
+    promise<void> started, released;
+    auto release = released.get_future().share();
+    auto executor = MakeExecutor(2);
+    auto first = make_shared<Strand>(executor);
+    auto second = make_shared<Strand>(executor);
+    first->Post([&]() {
+        started.set_value();
+        release.wait();
+    });
+    started.get_future().wait();
+    second->Post([&]() { released.set_value(); });
+
+    ASSERT_EQ(release.wait_for(chrono::seconds(5)), future_status::ready);
+    WaitIdle(*executor);
+}
+
+TEST(ExecutorTest, IdleWorkersStealFromABusyOne) {
+    constexpr int tasks = 8;
+    atomic<int> executed = 0;
+    promise<void> done;
+    auto finished = done.get_future().share();
+    auto executor = MakeExecutor(2);
+    executor->Post([&]() {
+        // Posted from a worker, so they land in its own deque; it then stays busy until the others ran.
+        for (int i = 0; i < tasks; ++i) executor->Post([&]() { if (++executed == tasks) done.set_value(); });
+        finished.wait();
+    });
+
+    ASSERT_EQ(finished.wait_for(chrono::seconds(5)), future_status::ready);
+    EXPECT_GE(executor->Stats().Stolen, static_cast<uint64_t>(tasks));
+}
+
+TEST(ExecutorTest, UnknownNumaNodeHasNoCpus) {
+    EXPECT_THAT(Executor::NumaNodeCpus(100000), IsEmpty());
+}
+
+TEST(EventStoreExecutorTest, SubscribersRunOnTheExecutorInPublishOrder) {
+    constexpr int events = 1000;
+    auto eventStore = make_shared<EventStore>();
+    eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    SubscriptionOptions options;
+    options.Executor = MakeExecutor(2);
+    auto first = make_shared<PropertyRecorder>();
+    auto second = make_shared<PropertyRecorder>();
+    auto firstSubscription = eventStore->Subscribe("pump-1", first, options);
+    auto secondSubscription = eventStore->Subscribe("pump-1", second, options);
+    auto publish = [&](int value) {
+        PropertyChangedEvent evt;
+        evt.set_property_name("Speed");
+        evt.set_value_data(to_string(value));
+        eventStore->Publish("pump-1", evt);
+    };
+
+    for (int i = 0; i < events; ++i) publish(i);
+    ASSERT_TRUE(first->WaitFor(events));
+    ASSERT_TRUE(second->WaitFor(events));
+    firstSubscription->Unsubscribe();
+    publish(events);
+    ASSERT_TRUE(second->WaitFor(events + 1));
+    secondSubscription->Unsubscribe();
+
+    auto firstRecords = first->Records();
+    auto secondRecords = second->Records();
+    for (int i = 0; i < events; ++i) {
+        ASSERT_EQ(firstRecords[i].Event.value_data(), to_string(i));
+        ASSERT_EQ(secondRecords[i].Event.value_data(), to_string(i));
+        ASSERT_NE(firstRecords[i].Thread, this_thread::get_id());
+    }
+    EXPECT_EQ(firstRecords.size(), static_cast<size_t>(events));
+    auto stats = firstSubscription->Stats();
+    EXPECT_EQ(stats.Received, static_cast<uint64_t>(events));
+    EXPECT_EQ(stats.Delivered, static_cast<uint64_t>(events));
+    EXPECT_EQ(stats.Pending, 0u);
+}
+
+TEST(EventStoreExecutorTest, UnsubscribingFromATaskOnTheSameExecutorDropsQueuedEvents) {
+    auto executor = MakeExecutor(1);
+    auto eventStore = make_shared<EventStore>();
+    eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    SubscriptionOptions options;
+    options.Executor = executor;
+    auto handler = make_shared<PropertyRecorder>();
+    auto subscription = eventStore->Subscribe("pump-1", handler, options);
+
+    // The event's delivery is queued behind the task that unsubscribes, on the executor's only worker.
+    promise<void> unsubscribed;
+    executor->Post([&]() {
+        PropertyChangedEvent evt;
+        evt.set_value_data("1");
+        eventStore->Publish("pump-1", evt);
+        subscription->Unsubscribe();
+        unsubscribed.set_value();
+    });
+    ASSERT_EQ(unsubscribed.get_future().wait_for(chrono::seconds(5)), future_status::ready);
+    WaitIdle(*executor);
+
+    EXPECT_EQ(handler->Count(), 0u);
+    EXPECT_EQ(subscription->Stats().Pending, 0u);
+}
@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <sstream>
+#include <fstream>
+#include "plumberd.hpp"
+#include "cppplumberd/flight_recorder_signals.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+static vector<uint8_t> Pattern(uint32_t tag, size_t size) {
+    vector<uint8_t> frame(size);
+    memcpy(frame.data(), &tag, sizeof(tag));
+    for (size_t i = sizeof(tag); i < size; ++i) frame[i] = static_cast<uint8_t>(tag + i);
+    return frame;
+}
+static bool IsPattern(const vector<uint8_t>& frame) {
+    uint32_t tag;
+    memcpy(&tag, frame.data(), sizeof(tag));
+    return frame == Pattern(tag, frame.size());
+}
+
+TEST(FlightRecorderTest, KeepsMostRecentFramesInOrder) {
+    FlightRecorder recorder(4096);
+    for (uint32_t i = 0; i < 200; ++i) {
+        auto frame = Pattern(i, 100);
+        recorder.Record(FrameKind::EVENT_PUBLISHED, "s", frame.data(), frame.size());
+    }
+
+    auto records = recorder.Snapshot();
+
+    ASSERT_FALSE(records.empty());
+    EXPECT_LE(records.size() * 101, recorder.Capacity());
+    uint32_t last;
+    memcpy(&last, records.back().Frame.data(), sizeof(last));
+    EXPECT_EQ(last, 199u);
+    for (size_t i = 1; i < records.size(); ++i) {
+        EXPECT_LE(records[i - 1].TimestampNs, records[i].TimestampNs);
+        EXPECT_TRUE(IsPattern(records[i].Frame));
+        EXPECT_EQ(records[i].Stream, "s");
+    }
+}
+
+TEST(FlightRecorderTest, OversizedFramesAreDropped) {
+    FlightRecorder recorder(4096);
+    vector<uint8_t> frame(2048);
+
+    recorder.Record(FrameKind::EVENT_PUBLISHED, "s", frame.data(), frame.size());
+
+    EXPECT_EQ(recorder.Dropped(), 1u);
+    EXPECT_TRUE(recorder.Snapshot().empty());
+}
+
+TEST(FlightRecorderTest, SnapshotUnderConcurrentWritersOnlyReturnsIntactFrames) {
+    FlightRecorder recorder(16 * 1024);
+    atomic<bool> stop{ false };
+    vector<thread> writers;
+    for (uint32_t t = 0; t < 4; ++t) {
+        writers.emplace_back([&recorder, &stop, t]() {
+            for (uint32_t i = 0; !stop; ++i) {
+                auto frame = Pattern(t * 1000000 + i, 40 + (i % 200));
+                recorder.Record(FrameKind::COMMAND_RECEIVED, "w" + to_string(t), frame.data(), frame.size());
+            }
+        });
+    }
+    while (recorder.Recorded() < 10000) this_thread::yield();
+    size_t seen = 0;
+    for (int i = 0; i < 200; ++i) {
+        for (const auto& r : recorder.Snapshot()) {
+            ASSERT_TRUE(IsPattern(r.Frame));
+            ++seen;
+        }
+    }
+    stop = true;
+    for (auto& w : writers) w.join();
+
+    EXPECT_GT(seen, 0u);
+}
+
+TEST(FlightRecorderTest, RawDumpIsReadableByLoader) {
+    FlightRecorder recorder(4096);
+    auto frame = Pattern(7, 64);
+    recorder.Record(FrameKind::EVENT_RECEIVED, "raw", frame.data(), frame.size(), 42);
+    string path = "/tmp/cppplumberd_flight_raw.bin";
+    {
+        ofstream file(path, ios::binary | ios::trunc);
+        recorder.DumpRaw([&file](const void* data, size_t size) { file.write(static_cast<const char*>(data), size); });
+    }
+
+    auto records = FlightRecordReader::Load(path);
+
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records[0].Kind, FrameKind::EVENT_RECEIVED);
+    EXPECT_EQ(records[0].Stream, "raw");
+    EXPECT_EQ(records[0].DurationNs, 42u);
+    EXPECT_EQ(records[0].Frame, frame);
+}
+
+#ifdef SIGUSR2
+TEST(FlightRecorderTest, EachSignalDumpsToItsOwnPath) {
+    auto& recorder = FlightRecorder::Install(4096);
+    auto frame = Pattern(7, 64);
+    recorder.Record(FrameKind::EVENT_PUBLISHED, "s", frame.data(), frame.size());
+    string first = "/tmp/cppplumberd_flight_usr1.bin";
+    string second = "/tmp/cppplumberd_flight_usr2.bin";
+    remove(first.c_str());
+    remove(second.c_str());
+    FlightRecorderDumps::OnSignal(SIGUSR1, first);
+    FlightRecorderDumps::OnSignal(SIGUSR2, second);
+
+    raise(SIGUSR2);
+    bool dumped = false;
+    for (int i = 0; i < 100 && !dumped; ++i) {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        dumped = ifstream(second).good();
+    }
+    FlightRecorderDumps::StopSignals();
+    FlightRecorder::Uninstall();
+
+    EXPECT_TRUE(dumped);
+    EXPECT_FALSE(ifstream(first).good());
+    EXPECT_EQ(FlightRecordReader::Load(second).size(), 1u);
+}
+#endif
+
+class RecordedCommandHandler : public ICommandHandler<SetterCommand> {
+    shared_ptr<EventStore> _eventStore;
+public:
+    explicit RecordedCommandHandler(shared_ptr<EventStore> es) : _eventStore(es) {}
+    void Handle(const string& recipient, const SetterCommand& cmd) override {
+        PropertyChangedEvent evt;
+        evt.set_element_name(cmd.element_name());
+        _eventStore->Publish("recorded", evt);
+    }
+};
+
+TEST(FlightRecorderFlowTest, DumpDecodesAndReplaysRecordedTraffic) {
+    auto& recorder = FlightRecorder::Install(1024 * 1024);
+    auto socketFactory = make_shared<NggSocketFactory>("ipc:///tmp/flight_recorder_test");
+    auto model = make_shared<PropertyRecorder>();
+    auto server = Plumber::CreateServer(socketFactory);
+    auto client = PlumberClient::CreateClient(socketFactory);
+    server->AddCommandHandler<RecordedCommandHandler, SetterCommand, app::testing::COMMANDS::SETTER>(server->GetEventStore());
+    server->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    server->Start();
+    auto sub = client->SubscriptionManager()->Subscribe("recorded", model);
+    client->RegisterMessage<SetterCommand, app::testing::COMMANDS::SETTER>();
+    client->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    this_thread::sleep_for(chrono::milliseconds(100));
+    client->Start();
+
+    SetterCommand cmd;
+    cmd.set_element_name("Recorded");
+    client->CommandBus()->Send("foo", cmd);
+    ASSERT_TRUE(model->WaitFor(1));
+    string path = "/tmp/cppplumberd_flight_test.bin";
+    recorder.Dump(path);
+    FlightRecorder::Uninstall();
+    client->Stop();
+    server->Stop();
+
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<SetterCommand, app::testing::COMMANDS::SETTER>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    FlightRecordReader reader(serializer);
+    auto records = FlightRecordReader::Load(path);
+    ostringstream text;
+    reader.Print(text, records);
+
+    auto count = [&records](FrameKind kind) { return ranges::count(records, kind, &FlightRecord::Kind); };
+    EXPECT_EQ(count(FrameKind::COMMAND_SENT), 2);
+    EXPECT_EQ(count(FrameKind::COMMAND_RECEIVED), 2);
+    EXPECT_EQ(count(FrameKind::RESPONSE_SENT), 2);
+    EXPECT_EQ(count(FrameKind::RESPONSE_RECEIVED), 2);
+    EXPECT_EQ(count(FrameKind::EVENT_PUBLISHED), 1);
+    EXPECT_EQ(count(FrameKind::EVENT_RECEIVED), 1);
+    EXPECT_THAT(text.str(), HasSubstr("element_name: \"Recorded\""));
+    EXPECT_THAT(text.str(), Not(HasSubstr("!")));
+
+    auto replayed = make_shared<PropertyRecorder>();
+    EXPECT_EQ(reader.ReplayEvents(records, *replayed), 1u);
+    ASSERT_EQ(replayed->Count(), 1u);
+    EXPECT_EQ(replayed->Records()[0].Event.element_name(), "Recorded");
+}
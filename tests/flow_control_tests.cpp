@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+TEST(FlowControlQueueTest, ConflateKeepsNewestValuePerKeyInFirstPushOrder) {
+    FlowControlQueue<int> queue(FlowControlPolicy{ FlowControl::CONFLATE, 0 });
+    queue.Push("speed", 1);
+    queue.Push("mode", 2);
+    queue.Push("", 3);
+    queue.Push("speed", 4);
+    queue.Push("", 5);
+
+    list<FlowControlQueue<int>::Item> items;
+    ASSERT_TRUE(queue.WaitAndTake(items));
+
+    vector<int> values;
+    for (auto& item : items) values.push_back(item.Value);
+    EXPECT_THAT(values, ElementsAre(4, 2, 3, 5));
+    auto stats = queue.Stats();
+    EXPECT_EQ(stats.Received, 5u);
+    EXPECT_EQ(stats.Conflated, 1u);
+    EXPECT_EQ(stats.Delivered, 4u);
+    EXPECT_EQ(stats.Pending, 0u);
+    EXPECT_EQ(stats.MaxPending, 4u);
+
+    queue.Close();
+    EXPECT_FALSE(queue.WaitAndTake(items));
+}
+
+static vector<int> Take(FlowControlQueue<int>& queue) {
+    list<FlowControlQueue<int>::Item> items;
+    queue.WaitAndTake(items);
+    vector<int> values;
+    for (auto& item : items) values.push_back(item.Value);
+    return values;
+}
+
+TEST(FlowControlQueueTest, DropPoliciesBoundTheQueue) {
+    FlowControlQueue<int> oldest(FlowControlPolicy{ FlowControl::DROP_OLDEST, 3 });
+    FlowControlQueue<int> newest(FlowControlPolicy{ FlowControl::DROP_NEWEST, 3 });
+    for (int i = 1; i <= 5; ++i) {
+        oldest.Push("", i);
+        newest.Push("", i);
+    }
+
+    EXPECT_THAT(Take(oldest), ElementsAre(3, 4, 5));
+    EXPECT_THAT(Take(newest), ElementsAre(1, 2, 3));
+    EXPECT_EQ(oldest.Stats().Dropped, 2u);
+    EXPECT_EQ(newest.Stats().Dropped, 2u);
+}
+
+TEST(FlowControlQueueTest, BlockHoldsProducerUntilSubscriberTakes) {
+    FlowControlQueue<int> queue(FlowControlPolicy{ FlowControl::BLOCK, 2 });
+    queue.Push("", 1);
+    queue.Push("", 2);
+    atomic<bool> pushed = false;
+    thread producer([&]() { queue.Push("", 3); pushed = true; });
+
+    this_thread::sleep_for(chrono::milliseconds(50));
+    EXPECT_FALSE(pushed);
+    EXPECT_THAT(Take(queue), ElementsAre(1, 2));
+    producer.join();
+
+    EXPECT_THAT(Take(queue), ElementsAre(3));
+}
+
+TEST(FlowControlQueueTest, DisconnectCutsOffSubscriberAndReportsIt) {
+    FlowControlQueue<int> queue(FlowControlPolicy{ FlowControl::DISCONNECT, 2 });
+    queue.Push("", 1);
+    queue.Push("", 2);
+    bool report = false;
+
+    EXPECT_EQ(queue.Push("", 3, &report), FlowControlQueue<int>::Result::DISCONNECTED);
+    EXPECT_TRUE(report);
+    EXPECT_EQ(queue.Push("", 4), FlowControlQueue<int>::Result::DISCONNECTED);
+    list<FlowControlQueue<int>::Item> items;
+    EXPECT_FALSE(queue.WaitAndTake(items));
+    EXPECT_TRUE(queue.Stats().Disconnected);
+}
+
+TEST(FlowControlQueueTest, SlowSubscriberIsReportedOncePerEpisode) {
+    FlowControlQueue<int> queue(FlowControlPolicy{ FlowControl::DROP_NEWEST, 10, 2 });
+    vector<bool> reports;
+    auto push = [&](int value) {
+        bool report = false;
+        queue.Push("", value, &report);
+        reports.push_back(report);
+    };
+    push(1); push(2); push(3);
+    Take(queue);
+    push(4);
+    Take(queue);
+    push(5); push(6);
+
+    EXPECT_THAT(reports, ElementsAre(false, true, false, false, false, true));
+    EXPECT_EQ(queue.Stats().SlowEpisodes, 2u);
+}
+
+TEST(ConflationTest, SlowSubscriberGetsNewestValueOfEveryKey) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    auto socket = make_unique<FrameTestSocket>();
+    auto received = socket.get();
+    auto handler = make_shared<PropertyRecorder>(true);
+    ClientProtoSubscriptionStream stream(std::move(socket), handler, serializer, "pump-1");
+    stream.EnableFlowControl(SubscriptionOptions::ConflateBy<PropertyChangedEvent>(
+        [](const PropertyChangedEvent& evt) { return evt.element_name() + "." + evt.property_name(); }));
+    auto publish = [&](const string& property, int value) {
+        PropertyChangedEvent evt;
+        evt.set_element_name("Pump");
+        evt.set_property_name(property);
+        evt.set_value_data(to_string(value));
+        Receive(received, serializer, evt);
+    };
+    stream.Start();
+
+    publish("Speed", 0);
+    while (stream.Stats().Pending > 0) this_thread::yield();
+    for (int i = 1; i <= 1000; ++i) {
+        publish("Speed", i);
+        if (i % 10 == 0) publish("Mode", i);
+    }
+    handler->Release();
+    ASSERT_TRUE(handler->WaitFor(3));
+    stream.Stop();
+
+    EXPECT_THAT(handler->Received(), ElementsAre("Speed=0", "Speed=1000", "Mode=1000"));
+    auto stats = stream.Stats();
+    EXPECT_EQ(stats.Received, 1101u);
+    EXPECT_EQ(stats.Conflated, 1098u);
+    EXPECT_EQ(stats.MaxPending, 2u);
+}
+
+TEST(FlowControlTest, SequenceGapsCountAsLost) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    auto socket = make_unique<FrameTestSocket>();
+    auto received = socket.get();
+    auto handler = make_shared<PropertyRecorder>();
+    ClientProtoSubscriptionStream stream(std::move(socket), handler, serializer, "pump-1");
+    stream.Start();
+
+    PropertyChangedEvent evt;
+    evt.set_property_name("Speed");
+    for (uint64_t sequence : { 1, 2, 5, 4, 6 }) Receive(received, serializer, evt, sequence);
+
+    EXPECT_EQ(handler->Count(), 5u);
+    EXPECT_EQ(stream.Stats().Lost, 1u);
+}
+
+TEST(FlowControlTest, InProcessSubscriberFollowsStreamPolicy) {
+    auto eventStore = make_shared<EventStore>();
+    eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    eventStore->SetFlowControl("pump-1", FlowControlPolicy{ FlowControl::DROP_NEWEST, 2 });
+    vector<SubscriptionStats> reports;
+    eventStore->OnSlowConsumer([&reports](const string&, const SubscriptionStats& stats) { reports.push_back(stats); });
+    auto handler = make_shared<PropertyRecorder>(true);
+    auto subscription = eventStore->Subscribe("pump-1", handler);
+    auto publish = [&](int value) {
+        PropertyChangedEvent evt;
+        evt.set_property_name("Speed");
+        evt.set_value_data(to_string(value));
+        eventStore->Publish("pump-1", evt);
+    };
+
+    publish(0);
+    while (subscription->Stats().Delivered == 0) this_thread::yield();
+    for (int i = 1; i <= 4; ++i) publish(i);
+    EXPECT_EQ(eventStore->QueueDepth("pump-1"), 2u);
+    handler->Release();
+    ASSERT_TRUE(handler->WaitFor(3));
+    subscription->Unsubscribe();
+
+    EXPECT_THAT(handler->Received(), ElementsAre("Speed=0", "Speed=1", "Speed=2"));
+    ASSERT_EQ(reports.size(), 1u);
+    EXPECT_TRUE(reports[0].Slow);
+    EXPECT_EQ(subscription->Stats().Dropped, 2u);
+}
@@ -0,0 +1,221 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+class LastValueCacheTest : public Test {
+protected:
+    shared_ptr<EventStore> _eventStore;
+    shared_ptr<PropertyRecorder> _log = make_shared<PropertyRecorder>();
+
+    void SetUp() override {
+        _eventStore = make_shared<EventStore>();
+        _eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        _eventStore->EnableLastValue<PropertyChangedEvent>("pump-1",
+            [](const PropertyChangedEvent& evt) { return evt.property_name(); });
+    }
+
+    static PropertyChangedEvent Changed(const string& property, const string& value) {
+        PropertyChangedEvent evt;
+        evt.set_element_name("Pump");
+        evt.set_property_name(property);
+        evt.set_value_data(value);
+        return evt;
+    }
+
+    void Publish(const string& stream, const string& property, const string& value) {
+        _eventStore->Publish(stream, Changed(property, value));
+    }
+};
+
+TEST_F(LastValueCacheTest, KeepsLatestEventPerKey) {
+    Publish("pump-1", "Speed", "1");
+    Publish("pump-1", "Mode", "auto");
+    Publish("pump-1", "Speed", "2");
+    Publish("valve-1", "Speed", "3");
+
+    auto snapshot = _eventStore->LastValues().Snapshot("pump-1");
+
+    ASSERT_EQ(snapshot.events_size(), 2);
+    PropertyChangedEvent speed;
+    speed.ParseFromString(snapshot.events(1).data());
+    EXPECT_EQ(speed.value_data(), "2");
+    EXPECT_EQ(snapshot.events(1).stream(), "pump-1");
+    EXPECT_EQ(_eventStore->LastValues().Snapshot("valve-1").events_size(), 0);
+    auto stats = _eventStore->LastValues().Stats();
+    EXPECT_EQ(stats.Keys, 2u);
+    EXPECT_EQ(stats.Updates, 3u);
+    EXPECT_GT(stats.Bytes, 0u);
+}
+
+TEST_F(LastValueCacheTest, LocalSubscriberGetsSnapshotThenLiveEvents) {
+    Publish("pump-1", "Speed", "1");
+    Publish("pump-1", "Mode", "auto");
+    Publish("pump-1", "Speed", "2");
+
+    auto subscription = _eventStore->Subscribe("pump-1", _log);
+    Publish("pump-1", "Speed", "3");
+
+    EXPECT_THAT(_log->Received(), ElementsAre("Mode=auto", "Speed=2", "Speed=3"));
+    subscription->Unsubscribe();
+}
+
+TEST_F(LastValueCacheTest, LocalSubscriberOnAnExecutorGetsSnapshotThroughIt) {
+    Publish("pump-1", "Speed", "1");
+    Publish("pump-1", "Mode", "auto");
+    auto log = make_shared<PropertyRecorder>();
+    ExecutorOptions executorOptions;
+    executorOptions.Threads = 1;
+    SubscriptionOptions options;
+    options.Executor = make_shared<Executor>(executorOptions);
+
+    auto subscription = _eventStore->Subscribe("pump-1", log, options);
+    Publish("pump-1", "Speed", "2");
+    log->WaitFor(3);
+    subscription->Unsubscribe();
+
+    EXPECT_THAT(log->Received(), ElementsAre("Mode=auto", "Speed=1", "Speed=2"));
+    for (auto& record : log->Records()) EXPECT_NE(record.Thread, this_thread::get_id());
+}
+
+TEST_F(LastValueCacheTest, RemoteStreamHoldsLiveEventsUntilSnapshotIsDelivered) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    auto socket = make_unique<FrameTestSocket>();
+    auto received = socket.get();
+    ClientProtoSubscriptionStream stream(std::move(socket), _log, serializer, "pump-1");
+    auto live = [&](const string& value) { Receive(received, serializer, Changed("Speed", value)); };
+    Publish("pump-1", "Speed", "1");
+
+    stream.HoldLive();
+    stream.Start();
+    live("2");
+    EXPECT_TRUE(_log->Received().empty());
+    stream.DeliverSnapshot(_eventStore->LastValues().Snapshot("pump-1"));
+    live("3");
+
+    EXPECT_THAT(_log->Received(), ElementsAre("Speed=1", "Speed=2", "Speed=3"));
+}
+
+TEST_F(LastValueCacheTest, HeldEventsTheSnapshotCoversAreNotDeliveredAgain) {
+    _eventStore->SetEventLog(make_shared<InMemoryEventLog>());
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    auto socket = make_unique<FrameTestSocket>();
+    auto received = socket.get();
+    ClientProtoSubscriptionStream stream(std::move(socket), _log, serializer, "pump-1");
+    auto live = [&](const string& value) {
+        EventHeader header;
+        header.set_position(_eventStore->Publish("pump-1", Changed("Speed", value)));
+        Receive(received, serializer, Changed("Speed", value), header);
+    };
+    Publish("pump-1", "Speed", "1");
+
+    // Two updates of the same key reach the stream before the snapshot, which already has the second.
+    stream.HoldLive();
+    stream.Start();
+    live("2");
+    live("3");
+    stream.DeliverSnapshot(_eventStore->LastValues().Snapshot("pump-1"));
+    live("4");
+
+    EXPECT_THAT(_log->Received(), ElementsAre("Speed=3", "Speed=4"));
+}
+
+TEST_F(LastValueCacheTest, LocalSubscriberNeverSeesAValueGoBack) {
+    class ValueLog : public EventHandlerBase, public IEventHandler<PropertyChangedEvent> {
+    public:
+        ValueLog() { Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(); }
+        void Handle(const Metadata&, const PropertyChangedEvent& evt) override {
+            int value = stoi(evt.value_data());
+            lock_guard lock(Mtx);
+            if (value < Last) ++Backwards;
+            Last = value;
+        }
+        std::mutex Mtx;
+        int Last = 0;
+        int Backwards = 0;
+    };
+    _eventStore->SetEventLog(make_shared<InMemoryEventLog>());
+    atomic<bool> stop = false;
+    thread publisher([&]() {
+        for (int i = 1; !stop; ++i) Publish("pump-1", "Speed", to_string(i));
+    });
+
+    vector<shared_ptr<ValueLog>> logs;
+    vector<unique_ptr<ISubscription>> subscriptions;
+    for (int i = 0; i < 200; ++i) {
+        logs.push_back(make_shared<ValueLog>());
+        subscriptions.push_back(_eventStore->Subscribe("pump-1", logs.back()));
+    }
+    stop = true;
+    publisher.join();
+    for (auto& s : subscriptions) s->Unsubscribe();
+
+    for (auto& log : logs) EXPECT_EQ(log->Backwards, 0);
+}
+
+TEST_F(LastValueCacheTest, ClientDeliversSnapshotBeforeEventsPublishedDuringTheQuery) {
+    auto factory = make_shared<LoopbackSocketFactory>();
+    auto server = Plumber::CreateServer(factory);
+    server->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    server->GetEventStore()->EnableLastValue<PropertyChangedEvent>("pump-1",
+        [](const PropertyChangedEvent& evt) { return evt.property_name(); });
+    server->Start();
+    server->GetEventStore()->Publish("pump-1", Changed("Speed", "1"));
+    server->GetEventStore()->Publish("pump-1", Changed("Mode", "auto"));
+    // Published once the snapshot is taken but before the client has received it.
+    factory->Server->AfterReply = [&server](uint32_t commandType) {
+        if (commandType == cppplumberd::COMMANDS::GET_LAST_VALUES) server->GetEventStore()->Publish("pump-1", Changed("Speed", "2"));
+    };
+
+    auto client = PlumberClient::CreateClient(factory);
+    client->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    client->Start();
+    SubscriptionOptions options;
+    options.LastValues = true;
+    auto subscription = client->SubscriptionManager()->Subscribe("pump-1", _log, options);
+    factory->Server->AfterReply = nullptr;
+
+    EXPECT_THAT(_log->Received(), ElementsAre("Mode=auto", "Speed=1", "Speed=2"));
+}
+
+TEST_F(LastValueCacheTest, RemoteSubscriberAsksForLastValuesOnlyWhenItOptsIn) {
+    auto factory = make_shared<LoopbackSocketFactory>();
+    auto server = Plumber::CreateServer(factory);
+    server->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    server->GetEventStore()->EnableLastValue<PropertyChangedEvent>("pump-1",
+        [](const PropertyChangedEvent& evt) { return evt.property_name(); });
+    server->Start();
+    server->GetEventStore()->Publish("pump-1", Changed("Speed", "1"));
+    int snapshotQueries = 0;
+    factory->Server->AfterReply = [&snapshotQueries](uint32_t commandType) {
+        if (commandType == cppplumberd::COMMANDS::GET_LAST_VALUES) ++snapshotQueries;
+    };
+
+    auto client = PlumberClient::CreateClient(factory);
+    client->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    client->Start();
+    auto subscription = client->SubscriptionManager()->Subscribe("pump-1", _log);
+    server->GetEventStore()->Publish("pump-1", Changed("Speed", "2"));
+    factory->Server->AfterReply = nullptr;
+
+    EXPECT_EQ(snapshotQueries, 0);
+    EXPECT_THAT(_log->Received(), ElementsAre("Speed=2"));
+}
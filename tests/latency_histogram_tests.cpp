@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+TEST(LatencyHistogramTest, ExactBelowSixteenNanoseconds) {
+    LatencyHistogram h;
+    for (uint64_t v = 0; v < 10; ++v) h.Record(v);
+
+    EXPECT_EQ(h.Count(), 10u);
+    EXPECT_EQ(h.Min(), 0u);
+    EXPECT_EQ(h.Max(), 9u);
+    EXPECT_EQ(h.Percentile(50), 5u);
+}
+
+TEST(LatencyHistogramTest, PercentilesWithinBucketPrecision) {
+    LatencyHistogram h;
+    for (uint64_t v = 1; v <= 100000; ++v) h.Record(v * 1000);
+
+    for (double p : { 50.0, 90.0, 99.0, 99.9 }) {
+        double expected = p / 100.0 * 100000 * 1000;
+        EXPECT_NEAR(static_cast<double>(h.Percentile(p)), expected, expected * 0.07) << "p" << p;
+        EXPECT_GE(static_cast<double>(h.Percentile(p)), expected * 0.999) << "p" << p << " under-reported";
+    }
+    EXPECT_EQ(h.Percentile(100), 100000u * 1000);
+    EXPECT_NEAR(h.Mean(), 50000.5 * 1000, 1.0);
+}
+
+TEST(LatencyHistogramTest, MergeCombinesCounts) {
+    LatencyHistogram a, b;
+    a.Record(100);
+    b.Record(1'000'000);
+
+    a.Merge(b);
+
+    EXPECT_EQ(a.Count(), 2u);
+    EXPECT_EQ(a.Min(), 100u);
+    EXPECT_EQ(a.Max(), 1'000'000u);
+}
+
+class MockPublishSocket : public ITransportPublishSocket {
+public:
+    MOCK_METHOD(void, Start, (), (override));
+    MOCK_METHOD(void, Start, (const string& url), (override));
+    MOCK_METHOD(void, Send, (const uint8_t* data, const size_t size), (override));
+};
+
+class MockSubscribeSocket : public ITransportSubscribeSocket {
+public:
+    MOCK_METHOD(void, Start, (), (override));
+    MOCK_METHOD(void, Start, (const string& url), (override));
+};
+
+class HopRecordingModel : public PropertyRecorder {
+public:
+    void Handle(const Metadata& m, const PropertyChangedEvent& evt) override {
+        PropertyRecorder::Handle(m, evt);
+        Recorder.Record(m);
+    }
+    HopLatencyRecorder Recorder;
+};
+
+TEST(HopStampsTest, SubscriberSeesOrderedNanosecondHops) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+
+    vector<uint8_t> frame;
+    auto pubSocket = make_unique<NiceMock<MockPublishSocket>>();
+    ON_CALL(*pubSocket, Send(_, _)).WillByDefault([&frame](const uint8_t* data, size_t size) {
+        frame.assign(data, data + size);
+        });
+    ProtoPublishHandler publisher(std::move(pubSocket), serializer);
+    publisher.EnableHopStamps(true);
+
+    auto subSocket = make_unique<NiceMock<MockSubscribeSocket>>();
+    auto* sub = subSocket.get();
+    auto model = make_shared<HopRecordingModel>();
+    ClientProtoSubscriptionStream stream(std::move(subSocket), model, serializer, "foo");
+    stream.Start();
+
+    PropertyChangedEvent evt;
+    evt.set_element_name("TestElement");
+    publisher.Publish(evt);
+    sub->Received(frame.data(), frame.size());
+
+    ASSERT_EQ(model->Count(), 1u);
+    auto m = model->Records()[0].Meta;
+    ASSERT_TRUE(m.HasHopStamps());
+    EXPECT_LE(m.Hops().Published, m.Hops().Sent);
+    EXPECT_LE(m.Hops().Sent, m.Hops().Received);
+    EXPECT_LE(m.Hops().Received, m.Hops().Dispatched);
+    EXPECT_EQ(m.Created(), m.Hops().Published);
+    EXPECT_EQ(model->Recorder.SendToReceive().Count(), 1u);
+    EXPECT_EQ(model->Recorder.PublishToDispatch().Count(), 1u);
+}
+
+TEST(HopStampsTest, SentHopIsAbsentUnlessEnabled) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+
+    vector<uint8_t> frame;
+    auto pubSocket = make_unique<NiceMock<MockPublishSocket>>();
+    ON_CALL(*pubSocket, Send(_, _)).WillByDefault([&frame](const uint8_t* data, size_t size) {
+        frame.assign(data, data + size);
+        });
+    ProtoPublishHandler publisher(std::move(pubSocket), serializer);
+
+    auto subSocket = make_unique<NiceMock<MockSubscribeSocket>>();
+    auto* sub = subSocket.get();
+    auto model = make_shared<HopRecordingModel>();
+    ClientProtoSubscriptionStream stream(std::move(subSocket), model, serializer, "foo");
+    stream.Start();
+
+    PropertyChangedEvent evt;
+    evt.set_element_name("TestElement");
+    publisher.Publish(evt);
+    sub->Received(frame.data(), frame.size());
+
+    ASSERT_EQ(model->Count(), 1u);
+    auto m = model->Records()[0].Meta;
+    EXPECT_FALSE(m.HasHopStamps());
+    EXPECT_GT(m.Created().time_since_epoch().count(), 0);
+    EXPECT_EQ(model->Recorder.SendToReceive().Count(), 0u);
+}
+
+TEST(HopStampsTest, MillisecondTimestampOfOlderPublishersIsRead) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+
+    auto subSocket = make_unique<NiceMock<MockSubscribeSocket>>();
+    auto* sub = subSocket.get();
+    auto model = make_shared<HopRecordingModel>();
+    ClientProtoSubscriptionStream stream(std::move(subSocket), model, serializer, "foo");
+    stream.Start();
+
+    // A frame as publishers without timestamp_ns write it.
+    PropertyChangedEvent evt;
+    evt.set_element_name("TestElement");
+    EventHeader header;
+    header.set_timestamp(1743811200123);
+    Receive(sub, serializer, evt, header);
+
+    ASSERT_EQ(model->Count(), 1u);
+    auto m = model->Records()[0].Meta;
+    EXPECT_EQ(m.Hops().Published, NanoTimePoint(milliseconds(1743811200123)));
+    EXPECT_EQ(m.Created(), system_clock::time_point(milliseconds(1743811200123)));
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+
+TEST(ListenerListTest, CallsListenersInConnectionOrderUntilDisconnected) {
+    ListenerList<void(uint8_t*, size_t)> received;
+    vector<string> calls;
+    auto first = received.connect([&calls](uint8_t* buffer, size_t size) { calls.push_back("first:" + to_string(size)); });
+    auto second = received.connect([&calls](const uint8_t* buffer, const size_t size) { calls.push_back("second:" + to_string(size)); });
+    uint8_t frame[4] = {};
+
+    received(frame, 4);
+    first.disconnect();
+    received(frame, 2);
+
+    EXPECT_THAT(calls, ElementsAre("first:4", "second:4", "second:2"));
+    EXPECT_FALSE(first.connected());
+    EXPECT_TRUE(second.connected());
+    EXPECT_EQ(received.num_slots(), 1u);
+}
+
+TEST(ListenerListTest, ConnectionMayOutliveTheList) {
+    ListenerConnection connection;
+    {
+        ListenerList<void(int)> list;
+        connection = list.connect([](int) {});
+        list.disconnect_all_slots();
+        EXPECT_TRUE(list.empty());
+        EXPECT_FALSE(connection.connected());
+    }
+    connection.disconnect();
+}
+
+TEST(ListenerListTest, ListenersCanChangeWhileAnotherThreadInvokes) {
+    ListenerList<void(int)> list;
+    atomic<uint64_t> permanent = 0, transient = 0;
+    list.connect([&permanent](int n) { permanent += n; });
+    atomic<bool> done = false;
+    thread invoker([&]() {
+        uint64_t calls = 0;
+        while (!done) {
+            list(1);
+            ++calls;
+        }
+        EXPECT_EQ(permanent, calls);
+    });
+    for (int i = 0; i < 1000; ++i) {
+        auto connection = list.connect([&transient](int n) { transient += n; });
+        connection.disconnect();
+    }
+    done = true;
+    invoker.join();
+
+    EXPECT_EQ(list.num_slots(), 1u);
+}
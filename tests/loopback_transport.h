@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cppplumberd/transport_interfaces.hpp"
+#include "proto/cqrs.pb.h"
+
+// In-process stand-in for the nng transport, for tests that run several servers in one process or need to break the
+// network on purpose. Each server answers its requests in arrival order on a thread of its own, and a client waits
+// for the reply for at most the socket timeout; a reply that comes too late is dropped. A frame published on an
+// endpoint reaches the subscribe sockets open on it, on the sender's thread.
+
+class LoopbackSocketFactory;
+
+class LoopbackSrvSocket : public cppplumberd::ITransportReqRspSrvSocket {
+public:
+    // A client waits on its request, not on the server, so the server may go away while clients still wait.
+    struct Request {
+        std::vector<uint8_t> In;
+        std::vector<uint8_t> Out;
+        bool Done = false;
+        bool Dropped = false;
+        std::mutex Mtx;
+        std::condition_variable Cv;
+    };
+
+    ~LoopbackSrvSocket() override {
+        {
+            std::lock_guard lock(_mtx);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable()) _thread.join();
+    }
+    void Start() override {}
+    void Start(const std::string& url) override {}
+    void Initialize(std::function<size_t(const size_t)> handler, uint8_t* inBuf, size_t inMaxBufSize, uint8_t* outBuf, size_t outMaxBufSize) override {
+        _handler = handler;
+        _inBuf = inBuf;
+        _outBuf = outBuf;
+        if (!_thread.joinable()) _thread = std::thread([this]() { Run(); });
+    }
+
+    // Until every request, answered in time or not, has been handled.
+    void WaitIdle() {
+        std::unique_lock lock(_mtx);
+        _cv.wait(lock, [this]() { return _requests.empty() && !_busy; });
+    }
+
+    size_t Call(const uint8_t* inBuf, size_t inSize, uint8_t* outBuf, std::chrono::milliseconds timeout) {
+        if (Down) throw cppplumberd::TransportException("Connection refused");
+        auto request = std::make_shared<Request>();
+        request->In.assign(inBuf, inBuf + inSize);
+        {
+            std::lock_guard lock(_mtx);
+            _requests.push_back(request);
+        }
+        _cv.notify_all();
+        std::unique_lock lock(request->Mtx);
+        auto done = [&request]() { return request->Done; };
+        if (timeout.count() == 0) request->Cv.wait(lock, done);
+        else if (!request->Cv.wait_for(lock, timeout, done)) throw cppplumberd::TimeoutException("No reply from the loopback server in time");
+        if (request->Dropped) throw cppplumberd::TransportException("Connection closed");
+        memcpy(outBuf, request->Out.data(), request->Out.size());
+        return request->Out.size();
+    }
+
+    // While Down, the server cannot be reached.
+    std::atomic<bool> Down = false;
+    // Runs with the command type once a reply is built, before its client reads it.
+    std::function<void(uint32_t)> AfterReply;
+
+private:
+    void Run() {
+        std::unique_lock lock(_mtx);
+        while (true) {
+            _cv.wait(lock, [this]() { return _stopping || !_requests.empty(); });
+            if (_stopping) {
+                for (auto& request : _requests) Complete(*request, true);
+                return;
+            }
+            auto request = _requests.front();
+            _requests.pop_front();
+            _busy = true;
+            lock.unlock();
+            memcpy(_inBuf, request->In.data(), request->In.size());
+            size_t size = _handler(request->In.size());
+            request->Out.assign(_outBuf, _outBuf + size);
+            if (AfterReply) AfterReply(CommandType(request->In));
+            Complete(*request, false);
+            lock.lock();
+            _busy = false;
+            _cv.notify_all();
+        }
+    }
+
+    static void Complete(Request& request, bool dropped) {
+        {
+            std::lock_guard lock(request.Mtx);
+            request.Done = true;
+            request.Dropped = dropped;
+        }
+        request.Cv.notify_all();
+    }
+
+    static uint32_t CommandType(const std::vector<uint8_t>& frame) {
+        const uint32_t* sizes = reinterpret_cast<const uint32_t*>(frame.data());
+        cppplumberd::CommandHeader header;
+        header.ParseFromArray(frame.data() + 2 * sizeof(uint32_t), static_cast<int>(sizes[0]));
+        return header.command_type();
+    }
+
+    std::function<size_t(const size_t)> _handler;
+    uint8_t* _inBuf = nullptr;
+    uint8_t* _outBuf = nullptr;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::deque<std::shared_ptr<Request>> _requests;
+    bool _stopping = false;
+    bool _busy = false;
+    std::thread _thread;
+};
+
+// Counts the requests it has in flight at once: a req/rsp socket takes one at a time.
+class LoopbackClientSocket : public cppplumberd::ITransportReqRspClientSocket {
+    LoopbackSrvSocket* _server;
+    const std::atomic<bool>* _cut;
+    std::chrono::milliseconds _timeout = std::chrono::milliseconds(0);
+public:
+    explicit LoopbackClientSocket(LoopbackSrvSocket* server, const std::atomic<bool>* cut = nullptr) : _server(server), _cut(cut) {}
+    void Start() override {}
+    void Start(const std::string& url) override {}
+    void SetTimeout(std::chrono::milliseconds timeout) override { _timeout = timeout; }
+    size_t Send(const uint8_t* inBuf, const size_t inSize, uint8_t* outBuf, const size_t outMaxBufSize) override {
+        if (_cut && *_cut) throw cppplumberd::TransportException("Network partition");
+        int inFlight = ++InFlight;
+        for (int seen = MaxInFlight; inFlight > seen && !MaxInFlight.compare_exchange_weak(seen, inFlight);) {}
+        try {
+            size_t size = _server->Call(inBuf, inSize, outBuf, _timeout);
+            --InFlight;
+            return size;
+        }
+        catch (...) {
+            --InFlight;
+            throw;
+        }
+    }
+    std::atomic<int> InFlight = 0;
+    std::atomic<int> MaxInFlight = 0;
+};
+
+class LoopbackSubscribeSocket : public cppplumberd::ITransportSubscribeSocket {
+public:
+    void Start() override {}
+    void Start(const std::string& url) override {}
+};
+
+class LoopbackPublishSocket : public cppplumberd::ITransportPublishSocket {
+    LoopbackSocketFactory* _bus;
+    std::string _endpoint;
+public:
+    LoopbackPublishSocket(LoopbackSocketFactory* bus, std::string endpoint) : _bus(bus), _endpoint(std::move(endpoint)) {}
+    void Start() override {}
+    void Start(const std::string& url) override {}
+    void Send(const uint8_t* buffer, const size_t size) override;
+};
+
+// One server's sockets. A factory whose Target is another one is a network link to that server: its sockets reach
+// the target's, and Cut partitions the link.
+class LoopbackSocketFactory : public cppplumberd::ISocketFactory {
+public:
+    std::unique_ptr<cppplumberd::ITransportPublishSocket> CreatePublishSocket(const std::string& endpoint) override {
+        return std::make_unique<LoopbackPublishSocket>(Target, endpoint);
+    }
+    std::unique_ptr<cppplumberd::ITransportSubscribeSocket> CreateSubscribeSocket(const std::string& endpoint) override {
+        auto socket = std::make_unique<LoopbackSubscribeSocket>();
+        std::lock_guard lock(Target->_mtx);
+        Target->_subscribers[endpoint].push_back(socket.get());
+        return socket;
+    }
+    std::unique_ptr<cppplumberd::ITransportReqRspClientSocket> CreateReqRspClientSocket(const std::string& endpoint) override {
+        ++ClientSockets;
+        return std::make_unique<LoopbackClientSocket>(Target->Server, &Cut);
+    }
+    std::unique_ptr<cppplumberd::ITransportReqRspSrvSocket> CreateReqRspSrvSocket(const std::string& endpoint) override {
+        auto socket = std::make_unique<LoopbackSrvSocket>();
+        Server = socket.get();
+        return socket;
+    }
+    void Deliver(const std::string& endpoint, const uint8_t* buffer, size_t size) {
+        std::vector<LoopbackSubscribeSocket*> subscribers;
+        {
+            std::lock_guard lock(_mtx);
+            subscribers = _subscribers[endpoint];
+        }
+        std::vector<uint8_t> frame(buffer, buffer + size);
+        for (auto* s : subscribers) s->Received(frame.data(), frame.size());
+    }
+
+    LoopbackSocketFactory* Target = this;
+    LoopbackSrvSocket* Server = nullptr;
+    std::atomic<bool> Cut = false;
+    std::atomic<size_t> ClientSockets = 0;
+private:
+    std::mutex _mtx;
+    std::map<std::string, std::vector<LoopbackSubscribeSocket*>> _subscribers;
+};
+
+inline void LoopbackPublishSocket::Send(const uint8_t* buffer, const size_t size) {
+    _bus->Deliver(_endpoint, buffer, size);
+}
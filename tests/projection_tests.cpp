@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+// Value of the last event of each stream the model handled.
+static map<string, string> Latest(const PropertyRecorder& model) {
+    map<string, string> values;
+    for (auto& record : model.Records()) values[record.Meta.StreamId()] = record.Event.value_data();
+    return values;
+}
+
+class ProjectionTest : public Test {
+protected:
+    shared_ptr<EventStore> _eventStore;
+    shared_ptr<InMemoryEventLog> _log;
+    shared_ptr<PropertyRecorder> _model;
+
+    void SetUp() override {
+        _eventStore = make_shared<EventStore>();
+        _eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        _log = make_shared<InMemoryEventLog>();
+        _eventStore->SetEventLog(_log);
+        _model = make_shared<PropertyRecorder>();
+    }
+
+    void Publish(const string& stream, const string& value) {
+        PropertyChangedEvent evt;
+        evt.set_element_name("Pump");
+        evt.set_property_name("Speed");
+        evt.set_value_data(value);
+        _eventStore->Publish(stream, evt);
+    }
+
+    unique_ptr<Projection> Create(shared_ptr<ICheckpointStore> checkpoints, const vector<string>& streams = {},
+        ProjectionOptions options = {}) {
+        return make_unique<Projection>("properties", _log, _eventStore->Serializer(), _model, checkpoints, streams, options);
+    }
+};
+
+TEST_F(ProjectionTest, ProjectsSelectedStreamsAndSkipsUnmappedEvents) {
+    Publish("pump-1", "1");
+    _log->Append("pump-1", 999, "not a registered message", TraceContext());
+    Publish("pump-2", "2");
+    Publish("valve-1", "3");
+    auto projection = Create(make_shared<InMemoryCheckpointStore>(), { "pump-1", "pump-2" });
+
+    EXPECT_EQ(projection->CatchUp(), 4u);
+
+    EXPECT_EQ(_model->Count(), 2u);
+    EXPECT_THAT(Latest(*_model), ElementsAre(Pair("pump-1", "1"), Pair("pump-2", "2")));
+    EXPECT_EQ(projection->Stats().Checkpoint, 4u);
+}
+
+TEST_F(ProjectionTest, ResumesFromCheckpointAfterRestart) {
+    string directory = "/tmp/cppplumberd_checkpoints_test";
+    filesystem::remove_all(directory);
+    for (int i = 0; i < 5; ++i) Publish("pump-1", to_string(i));
+    Create(make_shared<FileCheckpointStore>(directory))->CatchUp();
+    for (int i = 5; i < 8; ++i) Publish("pump-1", to_string(i));
+
+    _model = make_shared<PropertyRecorder>();
+    auto restarted = Create(make_shared<FileCheckpointStore>(directory));
+    restarted->CatchUp();
+
+    EXPECT_EQ(_model->Count(), 3u);
+    EXPECT_EQ(Latest(*_model)["pump-1"], "7");
+}
+
+TEST_F(ProjectionTest, CheckpointsAreCommittedInBatches) {
+    for (int i = 0; i < 250; ++i) Publish("pump-1", to_string(i));
+    auto checkpoints = make_shared<InMemoryCheckpointStore>();
+    ProjectionOptions options;
+    options.BatchSize = 10;
+    options.CheckpointEvery = 100;
+    options.CheckpointInterval = chrono::milliseconds(0);
+    auto projection = Create(checkpoints, {}, options);
+
+    while (projection->Step() > 0) {}
+
+    auto stats = projection->Stats();
+    EXPECT_EQ(stats.Position, 250u);
+    EXPECT_EQ(stats.Checkpoints, 2u);
+    EXPECT_EQ(checkpoints->Load("properties"), 200u);
+}
+
+TEST_F(ProjectionTest, FailedStepResumesAtTheFailingEvent) {
+    class FailOnceReadModel : public PropertyRecorder {
+    public:
+        void Handle(const Metadata& m, const PropertyChangedEvent& evt) override {
+            if (evt.value_data() == "2" && !Failed.exchange(true)) throw runtime_error("transient");
+            PropertyRecorder::Handle(m, evt);
+        }
+        atomic<bool> Failed = false;
+    };
+    auto model = make_shared<FailOnceReadModel>();
+    _model = model;
+    for (int i = 0; i < 5; ++i) Publish("pump-1", to_string(i));
+    auto projection = Create(make_shared<InMemoryCheckpointStore>());
+
+    EXPECT_THROW(projection->Step(), runtime_error);
+    EXPECT_EQ(projection->Stats().Position, 2u);
+    projection->CatchUp();
+
+    EXPECT_THAT(model->Received(), ElementsAre("Speed=0", "Speed=1", "Speed=2", "Speed=3", "Speed=4"));
+    EXPECT_EQ(projection->Stats().Processed, 5u);
+}
+
+TEST_F(ProjectionTest, RunsInBackgroundAndReportsLag) {
+    auto checkpoints = make_shared<InMemoryCheckpointStore>();
+    auto projection = Create(checkpoints);
+    for (int i = 0; i < 3; ++i) Publish("pump-1", to_string(i));
+    EXPECT_EQ(projection->Stats().Lag, 3u);
+
+    projection->Start();
+    for (int i = 3; i < 100; ++i) Publish("pump-1", to_string(i));
+    _model->WaitFor(100);
+    projection->Stop();
+
+    auto stats = projection->Stats();
+    EXPECT_EQ(_model->Count(), 100u);
+    EXPECT_EQ(stats.Lag, 0u);
+    EXPECT_EQ(stats.TimeLag.count(), 0);
+    EXPECT_EQ(checkpoints->Load("properties"), 100u);
+}
+
+TEST_F(ProjectionTest, PartitionsKeepPerStreamOrderAndCheckpoints) {
+    for (int i = 0; i < 50; ++i)
+        for (int s = 0; s < 20; ++s) Publish("pump-" + to_string(s), to_string(i));
+    auto checkpoints = make_shared<InMemoryCheckpointStore>();
+    vector<shared_ptr<PropertyRecorder>> models;
+    PartitionedProjection projection("properties", _log, _eventStore->Serializer(),
+        [&models](size_t) { models.push_back(make_shared<PropertyRecorder>()); return models.back(); },
+        checkpoints, 4);
+
+    projection.CatchUp();
+
+    size_t streams = 0;
+    for (size_t p = 0; p < models.size(); ++p) {
+        for (auto& [stream, value] : Latest(*models[p])) {
+            EXPECT_EQ(StreamPartition(stream, 4), p);
+            EXPECT_EQ(value, "49");
+            ++streams;
+        }
+        EXPECT_EQ(checkpoints->Load("properties/" + to_string(p)), 1000u);
+    }
+    EXPECT_EQ(streams, 20u);
+    EXPECT_EQ(projection.Stats().Processed, 1000u);
+    EXPECT_EQ(projection.Stats().Lag, 0u);
+}
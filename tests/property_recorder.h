@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+
+// Subscriber for the tests that publish PropertyChangedEvents: records every event with its metadata and the thread
+// that handled it. A held recorder blocks on its first event until released, so what arrives meanwhile piles up in
+// front of it.
+class PropertyRecorder : public cppplumberd::EventHandlerBase,
+    public cppplumberd::IEventHandler<app::testing::PropertyChangedEvent> {
+public:
+    struct Record {
+        cppplumberd::Metadata Meta;
+        app::testing::PropertyChangedEvent Event;
+        std::thread::id Thread;
+    };
+
+    explicit PropertyRecorder(bool held = false) : _held(held) {
+        Map<app::testing::PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    }
+
+    void Handle(const cppplumberd::Metadata& m, const app::testing::PropertyChangedEvent& evt) override {
+        std::unique_lock lock(_mtx);
+        _cv.wait(lock, [this]() { return !_held; });
+        _records.push_back({ m, evt, std::this_thread::get_id() });
+        _cv.notify_all();
+    }
+
+    void Release() {
+        std::lock_guard lock(_mtx);
+        _held = false;
+        _cv.notify_all();
+    }
+
+    bool WaitFor(size_t count, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+        std::unique_lock lock(_mtx);
+        return _cv.wait_for(lock, timeout, [this, count]() { return _records.size() >= count; });
+    }
+
+    size_t Count() const {
+        std::lock_guard lock(_mtx);
+        return _records.size();
+    }
+
+    std::vector<Record> Records() const {
+        std::lock_guard lock(_mtx);
+        return _records;
+    }
+
+    // "name=value" per event, in the order handled.
+    std::vector<std::string> Received() const {
+        std::vector<std::string> received;
+        for (auto& record : Records())
+            received.push_back(record.Event.property_name() + "=" + record.Event.value_data());
+        return received;
+    }
+
+private:
+    mutable std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _held;
+    std::vector<Record> _records;
+};
+
+// Subscribe socket that never receives anything itself; tests hand it frames through Receive.
+class FrameTestSocket : public cppplumberd::ITransportSubscribeSocket {
+public:
+    void Start() override {}
+    void Start(const std::string&) override {}
+};
+
+// Passes 'evt' to 'socket' as if it arrived in a published frame with the given header.
+inline void Receive(cppplumberd::ITransportSubscribeSocket* socket, std::shared_ptr<cppplumberd::MessageSerializer> serializer,
+    const app::testing::PropertyChangedEvent& evt, cppplumberd::EventHeader header) {
+    cppplumberd::ProtoFrameBuffer<64 * 1024> frame(serializer);
+    header.set_event_type(app::testing::EVENTS::PROPERTY_CHANGED);
+    frame.Write<cppplumberd::EventHeader, app::testing::PropertyChangedEvent>(header, evt);
+    socket->Received(frame.Get(), frame.Written());
+}
+
+inline void Receive(cppplumberd::ITransportSubscribeSocket* socket, std::shared_ptr<cppplumberd::MessageSerializer> serializer,
+    const app::testing::PropertyChangedEvent& evt, uint64_t sequence = 0) {
+    cppplumberd::EventHeader header;
+    header.set_sequence(sequence);
+    Receive(socket, serializer, evt, header);
+}
@@ -285,3 +285,83 @@ TEST_F(ReqRspIntegrationTest, ErrorHandlingTest) {
     }
 }
 
+
+TEST_F(ReqRspIntegrationTest, RetriedCommandIdRunsTheHandlerOnce) {
+    int executed = 0;
+    serverHandler->RegisterHandler<SetterCommand, app::testing::COMMANDS::SETTER>([&executed](const SetterCommand& cmd) {
+        if (++executed == 2) throw FaultException("Rejected", 409);
+    });
+    serverHandler->EnableDedup();
+    EXPECT_CALL(*mockClientSocket, Send(_, _, _, _)).Times(5);
+    serverHandler->Start("test-url");
+    SetterCommand cmd = CreateTestCommand("TestElement", "TestProperty", 42);
+
+    clientHandler->Send<SetterCommand>("foo", cmd, "cmd-1");
+    clientHandler->Send<SetterCommand>("foo", cmd, "cmd-1");
+    EXPECT_EQ(executed, 1);
+
+    // A faulted command is answered with the same fault.
+    EXPECT_THROW(clientHandler->Send<SetterCommand>("foo", cmd, "cmd-2"), FaultException);
+    EXPECT_THROW(clientHandler->Send<SetterCommand>("foo", cmd, "cmd-2"), FaultException);
+    EXPECT_EQ(executed, 2);
+
+    // Without an id every send runs.
+    clientHandler->Send<SetterCommand>("foo", cmd);
+    EXPECT_EQ(executed, 3);
+    auto stats = serverHandler->DedupStats();
+    EXPECT_EQ(stats.Hits, 2u);
+    EXPECT_EQ(stats.Stored, 2u);
+}
+
+TEST_F(ReqRspIntegrationTest, FilteredCommandIsNotRememberedByDedup) {
+    int executed = 0;
+    serverHandler->RegisterHandler<SetterCommand, app::testing::COMMANDS::SETTER>([&executed](const SetterCommand&) {
+        ++executed;
+    });
+    serverHandler->EnableDedup();
+    bool moving = true;
+    serverHandler->SetRequestFilter([&moving](const CommandHeader&) {
+        if (moving) throw FaultException("Slot is being handed off", 503);
+    });
+    serverHandler->Start("test-url");
+    SetterCommand cmd = CreateTestCommand("TestElement", "TestProperty", 42);
+
+    try {
+        clientHandler->Send<SetterCommand>("foo", cmd, "cmd-1");
+        FAIL() << "Expected FaultException";
+    }
+    catch (const FaultException& ex) {
+        EXPECT_EQ(ex.ErrorCode(), 503);
+    }
+    EXPECT_EQ(executed, 0);
+
+    // The retry with the same id is checked again and runs.
+    moving = false;
+    clientHandler->Send<SetterCommand>("foo", cmd, "cmd-1");
+    clientHandler->Send<SetterCommand>("foo", cmd, "cmd-1");
+    EXPECT_EQ(executed, 1);
+    auto stats = serverHandler->DedupStats();
+    EXPECT_EQ(stats.Hits, 1u);
+    EXPECT_EQ(stats.Stored, 1u);
+}
+
+TEST(CommandDedupCacheTest, ForgetsIdsAfterTheTtlOrBeyondCapacity) {
+    CommandDedupCache cache(CommandDedupOptions{ 2, chrono::milliseconds(50) });
+    const uint8_t response[] = { 1, 2, 3 };
+    cache.Put("a", response, sizeof(response));
+    cache.Put("b", response, sizeof(response));
+    cache.Put("c", response, sizeof(response));
+
+    string found;
+    EXPECT_FALSE(cache.Find("a", found));
+    ASSERT_TRUE(cache.Find("b", found));
+    EXPECT_EQ(found, string("\x01\x02\x03", 3));
+    this_thread::sleep_for(chrono::milliseconds(60));
+    EXPECT_FALSE(cache.Find("c", found));
+
+    auto stats = cache.Stats();
+    EXPECT_EQ(stats.Evicted, 1u);
+    EXPECT_EQ(stats.Expired, 2u);
+    EXPECT_EQ(stats.Entries, 0u);
+    EXPECT_EQ(stats.Bytes, 0u);
+}
@@ -0,0 +1,320 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+// Subscriptions whose events are pushed by the test.
+class FakeSubscriptionManager : public ISubscriptionManager {
+    class Subscription : public ISubscription {
+    public:
+        void Unsubscribe() override {}
+    };
+public:
+    unique_ptr<ISubscription> Subscribe(const string& streamName, const shared_ptr<IEventDispatcher>& handler) override {
+        Handlers[streamName] = handler;
+        return make_unique<Subscription>();
+    }
+    void Push(const string& stream, PropertyChangedEvent evt, uint64_t position = 0) {
+        Metadata m(stream, system_clock::now(), TraceContext(), 0, position);
+        Handlers.at(stream)->Handle(m, app::testing::EVENTS::PROPERTY_CHANGED, &evt);
+    }
+    map<string, shared_ptr<IEventDispatcher>> Handlers;
+};
+
+class PropertyQueryHandler : public IQueryHandler<PropertySelector, PropertyValue> {
+public:
+    PropertyValue Handle(const PropertySelector& query) override {
+        ++Calls;
+        PropertyValue value;
+        value.set_element_name(query.element_name());
+        value.set_property_name(query.property_name());
+        value.set_value_data(Values[query.property_name()]);
+        return value;
+    }
+    uint64_t Position() const override { return Applied; }
+    map<string, string> Values;
+    size_t Calls = 0;
+    // Last log position the handler's read model has applied.
+    atomic<uint64_t> Applied = 0;
+};
+
+class QueryBusTest : public Test {
+protected:
+    shared_ptr<EventStore> _eventStore;
+    unique_ptr<ProtoReqRspSrvHandler> _server;
+    unique_ptr<QueryServiceHandler> _queries;
+    shared_ptr<PlumberQueryBus> _queryBus;
+    shared_ptr<PropertyQueryHandler> _handler;
+    LoopbackClientSocket* _clientSocket = nullptr;
+
+    void SetUp() override {
+        _eventStore = make_shared<EventStore>();
+        _eventStore->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        auto serverSocket = make_unique<LoopbackSrvSocket>();
+        auto server = serverSocket.get();
+        _server = make_unique<ProtoReqRspSrvHandler>(std::move(serverSocket));
+        _queries = make_unique<QueryServiceHandler>(*_server, _eventStore);
+        _handler = make_shared<PropertyQueryHandler>();
+        _handler->Values["Speed"] = "1";
+        _server->Start();
+
+        auto clientSocket = make_unique<LoopbackClientSocket>(server);
+        _clientSocket = clientSocket.get();
+        _queryBus = make_shared<PlumberQueryBus>(make_unique<ProtoReqRspClientHandler>(std::move(clientSocket)));
+        _queryBus->RegisterQuery<PropertySelector, app::testing::QUERIES::GET_PROPERTY, PropertyValue, app::testing::QUERIES::PROPERTY_VALUE>();
+    }
+
+    void Register(const vector<string>& invalidatedBy) {
+        _queries->RegisterHandler<PropertySelector, app::testing::QUERIES::GET_PROPERTY, PropertyValue, app::testing::QUERIES::PROPERTY_VALUE>(
+            _handler, invalidatedBy);
+    }
+
+    PropertyValue Query(const string& property) {
+        PropertySelector query;
+        query.set_element_name("Pump");
+        query.set_property_name(property);
+        return _queryBus->Query<PropertyValue>(query);
+    }
+
+    void Publish(const string& stream) {
+        PropertyChangedEvent evt;
+        evt.set_property_name("Speed");
+        _eventStore->Publish(stream, evt);
+    }
+};
+
+TEST_F(QueryBusTest, QueryReturnsTypedResult) {
+    Register({});
+
+    auto first = Query("Speed");
+    auto second = Query("Speed");
+
+    EXPECT_EQ(first.element_name(), "Pump");
+    EXPECT_EQ(second.value_data(), "1");
+    EXPECT_EQ(_handler->Calls, 2u);
+    EXPECT_EQ(_queries->Cache().Stats().Misses, 0u);
+}
+
+TEST_F(QueryBusTest, QueriesFromSeveralThreadsGoOutOneAtATime) {
+    Register({});
+    for (int t = 0; t < 4; ++t) _handler->Values["P" + to_string(t)] = to_string(t);
+    _handler->Calls = 0;
+
+    atomic<int> mismatched = 0;
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([this, t, &mismatched]() {
+            for (int i = 0; i < 200; ++i)
+                if (Query("P" + to_string(t)).value_data() != to_string(t)) ++mismatched;
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    EXPECT_EQ(mismatched, 0);
+    EXPECT_EQ(_clientSocket->MaxInFlight, 1);
+    EXPECT_EQ(_handler->Calls, 800u);
+}
+
+TEST_F(QueryBusTest, CacheableQueryIsAnsweredFromCache) {
+    Register({ "pump-1" });
+
+    Query("Speed");
+    auto cached = Query("Speed");
+    Query("Mode");
+
+    EXPECT_EQ(cached.value_data(), "1");
+    EXPECT_EQ(_handler->Calls, 2u);
+    auto stats = _queries->Cache().Stats();
+    EXPECT_EQ(stats.Hits, 1u);
+    EXPECT_EQ(stats.Misses, 2u);
+    EXPECT_EQ(stats.Entries, 2u);
+    EXPECT_GT(stats.Bytes, 0u);
+}
+
+TEST_F(QueryBusTest, EventOnDeclaredStreamInvalidatesResults) {
+    Register({ "pump-1" });
+    Query("Speed");
+
+    Publish("valve-1");
+    Query("Speed");
+    _handler->Values["Speed"] = "2";
+    Publish("pump-1");
+    auto fresh = Query("Speed");
+
+    EXPECT_EQ(fresh.value_data(), "2");
+    EXPECT_EQ(_handler->Calls, 2u);
+    EXPECT_EQ(_queries->Cache().Stats().Invalidations, 1u);
+}
+
+TEST_F(QueryBusTest, ResultCacheEvictsLeastRecentlyUsedOverCapacity) {
+    Register({ "pump-1" });
+    Query("Speed");
+    size_t one = _queries->Cache().Stats().Bytes;
+    _queries->SetCacheCapacity(one + one / 2);
+
+    Query("Mode");
+    Query("Mode");
+    Query("Speed");
+
+    auto stats = _queries->Cache().Stats();
+    EXPECT_EQ(stats.Entries, 1u);
+    EXPECT_EQ(stats.Hits, 1u);
+    EXPECT_EQ(stats.Evictions, 2u);
+    EXPECT_LE(stats.Bytes, stats.CapacityBytes);
+    EXPECT_EQ(_handler->Calls, 3u);
+}
+
+class ClientQueryCacheTest : public QueryBusTest {
+protected:
+    shared_ptr<FakeSubscriptionManager> _subscriptions = make_shared<FakeSubscriptionManager>();
+    unique_ptr<ClientQueryCache> _cache;
+
+    void SetUp() override {
+        QueryBusTest::SetUp();
+        Register({});
+        _cache = make_unique<ClientQueryCache>(_queryBus, _subscriptions);
+        _cache->Register<PropertySelector, PropertyValue>({ "pump-1" });
+    }
+
+    PropertyValue CachedQuery(const string& property) {
+        PropertySelector query;
+        query.set_element_name("Pump");
+        query.set_property_name(property);
+        return _cache->Query<PropertyValue>(query);
+    }
+
+    static PropertyChangedEvent Changed(const string& property, const string& value) {
+        PropertyChangedEvent evt;
+        evt.set_property_name(property);
+        evt.set_value_data(value);
+        return evt;
+    }
+};
+
+TEST_F(ClientQueryCacheTest, RepeatedReadsAreServedLocally) {
+    CachedQuery("Speed");
+    auto cached = CachedQuery("Speed");
+
+    EXPECT_EQ(cached.value_data(), "1");
+    EXPECT_EQ(_handler->Calls, 1u);
+    auto stats = _cache->Stats();
+    EXPECT_EQ(stats.Hits, 1u);
+    EXPECT_EQ(stats.Misses, 1u);
+    EXPECT_DOUBLE_EQ(stats.HitRatio(), 0.5);
+    EXPECT_GT(stats.Bytes, 0u);
+}
+
+TEST_F(ClientQueryCacheTest, EventWithoutUpdateHandlerDropsResults) {
+    CachedQuery("Speed");
+    _handler->Values["Speed"] = "2";
+
+    _subscriptions->Push("pump-1", Changed("Speed", "2"));
+    auto fresh = CachedQuery("Speed");
+
+    EXPECT_EQ(fresh.value_data(), "2");
+    EXPECT_EQ(_handler->Calls, 2u);
+    EXPECT_EQ(_cache->Stats().Invalidations, 1u);
+}
+
+TEST_F(ClientQueryCacheTest, EventsUpdateResultsInPlace) {
+    _cache->OnEvent<PropertySelector, PropertyValue, PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(
+        [](const PropertySelector& query, PropertyValue& result, const Metadata&, const PropertyChangedEvent& evt) {
+            if (evt.property_name() == query.property_name()) result.set_value_data(evt.value_data());
+            return true;
+        });
+    CachedQuery("Speed");
+    CachedQuery("Mode");
+
+    _subscriptions->Push("pump-1", Changed("Speed", "9"));
+
+    EXPECT_EQ(CachedQuery("Speed").value_data(), "9");
+    EXPECT_EQ(_handler->Calls, 2u);
+    EXPECT_EQ(_cache->Stats().Updates, 2u);
+}
+
+TEST_F(ClientQueryCacheTest, EventsAlreadyInTheResultAreNotAppliedAgain) {
+    _eventStore->SetEventLog(make_shared<InMemoryEventLog>());
+    _cache->OnEvent<PropertySelector, PropertyValue, PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(
+        [](const PropertySelector&, PropertyValue& result, const Metadata&, const PropertyChangedEvent& evt) {
+            result.set_value_data(result.value_data() + evt.value_data());
+            return true;
+        });
+    Publish("pump-1");
+    _handler->Applied = 1;
+    CachedQuery("Speed");
+
+    _subscriptions->Push("pump-1", Changed("Speed", "+"), 1);
+    _subscriptions->Push("pump-1", Changed("Speed", "+"), 2);
+
+    EXPECT_EQ(CachedQuery("Speed").value_data(), "1+");
+    EXPECT_EQ(_cache->Stats().Updates, 1u);
+    EXPECT_EQ(_handler->Calls, 1u);
+}
+
+TEST_F(ClientQueryCacheTest, EventsTheReadModelHasNotAppliedReachTheResult) {
+    _eventStore->SetEventLog(make_shared<InMemoryEventLog>());
+    _cache->OnEvent<PropertySelector, PropertyValue, PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(
+        [](const PropertySelector&, PropertyValue& result, const Metadata&, const PropertyChangedEvent& evt) {
+            result.set_value_data(result.value_data() + evt.value_data());
+            return true;
+        });
+    // The log holds three events; the read model has applied only the first.
+    Publish("pump-1");
+    Publish("pump-1");
+    Publish("pump-1");
+    _handler->Applied = 1;
+    CachedQuery("Speed");
+
+    for (uint64_t position = 1; position <= 3; ++position)
+        _subscriptions->Push("pump-1", Changed("Speed", "+"), position);
+
+    EXPECT_EQ(CachedQuery("Speed").value_data(), "1++");
+    EXPECT_EQ(_cache->Stats().Updates, 2u);
+}
+
+TEST_F(ClientQueryCacheTest, ResultsOfHandlersWithoutAPositionGetEveryEvent) {
+    _eventStore->SetEventLog(make_shared<InMemoryEventLog>());
+    _cache->OnEvent<PropertySelector, PropertyValue, PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(
+        [](const PropertySelector&, PropertyValue& result, const Metadata&, const PropertyChangedEvent& evt) {
+            result.set_value_data(result.value_data() + evt.value_data());
+            return true;
+        });
+    Publish("pump-1");
+    Publish("pump-1");
+    CachedQuery("Speed");
+
+    _subscriptions->Push("pump-1", Changed("Speed", "+"), 1);
+    _subscriptions->Push("pump-1", Changed("Speed", "+"), 2);
+
+    EXPECT_EQ(CachedQuery("Speed").value_data(), "1++");
+    EXPECT_EQ(_cache->Stats().Updates, 2u);
+}
+
+TEST_F(ClientQueryCacheTest, EvictsLeastRecentlyUsedOverCapacity) {
+    CachedQuery("Speed");
+    size_t one = _cache->Stats().Bytes;
+    _cache->SetCapacity(one + one / 2);
+
+    CachedQuery("Mode");
+    CachedQuery("Mode");
+    CachedQuery("Speed");
+
+    auto stats = _cache->Stats();
+    EXPECT_EQ(stats.Entries, 1u);
+    EXPECT_EQ(stats.Hits, 1u);
+    EXPECT_EQ(stats.Evictions, 2u);
+    EXPECT_EQ(_handler->Calls, 3u);
+}
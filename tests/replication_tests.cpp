@@ -0,0 +1,375 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+class ReplicaSetterHandler : public ICommandHandler<SetterCommand> {
+    shared_ptr<EventStore> _store;
+public:
+    explicit ReplicaSetterHandler(shared_ptr<EventStore> store) : _store(store) {}
+    void Handle(const string& stream_id, const SetterCommand& cmd) override {
+        PropertyChangedEvent evt;
+        evt.set_element_name(stream_id);
+        evt.set_property_name(cmd.property_name());
+        evt.set_value_data(cmd.value_data());
+        _store->Publish(stream_id, evt);
+    }
+};
+
+// Holds the command that published the event until released.
+class BlockingEventHandler : public EventHandlerBase, public IEventHandler<PropertyChangedEvent> {
+public:
+    BlockingEventHandler() { Map<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>(); }
+    void Handle(const Metadata&, const PropertyChangedEvent&) override {
+        Entered = true;
+        while (!Released) this_thread::sleep_for(milliseconds(1));
+    }
+    atomic<bool> Entered = false;
+    atomic<bool> Released = false;
+};
+
+class ReplicationTest : public Test {
+protected:
+    struct Node {
+        shared_ptr<ISocketFactory> Factory;
+        unique_ptr<Plumber> Server;
+        unique_ptr<PlumberClient> Client;
+    };
+
+    static void StartNode(Node& node, shared_ptr<IEventLog> log) {
+        node.Server = Plumber::CreateServer(node.Factory);
+        node.Server->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        node.Server->GetEventStore()->SetEventLog(log);
+        node.Server->AddCommandHandler<SetterCommand, app::testing::COMMANDS::SETTER>(
+            make_shared<ReplicaSetterHandler>(node.Server->GetEventStore()));
+        node.Server->Start();
+        node.Client = PlumberClient::CreateClient(node.Factory);
+        node.Client->CommandBus()->RegisterMessage<SetterCommand, app::testing::COMMANDS::SETTER>();
+        node.Client->Start();
+    }
+    // A follower that stops and starts again over the event log file at 'path'. Nothing may be sending to it.
+    void RestartFollower(int node, const string& path) {
+        nodes[node].Client.reset();
+        nodes[node].Server.reset();
+        StartNode(nodes[node], make_shared<FileEventLog>(path));
+        nodes[node].Server->Follow();
+    }
+
+    void SetUp() override {
+        for (int i = 0; i < 3; ++i) {
+            Node node;
+            node.Factory = CreateFactory(i);
+            StartNode(node, make_shared<InMemoryEventLog>());
+            nodes.push_back(std::move(node));
+        }
+        WaitForListeners();
+        options.IdleWait = milliseconds(5);
+        options.RetryInterval = milliseconds(5);
+        nodes[1].Server->Follow();
+        nodes[2].Server->Follow();
+    }
+    void TearDown() override {
+        for (auto& node : nodes)
+            if (node.Server) node.Server->StopReplication();
+        nodes.clear();
+    }
+
+    virtual shared_ptr<ISocketFactory> CreateFactory(int node) { return make_shared<LoopbackSocketFactory>(); }
+    virtual void WaitForListeners() {}
+
+    // A link from 'from' to 'to' that can be cut without cutting anyone else's.
+    virtual FollowerEndpoint Link(int from, int to) {
+        auto link = make_shared<LoopbackSocketFactory>();
+        link->Target = static_cast<LoopbackSocketFactory*>(nodes[to].Factory.get());
+        links[{ from, to }] = link;
+        return FollowerEndpoint{ "node-" + to_string(to), link };
+    }
+    void StartLeader(int leader, vector<int> followers) {
+        vector<FollowerEndpoint> endpoints;
+        for (int f : followers) endpoints.push_back(Link(leader, f));
+        nodes[leader].Server->ReplicateTo(endpoints, options);
+    }
+
+    static SetterCommand Setter(int value) {
+        SetterCommand cmd;
+        cmd.set_property_name("Speed");
+        cmd.set_value_data(to_string(value));
+        return cmd;
+    }
+    void SendTo(int node, int count, const string& stream = "pump") {
+        for (int i = 0; i < count; ++i) nodes[node].Client->CommandBus()->Send(stream, Setter(i));
+    }
+    uint64_t Head(int node) {
+        return nodes[node].Server->GetEventStore()->EventLog()->Head();
+    }
+    vector<string> Records(int node) {
+        vector<string> records;
+        nodes[node].Server->GetEventStore()->EventLog()->ReadAll(1, SIZE_MAX,
+            [&records](const RecordedEvent& e) { records.push_back(e.SerializeAsString()); });
+        return records;
+    }
+    bool WaitFor(function<bool()> condition) {
+        for (int i = 0; i < 2000; ++i) {
+            if (condition()) return true;
+            this_thread::sleep_for(milliseconds(2));
+        }
+        return false;
+    }
+    bool CaughtUp(int leader, int follower) {
+        return WaitFor([&]() { return Head(follower) == Head(leader); });
+    }
+
+    vector<Node> nodes;
+    map<pair<int, int>, shared_ptr<LoopbackSocketFactory>> links;
+    ReplicationOptions options;
+};
+
+TEST_F(ReplicationTest, FollowersReceiveTheLogInBatchesAndServeSubscribers) {
+    auto subscriber = make_shared<PropertyRecorder>();
+    auto subscription = nodes[2].Server->GetEventStore()->Subscribe("pump", subscriber);
+    StartLeader(0, { 1, 2 });
+
+    SendTo(0, 300);
+
+    ASSERT_TRUE(CaughtUp(0, 1));
+    ASSERT_TRUE(CaughtUp(0, 2));
+    EXPECT_EQ(Records(1), Records(0));
+    EXPECT_EQ(Records(2), Records(0));
+    EXPECT_TRUE(WaitFor([&]() { return subscriber->Count() == 300; }));
+    EXPECT_EQ(subscriber->Records().back().Meta.Position(), 300u);
+
+    auto stats = nodes[0].Server->ReplicationStats();
+    ASSERT_EQ(stats.Followers.size(), 2u);
+    EXPECT_TRUE(WaitFor([&]() { return nodes[0].Server->ReplicationStats().Followers[1].LagEvents == 0; }));
+    stats = nodes[0].Server->ReplicationStats();
+    for (auto& f : stats.Followers) {
+        EXPECT_TRUE(f.Connected) << f.Name;
+        EXPECT_EQ(f.Acked, 300u) << f.Name;
+        EXPECT_EQ(f.Events, 300u) << f.Name;
+        EXPECT_LE(f.Batches, f.Events) << f.Name;
+    }
+}
+
+TEST_F(ReplicationTest, CompressedBatchesShipTheSameLog) {
+    options.Compress = true;
+    StartLeader(0, { 1 });
+
+    SendTo(0, 300);
+
+    ASSERT_TRUE(CaughtUp(0, 1));
+    EXPECT_EQ(Records(1), Records(0));
+    ASSERT_TRUE(WaitFor([&]() { return nodes[0].Server->ReplicationStats().Followers[0].Acked == 300; }));
+    auto follower = nodes[0].Server->ReplicationStats().Followers[0];
+    EXPECT_EQ(follower.Events, 300u);
+    EXPECT_GT(follower.RawBytes, 0u);
+    EXPECT_LT(follower.Bytes, follower.RawBytes);
+}
+
+TEST_F(ReplicationTest, FollowerRefusesCommandsAndLagShowsWhileItIsCutOff) {
+    StartLeader(0, { 1, 2 });
+    try {
+        nodes[1].Client->CommandBus()->Send("pump", Setter(1));
+        FAIL() << "expected a fault";
+    }
+    catch (const FaultException& fault) {
+        EXPECT_EQ(fault.ErrorCode(), NOT_LEADER);
+    }
+
+    SendTo(0, 5);
+    ASSERT_TRUE(CaughtUp(0, 2));
+    links[{ 0, 2 }]->Cut = true;
+    SendTo(0, 20);
+    ASSERT_TRUE(CaughtUp(0, 1));
+    this_thread::sleep_for(milliseconds(5));
+
+    auto lagging = nodes[0].Server->ReplicationStats().Followers[1];
+    EXPECT_EQ(lagging.Acked, 5u);
+    EXPECT_EQ(lagging.LagEvents, 20u);
+    EXPECT_GT(lagging.Lag, nanoseconds(0));
+    EXPECT_GT(lagging.Errors, 0u);
+
+    links[{ 0, 2 }]->Cut = false;
+    ASSERT_TRUE(CaughtUp(0, 2));
+    EXPECT_TRUE(WaitFor([&]() { return nodes[0].Server->ReplicationStats().Followers[1].LagEvents == 0; }));
+    EXPECT_EQ(Records(2), Records(0));
+}
+
+TEST_F(ReplicationTest, SemiSyncAnswersOnceAFollowerHasTheEvents) {
+    options.Mode = ReplicationMode::SEMI_SYNC;
+    options.SemiSyncTimeout = milliseconds(100);
+    StartLeader(0, { 1, 2 });
+
+    for (int i = 0; i < 20; ++i) {
+        SendTo(0, 1);
+        EXPECT_EQ(max(Head(1), Head(2)), Head(0));
+    }
+    auto stats = nodes[0].Server->ReplicationStats();
+    EXPECT_EQ(stats.SemiSyncWaits, 20u);
+    EXPECT_EQ(stats.SemiSyncTimeouts, 0u);
+
+    links[{ 0, 1 }]->Cut = true;
+    links[{ 0, 2 }]->Cut = true;
+    auto started = steady_clock::now();
+    SendTo(0, 1);
+    EXPECT_GE(steady_clock::now() - started, milliseconds(100));
+    EXPECT_EQ(nodes[0].Server->ReplicationStats().SemiSyncTimeouts, 1u);
+}
+
+TEST_F(ReplicationTest, PromotedFollowerTakesOverAndFencesTheOldLeader) {
+    StartLeader(0, { 1, 2 });
+    SendTo(0, 50);
+    ASSERT_TRUE(CaughtUp(0, 1));
+    ASSERT_TRUE(CaughtUp(0, 2));
+
+    // The leader is cut off; what it takes from now on is lost with asynchronous replication.
+    links[{ 0, 1 }]->Cut = true;
+    links[{ 0, 2 }]->Cut = true;
+    SendTo(0, 3);
+
+    nodes[1].Server->Promote();
+    StartLeader(1, { 0, 2 });
+    EXPECT_TRUE(nodes[1].Server->IsLeader());
+    EXPECT_EQ(nodes[1].Server->Epoch(), 2u);
+    SendTo(1, 10);
+    ASSERT_TRUE(CaughtUp(1, 2));
+    EXPECT_EQ(Head(2), 60u);
+    EXPECT_EQ(Records(2), Records(1));
+
+    links[{ 0, 1 }]->Cut = false;
+    links[{ 0, 2 }]->Cut = false;
+    ASSERT_TRUE(WaitFor([&]() { return !nodes[0].Server->IsLeader(); }));
+    EXPECT_THROW(nodes[0].Client->CommandBus()->Send("pump", Setter(1)), FaultException);
+    EXPECT_EQ(Head(2), 60u);
+    bool fenced = false;
+    for (auto& f : nodes[0].Server->ReplicationStats().Followers) fenced |= f.Fenced;
+    EXPECT_TRUE(fenced);
+
+    // The old leader's 3 records the others never got are replaced by the new leader's log.
+    EXPECT_TRUE(WaitFor([&]() { return Records(0) == Records(1); }));
+    EXPECT_EQ(Head(0), 60u);
+    EXPECT_EQ(nodes[0].Server->Epoch(), 2u);
+}
+
+TEST_F(ReplicationTest, DestroyedLeaderAnswersTheCommandItIsHandlingFirst) {
+    options.Mode = ReplicationMode::SEMI_SYNC;
+    StartLeader(0, { 1 });
+    auto store = nodes[0].Server->GetEventStore();
+    auto blocker = make_shared<BlockingEventHandler>();
+    auto subscription = store->Subscribe("pump", blocker);
+
+    thread sender([this]() { EXPECT_NO_THROW(SendTo(0, 1)); });
+    ASSERT_TRUE(WaitFor([&]() { return blocker->Entered.load(); }));
+    atomic<bool> destroyed = false;
+    thread destroyer([&]() {
+        nodes[0].Server.reset();
+        destroyed = true;
+    });
+    this_thread::sleep_for(milliseconds(20));
+    EXPECT_FALSE(destroyed);
+
+    // The reply still goes through the semi-sync gate, so the follower has the event when it arrives.
+    blocker->Released = true;
+    sender.join();
+    destroyer.join();
+    EXPECT_EQ(Head(1), 1u);
+    subscription->Unsubscribe();
+}
+
+TEST_F(ReplicationTest, RestartedFollowerKeepsTheNewEpochAndStillFencesTheOldLeader) {
+    string path = "/tmp/cppplumberd_replication_restart_test.bin";
+    filesystem::remove(path);
+    RestartFollower(1, path);
+    StartLeader(0, { 1, 2 });
+    SendTo(0, 10);
+    ASSERT_TRUE(CaughtUp(0, 1));
+    ASSERT_TRUE(CaughtUp(0, 2));
+
+    links[{ 0, 1 }]->Cut = true;
+    links[{ 0, 2 }]->Cut = true;
+    nodes[2].Server->Promote();
+    StartLeader(2, { 1 });
+    SendTo(2, 5);
+    ASSERT_TRUE(CaughtUp(2, 1));
+
+    nodes[0].Server->StopReplication();
+    nodes[2].Server->StopReplication();
+    RestartFollower(1, path);
+    EXPECT_EQ(nodes[1].Server->Epoch(), 2u);
+    EXPECT_EQ(Head(1), 15u);
+
+    // The old leader never learned it was replaced; the restarted follower still knows.
+    StartLeader(0, { 1 });
+    ASSERT_TRUE(WaitFor([&]() { return !nodes[0].Server->IsLeader(); }));
+    EXPECT_EQ(Head(1), 15u);
+    nodes.clear();
+    filesystem::remove(path);
+}
+
+// The same nodes, each listening on ipc:// endpoints of its own; links cannot be cut.
+class IpcReplicationTest : public ReplicationTest {
+protected:
+    shared_ptr<ISocketFactory> CreateFactory(int node) override {
+        return make_shared<NggSocketFactory>("ipc:///tmp/replication_test/node-" + to_string(node));
+    }
+    void WaitForListeners() override { this_thread::sleep_for(milliseconds(100)); }
+    FollowerEndpoint Link(int from, int to) override {
+        return FollowerEndpoint{ "node-" + to_string(to), nodes[to].Factory };
+    }
+};
+
+TEST_F(IpcReplicationTest, FollowersTakeTheLogAndTheOldLeaderFollowsAfterFailover) {
+    StartLeader(0, { 1, 2 });
+    SendTo(0, 20);
+    ASSERT_TRUE(CaughtUp(0, 1));
+    ASSERT_TRUE(CaughtUp(0, 2));
+    EXPECT_EQ(Records(1), Records(0));
+
+    nodes[1].Server->Promote();
+    StartLeader(1, { 0, 2 });
+    SendTo(1, 5);
+    ASSERT_TRUE(CaughtUp(1, 2));
+
+    // The old leader still takes a command; shipping it gets the old leader fenced, and its record is replaced.
+    SendTo(0, 1);
+    ASSERT_TRUE(WaitFor([&]() { return !nodes[0].Server->IsLeader(); }));
+    EXPECT_TRUE(WaitFor([&]() { return Records(0) == Records(1); }));
+    EXPECT_EQ(Head(0), 25u);
+    EXPECT_EQ(Records(2), Records(1));
+}
+
+TEST(ReplicationBatchTest, BlockClaimingTooManyBytesIsRefused) {
+    EventStore store;
+    store.SetEventLog(make_shared<InMemoryEventLog>());
+    ReplicateEvents batch;
+    batch.set_epoch(1);
+    string raw(1000, 'x');
+    batch.set_block(Deflate(raw.data(), raw.size()));
+    batch.set_raw_size(0xFFFFFFF0u);
+
+    try {
+        ApplyReplicatedEvents(store, batch);
+        FAIL() << "expected a fault";
+    }
+    catch (const FaultException& fault) {
+        EXPECT_EQ(fault.ErrorCode(), 400);
+    }
+    EXPECT_EQ(store.EventLog()->Head(), 0u);
+}
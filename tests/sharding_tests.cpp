@@ -0,0 +1,291 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "loopback_transport.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+// Appends every setter to the shard's log as a PropertyChangedEvent.
+class ShardSetterHandler : public ICommandHandler<SetterCommand> {
+    shared_ptr<EventStore> _store;
+public:
+    explicit ShardSetterHandler(shared_ptr<EventStore> store) : _store(store) {}
+    void Handle(const string& stream_id, const SetterCommand& cmd) override {
+        PropertyChangedEvent evt;
+        evt.set_element_name(stream_id);
+        evt.set_property_name(cmd.property_name());
+        evt.set_value_data(cmd.value_data());
+        _store->Publish(stream_id, evt);
+        lock_guard lock(_mtx);
+        Recipients.insert(stream_id);
+    }
+    set<string> Handled() {
+        lock_guard lock(_mtx);
+        return Recipients;
+    }
+    set<string> Recipients;
+private:
+    std::mutex _mtx;
+};
+
+class ShardingTest : public Test {
+protected:
+    static constexpr uint32_t SLOTS = 64;
+    inline static const vector<string> SHARDS = { "shard-a", "shard-b", "shard-c" };
+
+    void SetUp() override {
+        auto table = EvenRoutingTable(SHARDS, SLOTS);
+        vector<ShardEndpoint> endpoints;
+        for (const auto& name : SHARDS) {
+            auto factory = CreateFactory(name);
+            auto server = Plumber::CreateServer(factory);
+            server->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+            server->GetEventStore()->SetEventLog(make_shared<InMemoryEventLog>());
+            auto handler = make_shared<ShardSetterHandler>(server->GetEventStore());
+            server->AddCommandHandler<SetterCommand, app::testing::COMMANDS::SETTER>(handler);
+            server->EnableSharding(name, table);
+            server->Start();
+            servers[name] = std::move(server);
+            handlers[name] = handler;
+            endpoints.push_back(ShardEndpoint{ name, factory });
+        }
+        WaitForListeners();
+        client = make_unique<ShardedPlumberClient>(endpoints);
+        client->RegisterCommand<SetterCommand, app::testing::COMMANDS::SETTER>();
+        client->Start();
+    }
+    void TearDown() override {
+        client.reset();
+        servers.clear();
+    }
+
+    // Sockets of one shard; its client reaches the shard's server through the same factory.
+    virtual shared_ptr<ISocketFactory> CreateFactory(const string& shard) { return make_shared<LoopbackSocketFactory>(); }
+    virtual void WaitForListeners() {}
+
+    static SetterCommand Setter(const string& value) {
+        SetterCommand cmd;
+        cmd.set_property_name("Speed");
+        cmd.set_value_data(value);
+        return cmd;
+    }
+    string Handler(const string& stream) {
+        for (auto& [name, handler] : handlers) if (handler->Handled().contains(stream)) return name;
+        return string();
+    }
+    uint64_t StreamVersion(const string& shard, const string& stream) {
+        return servers[shard]->GetEventStore()->EventLog()->StreamVersion(stream);
+    }
+
+    map<string, unique_ptr<Plumber>> servers;
+    map<string, shared_ptr<ShardSetterHandler>> handlers;
+    unique_ptr<ShardedPlumberClient> client;
+};
+
+TEST_F(ShardingTest, CommandsReachTheShardThatOwnsTheirStream) {
+    EXPECT_EQ(client->Table().version(), 1u);
+    for (int i = 0; i < 60; ++i) client->Send("pump-" + to_string(i), Setter("1"));
+
+    map<string, int> perShard;
+    for (int i = 0; i < 60; ++i) {
+        string stream = "pump-" + to_string(i);
+        EXPECT_EQ(Handler(stream), client->ShardOf(stream)) << stream;
+        ++perShard[Handler(stream)];
+    }
+    EXPECT_EQ(perShard.size(), SHARDS.size());
+}
+
+TEST_F(ShardingTest, ServerRefusesStreamsItDoesNotOwn) {
+    string stream = "pump-1";
+    string owner = client->ShardOf(stream);
+    string other = owner == SHARDS[0] ? SHARDS[1] : SHARDS[0];
+
+    EXPECT_TRUE(servers[owner]->Sharding()->Owns(stream));
+    EXPECT_FALSE(servers[other]->Sharding()->Owns(stream));
+    try {
+        servers[other]->Sharding()->Check(stream);
+        FAIL() << "expected a fault";
+    }
+    catch (const FaultException& fault) {
+        EXPECT_EQ(fault.ErrorCode(), SHARD_MISDIRECTED);
+    }
+    EXPECT_NO_THROW(servers[other]->Sharding()->Check("$routing"));
+}
+
+TEST_F(ShardingTest, MovedSlotTakesItsEventsAndStaleClientsAreRedirected) {
+    string stream = "pump-7";
+    for (int i = 0; i < 5; ++i) client->Send(stream, Setter(to_string(i)));
+    uint32_t slot = ShardSlot(stream, SLOTS);
+    string source = client->ShardOf(stream);
+    string target = source == SHARDS[2] ? SHARDS[0] : SHARDS[2];
+
+    atomic<int> changes = 0;
+    client->OnRoutingChanged([&changes](const RoutingTable&) { ++changes; });
+
+    // Handed off behind the client's back: it still has version 1 of the table.
+    {
+        auto table = MoveSlotTo(servers[source]->Sharding()->Table(), slot, target);
+        servers[source]->Sharding()->Freeze(slot);
+        ExportSlot page;
+        page.set_slot(slot);
+        auto events = ExportSlotEvents(*servers[source]->GetEventStore(), page, SLOTS);
+        ASSERT_TRUE(events.done());
+        ImportEvents import;
+        *import.mutable_events() = events.events();
+        ImportSlotEvents(*servers[target]->GetEventStore(), import);
+        for (const auto& name : SHARDS) servers[name]->Sharding()->Adopt(table);
+    }
+
+    EXPECT_EQ(StreamVersion(target, stream), 5u);
+    EXPECT_EQ(client->ShardOf(stream), source);
+    client->Send(stream, Setter("5"));
+
+    EXPECT_EQ(changes, 1);
+    EXPECT_EQ(client->Table().version(), 2u);
+    EXPECT_EQ(client->ShardOf(stream), target);
+    EXPECT_EQ(StreamVersion(target, stream), 6u);
+    EXPECT_EQ(StreamVersion(source, stream), 5u);
+}
+
+TEST_F(ShardingTest, MoveSlotHandsOffThroughTheShards) {
+    vector<string> streams;
+    for (int i = 0; i < 40; ++i) streams.push_back("valve-" + to_string(i));
+    for (auto& s : streams) client->Send(s, Setter("open"));
+    string stream = streams[3];
+    uint32_t slot = ShardSlot(stream, SLOTS);
+    string source = client->ShardOf(stream);
+    string target = source == SHARDS[1] ? SHARDS[2] : SHARDS[1];
+
+    client->MoveSlot(slot, target);
+
+    EXPECT_EQ(client->Table().version(), 2u);
+    EXPECT_EQ(client->ShardOf(stream), target);
+    for (const auto& name : SHARDS) EXPECT_EQ(servers[name]->Sharding()->Table().version(), 2u) << name;
+    for (auto& s : streams) {
+        if (ShardSlot(s, SLOTS) == slot) {
+            EXPECT_EQ(StreamVersion(target, s), 1u) << s;
+        }
+        else if (client->ShardOf(s) != target) {
+            EXPECT_EQ(StreamVersion(target, s), 0u) << s;
+        }
+    }
+    client->Send(stream, Setter("closed"));
+    EXPECT_EQ(StreamVersion(target, stream), 2u);
+
+    // Moving it back skips the versions the old owner already has.
+    client->MoveSlot(slot, source);
+    EXPECT_EQ(StreamVersion(source, stream), 2u);
+    EXPECT_EQ(servers[source]->GetEventStore()->EventLog()->ReadStream(stream, 1, [](const RecordedEvent&) {}), 2u);
+}
+
+TEST_F(ShardingTest, FailedMoveSlotUnfreezesTheSlotOnItsOwner) {
+    string stream = "valve-3";
+    client->Send(stream, Setter("open"));
+    uint32_t slot = ShardSlot(stream, SLOTS);
+    string source = client->ShardOf(stream);
+    string target = source == SHARDS[1] ? SHARDS[2] : SHARDS[1];
+    // The target cannot import the slot's events.
+    auto log = servers[target]->GetEventStore()->EventLog();
+    servers[target]->GetEventStore()->SetEventLog(nullptr);
+
+    try {
+        client->MoveSlot(slot, target);
+        FAIL() << "expected a fault";
+    }
+    catch (const FaultException& fault) {
+        EXPECT_EQ(fault.ErrorCode(), 412);
+    }
+
+    EXPECT_NO_THROW(servers[source]->Sharding()->Check(stream));
+    for (const auto& name : SHARDS) EXPECT_EQ(servers[name]->Sharding()->Table().version(), 1u) << name;
+    client->Send(stream, Setter("closed"));
+    EXPECT_EQ(StreamVersion(source, stream), 2u);
+
+    // Once the target can import, moving it again succeeds.
+    servers[target]->GetEventStore()->SetEventLog(log);
+    client->MoveSlot(slot, target);
+    EXPECT_EQ(client->ShardOf(stream), target);
+    EXPECT_EQ(StreamVersion(target, stream), 2u);
+}
+
+// The same shards, each listening on ipc:// endpoints of its own (every shard publishes its streams on them too).
+class IpcShardingTest : public ShardingTest {
+protected:
+    shared_ptr<ISocketFactory> CreateFactory(const string& shard) override {
+        return make_shared<NggSocketFactory>("ipc:///tmp/sharding_test/" + shard);
+    }
+    void WaitForListeners() override { this_thread::sleep_for(milliseconds(100)); }
+};
+
+TEST_F(IpcShardingTest, CommandsReachTheirShardAndMoveSlotHandsOff) {
+    vector<string> streams;
+    for (int i = 0; i < 30; ++i) streams.push_back("pump-" + to_string(i));
+    for (auto& s : streams) client->Send(s, Setter("1"));
+    for (auto& s : streams) EXPECT_EQ(Handler(s), client->ShardOf(s)) << s;
+
+    string stream = streams[5];
+    uint32_t slot = ShardSlot(stream, SLOTS);
+    string source = client->ShardOf(stream);
+    string target = source == SHARDS[0] ? SHARDS[1] : SHARDS[0];
+
+    client->MoveSlot(slot, target);
+
+    EXPECT_EQ(client->ShardOf(stream), target);
+    for (const auto& name : SHARDS) EXPECT_EQ(servers[name]->Sharding()->Table().version(), 2u) << name;
+    EXPECT_EQ(StreamVersion(target, stream), 1u);
+    client->Send(stream, Setter("2"));
+    EXPECT_EQ(StreamVersion(target, stream), 2u);
+    EXPECT_EQ(StreamVersion(source, stream), 1u);
+}
+
+TEST(RoutingTableTest, MovingASlotChangesOnlyItsStreams) {
+    auto table = EvenRoutingTable({ "a", "b" }, 16);
+    EXPECT_EQ(table.version(), 1u);
+    EXPECT_EQ(table.slots_size(), 16);
+
+    auto next = MoveSlotTo(table, 5, "c");
+    EXPECT_EQ(next.version(), 2u);
+    EXPECT_EQ(next.shards_size(), 3);
+    for (int i = 0; i < 500; ++i) {
+        string stream = "stream-" + to_string(i);
+        if (ShardSlot(stream, 16) == 5) EXPECT_EQ(ShardOf(next, stream), "c");
+        else EXPECT_EQ(ShardOf(next, stream), ShardOf(table, stream));
+    }
+
+    ShardOwnership ownership("a", table);
+    EXPECT_FALSE(ownership.Adopt(table));
+    string inSlot = "stream-0";
+    for (int i = 1; ShardSlot(inSlot, 16) != 5; ++i) inSlot = "stream-" + to_string(i);
+    auto faultOf = [&ownership](const string& stream) {
+        try {
+            ownership.Check(stream);
+        }
+        catch (const FaultException& fault) {
+            return fault.ErrorCode();
+        }
+        return 0u;
+    };
+    ownership.Freeze(5);
+    EXPECT_EQ(faultOf(inSlot), SHARD_SLOT_MOVING);
+    ownership.Unfreeze(5);
+    EXPECT_EQ(faultOf(inSlot), SHARD_MISDIRECTED);
+    ownership.Freeze(5);
+    EXPECT_TRUE(ownership.Adopt(next));
+    auto resized = EvenRoutingTable({ "a" }, 8);
+    resized.set_version(3);
+    EXPECT_THROW(ownership.Adopt(resized), FaultException);
+}
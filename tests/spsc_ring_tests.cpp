@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+static vector<string> DrainStrings(SpscFrameRing& ring) {
+    vector<string> frames;
+    ring.Drain([&frames](const uint8_t* data, size_t size, uint64_t stamp) {
+        frames.push_back(string(reinterpret_cast<const char*>(data), size) + "@" + to_string(stamp));
+    });
+    return frames;
+}
+
+static bool Push(SpscFrameRing& ring, const string& frame, uint64_t stamp = 0) {
+    return ring.TryPush(reinterpret_cast<const uint8_t*>(frame.data()), frame.size(), stamp);
+}
+
+TEST(SpscFrameRingTest, KeepsFramesWholeAcrossTheEndAndDropsWhatDoesNotFit) {
+    SpscFrameRing ring(128);
+    EXPECT_TRUE(Push(ring, string(40, 'a'), 1));
+    EXPECT_TRUE(Push(ring, string(8, 'b'), 2));
+    EXPECT_FALSE(Push(ring, string(40, 'c'), 3));
+    EXPECT_THAT(DrainStrings(ring), ElementsAre(string(40, 'a') + "@1", string(8, 'b') + "@2"));
+
+    // Only 32 bytes are left before the end, so this frame starts over at the beginning.
+    EXPECT_TRUE(Push(ring, string(40, 'd'), 4));
+    EXPECT_THAT(DrainStrings(ring), ElementsAre(string(40, 'd') + "@4"));
+    EXPECT_FALSE(Push(ring, string(200, 'x')));
+
+    auto stats = ring.Stats();
+    EXPECT_EQ(stats.Pushed, 3u);
+    EXPECT_EQ(stats.Taken, 3u);
+    EXPECT_EQ(stats.Dropped, 2u);
+    EXPECT_EQ(stats.Used, 0u);
+}
+
+TEST(SpscFrameRingTest, ConsumerSeesEveryAcceptedFrameInOrder) {
+    SpscFrameRing ring(4096);
+    constexpr uint64_t frames = 100000;
+    vector<uint64_t> accepted;
+    thread producer([&]() {
+        for (uint64_t i = 1; i <= frames; ++i) {
+            string frame(i % 97 + 1, static_cast<char>('a' + i % 26));
+            if (Push(ring, frame, i)) accepted.push_back(i);
+        }
+        ring.Close();
+    });
+    vector<uint64_t> taken;
+    bool intact = true;
+    ring.Run([&](const uint8_t* data, size_t size, uint64_t stamp) {
+        intact = intact && size == stamp % 97 + 1 && data[size - 1] == static_cast<uint8_t>('a' + stamp % 26);
+        taken.push_back(stamp);
+    });
+    producer.join();
+
+    EXPECT_TRUE(intact);
+    EXPECT_EQ(taken, accepted);
+    EXPECT_EQ(ring.Stats().Dropped + accepted.size(), frames);
+}
+
+TEST(ReceiveRingTest, SlowHandlerCostsDroppedFramesNotTheReceiveThread) {
+    auto serializer = make_shared<MessageSerializer>();
+    serializer->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+    auto socket = make_unique<FrameTestSocket>();
+    auto received = socket.get();
+    auto handler = make_shared<PropertyRecorder>(true);
+    ClientProtoSubscriptionStream stream(std::move(socket), handler, serializer, "pump-1");
+    stream.EnableReceiveRing(1024);
+    stream.Start();
+
+    PropertyChangedEvent evt;
+    evt.set_property_name("Speed");
+    for (uint64_t sequence = 1; sequence <= 100; ++sequence) {
+        evt.set_value_data(to_string(sequence));
+        Receive(received, serializer, evt, sequence);
+    }
+    auto dropped = stream.Stats().Dropped;
+    EXPECT_GT(dropped, 0u);
+    handler->Release();
+    ASSERT_TRUE(handler->WaitFor(100 - dropped));
+    stream.Stop();
+
+    auto values = handler->Received();
+    ASSERT_EQ(values.size(), 100 - dropped);
+    EXPECT_EQ(values.front(), "Speed=1");
+    for (size_t i = 1; i < values.size(); ++i)
+        EXPECT_LT(stoi(values[i - 1].substr(6)), stoi(values[i].substr(6)));
+    auto stats = stream.Stats();
+    EXPECT_EQ(stats.Received, 100u);
+    EXPECT_EQ(stats.Delivered, 100 - dropped);
+    EXPECT_EQ(stats.Lost, 0u);
+}
@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include "plumberd.hpp"
+#include "test_msgs.pb.h"
+#include "contract.h"
+#include "property_recorder.h"
+
+using namespace cppplumberd;
+using namespace std;
+using namespace testing;
+using namespace app::testing;
+
+TEST(TraceContextTest, ChildOfInvalidStartsNewRoot) {
+    auto ctx = TraceContext::ChildOf(TraceContext());
+
+    EXPECT_TRUE(ctx.IsValid());
+    EXPECT_EQ(ctx.ParentSpanId, 0u);
+    EXPECT_EQ(ctx.CorrelationId, ctx.SpanIdHex());
+}
+
+TEST(TraceContextTest, ProcessingOfLinksCausation) {
+    auto command = TraceContext::NewRoot("order-42");
+    auto processing = TraceContext::ProcessingOf(command);
+    auto event = TraceContext::ChildOf(processing);
+
+    EXPECT_EQ(event.TraceIdHigh, command.TraceIdHigh);
+    EXPECT_EQ(event.TraceIdLow, command.TraceIdLow);
+    EXPECT_EQ(event.ParentSpanId, processing.SpanId);
+    EXPECT_EQ(event.CausationId, command.SpanId);
+    EXPECT_EQ(event.CorrelationId, "order-42");
+}
+
+TEST(TraceContextTest, HeaderRoundTrip) {
+    auto ctx = TraceContext::ProcessingOf(TraceContext::NewRoot("abc"));
+    TraceHeader header;
+    ctx.WriteTo(header);
+
+    auto back = TraceContext::FromHeader(header);
+
+    EXPECT_EQ(back.TraceIdHex(), ctx.TraceIdHex());
+    EXPECT_EQ(back.SpanId, ctx.SpanId);
+    EXPECT_EQ(back.ParentSpanId, ctx.ParentSpanId);
+    EXPECT_EQ(back.CausationId, ctx.CausationId);
+    EXPECT_EQ(back.CorrelationId, "abc");
+}
+
+TEST(ScopedSpanTest, RestoresCurrentAndMarksErrorOnException) {
+    auto exporter = make_shared<InMemorySpanExporter>();
+    Tracer::SetExporter(exporter);
+    auto root = TraceContext::NewRoot();
+    try {
+        ScopedSpan span("work", SpanKind::INTERNAL, root);
+        EXPECT_EQ(Tracer::Current().SpanId, root.SpanId);
+        throw runtime_error("boom");
+    }
+    catch (const runtime_error&) {}
+    Tracer::SetExporter(nullptr);
+
+    EXPECT_FALSE(Tracer::Current().IsValid());
+    auto spans = exporter->Spans();
+    ASSERT_EQ(spans.size(), 1u);
+    EXPECT_TRUE(spans[0].Error);
+    EXPECT_LE(spans[0].StartNs, spans[0].EndNs);
+}
+
+TEST(OtlpJsonFileSpanExporterTest, WritesOneResourceSpansLinePerBatch) {
+    string path = "/tmp/cppplumberd_spans_test.json";
+    remove(path.c_str());
+    auto ctx = TraceContext::ProcessingOf(TraceContext::NewRoot("corr"));
+    {
+        OtlpJsonFileSpanExporter exporter(path, "tests", 2);
+        Span span;
+        span.Name = "handle";
+        span.Kind = SpanKind::SERVER;
+        span.Context = ctx;
+        exporter.Export(span);
+        exporter.Export(span);
+        exporter.Export(span);
+    }
+    ifstream file(path);
+    string first, second, third;
+    getline(file, first);
+    getline(file, second);
+
+    EXPECT_FALSE(getline(file, third));
+    EXPECT_THAT(first, HasSubstr("\"resourceSpans\""));
+    EXPECT_THAT(first, HasSubstr("\"traceId\":\"" + ctx.TraceIdHex() + "\""));
+    EXPECT_THAT(first, HasSubstr("\"kind\":2"));
+    EXPECT_THAT(first, HasSubstr("\"messaging.correlation_id\",\"value\":{\"stringValue\":\"corr\"}"));
+    EXPECT_THAT(second, HasSubstr("\"service.name\",\"value\":{\"stringValue\":\"tests\"}"));
+}
+
+class TracePublishingHandler : public ICommandHandler<SetterCommand> {
+    shared_ptr<EventStore> _eventStore;
+public:
+    explicit TracePublishingHandler(shared_ptr<EventStore> es) : _eventStore(es) {}
+    void Handle(const string& recipient, const SetterCommand& cmd) override {
+        PropertyChangedEvent evt;
+        evt.set_element_name(cmd.element_name());
+        _eventStore->Publish("traced", evt);
+    }
+};
+
+class TracingFlowTest : public Test {
+protected:
+    void SetUp() override {
+        exporter = make_shared<InMemorySpanExporter>();
+        Tracer::SetExporter(exporter);
+        auto socketFactory = make_shared<NggSocketFactory>("ipc:///tmp/tracing_test");
+        model = make_shared<PropertyRecorder>();
+        server = Plumber::CreateServer(socketFactory);
+        client = PlumberClient::CreateClient(socketFactory);
+
+        server->AddCommandHandler<TracePublishingHandler, SetterCommand, app::testing::COMMANDS::SETTER>(server->GetEventStore());
+        server->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        server->Start();
+
+        sub = client->SubscriptionManager()->Subscribe("traced", model);
+        client->RegisterMessage<SetterCommand, app::testing::COMMANDS::SETTER>();
+        client->RegisterMessage<PropertyChangedEvent, app::testing::EVENTS::PROPERTY_CHANGED>();
+        this_thread::sleep_for(chrono::milliseconds(100));
+        client->Start();
+        exporter->Clear();
+    }
+    void TearDown() override {
+        client->Stop();
+        server->Stop();
+        Tracer::SetExporter(nullptr);
+    }
+
+    shared_ptr<InMemorySpanExporter> exporter;
+    unique_ptr<Plumber> server;
+    unique_ptr<PlumberClient> client;
+    shared_ptr<PropertyRecorder> model;
+    unique_ptr<ISubscription> sub;
+};
+
+TEST_F(TracingFlowTest, EventCarriesTraceOfCausingCommand) {
+    SetterCommand cmd;
+    cmd.set_element_name("TestElement");
+    auto root = TraceContext::NewRoot("order-7");
+    {
+        TraceScope scope(root);
+        client->CommandBus()->Send("foo", cmd);
+    }
+
+    ASSERT_TRUE(model->WaitFor(1));
+    auto evt = model->Records().back().Meta.Trace();
+    this_thread::sleep_for(chrono::milliseconds(50));
+    auto spans = exporter->Spans();
+
+    auto find = [&spans](SpanKind kind) {
+        auto it = find_if(spans.begin(), spans.end(), [kind](const Span& s) { return s.Kind == kind; });
+        EXPECT_NE(it, spans.end());
+        return it == spans.end() ? Span() : *it;
+    };
+    auto sent = find(SpanKind::CLIENT);
+    auto handled = find(SpanKind::SERVER);
+    auto published = find(SpanKind::PRODUCER);
+    auto processed = find(SpanKind::CONSUMER);
+
+    EXPECT_EQ(evt.TraceIdHex(), root.TraceIdHex());
+    EXPECT_EQ(evt.CorrelationId, "order-7");
+    EXPECT_EQ(sent.Context.ParentSpanId, root.SpanId);
+    EXPECT_EQ(handled.Context.CausationId, sent.Context.SpanId);
+    EXPECT_EQ(evt.SpanId, published.Context.SpanId);
+    EXPECT_EQ(evt.CausationId, sent.Context.SpanId);
+    EXPECT_EQ(processed.Context.CausationId, evt.SpanId);
+    for (const auto& s : spans) EXPECT_EQ(s.Context.TraceIdHex(), root.TraceIdHex()) << s.Name;
+}
+
+TEST_F(TracingFlowTest, CommandWithoutContextStartsNewTrace) {
+    SetterCommand cmd;
+    cmd.set_element_name("TestElement");
+
+    client->CommandBus()->Send("foo", cmd);
+
+    ASSERT_TRUE(model->WaitFor(1));
+    auto evt = model->Records().back().Meta.Trace();
+    EXPECT_TRUE(evt.IsValid());
+    EXPECT_NE(evt.CausationId, 0u);
+    EXPECT_FALSE(evt.CorrelationId.empty());
+}
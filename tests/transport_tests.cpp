@@ -126,6 +126,75 @@ TEST_F(TransportTest, PubSubTest) {
     }
 }
 
+// A handler may drop its own subscription: the socket must neither wait for the delivery it is called from nor be
+// touched by it afterwards.
+TEST_F(TransportTest, HandlerDestroysItsOwnSubscribeSocket) {
+    auto publisher = factory->CreatePublishSocket("self-destroy");
+    publisher->Start();
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    std::mutex mtx;
+    condition_variable cv;
+    bool destroyed = false;
+    auto subscriber = factory->CreateSubscribeSocket("self-destroy");
+    subscriber->Received.connect([&](const uint8_t*, const size_t) {
+        subscriber.reset();
+        {
+            lock_guard<std::mutex> lock(mtx);
+            destroyed = true;
+        }
+        cv.notify_one();
+        });
+    subscriber->Start();
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    const string msg = "bye";
+    publisher->Send(reinterpret_cast<const uint8_t*>(msg.data()), msg.size());
+
+    unique_lock<std::mutex> lock(mtx);
+    ASSERT_TRUE(cv.wait_for(lock, chrono::seconds(2), [&]() { return destroyed; }));
+    EXPECT_EQ(subscriber, nullptr);
+}
+
+TEST_F(TransportTest, SocketDestroyedFromATaskOnItsExecutorDoesNotWaitForQueuedMessages) {
+    ExecutorOptions options;
+    options.Threads = 1;
+    auto executor = make_shared<Executor>(options);
+    auto executorFactory = make_shared<NggSocketFactory>("ipc:///tmp/transport_test", executor);
+    auto publisher = executorFactory->CreatePublishSocket("destroy-other");
+    publisher->Start();
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    // Both sockets get the message; whichever handler runs first destroys the other socket, whose delivery is then
+    // queued behind it on the executor's only worker.
+    std::mutex mtx;
+    condition_variable cv;
+    bool destroyed = false;
+    unique_ptr<ITransportSubscribeSocket> sockets[2];
+    for (int i = 0; i < 2; ++i) {
+        sockets[i] = executorFactory->CreateSubscribeSocket("destroy-other");
+        sockets[i]->Received.connect([&, other = 1 - i](const uint8_t*, const size_t) {
+            this_thread::sleep_for(chrono::milliseconds(50));
+            lock_guard<std::mutex> lock(mtx);
+            if (destroyed) return;
+            sockets[other].reset();
+            destroyed = true;
+            cv.notify_one();
+            });
+        sockets[i]->Start();
+    }
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    const string msg = "hello";
+    publisher->Send(reinterpret_cast<const uint8_t*>(msg.data()), msg.size());
+
+    unique_lock<std::mutex> lock(mtx);
+    ASSERT_TRUE(cv.wait_for(lock, chrono::seconds(2), [&]() { return destroyed; }));
+    lock.unlock();
+    sockets[0].reset();
+    sockets[1].reset();
+}
+
 // Test request-reply pattern
 TEST_F(TransportTest, ReqRepTest) {
     auto server = factory->CreateReqRspSrvSocket(req_rsp);